@@ -0,0 +1,64 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+// Admission of the frames of one camera at the 15 fps target, for cameras of 20, 25 and 30 fps with
+// timestamps rounded to the millisecond. Before timing, a minute of frames is admitted with nothing
+// in flight and the admitted rate is checked against the target.
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstdint>
+
+#include "admission_controller.h"
+
+namespace {
+
+using hailo::vms_server_plugins::clip_person_tracker::AdmissionController;
+
+constexpr float kTargetFps = 15.0f;
+
+AdmissionController::Params params()
+{
+    AdmissionController::Params result;
+    result.targetFps = kTargetFps;
+    return result;
+}
+
+int64_t timestampUs(int64_t frame, int cameraFps)
+{
+    return (frame * 1000 + cameraFps / 2) / cameraFps * 1000;
+}
+
+void BM_Admission(benchmark::State& state)
+{
+    const int cameraFps = static_cast<int>(state.range(0));
+
+    // Check the rate over a minute of camera time before timing
+    AdmissionController check(params());
+    const int64_t frames = 60 * cameraFps;
+    int64_t admitted = 0;
+    for (int64_t frame = 0; frame < frames; ++frame)
+    {
+        if (check.admit(timestampUs(frame, cameraFps)) == AdmissionController::Decision::admit)
+            ++admitted;
+    }
+    const double fps = admitted / 60.0;
+    state.counters["admitted_fps"] = fps;
+    if (std::fabs(fps - kTargetFps) > 0.05 * kTargetFps)
+    {
+        state.SkipWithError("admitted rate differs from the target");
+        return;
+    }
+
+    AdmissionController controller(params());
+    int64_t frame = 0;
+    for (auto _: state)
+        benchmark::DoNotOptimize(controller.admit(timestampUs(frame++, cameraFps)));
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_Admission)->Arg(20)->Arg(25)->Arg(30);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,152 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+// Recall and latency of the IVF-flat prompt index against brute-force scoring, for vocabularies of
+// 1k to 16k prompts (dim 640, top 10 per query).
+//
+// Real prompt vocabularies are clustered (colours of one garment, variants of one uniform...), so
+// the synthetic prompts are drawn around a set of topic directions, and each query is a noisy copy
+// of one prompt, like the image embedding of a person matching it. The recall counters are measured
+// on a fixed query set before timing.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "ivf_index.hpp"
+#include "similarity_kernel.hpp"
+
+namespace {
+
+constexpr size_t kDim = 640;
+constexpr size_t kTopics = 64;
+constexpr size_t kQueries = 256;
+constexpr size_t kTopK = 10;
+
+void normalize(float* row) {
+    float sum_squares = 0.0f;
+    for (size_t k = 0; k < kDim; ++k) {
+        sum_squares += row[k] * row[k];
+    }
+    for (size_t k = 0; k < kDim; ++k) {
+        row[k] /= std::sqrt(sum_squares);
+    }
+}
+
+struct Vocabulary {
+    std::vector<float> prompts; // count x kDim
+    std::vector<float> queries; // kQueries x kDim
+    size_t count = 0;
+};
+
+const Vocabulary& vocabulary(size_t count) {
+    static std::vector<std::pair<size_t, Vocabulary>> cache;
+    for (const auto& [cached_count, cached] : cache) {
+        if (cached_count == count)
+            return cached;
+    }
+    std::mt19937 rng(7);
+    std::normal_distribution<float> normal;
+    std::vector<float> topics(kTopics * kDim);
+    for (auto& value : topics) {
+        value = normal(rng);
+    }
+    Vocabulary result;
+    result.count = count;
+    result.prompts.resize(count * kDim);
+    for (size_t i = 0; i < count; ++i) {
+        const float* topic = topics.data() + (i % kTopics) * kDim;
+        float* prompt = result.prompts.data() + i * kDim;
+        for (size_t k = 0; k < kDim; ++k) {
+            prompt[k] = topic[k] + 0.6f * normal(rng);
+        }
+        normalize(prompt);
+    }
+    result.queries.resize(kQueries * kDim);
+    std::uniform_int_distribution<size_t> pick(0, count - 1);
+    for (size_t q = 0; q < kQueries; ++q) {
+        const float* prompt = result.prompts.data() + pick(rng) * kDim;
+        float* query = result.queries.data() + q * kDim;
+        for (size_t k = 0; k < kDim; ++k) {
+            query[k] = prompt[k] + 0.04f * normal(rng);
+        }
+        normalize(query);
+    }
+    cache.emplace_back(count, std::move(result));
+    return cache.back().second;
+}
+
+void brute_force_top_k(const Vocabulary& vocab, const float* query, std::vector<float>& scores,
+                       std::vector<int>& rows) {
+    scores.resize(vocab.count);
+    clip_matcher::dot_products(query, 1, kDim, vocab.prompts.data(), vocab.count, kDim, kDim, scores.data());
+    rows.resize(vocab.count);
+    std::iota(rows.begin(), rows.end(), 0);
+    std::partial_sort(rows.begin(), rows.begin() + kTopK, rows.end(),
+                      [&scores](int a, int b) { return scores[a] > scores[b] || (scores[a] == scores[b] && a < b); });
+    rows.resize(kTopK);
+}
+
+void BM_BruteForceTopK(benchmark::State& state) {
+    const Vocabulary& vocab = vocabulary(static_cast<size_t>(state.range(0)));
+    std::vector<float> scores;
+    std::vector<int> rows;
+    size_t q = 0;
+    for (auto _ : state) {
+        brute_force_top_k(vocab, vocab.queries.data() + (q++ % kQueries) * kDim, scores, rows);
+        benchmark::DoNotOptimize(rows.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_IvfTopK(benchmark::State& state) {
+    const Vocabulary& vocab = vocabulary(static_cast<size_t>(state.range(0)));
+    const size_t num_probes = static_cast<size_t>(state.range(1));
+    auto index = clip_matcher::IvfFlatIndex::build(vocab.prompts.data(), vocab.count, kDim, kDim);
+    clip_matcher::IvfSearchScratch scratch;
+    std::vector<clip_matcher::Neighbor> neighbors;
+
+    // Recall against brute force on the whole query set
+    std::vector<float> scores;
+    std::vector<int> expected;
+    size_t top1_hits = 0;
+    size_t topk_hits = 0;
+    for (size_t q = 0; q < kQueries; ++q) {
+        const float* query = vocab.queries.data() + q * kDim;
+        brute_force_top_k(vocab, query, scores, expected);
+        index->search(query, 1.0f, kTopK, num_probes, scratch, neighbors);
+        if (!neighbors.empty() && neighbors[0].row == expected[0])
+            ++top1_hits;
+        for (const auto& neighbor : neighbors) {
+            topk_hits += std::count(expected.begin(), expected.end(), neighbor.row);
+        }
+    }
+    state.counters["recall@1"] = static_cast<double>(top1_hits) / kQueries;
+    state.counters["recall@10"] = static_cast<double>(topk_hits) / (kQueries * kTopK);
+    state.counters["lists"] = static_cast<double>(index->num_lists());
+
+    size_t q = 0;
+    for (auto _ : state) {
+        index->search(vocab.queries.data() + (q++ % kQueries) * kDim, 1.0f, kTopK, num_probes, scratch, neighbors);
+        benchmark::DoNotOptimize(neighbors.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_IvfBuild(benchmark::State& state) {
+    const Vocabulary& vocab = vocabulary(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(clip_matcher::IvfFlatIndex::build(vocab.prompts.data(), vocab.count, kDim, kDim));
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_BruteForceTopK)->Arg(1024)->Arg(4096)->Arg(16384);
+BENCHMARK(BM_IvfTopK)->ArgsProduct({{1024, 4096, 16384}, {4, 8, 16}});
+BENCHMARK(BM_IvfBuild)->Arg(4096)->Arg(16384)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,245 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+// Compares the per-frame CLIP matching path before and after the fused batch:
+//
+// - legacy: clip_post dequantizes and normalizes each detection into its own float vector, the
+//   handoff copies it into an xarray and grows the frame matrix by concatenation (one reallocation
+//   and full copy per detection), converts it to double and scores it row by row.
+// - fused: each raw quantized embedding is dequantized into a preallocated EmbeddingBatch (norm
+//   accumulated in the same pass) and the whole frame is scored by one kernel call.
+//
+// Both run on the same synthetic uint8 tensors; the fused results are checked against the legacy
+// ones before timing, and against a double-precision reference at every SIMD level the CPU has.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "embedding_batch.hpp"
+#include "similarity_kernel.hpp"
+
+namespace {
+
+constexpr size_t kDim = 640;
+constexpr size_t kPrompts = 10;
+constexpr float kScale = 0.0021f;
+constexpr float kZeroPoint = 127.0f;
+
+struct Frame {
+    std::vector<std::vector<uint8_t>> tensors; // one quantized embedding per detection
+    std::vector<float> prompts;                // kPrompts x kDim, normalized
+};
+
+Frame make_frame(size_t detections) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::normal_distribution<float> normal;
+    Frame frame;
+    frame.tensors.resize(detections, std::vector<uint8_t>(kDim));
+    for (auto& tensor : frame.tensors) {
+        for (auto& q : tensor) {
+            q = static_cast<uint8_t>(byte(rng));
+        }
+    }
+    frame.prompts.resize(kPrompts * kDim);
+    for (size_t p = 0; p < kPrompts; ++p) {
+        float norm = 0.0f;
+        for (size_t k = 0; k < kDim; ++k) {
+            frame.prompts[p * kDim + k] = normal(rng);
+            norm += frame.prompts[p * kDim + k] * frame.prompts[p * kDim + k];
+        }
+        for (size_t k = 0; k < kDim; ++k) {
+            frame.prompts[p * kDim + k] /= std::sqrt(norm);
+        }
+    }
+    return frame;
+}
+
+// Best prompt per detection, following the pre-batch code path.
+std::vector<int> legacy_match(const Frame& frame, std::vector<double>* best_similarity) {
+    std::vector<double> image_embedding; // frame matrix, grown by "concatenation"
+    size_t rows = 0;
+    for (const auto& tensor : frame.tensors) {
+        // clip_post: dequantize, normalize and attach a HailoMatrix
+        std::vector<float> embedding(kDim);
+        float norm = 0.0f;
+        for (size_t k = 0; k < kDim; ++k) {
+            embedding[k] = (static_cast<float>(tensor[k]) - kZeroPoint) * kScale;
+            norm += embedding[k] * embedding[k];
+        }
+        for (auto& value : embedding) {
+            value /= std::sqrt(norm);
+        }
+        // get_xtensor(): copy into a float xarray
+        std::vector<float> xtensor(embedding.begin(), embedding.end());
+        // xt::concatenate(): new matrix with one more row
+        std::vector<double> grown((rows + 1) * kDim);
+        std::copy(image_embedding.begin(), image_embedding.end(), grown.begin());
+        std::copy(xtensor.begin(), xtensor.end(), grown.begin() + rows * kDim);
+        image_embedding.swap(grown);
+        ++rows;
+    }
+
+    std::vector<int> best(rows);
+    best_similarity->resize(rows);
+    for (size_t row = 0; row < rows; ++row) {
+        std::vector<double> similarities(kPrompts);
+        double sum = 0.0;
+        for (size_t p = 0; p < kPrompts; ++p) {
+            double dot = 0.0;
+            for (size_t k = 0; k < kDim; ++k) {
+                dot += static_cast<double>(frame.prompts[p * kDim + k]) * image_embedding[row * kDim + k];
+            }
+            similarities[p] = std::exp(100 * dot);
+            sum += similarities[p];
+        }
+        for (auto& similarity : similarities) {
+            similarity /= sum;
+        }
+        best[row] = static_cast<int>(std::max_element(similarities.begin(), similarities.end()) - similarities.begin());
+        (*best_similarity)[row] = similarities[best[row]];
+    }
+    return best;
+}
+
+// Softmax over the prompts of each detection, computed in double from the quantized tensors.
+std::vector<std::vector<double>> reference_similarities(const Frame& frame) {
+    std::vector<std::vector<double>> similarities;
+    for (const auto& tensor : frame.tensors) {
+        std::vector<double> embedding(kDim);
+        double norm = 0.0;
+        for (size_t k = 0; k < kDim; ++k) {
+            embedding[k] = (static_cast<double>(tensor[k]) - kZeroPoint) * kScale;
+            norm += embedding[k] * embedding[k];
+        }
+        std::vector<double> logits(kPrompts);
+        for (size_t p = 0; p < kPrompts; ++p) {
+            double dot = 0.0;
+            for (size_t k = 0; k < kDim; ++k) {
+                dot += static_cast<double>(frame.prompts[p * kDim + k]) * embedding[k];
+            }
+            logits[p] = 100 * dot / std::sqrt(norm);
+        }
+        const double max_logit = *std::max_element(logits.begin(), logits.end());
+        double sum = 0.0;
+        for (auto& logit : logits) {
+            logit = std::exp(logit - max_logit);
+            sum += logit;
+        }
+        for (auto& logit : logits) {
+            logit /= sum;
+        }
+        similarities.push_back(std::move(logits));
+    }
+    return similarities;
+}
+
+struct FusedState {
+    clip_matcher::EmbeddingBatch batch;
+    std::vector<float> scores;
+    std::vector<int> best;
+    std::vector<float> best_similarity;
+};
+
+void fused_match(const Frame& frame, FusedState& state) {
+    state.batch.clear();
+    for (const auto& tensor : frame.tensors) {
+        clip_matcher::QuantizedEmbeddingView view;
+        view.data = tensor.data();
+        view.type = clip_matcher::QuantizedType::uint8;
+        view.dim = kDim;
+        view.scale = kScale;
+        view.zero_point = kZeroPoint;
+        state.batch.add(view);
+    }
+    const size_t rows = state.batch.rows();
+    state.scores.resize(rows * kPrompts);
+    state.best.resize(rows);
+    state.best_similarity.resize(rows);
+    clip_matcher::score_batch(state.batch.data(), rows, state.batch.stride(),
+                              frame.prompts.data(), kPrompts, kDim, kDim,
+                              clip_matcher::ScoreParams(), state.batch.row_scales(),
+                              state.scores.data(), state.best.data(), state.best_similarity.data());
+}
+
+// Runs the fused path at every SIMD level the CPU supports and compares it with the reference.
+// A different best prompt is only accepted on a near tie, where rounding may pick either one.
+// Leaves the best level active.
+bool check_simd_parity(const Frame& frame, FusedState& fused, const char** failed_level) {
+    const std::vector<std::vector<double>> expected = reference_similarities(frame);
+    const clip_matcher::SimdLevel best_level = clip_matcher::active_simd_level();
+    bool ok = true;
+    for (auto level : {clip_matcher::SimdLevel::scalar, clip_matcher::SimdLevel::neon,
+                       clip_matcher::SimdLevel::avx2, clip_matcher::SimdLevel::avx512}) {
+        if (!clip_matcher::set_simd_level(level)) {
+            continue;
+        }
+        fused_match(frame, fused);
+        for (size_t row = 0; ok && row < expected.size(); ++row) {
+            const std::vector<double>& similarities = expected[row];
+            const int best = static_cast<int>(
+                std::max_element(similarities.begin(), similarities.end()) - similarities.begin());
+            const int got = fused.best[row];
+            ok = got >= 0 && got < static_cast<int>(kPrompts)
+                && std::fabs(similarities[got] - similarities[best]) <= 1e-4
+                && std::fabs(fused.best_similarity[row] - similarities[best]) <= 1e-4;
+        }
+        if (!ok) {
+            *failed_level = clip_matcher::simd_level_name(level);
+            break;
+        }
+    }
+    clip_matcher::set_simd_level(best_level);
+    return ok;
+}
+
+void BM_LegacyMatch(benchmark::State& state) {
+    const Frame frame = make_frame(static_cast<size_t>(state.range(0)));
+    std::vector<double> best_similarity;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(legacy_match(frame, &best_similarity));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_FusedMatch(benchmark::State& state) {
+    const Frame frame = make_frame(static_cast<size_t>(state.range(0)));
+    FusedState fused;
+    fused.batch.reserve(frame.tensors.size(), kDim);
+
+    // Check against the legacy path before timing
+    std::vector<double> expected_similarity;
+    const std::vector<int> expected = legacy_match(frame, &expected_similarity);
+    fused_match(frame, fused);
+    for (size_t row = 0; row < expected.size(); ++row) {
+        if (fused.best[row] != expected[row]
+            || std::fabs(fused.best_similarity[row] - expected_similarity[row]) > 1e-4) {
+            state.SkipWithError("fused results differ from the legacy path");
+            return;
+        }
+    }
+    const char* failed_level = nullptr;
+    if (!check_simd_parity(frame, fused, &failed_level)) {
+        state.SkipWithError((std::string("fused results differ from the double-precision reference at SIMD level ")
+                             + failed_level).c_str());
+        return;
+    }
+
+    for (auto _ : state) {
+        fused_match(frame, fused);
+        benchmark::DoNotOptimize(fused.best.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+} // namespace
+
+BENCHMARK(BM_LegacyMatch)->Arg(1)->Arg(8)->Arg(32)->Arg(64);
+BENCHMARK(BM_FusedMatch)->Arg(1)->Arg(8)->Arg(32)->Arg(64);
+
+BENCHMARK_MAIN();
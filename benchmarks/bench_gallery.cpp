@@ -0,0 +1,136 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+// Retrospective text search over the person gallery: one day of 16 cameras with 400 tracks per
+// camera and hour (153,600 tracks of dim 640, about 200 MB of float16 embeddings), searched on one
+// thread for the whole day and for a single hour. The gallery is written once to a temporary
+// directory; a planted track is checked to come out first before timing.
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gallery.hpp"
+
+namespace {
+
+constexpr size_t kDim = 640;
+constexpr int kCameras = 16;
+constexpr int kHours = 24;
+constexpr int kTracksPerHour = 400;
+constexpr int64_t kDayStartUs = 1700000000LL * 1000 * 1000 / clip_matcher::kGalleryPartitionDurationUs
+    * clip_matcher::kGalleryPartitionDurationUs;
+constexpr int64_t kHourUs = 3600LL * 1000 * 1000;
+constexpr int kPlantedTrackId = 123456;
+
+void random_embedding(std::mt19937& rng, std::vector<float>& embedding) {
+    std::normal_distribution<float> normal;
+    float sum_squares = 0.0f;
+    for (auto& value : embedding) {
+        value = normal(rng);
+        sum_squares += value * value;
+    }
+    for (auto& value : embedding) {
+        value /= std::sqrt(sum_squares);
+    }
+}
+
+struct Gallery {
+    std::string dir;
+    std::vector<float> planted; // embedding of the planted track, used as the text query
+};
+
+const Gallery& gallery() {
+    static const Gallery instance = [] {
+        Gallery result;
+        result.dir = (std::filesystem::temp_directory_path() / "clip_gallery_bench").string();
+        std::filesystem::remove_all(result.dir);
+        std::mt19937 rng(11);
+        std::uniform_int_distribution<int64_t> offset(0, kHourUs - 60LL * 1000 * 1000);
+        std::vector<float> embedding(kDim);
+        result.planted.resize(kDim);
+        random_embedding(rng, result.planted);
+        for (int camera = 0; camera < kCameras; ++camera) {
+            clip_matcher::GalleryWriter writer(result.dir, "camera_" + std::to_string(camera));
+            for (int hour = 0; hour < kHours; ++hour) {
+                for (int i = 0; i < kTracksPerHour; ++i) {
+                    clip_matcher::GalleryTrack track;
+                    track.track_id = hour * kTracksPerHour + i;
+                    track.start_us = kDayStartUs + hour * kHourUs + offset(rng);
+                    track.end_us = track.start_us + 30LL * 1000 * 1000;
+                    track.bbox[2] = track.bbox[3] = 0.2f;
+                    track.confidence = 0.8f;
+                    track.observations = 20;
+                    random_embedding(rng, embedding);
+                    writer.append(track, embedding.data(), kDim);
+                }
+            }
+            if (camera == kCameras / 2) {
+                clip_matcher::GalleryTrack track;
+                track.track_id = kPlantedTrackId;
+                track.start_us = kDayStartUs + 13 * kHourUs + 1000;
+                track.end_us = track.start_us + 1000;
+                writer.append(track, result.planted.data(), kDim);
+            }
+        }
+        return result;
+    }();
+    return instance;
+}
+
+void search(benchmark::State& state, int64_t start_us, int64_t end_us, size_t expected_tracks) {
+    const Gallery& data = gallery();
+    clip_matcher::GalleryQuery query;
+    query.text_embedding = data.planted.data();
+    query.dim = kDim;
+    query.start_us = start_us;
+    query.end_us = end_us;
+    query.top_k = 20;
+
+    const auto hits = clip_matcher::search_gallery(data.dir, query);
+    if (hits.empty() || hits[0].track.track_id != kPlantedTrackId) {
+        state.SkipWithError("planted track is not the best hit");
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(clip_matcher::search_gallery(data.dir, query));
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(expected_tracks));
+}
+
+void BM_GallerySearchDay(benchmark::State& state) {
+    search(state, kDayStartUs, kDayStartUs + kHours * kHourUs, kCameras * kHours * kTracksPerHour);
+}
+
+void BM_GallerySearchHour(benchmark::State& state) {
+    search(state, kDayStartUs + 13 * kHourUs, kDayStartUs + 14 * kHourUs, kCameras * kTracksPerHour);
+}
+
+void BM_GalleryAppend(benchmark::State& state) {
+    const std::string dir = (std::filesystem::temp_directory_path() / "clip_gallery_bench_append").string();
+    std::filesystem::remove_all(dir);
+    std::mt19937 rng(5);
+    std::vector<float> embedding(kDim);
+    random_embedding(rng, embedding);
+    clip_matcher::GalleryWriter writer(dir, "camera");
+    clip_matcher::GalleryTrack track;
+    track.start_us = kDayStartUs;
+    for (auto _ : state) {
+        track.end_us = track.start_us + 1000;
+        writer.append(track, embedding.data(), kDim);
+        ++track.track_id;
+    }
+    state.SetItemsProcessed(state.iterations());
+    std::filesystem::remove_all(dir);
+}
+
+} // namespace
+
+BENCHMARK(BM_GallerySearchDay)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_GallerySearchHour)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_GalleryAppend);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,265 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+// TextImageMatcher::match() and the CPU work of on_handoff_clip, swept over the prompt count, the
+// detections per frame, the embedding dimension, softmax and debug mode:
+//
+// - BM_Match: match() of a frame batch that is already filled, report_all off (debug mode then
+//   reports every detection, like it does in the plugin).
+// - BM_Handoff: what on_handoff_clip does for one frame without GStreamer: dequantize the uint8
+//   CLIP outputs into the frame batch, update the track cache, gather the track embeddings into
+//   the batch that is matched, match() with report_all on and copy the matches to the tracks.
+//
+// Counters, per iteration (one frame): ns_per_match, allocs_per_call (global operator new calls)
+// and detections/s. Vocabularies of at least 4096 prompts go through the ANN index, as in the
+// plugin. For machine-readable output run with:
+//     --benchmark_format=json --benchmark_out=matcher.json
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "TextImageMatcher.hpp"
+#include "embedding_batch.hpp"
+#include "track_cache.hpp"
+
+namespace {
+
+std::atomic<uint64_t> g_allocations{0};
+
+} // namespace
+
+// Counts every heap allocation of the process; only the difference over the timed loop is reported.
+void* operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    const size_t align = static_cast<size_t>(alignment);
+    // aligned_alloc() wants a size multiple of the alignment
+    if (void* p = std::aligned_alloc(align, (size + align - 1) / align * align))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+namespace {
+
+constexpr float kScale = 0.0021f;
+constexpr float kZeroPoint = 127.0f;
+
+std::vector<float> random_unit_rows(size_t rows, size_t dim, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> normal;
+    std::vector<float> data(rows * dim);
+    for (size_t r = 0; r < rows; ++r) {
+        float norm = 0.0f;
+        for (size_t k = 0; k < dim; ++k) {
+            data[r * dim + k] = normal(rng);
+            norm += data[r * dim + k] * data[r * dim + k];
+        }
+        for (size_t k = 0; k < dim; ++k) {
+            data[r * dim + k] /= std::sqrt(norm);
+        }
+    }
+    return data;
+}
+
+// One matcher per vocabulary, shared by all the cases of that vocabulary: building the ANN index of
+// the large ones takes longer than timing them.
+TextImageMatcher& matcher_for(size_t prompts, size_t dim) {
+    static std::map<std::pair<size_t, size_t>, std::unique_ptr<TextImageMatcher>> matchers;
+    auto& matcher = matchers[{prompts, dim}];
+    if (!matcher) {
+        matcher = TextImageMatcher::create("bench", 0.5f, static_cast<int>(prompts), nullptr);
+        clip_matcher::EmbeddingStoreContents contents;
+        contents.dim = static_cast<uint32_t>(dim);
+        contents.threshold = 0.5f;
+        contents.text_prefix = "A photo of a ";
+        for (size_t i = 0; i < prompts; ++i) {
+            clip_matcher::EmbeddingStoreEntry entry;
+            entry.text = "person wearing outfit number " + std::to_string(i);
+            entry.negative = i % 7 == 6;
+            contents.entries.push_back(entry);
+        }
+        contents.embeddings = random_unit_rows(prompts, dim, 7);
+        matcher->load_prompts(contents);
+    }
+    return *matcher;
+}
+
+std::vector<std::vector<uint8_t>> make_tensors(size_t detections, size_t dim) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<std::vector<uint8_t>> tensors(detections, std::vector<uint8_t>(dim));
+    for (auto& tensor : tensors) {
+        for (auto& q : tensor) {
+            q = static_cast<uint8_t>(byte(rng));
+        }
+    }
+    return tensors;
+}
+
+clip_matcher::QuantizedEmbeddingView view_of(const std::vector<uint8_t>& tensor) {
+    clip_matcher::QuantizedEmbeddingView view;
+    view.data = tensor.data();
+    view.type = clip_matcher::QuantizedType::uint8;
+    view.dim = tensor.size();
+    view.scale = kScale;
+    view.zero_point = kZeroPoint;
+    return view;
+}
+
+struct Case {
+    size_t prompts;
+    size_t detections;
+    size_t dim;
+    bool softmax;
+    bool debug;
+};
+
+Case case_of(const benchmark::State& state) {
+    return {static_cast<size_t>(state.range(0)), static_cast<size_t>(state.range(1)),
+            static_cast<size_t>(state.range(2)), state.range(3) != 0, state.range(4) != 0};
+}
+
+TextImageMatcher& prepare_matcher(const Case& c) {
+    TextImageMatcher& matcher = matcher_for(c.prompts, c.dim);
+    matcher.set_run_softmax(c.softmax);
+    matcher.set_debug(c.debug);
+    return matcher;
+}
+
+// Measures the timed loop of a benchmark, in wall time and heap allocations.
+class LoopMeter {
+public:
+    LoopMeter()
+        : m_allocations(g_allocations.load()), m_start(std::chrono::steady_clock::now()) {}
+
+    void report(benchmark::State& state, const Case& c) const {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - m_start);
+        const double iterations = static_cast<double>(state.iterations());
+        state.counters["ns_per_match"] = static_cast<double>(elapsed.count()) / iterations;
+        state.counters["allocs_per_call"] = static_cast<double>(g_allocations.load() - m_allocations) / iterations;
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(c.detections));
+        state.SetLabel(c.prompts >= matcher_for(c.prompts, c.dim).get_ann_min_prompts() ? "ann" : "exact");
+    }
+
+private:
+    uint64_t m_allocations;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+void BM_Match(benchmark::State& state) {
+    const Case c = case_of(state);
+    TextImageMatcher& matcher = prepare_matcher(c);
+    const auto tensors = make_tensors(c.detections, c.dim);
+    clip_matcher::EmbeddingBatch batch;
+    batch.reserve(c.detections, c.dim);
+    for (const auto& tensor : tensors) {
+        batch.add(view_of(tensor));
+    }
+    MatchScores scores;
+    benchmark::DoNotOptimize(matcher.match(batch, scores)); // picks up the PromptSet
+
+    const LoopMeter meter;
+    for (auto _ : state) {
+        std::vector<Match> matches = matcher.match(batch, scores);
+        benchmark::DoNotOptimize(matches.data());
+    }
+    meter.report(state, c);
+}
+
+void BM_Handoff(benchmark::State& state) {
+    const Case c = case_of(state);
+    TextImageMatcher& matcher = prepare_matcher(c);
+    const auto tensors = make_tensors(c.detections, c.dim);
+    clip_matcher::EmbeddingBatch clip_batch;
+    clip_matcher::EmbeddingBatch track_batch;
+    clip_batch.reserve(c.detections, c.dim);
+    track_batch.reserve(c.detections, c.dim);
+    clip_matcher::TrackCache track_cache;
+    AlignedFloatVector track_embedding;
+    MatchScores scores;
+
+    auto frame = [&]() {
+        clip_batch.clear();
+        track_cache.begin_frame();
+        clip_matcher::TrackSighting sighting;
+        sighting.confidence = 0.8f;
+        for (size_t i = 0; i < tensors.size(); ++i) {
+            const size_t row = clip_batch.rows();
+            clip_batch.add(view_of(tensors[i]));
+            track_cache.update(static_cast<int>(i), clip_batch.data() + row * clip_batch.stride(),
+                               clip_batch.dim(), clip_batch.row_scales()[row], sighting);
+        }
+        track_batch.clear();
+        for (size_t i = 0; i < tensors.size(); ++i) {
+            track_cache.copy_embedding(static_cast<int>(i), track_embedding);
+            clip_matcher::QuantizedEmbeddingView view;
+            view.data = track_embedding.data();
+            view.dim = track_embedding.size();
+            track_batch.add(view, /*normalize*/ false);
+        }
+        std::vector<Match> matches = matcher.match(track_batch, scores, /*report_all*/ true);
+        for (const auto& match : matches) {
+            clip_matcher::TrackMatch track_match;
+            track_match.valid = true;
+            track_match.text = match.text;
+            track_match.similarity = static_cast<float>(match.similarity);
+            track_match.negative = match.negative;
+            track_match.passed_threshold = match.passed_threshold;
+            track_cache.set_match(match.row_idx, track_match);
+        }
+    };
+    frame(); // creates the tracks and picks up the PromptSet
+
+    const LoopMeter meter;
+    for (auto _ : state) {
+        frame();
+    }
+    meter.report(state, c);
+}
+
+void sweep(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"prompts", "detections", "dim", "softmax", "debug"});
+    b->ArgsProduct({{5, 100, 1000, 10000}, {1, 4, 16, 64}, {512, 640, 1024}, {0, 1}, {0, 1}});
+}
+
+} // namespace
+
+BENCHMARK(BM_Match)->Apply(sweep);
+BENCHMARK(BM_Handoff)->Apply(sweep);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,128 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+// Object metadata of one frame with 1 to 64 tracked persons, each with a CLIP match: built anew
+// for every frame as the plugin used to, and by the MetadataBuilder reusing the objects of the
+// previous frames. The packet is released after every frame, as the Server does once it took it.
+// The heap allocations are counted by replacing the global operator new, and reported per frame.
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <nx/sdk/analytics/helpers/attribute.h>
+#include <nx/sdk/analytics/helpers/object_metadata.h>
+#include <nx/sdk/analytics/helpers/object_metadata_packet.h>
+#include <nx/sdk/helpers/uuid_helper.h>
+
+#include "metadata_builder.h"
+
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+
+} // namespace
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size == 0 ? 1 : size))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    std::free(memory);
+}
+
+namespace {
+
+using hailo::vms_server_plugins::clip_person_tracker::MetadataBuilder;
+using nx::sdk::makePtr;
+using nx::sdk::Ptr;
+using nx::sdk::analytics::Attribute;
+using nx::sdk::analytics::ObjectMetadata;
+using nx::sdk::analytics::ObjectMetadataPacket;
+using nx::sdk::analytics::Rect;
+
+const std::string kPersonObjectType = "hailo.clip.person";
+const std::string kClipLabel = "person with a red shirt";
+
+struct Person {
+    Rect box;
+    float confidence;
+    int trackId;
+    float clipConfidence;
+};
+
+std::vector<Person> persons(int count) {
+    std::vector<Person> result;
+    for (int i = 0; i < count; ++i) {
+        const float x = (i % 8) / 8.0f;
+        const float y = (i / 8) / 8.0f;
+        result.push_back({Rect(x, y, 0.1f, 0.1f), 0.9f, i + 1, 0.27f});
+    }
+    return result;
+}
+
+void report(benchmark::State& state, uint64_t allocationsBefore) {
+    const double frames = static_cast<double>(state.iterations());
+    state.counters["allocs_per_frame"] = (allocations.load() - allocationsBefore) / frames;
+    state.counters["frames_per_s"] = benchmark::Counter(frames, benchmark::Counter::kIsRate);
+}
+
+// The plugin before the builder: every object and attribute is allocated for every frame
+void BM_MetadataPerFrame(benchmark::State& state) {
+    const std::vector<Person> frame = persons(static_cast<int>(state.range(0)));
+    int64_t timestampUs = 0;
+    const uint64_t allocationsBefore = allocations.load();
+    for (auto _ : state) {
+        const auto packet = makePtr<ObjectMetadataPacket>();
+        for (const Person& person : frame) {
+            const auto object = makePtr<ObjectMetadata>();
+            object->setBoundingBox(person.box);
+            object->setConfidence(person.confidence);
+            object->setTrackId(nx::sdk::Uuid(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, person.trackId));
+            object->setTypeId(kPersonObjectType);
+            packet->addItem(object.get());
+            object->addAttribute(makePtr<Attribute>(kClipLabel, std::to_string(person.clipConfidence)));
+            object->addAttribute(makePtr<Attribute>("match", "true"));
+        }
+        packet->setTimestampUs(timestampUs += 33333);
+        benchmark::DoNotOptimize(packet.get());
+    }
+    report(state, allocationsBefore);
+}
+BENCHMARK(BM_MetadataPerFrame)->RangeMultiplier(4)->Range(1, 64);
+
+void BM_MetadataBuilder(benchmark::State& state) {
+    const std::vector<Person> frame = persons(static_cast<int>(state.range(0)));
+    MetadataBuilder builder;
+    int64_t timestampUs = 0;
+    const uint64_t allocationsBefore = allocations.load();
+    for (auto _ : state) {
+        builder.begin(timestampUs += 33333);
+        for (const Person& person : frame) {
+            builder.add(kPersonObjectType, person.box, person.confidence, person.trackId, kClipLabel,
+                person.clipConfidence);
+        }
+        const Ptr<ObjectMetadataPacket> packet = builder.finish();
+        benchmark::DoNotOptimize(packet.get());
+    }
+    report(state, allocationsBefore);
+    state.counters["reused_objects"] = static_cast<double>(builder.counters().reusedObjects);
+}
+BENCHMARK(BM_MetadataBuilder)->RangeMultiplier(4)->Range(1, 64);
+
+} // namespace
+
+BENCHMARK_MAIN();
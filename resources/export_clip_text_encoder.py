@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Exports the text tower of a CLIP model for the plugin's in-process text encoder.
+
+Writes the weight file read by clip_matcher::ClipTextEncoder (see clip_text_encoder.hpp for the
+layout) and copies CLIP's BPE merges next to it, uncompressed:
+
+    python3 export_clip_text_encoder.py --model RN50x4 --output-dir .
+
+Copy both files to the resources directory of the plugin.
+"""
+
+import argparse
+import gzip
+import os
+import struct
+
+import clip
+import numpy as np
+import torch
+
+MAGIC = b"HCLIPTXT"
+VERSION = 1
+HEADER_SIZE = 64
+ALIGNMENT = 64
+
+
+def tensors(model):
+    state = {name: tensor.detach().float().cpu().numpy() for name, tensor in model.state_dict().items()}
+    yield state["token_embedding.weight"]
+    yield state["positional_embedding"]
+    layers = model.transformer.layers
+    for i in range(layers):
+        prefix = f"transformer.resblocks.{i}."
+        for name in ("ln_1.weight", "ln_1.bias",
+                     "attn.in_proj_weight", "attn.in_proj_bias",
+                     "attn.out_proj.weight", "attn.out_proj.bias",
+                     "ln_2.weight", "ln_2.bias",
+                     "mlp.c_fc.weight", "mlp.c_fc.bias",
+                     "mlp.c_proj.weight", "mlp.c_proj.bias"):
+            yield state[prefix + name]
+    yield state["ln_final.weight"]
+    yield state["ln_final.bias"]
+    # Stored transposed, one row per output dimension
+    yield np.ascontiguousarray(state["text_projection"].T)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--model", default="RN50x4", help="CLIP model name")
+    parser.add_argument("--output-dir", default=".", help="directory of the exported files")
+    args = parser.parse_args()
+
+    model, _ = clip.load(args.model, device="cpu")
+    model.eval()
+    with torch.no_grad():
+        blobs = [np.ascontiguousarray(t, dtype="<f4") for t in tensors(model)]
+
+    vocab_size, width = model.token_embedding.weight.shape
+    context_length = model.positional_embedding.shape[0]
+    heads = model.transformer.resblocks[0].attn.num_heads
+    embed_dim = model.text_projection.shape[1]
+
+    weights_path = os.path.join(args.output_dir, f"clip_text_encoder_{args.model}.bin")
+    with open(weights_path, "wb") as f:
+        f.write(b"\0" * HEADER_SIZE)
+        for blob in blobs:
+            f.write(b"\0" * (-f.tell() % ALIGNMENT))
+            f.write(blob.tobytes())
+        file_size = f.tell()
+        f.seek(0)
+        f.write(MAGIC + struct.pack("<8IQ", VERSION, HEADER_SIZE, vocab_size, context_length, width, heads,
+                                    model.transformer.layers, embed_dim, file_size))
+    print(f"Wrote {weights_path} ({file_size / 1e6:.1f} MB)")
+
+    merges_source = os.path.join(os.path.dirname(clip.__file__), "bpe_simple_vocab_16e6.txt.gz")
+    merges_path = os.path.join(args.output_dir, "bpe_simple_vocab_16e6.txt")
+    with gzip.open(merges_source, "rb") as source, open(merges_path, "wb") as target:
+        target.write(source.read())
+    print(f"Wrote {merges_path}")
+
+
+if __name__ == "__main__":
+    main()
@@ -4,8 +4,12 @@
 #include <filesystem>
 #include <vector>
 #include <algorithm>
+#include <chrono>
 #include <mutex>
 #include <atomic>
+#include <memory>
+#include <optional>
+#include <functional>
 #include <nlohmann/json.hpp>
 #include <xtensor/xarray.hpp>
 #include <xtensor/xmath.hpp>
@@ -14,7 +18,13 @@
 #include <xtensor/xview.hpp>
 #include <xtensor/xadapt.hpp>
 #include <xtensor/xsort.hpp>
-#include <xtensor-blas/xlinalg.hpp>
+
+#include "aligned_allocator.hpp"
+#include "embedding_batch.hpp"
+#include "embedding_store.hpp"
+#include "ivf_index.hpp"
+#include "prompt_embedding_store.hpp"
+#include "similarity_kernel.hpp"
 
 #ifndef TEXTIMAGEMATCHER_H
 #define TEXTIMAGEMATCHER_H
@@ -26,16 +36,12 @@
 class TextEmbeddingEntry {
 public:
     std::string text;
-    xt::xarray<double> embedding;  // Use xtensor array for embedding
     bool negative;
     bool ensemble;
-    double probability;  // Use double for probability
+    unsigned template_count = 0; // template rows averaged into the embedding of an ensembled prompt
 
-    TextEmbeddingEntry(std::string txt, const std::vector<float>& emb, bool neg, bool ens)
-        : text(txt), negative(neg), ensemble(ens), probability(0.0) {
-        // Adapt the std::vector<float> to xt::xarray<double>
-        embedding = xt::adapt(emb, {emb.size()});
-    }
+    TextEmbeddingEntry(std::string txt, bool neg, bool ens, unsigned templates = 0)
+        : text(txt), negative(neg), ensemble(ens), template_count(templates) {}
 };
 
 class Match {
@@ -52,18 +58,230 @@ public:
         : row_idx(r_idx), text(txt), similarity(sim), entry_index(e_idx), negative(neg), passed_threshold(passed) {}
 };
 
+// Immutable set of prompts and matching settings. TextImageMatcher publishes a new PromptSet on
+// every change instead of modifying the current one, so a match() that already holds a PromptSet
+// can finish with it while a newer one is being published.
+class PromptSet {
+public:
+    std::vector<TextEmbeddingEntry> entries;
+    double threshold = 0.5;
+    std::string text_prefix = "A photo of a ";
+    bool run_softmax = true;
+
+    // Row-major float32 matrix of the valid entries' embeddings (one row per prompt), built once per
+    // PromptSet so that match() does not need to gather them on every frame. It points either into
+    // the mapped embedding store or into a matrix owned by prompt_matrix_storage, and is null when
+    // the rows come from the shared PromptEmbeddingStore (see create_shared()).
+    const float* prompt_matrix = nullptr;
+    std::vector<int> valid_rows; // valid_rows[row] is the index in entries of matrix row `row`
+    size_t embedding_dim = 0;
+    std::shared_ptr<const void> prompt_matrix_storage;
+    // One pointer per matrix row, into prompt_matrix or into shared_rows. match() reads these.
+    std::vector<const float*> prompt_rows;
+    std::vector<std::shared_ptr<const clip_matcher::SharedPromptEmbedding>> shared_rows;
+    // Template rows averaged at import into the rows of ensembled prompts
+    size_t collapsed_template_rows = 0;
+
+    // Approximate index over the prompt matrix, built for large vocabularies matched without softmax
+    // (see TextImageMatcher::set_ann_min_prompts()). match() then only scores the ann_top_k best
+    // candidates of each image.
+    std::shared_ptr<const clip_matcher::IvfFlatIndex> ann_index;
+    size_t ann_top_k = 32;
+    size_t ann_num_probes = 0; // 0 uses the default of the index
+
+    // `embeddings` holds entries.size() rows of `dim` floats. Entries without text are kept in
+    // entries but get no matrix row.
+    static std::shared_ptr<const PromptSet> create(std::vector<TextEmbeddingEntry> entries,
+        const std::vector<float>& embeddings, size_t dim,
+        double threshold, std::string text_prefix, bool run_softmax) {
+        auto prompt_set = std::make_shared<PromptSet>();
+        prompt_set->entries = std::move(entries);
+        prompt_set->threshold = threshold;
+        prompt_set->text_prefix = std::move(text_prefix);
+        prompt_set->run_softmax = run_softmax;
+        prompt_set->embedding_dim = dim;
+        prompt_set->valid_rows = prompt_set->get_embeddings();
+        prompt_set->collapsed_template_rows = prompt_set->count_template_rows();
+
+        auto matrix = std::make_shared<AlignedFloatVector>(prompt_set->valid_rows.size() * dim);
+        for (size_t row = 0; row < prompt_set->valid_rows.size(); ++row) {
+            const float* src = embeddings.data() + prompt_set->valid_rows[row] * dim;
+            std::copy(src, src + dim, matrix->data() + row * dim);
+        }
+        prompt_set->prompt_matrix = matrix->data();
+        prompt_set->prompt_matrix_storage = std::move(matrix);
+        prompt_set->set_rows_from_matrix();
+        return prompt_set;
+    }
+
+    // Like create(), with each row taken from (or added to) the shared `store`, so that prompt sets
+    // holding the same prompts share their embeddings.
+    static std::shared_ptr<const PromptSet> create_shared(std::vector<TextEmbeddingEntry> entries,
+        const std::vector<float>& embeddings, size_t dim,
+        double threshold, std::string text_prefix, bool run_softmax,
+        clip_matcher::PromptEmbeddingStore& store) {
+        auto prompt_set = std::make_shared<PromptSet>();
+        prompt_set->entries = std::move(entries);
+        prompt_set->threshold = threshold;
+        prompt_set->text_prefix = std::move(text_prefix);
+        prompt_set->run_softmax = run_softmax;
+        prompt_set->embedding_dim = dim;
+        prompt_set->valid_rows = prompt_set->get_embeddings();
+        prompt_set->collapsed_template_rows = prompt_set->count_template_rows();
+        for (int index : prompt_set->valid_rows) {
+            const TextEmbeddingEntry& entry = prompt_set->entries[index];
+            auto row = store.intern(clip_matcher::PromptEmbeddingStore::key(prompt_set->text_prefix, entry.text, entry.ensemble),
+                                    embeddings.data() + index * dim, dim);
+            prompt_set->prompt_rows.push_back(row->data());
+            prompt_set->shared_rows.push_back(std::move(row));
+        }
+        return prompt_set;
+    }
+
+    // Uses the embeddings of a mapped store in place (float32 stores), the PromptSet keeps the
+    // mapping alive. With a `shared_store` the rows are taken from (or added to) it instead.
+    static std::shared_ptr<const PromptSet> create(std::shared_ptr<const clip_matcher::MappedEmbeddingStore> store,
+        double threshold, bool run_softmax, clip_matcher::PromptEmbeddingStore* shared_store = nullptr) {
+        auto prompt_set = std::make_shared<PromptSet>();
+        prompt_set->threshold = threshold;
+        prompt_set->text_prefix = std::string(store->text_prefix());
+        prompt_set->run_softmax = run_softmax;
+        prompt_set->embedding_dim = store->dim();
+        bool all_rows_valid = true;
+        for (size_t i = 0; i < store->count(); ++i) {
+            prompt_set->entries.emplace_back(std::string(store->text(i)), store->negative(i), store->ensemble(i),
+                                             store->template_count(i));
+            all_rows_valid = all_rows_valid && !store->text(i).empty();
+        }
+        prompt_set->valid_rows = prompt_set->get_embeddings();
+        prompt_set->collapsed_template_rows = prompt_set->count_template_rows();
+
+        if (shared_store != nullptr) {
+            AlignedFloatVector embedding(store->dim());
+            for (int index : prompt_set->valid_rows) {
+                const TextEmbeddingEntry& entry = prompt_set->entries[index];
+                store->copy_embedding(index, embedding.data());
+                auto row = shared_store->intern(
+                    clip_matcher::PromptEmbeddingStore::key(prompt_set->text_prefix, entry.text, entry.ensemble),
+                    embedding.data(), store->dim());
+                prompt_set->prompt_rows.push_back(row->data());
+                prompt_set->shared_rows.push_back(std::move(row));
+            }
+            return prompt_set;
+        }
+        if (store->float32_embeddings() != nullptr && all_rows_valid) {
+            prompt_set->prompt_matrix = store->float32_embeddings();
+            prompt_set->prompt_matrix_storage = std::move(store);
+            prompt_set->set_rows_from_matrix();
+            return prompt_set;
+        }
+        auto matrix = std::make_shared<AlignedFloatVector>(prompt_set->valid_rows.size() * store->dim());
+        for (size_t row = 0; row < prompt_set->valid_rows.size(); ++row) {
+            store->copy_embedding(prompt_set->valid_rows[row], matrix->data() + row * store->dim());
+        }
+        prompt_set->prompt_matrix = matrix->data();
+        prompt_set->prompt_matrix_storage = std::move(matrix);
+        prompt_set->set_rows_from_matrix();
+        return prompt_set;
+    }
+
+    void set_rows_from_matrix() {
+        prompt_rows.resize(valid_rows.size());
+        for (size_t row = 0; row < valid_rows.size(); ++row) {
+            prompt_rows[row] = prompt_matrix + row * embedding_dim;
+        }
+    }
+
+    // Copy of this PromptSet with different matching settings, sharing the prompt matrix.
+    std::shared_ptr<const PromptSet> with_settings(double new_threshold, std::string new_text_prefix,
+        bool new_run_softmax) const {
+        auto prompt_set = std::make_shared<PromptSet>(*this);
+        prompt_set->threshold = new_threshold;
+        prompt_set->text_prefix = std::move(new_text_prefix);
+        prompt_set->run_softmax = new_run_softmax;
+        return prompt_set;
+    }
+
+    // Copy of this PromptSet matched through an IVF-flat index over its prompt matrix.
+    std::shared_ptr<const PromptSet> with_ann_index(const clip_matcher::IvfParams& params) const {
+        auto prompt_set = std::make_shared<PromptSet>(*this);
+        if (prompt_matrix != nullptr) {
+            prompt_set->ann_index = clip_matcher::IvfFlatIndex::build(prompt_matrix, valid_rows.size(),
+                embedding_dim, embedding_dim, params);
+            return prompt_set;
+        }
+        AlignedFloatVector matrix(prompt_rows.size() * embedding_dim);
+        for (size_t row = 0; row < prompt_rows.size(); ++row) {
+            std::copy(prompt_rows[row], prompt_rows[row] + embedding_dim, matrix.data() + row * embedding_dim);
+        }
+        prompt_set->ann_index = clip_matcher::IvfFlatIndex::build(matrix.data(), prompt_rows.size(),
+            embedding_dim, embedding_dim, params);
+        return prompt_set;
+    }
+
+    size_t count_template_rows() const {
+        size_t template_rows = 0;
+        for (int index : valid_rows) {
+            template_rows += entries[index].template_count;
+        }
+        return template_rows;
+    }
+
+    std::vector<int> get_embeddings() const {
+        std::vector<int> valid_entries;
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (!entries[i].text.empty()) {
+                valid_entries.push_back(i);
+            }
+        }
+        return valid_entries;
+    }
+};
+
+// Caller-owned state of match(): the PromptSet the caller currently reads and the per-call
+// similarities, so concurrent matches never write to shared memory. Reuse one instance per thread
+// to avoid allocations and to only touch the matcher's PromptSet when a new one is published.
+class MatchScores {
+public:
+    std::shared_ptr<const PromptSet> prompt_set;
+    uint64_t prompt_set_generation = 0;
+
+    // similarities[row * num_prompts + i] is the similarity of image row `row` to the prompt in
+    // prompt_set->entries[prompt_set->valid_rows[i]], as of the last match() call. Empty (num_prompts
+    // is 0) when the PromptSet is matched through its ANN index, see match_top_k() instead.
+    std::vector<float> similarities;
+    size_t num_rows = 0;
+    size_t num_prompts = 0;
+
+    // Best prompt of image row `row` as of the last match() or score() call: its index in
+    // prompt_set->entries, and its similarity.
+    int best_entry(size_t row) const { return prompt_set->valid_rows[best_indices[row]]; }
+    float best_similarity(size_t row) const { return best_similarities[row]; }
+
+private:
+    friend class TextImageMatcher;
+    AlignedFloatVector images;
+    std::vector<int> best_indices;
+    std::vector<float> best_similarities;
+    clip_matcher::IvfSearchScratch ann_scratch;
+    std::vector<clip_matcher::Neighbor> candidates;
+    std::vector<float> candidate_scores;
+};
+
 class TextImageMatcher {
 public:
+    // Writes the embeddings of text_prefix + each of `texts` to consecutive rows of `embeddings`,
+    // returns false if it cannot.
+    using TextEncoder = std::function<bool(const std::string& text_prefix, const std::vector<std::string>& texts,
+                                           std::vector<float>& embeddings, size_t& dim)>;
+
     std::string model_name;
-    double threshold;  // Use double for threshold
     int max_entries;
-    bool run_softmax = true;
-    std::vector<TextEmbeddingEntry> entries;
     std::string user_data = "";
-    std::string text_prefix = "A photo of a ";
 
 public:
-    bool prompt_upadte = false;
+    // Set while new prompts are being computed, the pipeline drops the stale classifications.
+    std::atomic<bool> prompt_upadte{false};
     void set_prompt_update(bool update) {
         prompt_upadte = update;
     }
@@ -81,14 +299,53 @@ private:
     TextImageMatcher& operator=(const TextImageMatcher&) = delete;
 
     // Private Constructor
-    TextImageMatcher(std::string m_name, double thresh, int max_ents)
-        : model_name(m_name), threshold(thresh), max_entries(max_ents), m_debug(false) {
+    TextImageMatcher(std::string m_name, double thresh, int max_ents,
+                     clip_matcher::PromptEmbeddingStore* shared_store = nullptr)
+        : model_name(m_name), max_entries(max_ents), m_debug(false), m_shared_store(shared_store) {
         // Initialize entries with default TextEmbeddingEntry
+        std::vector<TextEmbeddingEntry> entries;
         for (int i = 0; i < max_entries; ++i) {
-            entries.push_back(TextEmbeddingEntry("", std::vector<float>(), false, false));
+            entries.push_back(TextEmbeddingEntry("", false, false));
         }
+        m_prompt_set = PromptSet::create(std::move(entries), {}, 0, thresh, "A photo of a ", true);
     }
     std::atomic<bool> m_debug;//When set outputs all matches overrides match(report_all = false)
+    // Store deduplicating the prompt rows across matchers, null to keep them in this matcher only
+    clip_matcher::PromptEmbeddingStore* m_shared_store;
+    TextEncoder m_text_encoder;
+
+    // Published PromptSet, only accessed through std::atomic_load() and std::atomic_exchange().
+    // Writers serialize on m_update_mutex, exchange the pointer, then bump m_generation. Readers
+    // only load m_generation on the hot path, and copy the pointer after a new PromptSet was
+    // published without waiting for a writer.
+    std::shared_ptr<const PromptSet> m_prompt_set;
+    std::atomic<uint64_t> m_generation{1};
+    std::mutex m_update_mutex;
+    std::atomic<size_t> m_ann_min_prompts{4096};
+
+    // Adds an ANN index to `prompt_set` if its vocabulary is large enough and it is matched without
+    // softmax, removes it otherwise.
+    std::shared_ptr<const PromptSet> with_index_if_large(std::shared_ptr<const PromptSet> prompt_set) const {
+        const size_t min_prompts = m_ann_min_prompts.load();
+        if (min_prompts == 0 || prompt_set->run_softmax || prompt_set->valid_rows.size() < min_prompts) {
+            if (!prompt_set->ann_index) {
+                return prompt_set;
+            }
+            auto unindexed = std::make_shared<PromptSet>(*prompt_set);
+            unindexed->ann_index.reset();
+            return unindexed;
+        }
+        if (prompt_set->ann_index) {
+            return prompt_set;
+        }
+        return prompt_set->with_ann_index(clip_matcher::IvfParams());
+    }
+
+    void publish(std::shared_ptr<const PromptSet> prompt_set) {
+        prompt_set = std::atomic_exchange(&m_prompt_set, std::move(prompt_set));
+        m_generation.fetch_add(1, std::memory_order_release);
+        // The previous PromptSet is released here, or by the last match() still using it
+    }
 
 public:
     // Public Method to get the singleton instance
@@ -100,150 +357,527 @@ public:
         return instance;
     }
 
+    // Creates a matcher of its own (one per camera), its prompt rows shared through `shared_store`
+    // with the other matchers holding the same prompts when given.
+    static std::unique_ptr<TextImageMatcher> create(std::string model_name, float threshold, int max_entries,
+        clip_matcher::PromptEmbeddingStore* shared_store) {
+        return std::unique_ptr<TextImageMatcher>(
+            new TextImageMatcher(model_name, threshold, max_entries, shared_store));
+    }
+
     // Destructor
     ~TextImageMatcher() {
         // Cleanup code
     }
 
+    // Currently published PromptSet, stays valid for as long as the caller holds it.
+    std::shared_ptr<const PromptSet> prompt_set() const {
+        return std::atomic_load(&m_prompt_set);
+    }
+
+    double get_threshold() const {
+        return prompt_set()->threshold;
+    }
+
     void set_threshold(double new_threshold) {
-        threshold = new_threshold;
+        std::lock_guard<std::mutex> lock(m_update_mutex);
+        auto current = prompt_set();
+        publish(current->with_settings(new_threshold, current->text_prefix, current->run_softmax));
     }
 
     void set_text_prefix(std::string new_text_prefix) {
-        text_prefix = new_text_prefix;
+        std::lock_guard<std::mutex> lock(m_update_mutex);
+        auto current = prompt_set();
+        publish(current->with_settings(current->threshold, new_text_prefix, current->run_softmax));
     }
 
-    std::vector<int> get_embeddings() {
-        std::vector<int> valid_entries;
-        for (size_t i = 0; i < entries.size(); i++) {
-            if (!entries[i].text.empty()) {
-                valid_entries.push_back(i);
+    void set_run_softmax(bool run_softmax) {
+        std::lock_guard<std::mutex> lock(m_update_mutex);
+        auto current = prompt_set();
+        publish(with_index_if_large(current->with_settings(current->threshold, current->text_prefix, run_softmax)));
+    }
+
+    std::vector<int> get_embeddings() const {
+        return prompt_set()->get_embeddings();
+    }
+
+    // Ensemble template rows averaged into the current prompts at load time.
+    size_t get_collapsed_template_rows() const {
+        return prompt_set()->collapsed_template_rows;
+    }
+
+    // Vocabularies with at least `min_prompts` prompts are matched through an approximate (IVF-flat)
+    // index instead of scoring every prompt, 0 disables the index. Applies from the next
+    // load_embeddings().
+    //
+    // Only without softmax (see set_run_softmax()): the index yields the best candidates of an image,
+    // not its similarity to every prompt, and a softmax over the candidates alone would report the
+    // best prompt more likely than it is. With softmax every prompt is scored, whatever the size of
+    // the vocabulary.
+    void set_ann_min_prompts(size_t min_prompts) {
+        m_ann_min_prompts.store(min_prompts);
+    }
+    size_t get_ann_min_prompts() const {
+        return m_ann_min_prompts.load();
+    }
+
+    // Encoder of the ensemble templates of the JSON files loaded from now on, see
+    // import_json_embeddings(). Set before loading, not concurrently with it.
+    void set_text_encoder(TextEncoder text_encoder) {
+        m_text_encoder = std::move(text_encoder);
+    }
+
+    // Reads a JSON embedding file as written by the text_image_matcher tool. Entries without
+    // text are dropped, they can never be matched.
+    //
+    // An ensembled entry ("ensemble": true) is matched as the average of its prompt put through
+    // every ensemble_template of the file ("{}" standing for the prompt): the template embeddings
+    // are averaged and renormalized here into the entry's single row, so ensembling costs nothing
+    // per frame. They are taken from the entry's "template_embeddings" if it has them, else encoded
+    // by `text_encoder`. Without either, "embedding" is used as is.
+    static clip_matcher::EmbeddingStoreContents import_json_embeddings(const std::string& filename,
+        const TextEncoder& text_encoder = nullptr) {
+        // Before reading: a file rewritten meanwhile no longer matches the store made from it
+        const clip_matcher::EmbeddingStoreSource source = clip_matcher::embedding_store_source(filename);
+        std::ifstream f(filename);
+        nlohmann::json data;
+        f >> data;
+
+        clip_matcher::EmbeddingStoreContents contents;
+        contents.source = source;
+        contents.threshold = data["threshold"].get<float>();
+        contents.text_prefix = data["text_prefix"].get<std::string>();
+        if (data.contains("ensemble_template")) {
+            contents.ensemble_templates = data["ensemble_template"].get<std::vector<std::string>>();
+        }
+        const std::vector<std::vector<float>> encoded_templates = encode_ensemble_templates(data,
+            contents.ensemble_templates, text_encoder);
+        for (size_t i = 0; i < data["entries"].size(); i++) {
+            std::string text = data["entries"][i]["text"];
+            if (text.empty()) {
+                continue;
+            }
+            bool negative = data["entries"][i]["negative"];
+            bool ensemble = data["entries"][i]["ensemble"];
+            std::vector<float> embedding;
+            uint32_t template_count = 0;
+            if (ensemble && data["entries"][i].contains("template_embeddings")
+                && !data["entries"][i]["template_embeddings"].empty()) {
+                auto template_embeddings = data["entries"][i]["template_embeddings"].get<std::vector<std::vector<float>>>();
+                const size_t template_dim = template_embeddings[0].size();
+                std::vector<float> rows;
+                for (const auto& template_embedding : template_embeddings) {
+                    if (template_embedding.size() == template_dim) {
+                        rows.insert(rows.end(), template_embedding.begin(), template_embedding.end());
+                    }
+                }
+                template_count = static_cast<uint32_t>(rows.size() / std::max<size_t>(template_dim, 1));
+                embedding.resize(template_dim);
+                clip_matcher::collapse_template_embeddings(rows.data(), template_count, template_dim, embedding.data());
+            } else if (!encoded_templates[i].empty()) {
+                template_count = static_cast<uint32_t>(contents.ensemble_templates.size());
+                const size_t template_dim = encoded_templates[i].size() / template_count;
+                embedding.resize(template_dim);
+                clip_matcher::collapse_template_embeddings(encoded_templates[i].data(), template_count, template_dim,
+                                                           embedding.data());
+            } else {
+                embedding = data["entries"][i]["embedding"].get<std::vector<float>>();
+            }
+            if (contents.dim == 0) {
+                contents.dim = static_cast<uint32_t>(embedding.size());
             }
+            if (embedding.size() != contents.dim) {
+                std::cout << "Skipping prompt '" << text << "': embedding size " << embedding.size()
+                          << " != " << contents.dim << std::endl;
+                continue;
+            }
+            contents.entries.push_back({text, negative, ensemble, template_count});
+            contents.embeddings.insert(contents.embeddings.end(), embedding.begin(), embedding.end());
         }
-        return valid_entries;
+        return contents;
+    }
+
+    // The ensemble_template list of a JSON embedding file, empty if it has none. Throws if the file
+    // cannot be read.
+    static std::vector<std::string> read_ensemble_templates(const std::string& filename) {
+        std::ifstream f(filename);
+        nlohmann::json data;
+        f >> data;
+        if (!data.contains("ensemble_template")) {
+            return {};
+        }
+        return data["ensemble_template"].get<std::vector<std::string>>();
     }
 
-    void load_embeddings(std::string filename) {
+    // Prompt put through an ensemble template, as str.format() of the text_image_matcher tool does.
+    static std::string apply_ensemble_template(const std::string& ensemble_template, const std::string& text) {
+        const size_t placeholder = ensemble_template.find("{}");
+        if (placeholder == std::string::npos) {
+            return ensemble_template + text;
+        }
+        return ensemble_template.substr(0, placeholder) + text + ensemble_template.substr(placeholder + 2);
+    }
+
+    // For each entry of `data`, the embeddings of its prompt through every template in one batch,
+    // empty if the entry is not ensembled, carries its own template embeddings, or nothing could be
+    // encoded.
+    static std::vector<std::vector<float>> encode_ensemble_templates(const nlohmann::json& data,
+        const std::vector<std::string>& ensemble_templates, const TextEncoder& text_encoder) {
+        std::vector<std::vector<float>> encoded(data["entries"].size());
+        if (!text_encoder || ensemble_templates.empty()) {
+            return encoded;
+        }
+        std::vector<size_t> ensembled;
+        std::vector<std::string> texts;
+        for (size_t i = 0; i < data["entries"].size(); i++) {
+            const auto& entry = data["entries"][i];
+            const std::string text = entry["text"];
+            if (text.empty() || !entry["ensemble"].get<bool>()
+                || (entry.contains("template_embeddings") && !entry["template_embeddings"].empty())) {
+                continue;
+            }
+            ensembled.push_back(i);
+            for (const auto& ensemble_template : ensemble_templates) {
+                texts.push_back(apply_ensemble_template(ensemble_template, text));
+            }
+        }
+        if (texts.empty()) {
+            return encoded;
+        }
+        // The templates hold the whole sentence, the text prefix of the file is not added
+        std::vector<float> embeddings;
+        size_t dim = 0;
+        if (!text_encoder("", texts, embeddings, dim) || dim == 0 || embeddings.size() != texts.size() * dim) {
+            std::cout << "Cannot encode the ensemble templates of " << ensembled.size()
+                      << " prompts, using their stored embeddings" << std::endl;
+            return encoded;
+        }
+        const size_t rows_per_entry = ensemble_templates.size() * dim;
+        for (size_t k = 0; k < ensembled.size(); k++) {
+            encoded[ensembled[k]].assign(embeddings.begin() + k * rows_per_entry,
+                                         embeddings.begin() + (k + 1) * rows_per_entry);
+        }
+        return encoded;
+    }
+
+    // Converts a JSON embedding file into a binary embedding store.
+    static void convert_json_to_store(const std::string& json_filename, const std::string& store_filename,
+        clip_matcher::EmbeddingDType dtype = clip_matcher::EmbeddingDType::float32) {
+        clip_matcher::write_embedding_store(store_filename, import_json_embeddings(json_filename), dtype);
+    }
+
+    // Loads the prompts from `filename` and publishes them in one PromptSet, with `threshold`
+    // overriding the one stored in the file when given.
+    //
+    // `filename` is either a binary embedding store, which is mapped and used in place, or a JSON
+    // file. A JSON file is converted once into a store next to it (same name, .bin extension), which
+    // is then reused for as long as it records the size, modification time and inode the JSON file
+    // still has.
+    void load_embeddings(std::string filename, std::optional<double> threshold_override = std::nullopt) {
         if (!std::filesystem::exists(filename)) {
             std::ofstream file(filename);
             file.close();
             std::cout << "File " << filename << " does not exist, creating it." << std::endl;
-        } else {
-            try {
-                std::ifstream f(filename);
-                nlohmann::json data;
-                f >> data;
-
-                threshold = data["threshold"].get<double>();
-                text_prefix = data["text_prefix"].get<std::string>();
-
-                entries.clear();
-                for (size_t i = 0; i < data["entries"].size(); i++) {
-                    std::string text = data["entries"][i]["text"];
-                    std::vector<float> embedding = data["entries"][i]["embedding"].get<std::vector<float>>();
-                    bool negative = data["entries"][i]["negative"];
-                    bool ensemble = data["entries"][i]["ensemble"];
-                    entries.push_back(TextEmbeddingEntry(text, embedding, negative, ensemble));
+            return;
+        }
+        const auto start_time = std::chrono::steady_clock::now();
+        try {
+            std::filesystem::path path(filename);
+            std::filesystem::path store_path = path;
+            std::shared_ptr<const clip_matcher::MappedEmbeddingStore> store;
+            if (path.extension() != clip_matcher::kEmbeddingStoreExtension) {
+                store_path.replace_extension(clip_matcher::kEmbeddingStoreExtension);
+                std::error_code error;
+                if (std::filesystem::exists(store_path, error)) {
+                    // A store of an older version, or a torn one, is converted again
+                    try {
+                        store = clip_matcher::MappedEmbeddingStore::open(store_path.string());
+                    } catch (const std::exception&) {
+                    }
+                }
+                if (!store || store->source() != clip_matcher::embedding_store_source(filename)) {
+                    store.reset();
+                    clip_matcher::EmbeddingStoreContents contents = import_json_embeddings(filename, m_text_encoder);
+                    try {
+                        clip_matcher::write_embedding_store(store_path.string(), contents);
+                    } catch (const std::exception& e) {
+                        // Still use the prompts, only the next load will be slow again
+                        std::cout << "Cannot write embedding store: " << e.what() << std::endl;
+                        load_prompts(contents, threshold_override);
+                        return;
+                    }
                 }
-            } catch (const std::exception& e) {
-                std::cout << "Error while loading file " << filename << ": " << e.what() << ". Maybe you forgot to save your embeddings?" << std::endl;
+            }
+            if (!store)
+                store = clip_matcher::MappedEmbeddingStore::open(store_path.string());
+            double threshold = threshold_override.value_or(store->threshold());
+
+            std::lock_guard<std::mutex> lock(m_update_mutex);
+            publish(with_index_if_large(PromptSet::create(std::move(store), threshold, prompt_set()->run_softmax,
+                                                          m_shared_store)));
+        } catch (const std::exception& e) {
+            std::cout << "Error while loading file " << filename << ": " << e.what() << ". Maybe you forgot to save your embeddings?" << std::endl;
+            return;
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_time);
+        const auto loaded = prompt_set();
+        std::cout << "Loaded " << loaded->valid_rows.size() << " prompts ("
+                  << loaded->collapsed_template_rows << " ensemble template rows collapsed";
+        if (loaded->ann_index) {
+            std::cout << ", ANN index of " << loaded->ann_index->num_lists() << " lists";
+        }
+        std::cout << ") from " << filename << " in " << elapsed.count() << " us" << std::endl;
+    }
+    // Publishes prompts encoded in memory (e.g. by the in-process text encoder) without going
+    // through a file, with `threshold` overriding the one of `contents` when given.
+    void load_prompts(const clip_matcher::EmbeddingStoreContents& contents,
+                      std::optional<double> threshold_override = std::nullopt) {
+        std::vector<TextEmbeddingEntry> entries;
+        for (const auto& entry : contents.entries) {
+            entries.emplace_back(entry.text, entry.negative, entry.ensemble, entry.template_count);
+        }
+        double threshold = threshold_override.value_or(contents.threshold);
+        std::lock_guard<std::mutex> lock(m_update_mutex);
+        const bool run_softmax = prompt_set()->run_softmax;
+        publish(with_index_if_large(m_shared_store != nullptr
+            ? PromptSet::create_shared(std::move(entries), contents.embeddings, contents.dim,
+                threshold, contents.text_prefix, run_softmax, *m_shared_store)
+            : PromptSet::create(std::move(entries), contents.embeddings, contents.dim,
+                threshold, contents.text_prefix, run_softmax)));
+    }
+
+    // Writes `contents` as a JSON embedding file in the format of the text_image_matcher tool, through
+    // a temporary file and a rename. Throws on failure.
+    static void export_json_embeddings(const std::string& filename,
+                                       const clip_matcher::EmbeddingStoreContents& contents) {
+        nlohmann::json data;
+        data["threshold"] = contents.threshold;
+        data["text_prefix"] = contents.text_prefix;
+        data["ensemble_template"] = contents.ensemble_templates;
+        data["entries"] = nlohmann::json::array();
+        for (size_t i = 0; i < contents.entries.size(); i++) {
+            const auto* row = contents.embeddings.data() + i * contents.dim;
+            nlohmann::json entry;
+            entry["text"] = contents.entries[i].text;
+            entry["embedding"] = std::vector<float>(row, row + contents.dim);
+            entry["negative"] = contents.entries[i].negative;
+            entry["ensemble"] = contents.entries[i].ensemble;
+            data["entries"].push_back(entry);
+        }
+        // Replaced through a rename: a store converted from the previous file sees a new inode, even
+        // when the new one has the same size and modification time
+        const std::string temp_filename = clip_matcher::create_temp_file_for(filename);
+        {
+            std::ofstream f(temp_filename);
+            f << data.dump();
+            if (!f) {
+                std::filesystem::remove(temp_filename);
+                throw std::runtime_error("Cannot write " + temp_filename);
             }
         }
+        std::filesystem::rename(temp_filename, filename);
     }
+
     void set_debug(bool debug) {
         m_debug.store(debug);
         std::cout << "Setting debug to: " << m_debug.load() << std::endl;
     }
+    bool get_debug() const {
+        return m_debug.load();
+    }
 
-    std::vector<Match> match(const xt::xarray<double>& image_embedding_np, bool report_all = false) {
-        
-        bool report_all_debug = report_all || m_debug.load();
-
-        std::vector<Match> results;
-        // Ensure the input is a 2D array
-        xt::xarray<double> image_embedding = image_embedding_np;
-        if (image_embedding.dimension() == 1) {
-            image_embedding = image_embedding.reshape({1, -1});
-        }
-        // Getting valid entries
-        std::vector<int> valid_entries = get_embeddings();
-        if (valid_entries.empty()) {
-            return results; // Return an empty list if no valid entries
+    // Matches the image embeddings of an xarray through the caller-owned `scores`, whose buffers are
+    // reused across calls.
+    std::vector<Match> match(const xt::xarray<double>& image_embedding_np, MatchScores& scores,
+        bool report_all = false) {
+        if (image_embedding_np.size() == 0 || image_embedding_np.dimension() == 0) {
+            return {};
         }
-        
-        std::vector<xt::xarray<double>> to_stack;
-        to_stack.reserve(valid_entries.size()); // Reserve memory in advance
+        // A 1D input is a single image embedding, a 2D input holds one embedding per row
+        const size_t dim = image_embedding_np.shape().back();
+        const size_t num_rows = image_embedding_np.size() / dim;
+        const double* image_data = image_embedding_np.data();
+        scores.images.resize(num_rows * dim);
+        std::copy(image_data, image_data + num_rows * dim, scores.images.begin());
+        return match_rows(scores.images.data(), num_rows, dim, dim, nullptr, scores, report_all);
+    }
 
-        xt::xarray<double> text_embeddings_np; // Declare text_embeddings_np outside the if block
+    // Matches the image embeddings gathered in `batch`, normalized through the batch row scales.
+    std::vector<Match> match(const clip_matcher::EmbeddingBatch& batch, MatchScores& scores,
+        bool report_all = false) {
+        return match_rows(batch.data(), batch.rows(), batch.stride(), batch.dim(), batch.row_scales(),
+                          scores, report_all);
+    }
 
-        if (!valid_entries.empty()) {
-            for (size_t entry_idx : valid_entries) {
-                if (entry_idx < entries.size()) {
-                    to_stack.push_back(entries[entry_idx].embedding);
-                } 
-            }
+    // Scores the rows of `batch` like match() without building a Match per row, the best prompt of
+    // each is then read from `scores`. False if no row was scored (no prompts, or embeddings of
+    // another size).
+    bool score(const clip_matcher::EmbeddingBatch& batch, MatchScores& scores) {
+        return score_rows(batch.data(), batch.rows(), batch.stride(), batch.dim(), batch.row_scales(), scores);
+    }
 
-            if (!to_stack.empty()) {
-                // Initialize text_embeddings_np with the correct shape
-                text_embeddings_np.resize({to_stack.size(), to_stack.front().size()});
-                for (size_t i = 0; i < to_stack.size(); ++i) {
-                    xt::view(text_embeddings_np, i, xt::all()) = to_stack[i];
-                }
-            }
+    // The `k` best prompts of every row of `batch`, best first, with the similarities match() would
+    // compute for them (over the ANN candidates when the PromptSet has an index). Negative prompts
+    // and the threshold are not filtered, Match::passed_threshold tells the latter.
+    std::vector<std::vector<Match>> match_top_k(const clip_matcher::EmbeddingBatch& batch, size_t k,
+        MatchScores& scores) {
+        const PromptSet& prompts = current_prompt_set(scores);
+        scores.num_rows = 0;
+        scores.num_prompts = 0;
+        std::vector<std::vector<Match>> results(batch.rows());
+        const size_t num_prompts = prompts.valid_rows.size();
+        if (num_prompts == 0 || k == 0 || batch.dim() != prompts.embedding_dim) {
+            return results;
         }
-        
-        // Looping through each image embedding
-        for (std::size_t row_idx = 0; row_idx < image_embedding.shape()[0]; ++row_idx) {
-            auto image_embedding_1d = xt::view(image_embedding, row_idx);
-            xt::xarray<double> dot_products = xt::linalg::dot(text_embeddings_np, image_embedding_1d);
-            xt::xarray<double> similarities;
-
-            if (run_softmax) {
-                similarities = xt::exp(100 * dot_products);
-                double sum = xt::sum(similarities)();
-                if (sum != 0) {
-                    similarities /= sum;
-                } else {
-                    similarities = xt::zeros<double>({dot_products.size()});
+        clip_matcher::ScoreParams params;
+        params.run_softmax = prompts.run_softmax;
+        for (size_t row = 0; row < batch.rows(); ++row) {
+            const float* image = batch.data() + row * batch.stride();
+            const float row_scale = batch.row_scales()[row];
+            size_t count = 0;
+            if (prompts.ann_index) {
+                // Candidates come sorted, the similarity mapping keeps their order
+                prompts.ann_index->search(image, row_scale, std::max(k, prompts.ann_top_k),
+                                          prompts.ann_num_probes, scores.ann_scratch, scores.candidates);
+                count = std::min(k, scores.candidates.size());
+                scores.candidate_scores.resize(scores.candidates.size());
+                for (size_t i = 0; i < scores.candidates.size(); ++i) {
+                    scores.candidate_scores[i] = scores.candidates[i].score;
                 }
             } else {
-                // These values are based on statistics collected for the RN50x4 model
-                similarities = (dot_products - 0.27) / (0.41 - 0.27);
-                similarities = xt::clip(similarities, 0, 1);
+                scores.candidate_scores.resize(num_prompts);
+                clip_matcher::dot_products_rows(image, 1, batch.stride(), prompts.prompt_rows.data(), num_prompts,
+                                                prompts.embedding_dim, scores.candidate_scores.data());
+                scores.candidates.resize(num_prompts);
+                for (size_t i = 0; i < num_prompts; ++i) {
+                    scores.candidates[i] = {static_cast<int>(i), scores.candidate_scores[i]};
+                }
+                count = std::min(k, num_prompts);
+                std::partial_sort(scores.candidates.begin(), scores.candidates.begin() + count,
+                    scores.candidates.end(), [](const clip_matcher::Neighbor& a, const clip_matcher::Neighbor& b) {
+                        return a.score > b.score || (a.score == b.score && a.row < b.row);
+                    });
+            }
+            if (scores.candidate_scores.empty()) {
+                continue;
             }
+            int best_idx = 0;
+            float best_similarity = 0.0f;
+            clip_matcher::dot_products_to_similarities(scores.candidate_scores.data(), 1,
+                scores.candidate_scores.size(), params, prompts.ann_index ? nullptr : &row_scale,
+                &best_idx, &best_similarity);
+            for (size_t i = 0; i < count; ++i) {
+                const int prompt_row = scores.candidates[i].row;
+                // Brute-force similarities are indexed by prompt row, ANN ones by candidate
+                const double similarity = scores.candidate_scores[prompts.ann_index ? i : prompt_row];
+                const TextEmbeddingEntry& entry = prompts.entries[prompts.valid_rows[prompt_row]];
+                results[row].emplace_back(row, entry.text, similarity, prompts.valid_rows[prompt_row],
+                                          entry.negative, similarity > prompts.threshold);
+            }
+        }
+        return results;
+    }
 
-            int best_idx = xt::argmax(similarities)();
-            double best_similarity = similarities[best_idx];
+private:
+    // Picks up a newly published PromptSet, the caller keeps it alive until the next one.
+    const PromptSet& current_prompt_set(MatchScores& scores) const {
+        const uint64_t generation = m_generation.load(std::memory_order_acquire);
+        if (scores.prompt_set == nullptr || scores.prompt_set_generation != generation) {
+            scores.prompt_set = prompt_set();
+            scores.prompt_set_generation = generation;
+        }
+        return *scores.prompt_set;
+    }
 
-            // Updating probabilities in entries
-            for (size_t i = 0; i < similarities.size(); i++) {
-                entries[valid_entries[i]].probability = similarities[i];
+    // Best candidate of every row through the ANN index, written like score_batch() would.
+    void match_rows_ann(const PromptSet& prompts, const float* images, size_t num_rows, size_t image_stride,
+        const float* row_scales, const clip_matcher::ScoreParams& params, MatchScores& scores) {
+        for (size_t row = 0; row < num_rows; ++row) {
+            const float row_scale = row_scales != nullptr ? row_scales[row] : 1.0f;
+            prompts.ann_index->search(images + row * image_stride, row_scale, prompts.ann_top_k,
+                                      prompts.ann_num_probes, scores.ann_scratch, scores.candidates);
+            scores.candidate_scores.resize(scores.candidates.size());
+            for (size_t i = 0; i < scores.candidates.size(); ++i) {
+                scores.candidate_scores[i] = scores.candidates[i].score;
             }
+            int best_candidate = 0;
+            float best_similarity = 0.0f;
+            clip_matcher::dot_products_to_similarities(scores.candidate_scores.data(), 1,
+                scores.candidate_scores.size(), params, nullptr, &best_candidate, &best_similarity);
+            scores.best_indices[row] = scores.candidates[best_candidate].row;
+            scores.best_similarities[row] = best_similarity;
+        }
+    }
+
+    bool score_rows(const float* images, size_t num_rows, size_t image_stride, size_t dim,
+        const float* row_scales, MatchScores& scores) {
+        const PromptSet& prompts = current_prompt_set(scores);
+        scores.num_rows = 0;
+        scores.num_prompts = prompts.valid_rows.size();
+
+        if (prompts.valid_rows.empty() || num_rows == 0) {
+            return false;
+        }
+        if (dim != prompts.embedding_dim) {
+            std::cout << "Image embedding size " << dim << " does not match prompt embedding size "
+                      << prompts.embedding_dim << std::endl;
+            return false;
+        }
+        const size_t num_prompts = prompts.valid_rows.size();
+
+        scores.num_rows = num_rows;
+        scores.best_indices.resize(num_rows);
+        scores.best_similarities.resize(num_rows);
+        clip_matcher::ScoreParams params;
+        params.run_softmax = prompts.run_softmax;
+        if (prompts.ann_index) {
+            scores.num_prompts = 0;
+            scores.similarities.clear();
+            match_rows_ann(prompts, images, num_rows, image_stride, row_scales, params, scores);
+        } else {
+            // Score all image embeddings against all prompts in one pass
+            scores.similarities.resize(num_rows * num_prompts);
+            clip_matcher::score_batch_rows(images, num_rows, image_stride,
+                                           prompts.prompt_rows.data(), num_prompts, dim,
+                                           params, row_scales,
+                                           scores.similarities.data(), scores.best_indices.data(),
+                                           scores.best_similarities.data());
+        }
+        return true;
+    }
+
+    std::vector<Match> match_rows(const float* images, size_t num_rows, size_t image_stride, size_t dim,
+        const float* row_scales, MatchScores& scores, bool report_all) {
+        
+        bool report_all_debug = report_all || m_debug.load();
+
+        std::vector<Match> results;
+        if (!score_rows(images, num_rows, image_stride, dim, row_scales, scores)) {
+            return results; // Return an empty list if no valid entries
+        }
+        const PromptSet& prompts = *scores.prompt_set;
 
-            // Creating a new match object
-            Match new_match(row_idx,
-                            entries[valid_entries[best_idx]].text,
-                            best_similarity,
-                            valid_entries[best_idx],
-                            entries[valid_entries[best_idx]].negative,
-                            best_similarity > threshold);
+        // Looping through each image embedding
+        for (std::size_t row_idx = 0; row_idx < num_rows; ++row_idx) {
+            const int best_idx = scores.best_indices[row_idx];
+            const double best_similarity = scores.best_similarities[row_idx];
 
+            const TextEmbeddingEntry& best_entry = prompts.entries[prompts.valid_rows[best_idx]];
             // Filtering results based on conditions
-            if (!report_all_debug && new_match.negative) {
+            if (!report_all_debug && best_entry.negative) {
                 continue;
             }
-            if (report_all_debug || new_match.passed_threshold) {
-                results.push_back(new_match);
+            if (report_all_debug || best_similarity > prompts.threshold) {
+                results.emplace_back(row_idx,
+                                     best_entry.text,
+                                     best_similarity,
+                                     prompts.valid_rows[best_idx],
+                                     best_entry.negative,
+                                     best_similarity > prompts.threshold);
             }
         }
 
-        // // print results
-        // NX_PRINT << "Best match output: [";
-        // for (const auto& match : results) {
-        //     NX_PRINT << match.text << ", ";
-        // }
-        // NX_PRINT << "]" << std::endl;
-
         return results;
     }    
 };
@@ -0,0 +1,167 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "admission_controller.h"
+
+#include <algorithm>
+
+#include "hailo_clip_plugin_ini.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+namespace {
+
+constexpr double kLatencyAlpha = 0.2; //< Weight of a new frame in the latency average.
+constexpr float kRateCut = 0.75f;
+constexpr float kRateStep = 0.1f; //< Of the target rate.
+// Camera timestamps are rounded: 15 fps of a 30 fps camera would otherwise admit every 3rd frame
+constexpr double kCreditTolerance = 0.05;
+// One frame of burst: the fraction of a frame left after an admit carries over, so that 15 fps of
+// a 20 fps camera admits 3 frames out of 4 rather than every other one.
+constexpr double kMaxCredit = 2.0;
+
+} // namespace
+
+AdmissionController::AdmissionController(Params params):
+    m_params(params)
+{
+    m_counters.fps = std::max(m_params.targetFps, 0.0f);
+}
+
+AdmissionController::Params AdmissionController::paramsFromIni()
+{
+    Params params;
+    params.targetFps = std::max(ini().admissionTargetFps, 0.0f);
+    params.minFps = std::max(ini().admissionMinFps, 0.1f);
+    params.maxInFlight = std::max(ini().admissionMaxInFlight, 1);
+    params.targetLatencyMs = std::max(ini().admissionTargetLatencyMs, 1);
+    params.frameTimeoutMs = std::max(ini().admissionFrameTimeoutMs, params.targetLatencyMs);
+    return params;
+}
+
+AdmissionController::Decision AdmissionController::admit(int64_t timestampUs)
+{
+    const Clock::time_point now = Clock::now();
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    expireLocked(now);
+    if (now - m_lastAdjust >= std::chrono::milliseconds(m_params.adjustPeriodMs))
+        adjustLocked(now);
+
+    // The bucket refills with the camera time, whatever the frame rate of the camera
+    if (m_lastTimestampUs >= 0 && timestampUs > m_lastTimestampUs && m_counters.fps > 0.0f)
+        m_credit = std::min(kMaxCredit, m_credit + (timestampUs - m_lastTimestampUs) * 1e-6 * m_counters.fps);
+    m_lastTimestampUs = timestampUs;
+
+    if (static_cast<int>(m_inFlight.size()) >= m_params.maxInFlight)
+    {
+        ++m_counters.droppedOccupancy;
+        return Decision::dropOccupancy;
+    }
+    if (m_counters.fps > 0.0f)
+    {
+        if (m_credit < 1.0 - kCreditTolerance)
+        {
+            ++m_counters.droppedRate;
+            return Decision::dropRate;
+        }
+        m_credit -= 1.0;
+    }
+    ++m_counters.admitted;
+    return Decision::admit;
+}
+
+void AdmissionController::submitted(int64_t timestampUs)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_inFlight[timestampUs] = Clock::now();
+}
+
+void AdmissionController::notSubmitted(int64_t timestampUs)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_inFlight.erase(timestampUs);
+    ++m_counters.notSubmitted;
+}
+
+void AdmissionController::completed(int64_t timestampUs)
+{
+    const Clock::time_point now = Clock::now();
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    const auto frame = m_inFlight.find(timestampUs);
+    if (frame == m_inFlight.end())
+        return;
+    const double latencyMs = std::chrono::duration<double, std::milli>(now - frame->second).count();
+    m_counters.latencyMs = static_cast<float>(m_hasLatency
+        ? (1.0 - kLatencyAlpha) * m_counters.latencyMs + kLatencyAlpha * latencyMs
+        : latencyMs);
+    m_hasLatency = true;
+    ++m_counters.completed;
+    m_inFlight.erase(frame);
+}
+
+void AdmissionController::abandonInFlight()
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_inFlight.clear();
+}
+
+AdmissionController::Counters AdmissionController::counters() const
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    Counters result = m_counters;
+    result.inFlight = static_cast<int>(m_inFlight.size());
+    return result;
+}
+
+void AdmissionController::expireLocked(Clock::time_point now)
+{
+    const Clock::time_point oldest = now - std::chrono::milliseconds(m_params.frameTimeoutMs);
+    for (auto frame = m_inFlight.begin(); frame != m_inFlight.end();)
+    {
+        if (frame->second < oldest)
+        {
+            frame = m_inFlight.erase(frame);
+            ++m_counters.lost;
+        }
+        else
+        {
+            ++frame;
+        }
+    }
+}
+
+void AdmissionController::adjustLocked(Clock::time_point now)
+{
+    m_lastAdjust = now;
+    const int inFlight = static_cast<int>(m_inFlight.size());
+    const bool lost = m_counters.lost > m_lostAtAdjust;
+    m_lostAtAdjust = m_counters.lost;
+    const bool overload = lost
+        || inFlight * 4 >= m_params.maxInFlight * 3
+        || m_counters.latencyMs > m_params.targetLatencyMs;
+    const bool underload = !lost
+        && inFlight * 4 <= m_params.maxInFlight
+        && m_counters.latencyMs < 0.7f * m_params.targetLatencyMs;
+
+    // Uncapped, the occupancy limit alone sheds the load
+    if (m_params.targetFps <= 0.0f)
+    {
+        m_counters.overloaded = overload || (m_counters.overloaded && !underload);
+        return;
+    }
+    if (overload)
+    {
+        m_counters.fps = std::max(m_params.minFps, m_counters.fps * kRateCut);
+        m_counters.overloaded = true;
+    }
+    else if (underload && m_counters.overloaded)
+    {
+        m_counters.fps = std::min(m_params.targetFps, m_counters.fps + kRateStep * m_params.targetFps);
+        m_counters.overloaded = m_counters.fps < m_params.targetFps;
+    }
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
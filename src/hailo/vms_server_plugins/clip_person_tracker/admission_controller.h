@@ -0,0 +1,103 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/**
+ * Decides which frames of a camera enter its pipeline, so that an overloaded pipeline sheds load
+ * at the source instead of in its leaky queues.
+ *
+ * Frames are admitted at an analytics rate (a token bucket over the camera timestamps), which
+ * starts at the target rate. The rate follows the load of the pipeline, checked once per adjustment
+ * period:
+ * - Overload: the frames in flight (submitted and not yet matched) reach 3/4 of maxInFlight, the
+ *   recent end-to-end latency exceeds the target, or frames were lost in the pipeline. The rate is
+ *   cut by a quarter, down to minFps.
+ * - Underload: at most 1/4 of maxInFlight in flight, latency below 70% of the target and nothing
+ *   lost. The rate grows by a tenth of the target, up to it.
+ * - In between, the rate is kept, so that it does not oscillate around a threshold.
+ * Whatever the rate, no frame is admitted while maxInFlight frames are in flight.
+ *
+ * Thread-safe: frames are admitted on the frame thread and completed on the pipeline thread.
+ */
+class AdmissionController
+{
+public:
+    struct Params
+    {
+        float targetFps = 15.0f; //< 0 admits every frame the load allows.
+        float minFps = 1.0f;
+        int maxInFlight = 10;
+        int targetLatencyMs = 1500;
+        int frameTimeoutMs = 3000; //< A frame in flight for longer was lost in the pipeline.
+        int adjustPeriodMs = 1000;
+    };
+
+    enum class Decision
+    {
+        admit,
+        dropRate, //< Not due at the current rate.
+        dropOccupancy, //< maxInFlight frames in flight.
+    };
+
+    struct Counters
+    {
+        uint64_t admitted = 0;
+        uint64_t droppedRate = 0;
+        uint64_t droppedOccupancy = 0;
+        uint64_t notSubmitted = 0; //< Admitted, but the pipeline was starting or the ingest dropped it.
+        uint64_t completed = 0;
+        uint64_t lost = 0; //< Submitted and never matched: dropped by a queue of the pipeline.
+        int inFlight = 0;
+        float fps = 0.0f; //< Current analytics rate, 0 when not capped.
+        float latencyMs = 0.0f; //< Moving average of the end-to-end latency.
+        bool overloaded = false; //< The rate is below the target because of the load.
+    };
+
+    explicit AdmissionController(Params params);
+
+    /** Reads the admission settings of the ini. */
+    static Params paramsFromIni();
+
+    Decision admit(int64_t timestampUs);
+    /** The admitted frame of `timestampUs` is entering the pipeline; called before pushing it. */
+    void submitted(int64_t timestampUs);
+    /** The admitted frame of `timestampUs` did not enter the pipeline after all. */
+    void notSubmitted(int64_t timestampUs);
+    /** The frame of `timestampUs` came out of the pipeline. */
+    void completed(int64_t timestampUs);
+    /** Forgets the frames in flight, which will not come out: their pipeline was replaced, not overloaded. */
+    void abandonInFlight();
+
+    Counters counters() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void expireLocked(Clock::time_point now);
+    void adjustLocked(Clock::time_point now);
+
+private:
+    const Params m_params;
+
+    mutable std::mutex m_mutex;
+    std::map<int64_t, Clock::time_point> m_inFlight; //< Submission time by camera timestamp.
+    Counters m_counters;
+    double m_credit = 1.0; //< Frames the token bucket may admit, at most 2.
+    int64_t m_lastTimestampUs = -1;
+    bool m_hasLatency = false;
+    uint64_t m_lostAtAdjust = 0;
+    Clock::time_point m_lastAdjust = Clock::now();
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,103 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/**
+ * Bounded lock-free FIFO with any number of producers and a single consumer (D. Vyukov's bounded
+ * queue): each cell carries a sequence number telling whether it is free for the producer claiming
+ * its position or filled for the consumer, so neither side ever waits for the other.
+ */
+template<typename T>
+class BoundedMpscQueue
+{
+public:
+    /** @param capacity Rounded up to a power of two. */
+    explicit BoundedMpscQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        m_mask = size - 1;
+        m_cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedMpscQueue(const BoundedMpscQueue&) = delete;
+    BoundedMpscQueue& operator=(const BoundedMpscQueue&) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+
+    /** Moves `value` in, or leaves it to the caller and returns false if the queue is full. */
+    bool tryPush(T& value)
+    {
+        size_t position = m_tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true)
+        {
+            cell = &m_cells[position & m_mask];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0)
+            {
+                if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer only. */
+    bool tryPop(T& value)
+    {
+        Cell& cell = m_cells[m_head & m_mask];
+        if (cell.sequence.load(std::memory_order_acquire) != m_head + 1)
+            return false;
+        value = std::move(cell.value);
+        cell.sequence.store(m_head + m_mask + 1, std::memory_order_release);
+        ++m_head;
+        return true;
+    }
+
+    /** Consumer only. */
+    bool empty() const
+    {
+        return m_cells[m_head & m_mask].sequence.load(std::memory_order_acquire) != m_head + 1;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence{0};
+        T value{};
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask = 0;
+    alignas(64) std::atomic<size_t> m_tail{0}; //< Next position to claim, shared by the producers.
+    alignas(64) size_t m_head = 0; //< Next position to take, owned by the consumer.
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
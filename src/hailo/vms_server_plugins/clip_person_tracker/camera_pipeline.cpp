@@ -0,0 +1,382 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "camera_pipeline.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "gstreamer_pipeline.hpp"
+#include "hailo_clip_plugin_ini.h"
+#include "pipeline_builder.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+namespace {
+
+double elapsedMs(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+std::atomic<int> pipelineCount{0};
+
+} // namespace
+
+void initGstreamer()
+{
+    static std::once_flag initialized;
+    std::call_once(initialized, []() { gst_init(nullptr, nullptr); });
+}
+
+CameraPipeline::CameraPipeline(std::filesystem::path pluginHomeDir, const DevicePlacement& placement):
+    m_pluginHomeDir(std::move(pluginHomeDir)),
+    m_id(pipelineCount++),
+    m_placement(placement),
+    m_config(PipelineConfig::load(m_pluginHomeDir)),
+    m_created(std::chrono::steady_clock::now())
+{
+    m_context = g_main_context_new();
+    m_mainLoop = g_main_loop_new(m_context, FALSE);
+    m_thread = std::make_unique<std::thread>(&CameraPipeline::run, this);
+}
+
+CameraPipeline::~CameraPipeline()
+{
+    stop(std::chrono::milliseconds(std::max(ini().pipelineEosTimeoutMs, 0)));
+    g_main_loop_unref(m_mainLoop);
+    g_main_context_unref(m_context);
+}
+
+void CameraPipeline::waitStarted()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_changed.wait(lock, [this]() { return m_started; });
+}
+
+void CameraPipeline::attach(GStreamerObjectDetector* detector, std::unique_ptr<LatencyTracer> latencyTracer)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_detector = detector;
+    m_latencyTracer = std::move(latencyTracer);
+    // Otherwise attached by the thread once the pipeline is built
+    if (m_latencyTracer && m_pipeline != nullptr)
+        m_latencyTracer->attach(m_pipeline, "hailo_tracker");
+}
+
+void CameraPipeline::detach()
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_detector = nullptr;
+}
+
+bool CameraPipeline::push(GstBuffer* buffer, GstCaps* caps, uint64_t capsGeneration)
+{
+    if (!m_running)
+        return false;
+    // First frame or new camera resolution: appsrc sends the new caps downstream before this buffer
+    if (capsGeneration != m_capsGeneration)
+    {
+        m_capsGeneration = capsGeneration;
+        g_object_set(G_OBJECT(m_appsrc), "caps", caps, NULL);
+    }
+    if (m_latencyTracer)
+        m_latencyTracer->markPushed(buffer);
+    GstFlowReturn ret;
+    g_signal_emit_by_name(m_appsrc, "push-buffer", buffer, &ret);
+    if (ret != GST_FLOW_OK)
+    {
+        std::cout << "Camera pipeline ID: " << m_id << " error pushing buffer" << std::endl;
+        return false;
+    }
+    ++m_pushedFrames;
+    return true;
+}
+
+void CameraPipeline::stop(std::chrono::milliseconds eosTimeout)
+{
+    if (!m_thread)
+        return;
+    const auto start = std::chrono::steady_clock::now();
+    // A pipeline that never got a frame has nothing to flush
+    bool eos = true;
+    if (m_running && m_pushedFrames > 0)
+    {
+        GstFlowReturn ret;
+        g_signal_emit_by_name(m_appsrc, "end-of-stream", &ret);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        eos = m_changed.wait_for(lock, eosTimeout, [this]() { return m_eos; });
+    }
+    const double eosMs = elapsedMs(start);
+
+    m_running = false;
+    // Run by the loop itself: quits it even if the thread has not reached g_main_loop_run() yet
+    GSource* source = g_idle_source_new();
+    g_source_set_callback(source, &CameraPipeline::quitMainLoop, m_mainLoop, nullptr);
+    g_source_attach(source, m_context);
+    g_source_unref(source);
+    m_thread->join();
+    m_thread.reset();
+    std::cout << "Camera pipeline ID: " << m_id << " stopped in " << elapsedMs(start) << " ms (EOS "
+        << (eos ? "" : "timed out after ") << eosMs << " ms, " << m_pushedFrames << " frames pushed)" << std::endl;
+}
+
+void CameraPipeline::run()
+{
+    initGstreamer();
+    // The bus watch is attached to the context of this thread's loop
+    g_main_context_push_thread_default(m_context);
+
+    const PipelineResources resources = pipelineResources(m_pluginHomeDir);
+    const PipelineDescription description = buildPipeline(m_config, resources, m_placement);
+    const std::string pipelineString = description.toLaunchString();
+    std::cout << "Camera pipeline config ID: " << m_id << "\n" << m_config.dump();
+    std::cout << "Camera pipeline ID: " << m_id << " detection vdevice: " << m_placement.detectionVdeviceGroup
+        << " CLIP vdevice: " << m_placement.clipVdeviceGroup << "\n"
+        << description.dump();
+
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(pipelineString.c_str(), &error);
+    if (error)
+    {
+        std::cout << "Error creating the pipeline ID: " << m_id << " " << error->message << std::endl;
+        g_clear_error(&error);
+    }
+    const double parseMs = elapsedMs(m_created);
+
+    GstBus* bus = nullptr;
+    if (pipeline != nullptr)
+    {
+        bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+        gst_bus_add_watch(bus, &CameraPipeline::onBusMessage, this);
+        m_appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "app_source");
+
+        // The frames out of the pipeline are handed over to the matcher by its appsink
+        GstElement* sink = gst_bin_get_by_name(GST_BIN(pipeline), "clip_matcher_sink");
+        g_signal_connect(sink, "new-sample", G_CALLBACK(&CameraPipeline::onMatcherSample), this);
+        gst_object_unref(sink);
+
+        // Mark the persons that skip CLIP before the cropper, see clip_track_cropper
+        if (ini().trackSkipClipSimilarity > 0)
+        {
+            GstElement* cropper = gst_bin_get_by_name(GST_BIN(pipeline), "cropper");
+            GstPad* cropperSink = gst_element_get_static_pad(cropper, "sink");
+            gst_pad_add_probe(cropperSink, GST_PAD_PROBE_TYPE_BUFFER, &CameraPipeline::onClipCropperProbe, this,
+                nullptr);
+            gst_object_unref(cropperSink);
+            gst_object_unref(cropper);
+        }
+
+        // Without a Hailo device the networks are simulated on their identity handoffs
+        if (resources.standInNetworks)
+        {
+            m_standInInference = std::make_unique<StandInInference>(m_config);
+            m_standInInference->connect(pipeline);
+        }
+
+        {
+            const std::lock_guard<std::mutex> lock(m_mutex);
+            m_pipeline = pipeline;
+            if (m_latencyTracer)
+                m_latencyTracer->attach(m_pipeline, "hailo_tracker");
+        }
+
+        // Loads the networks, then a blank frame is run through them
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+        m_running = preroll(pipeline);
+    }
+    if (!m_running)
+        m_failed = true;
+    std::cout << "Camera pipeline ID: " << m_id << (m_running ? " running" : " failed")
+        << " after " << elapsedMs(m_created) << " ms (parsed in " << parseMs << " ms)" << std::endl;
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_started = true;
+    }
+    m_changed.notify_all();
+
+    // Until stop(); a pipeline that failed to be created gets no frames
+    g_main_loop_run(m_mainLoop);
+
+    m_running = false;
+    if (pipeline != nullptr)
+    {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_bus_remove_watch(bus);
+        gst_object_unref(bus);
+        gst_object_unref(m_appsrc);
+        m_appsrc = nullptr;
+        {
+            const std::lock_guard<std::mutex> lock(m_mutex);
+            m_pipeline = nullptr;
+        }
+        gst_object_unref(pipeline);
+    }
+    m_standInInference.reset();
+    g_main_context_pop_thread_default(m_context);
+}
+
+bool CameraPipeline::preroll(GstElement* pipeline)
+{
+    const int timeoutMs = ini().pipelinePrerollTimeoutMs;
+    if (timeoutMs <= 0)
+    {
+        // The networks then warm up on the first frame of the camera
+        if (gst_element_get_state(pipeline, nullptr, nullptr, GST_SECOND) != GST_STATE_CHANGE_FAILURE)
+            return true;
+        std::cout << "Error running the pipeline ID: " << m_id << std::endl;
+        return false;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const auto deadline = start + std::chrono::milliseconds(timeoutMs);
+    if (gst_element_get_state(pipeline, nullptr, nullptr, GST_SECOND) == GST_STATE_CHANGE_FAILURE)
+    {
+        std::cout << "Error running the pipeline ID: " << m_id << std::endl;
+        return false;
+    }
+
+    // Even sizes, as for the frames of the cameras (see FrameIngest), and rows padded to 4 bytes
+    const int width = std::max(ini().maxInputWidth, 2) & ~1;
+    const int height = std::max(ini().maxInputHeight, 2) & ~1;
+    GstCaps* caps = gst_caps_new_simple("video/x-raw",
+        "format", G_TYPE_STRING, "RGB",
+        "width", G_TYPE_INT, width,
+        "height", G_TYPE_INT, height,
+        NULL);
+    g_object_set(G_OBJECT(m_appsrc), "caps", caps, NULL);
+    gst_caps_unref(caps);
+    const gsize size = static_cast<gsize>(GST_ROUND_UP_4(width * 3)) * height;
+    GstBuffer* buffer = gst_buffer_new_allocate(nullptr, size, nullptr);
+    gst_buffer_memset(buffer, 0, 0, size);
+    GST_BUFFER_PTS(buffer) = 0;
+    GST_BUFFER_DTS(buffer) = 0;
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_prerollSamples = 1;
+    }
+    GstFlowReturn ret;
+    g_signal_emit_by_name(m_appsrc, "push-buffer", buffer, &ret);
+    gst_buffer_unref(buffer);
+    if (ret != GST_FLOW_OK)
+    {
+        std::cout << "Camera pipeline ID: " << m_id << " error pushing the preroll frame" << std::endl;
+        return false;
+    }
+
+    // The appsink does not hold the state change (async=false): the frame is through both networks
+    // once its sample is out. The loop is not running yet, the bus is dispatched here so that an
+    // error ends the wait.
+    bool prerolled = false;
+    bool broken = false;
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        while (g_main_context_iteration(m_context, FALSE))
+        {
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        const auto slice = std::min(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(10));
+        m_changed.wait_until(lock, slice, [this]() { return m_prerollSamples == 0 || m_eos; });
+        prerolled = m_prerollSamples == 0;
+        broken = m_eos;
+        if (prerolled || broken)
+            break;
+    }
+    if (prerolled && !broken)
+    {
+        std::cout << "Camera pipeline ID: " << m_id << " prerolled in " << elapsedMs(start) << " ms" << std::endl;
+        return true;
+    }
+    if (broken)
+        std::cout << "Camera pipeline ID: " << m_id << " broke while prerolling" << std::endl;
+    else
+        std::cout << "Camera pipeline ID: " << m_id << " not prerolled after " << timeoutMs << " ms" << std::endl;
+    return false;
+}
+
+// Called on the streaming thread by the appsink at the end of the pipeline
+GstFlowReturn CameraPipeline::onMatcherSample(GstElement* sink, gpointer data)
+{
+    CameraPipeline* pipeline = static_cast<CameraPipeline*>(data);
+    GstSample* sample = nullptr;
+    g_signal_emit_by_name(sink, "pull-sample", &sample);
+    if (sample == nullptr)
+        return GST_FLOW_OK;
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    {
+        const std::lock_guard<std::mutex> lock(pipeline->m_mutex);
+        // The preroll frame is the first out, and no frame of the camera
+        if (pipeline->m_prerollSamples > 0)
+        {
+            if (--pipeline->m_prerollSamples == 0)
+                pipeline->m_changed.notify_all();
+        }
+        else if (pipeline->m_detector != nullptr && buffer != nullptr)
+            pipeline->m_detector->handOffToMatcher(buffer, pipeline->m_latencyTracer.get());
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+GstPadProbeReturn CameraPipeline::onClipCropperProbe(GstPad* pad, GstPadProbeInfo* info, gpointer data)
+{
+    CameraPipeline* pipeline = static_cast<CameraPipeline*>(data);
+    const std::lock_guard<std::mutex> lock(pipeline->m_mutex);
+    if (pipeline->m_detector == nullptr)
+        return GST_PAD_PROBE_OK;
+    return GStreamerObjectDetector::on_clip_cropper_probe(pad, info, pipeline->m_detector);
+}
+
+gboolean CameraPipeline::onBusMessage(GstBus* /*bus*/, GstMessage* message, gpointer data)
+{
+    CameraPipeline* pipeline = static_cast<CameraPipeline*>(data);
+    switch (GST_MESSAGE_TYPE(message))
+    {
+        case GST_MESSAGE_ERROR:
+        {
+            GError* error = nullptr;
+            gchar* debugInfo = nullptr;
+            gst_message_parse_error(message, &error, &debugInfo);
+            std::cout << "Camera pipeline ID: " << pipeline->m_id << " error from "
+                << GST_OBJECT_NAME(message->src) << ": " << error->message << " ("
+                << (debugInfo ? debugInfo : "no debug info") << ")" << std::endl;
+            g_clear_error(&error);
+            g_free(debugInfo);
+            // The EOS of a broken pipeline may never come, stopping it does not wait for it
+            pipeline->m_failed = true;
+            {
+                const std::lock_guard<std::mutex> lock(pipeline->m_mutex);
+                pipeline->m_eos = true;
+            }
+            pipeline->m_changed.notify_all();
+            break;
+        }
+        case GST_MESSAGE_EOS:
+        {
+            std::cout << "Camera pipeline ID: " << pipeline->m_id << " End-Of-Stream reached" << std::endl;
+            {
+                const std::lock_guard<std::mutex> lock(pipeline->m_mutex);
+                pipeline->m_eos = true;
+            }
+            pipeline->m_changed.notify_all();
+            break;
+        }
+        case GST_MESSAGE_QOS:
+            std::cout << "Camera pipeline ID: " << pipeline->m_id << " QOS message from "
+                << GST_OBJECT_NAME(message->src) << std::endl;
+            break;
+        default:
+            break;
+    }
+    return TRUE;
+}
+
+gboolean CameraPipeline::quitMainLoop(gpointer data)
+{
+    g_main_loop_quit(static_cast<GMainLoop*>(data));
+    return G_SOURCE_REMOVE;
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,135 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <gst/gst.h>
+
+#include "latency_tracer.h"
+#include "pipeline_config.h"
+#include "stand_in_inference.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+class GStreamerObjectDetector;
+
+/** gst_init() of the plugin, done once by the first pipeline to start. */
+void initGstreamer();
+
+/**
+ * Pipeline of a camera of its own (see buildPipeline()), built and run on a thread of its own, with
+ * its own main context. It starts before knowing its camera, so that the PipelinePool can have it
+ * ready in advance: the results go to the GStreamerObjectDetector attached to it, if any.
+ *
+ * Starting it sets it to PLAYING, then prerolls it on a blank frame of maxInputWidth x
+ * maxInputHeight: once it is started, its networks are loaded, its caps negotiated and the frame
+ * went through the detection network, so the first frame of its camera gets no start-up delay. The
+ * CLIP network gets no crop of a blank frame, it is only loaded.
+ *
+ * Stopping is bounded: the last frames are given eosTimeout to come out, then the pipeline is set to
+ * NULL whether they did or not.
+ */
+class CameraPipeline
+{
+public:
+    /**
+     * Starts building the pipeline on its thread; frames pushed before it runs are dropped.
+     *
+     * @param placement vdevice groups of the networks, see DeviceScheduler.
+     */
+    CameraPipeline(std::filesystem::path pluginHomeDir, const DevicePlacement& placement);
+    /** Stops the pipeline (see stop()) with the timeout of the ini. */
+    ~CameraPipeline();
+
+    CameraPipeline(const CameraPipeline&) = delete;
+    CameraPipeline& operator=(const CameraPipeline&) = delete;
+
+    int id() const { return m_id; }
+    const DevicePlacement& placement() const { return m_placement; }
+
+    /** Waits for the thread to be done starting the pipeline, successfully or not. */
+    void waitStarted();
+
+    /** Started successfully and not stopped since: the appsrc accepts frames. */
+    bool running() const { return m_running; }
+
+    /** Could not be started, or reported an error since: no more results will come out of it. */
+    bool failed() const { return m_failed; }
+
+    /**
+     * Hands the results to `detector` from now on.
+     *
+     * @param latencyTracer Follows the frames of the pipeline until it is stopped; null if disabled.
+     */
+    void attach(GStreamerObjectDetector* detector, std::unique_ptr<LatencyTracer> latencyTracer);
+
+    /**
+     * Waits for the results being handed to the detector, which gets no more of them once this
+     * returns.
+     */
+    void detach();
+
+    /**
+     * Pushes a buffer to the appsrc, after setting `caps` on it if `capsGeneration` changed since
+     * the last push.
+     *
+     * @return False if the frame was dropped. The caller keeps its ref to the buffer either way.
+     */
+    bool push(GstBuffer* buffer, GstCaps* caps, uint64_t capsGeneration);
+
+    /**
+     * Sends EOS if frames were pushed and waits up to `eosTimeout` for it to come out, then stops
+     * the pipeline and its thread. Does nothing the second time.
+     */
+    void stop(std::chrono::milliseconds eosTimeout);
+
+private:
+    void run();
+    /** Called by the thread on the pipeline set to PLAYING; false if it did not get there. */
+    bool preroll(GstElement* pipeline);
+    static GstFlowReturn onMatcherSample(GstElement* sink, gpointer data);
+    static GstPadProbeReturn onClipCropperProbe(GstPad* pad, GstPadProbeInfo* info, gpointer data);
+    static gboolean onBusMessage(GstBus* bus, GstMessage* message, gpointer data);
+    static gboolean quitMainLoop(gpointer data);
+
+private:
+    const std::filesystem::path m_pluginHomeDir;
+    const int m_id; //< In the logs: the pipelines start before their camera is known.
+    const DevicePlacement m_placement;
+    const PipelineConfig m_config;
+    const std::chrono::steady_clock::time_point m_created;
+
+    std::mutex m_mutex; //< Guards the fields below; held while results are handed to the detector.
+    std::condition_variable m_changed;
+    GStreamerObjectDetector* m_detector = nullptr;
+    std::unique_ptr<LatencyTracer> m_latencyTracer; //< Attached to the pipeline once it is built.
+    GstElement* m_pipeline = nullptr; //< Set by the thread once built, until it is stopped.
+    bool m_started = false; //< The thread is done starting the pipeline.
+    bool m_eos = false; //< EOS, or an error, reached the bus.
+    int m_prerollSamples = 0; //< Samples of the preroll frame the appsink is still to drop; preroll() waits for 0.
+
+    std::unique_ptr<std::thread> m_thread; //< Null once stopped.
+    std::atomic<bool> m_running{false}; //< The appsrc accepts frames.
+    std::atomic<bool> m_failed{false};
+    std::atomic<uint64_t> m_pushedFrames{0};
+    uint64_t m_capsGeneration = 0; //< Caps last set on the appsrc, used only by push().
+
+    // Owned by the pipeline thread, the appsrc is used by push() and stop() once m_running is set
+    GMainContext* m_context = nullptr;
+    GMainLoop* m_mainLoop = nullptr;
+    GstElement* m_appsrc = nullptr;
+    std::unique_ptr<StandInInference> m_standInInference; //< Null with a Hailo device.
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,280 @@
+#include "clip_text_encoder.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "similarity_kernel.hpp"
+
+namespace clip_matcher {
+
+namespace {
+
+constexpr float kLayerNormEpsilon = 1e-5f;
+
+size_t align_offset(size_t offset) {
+    return (offset + kClipTextEncoderAlignment - 1) / kClipTextEncoderAlignment * kClipTextEncoderAlignment;
+}
+
+void layer_norm(const float* x, size_t width, const float* weight, const float* bias, float* out) {
+    float mean = 0.0f;
+    for (size_t k = 0; k < width; ++k) {
+        mean += x[k];
+    }
+    mean /= static_cast<float>(width);
+    float variance = 0.0f;
+    for (size_t k = 0; k < width; ++k) {
+        variance += (x[k] - mean) * (x[k] - mean);
+    }
+    variance /= static_cast<float>(width);
+    const float scale = 1.0f / std::sqrt(variance + kLayerNormEpsilon);
+    for (size_t k = 0; k < width; ++k) {
+        out[k] = (x[k] - mean) * scale * weight[k] + bias[k];
+    }
+}
+
+// out[t][o] = dot(x[t], weight[o]) + bias[o] for a PyTorch (out_dim, in_dim) weight.
+void linear(const float* x, size_t count, size_t in_dim, const float* weight, const float* bias,
+            size_t out_dim, float* out) {
+    dot_products(x, count, in_dim, weight, out_dim, in_dim, in_dim, out);
+    for (size_t t = 0; t < count; ++t) {
+        for (size_t o = 0; o < out_dim; ++o) {
+            out[t * out_dim + o] += bias[o];
+        }
+    }
+}
+
+// Causal multi-head self-attention over `count` tokens of packed q, k, v rows (3 width each).
+void causal_attention(const float* qkv, size_t count, size_t width, size_t heads,
+                      std::vector<float>& scores, float* out) {
+    const size_t head_dim = width / heads;
+    const size_t qkv_stride = 3 * width;
+    const float scale = 1.0f / std::sqrt(static_cast<float>(head_dim));
+    scores.resize(count * count);
+    std::fill(out, out + count * width, 0.0f);
+    for (size_t h = 0; h < heads; ++h) {
+        const float* q = qkv + h * head_dim;
+        const float* k = qkv + width + h * head_dim;
+        const float* v = qkv + 2 * width + h * head_dim;
+        dot_products(q, count, qkv_stride, k, count, qkv_stride, head_dim, scores.data());
+        for (size_t i = 0; i < count; ++i) {
+            float* row = scores.data() + i * count;
+            float max_score = -std::numeric_limits<float>::infinity();
+            for (size_t j = 0; j <= i; ++j) {
+                row[j] *= scale;
+                max_score = std::max(max_score, row[j]);
+            }
+            float sum = 0.0f;
+            for (size_t j = 0; j <= i; ++j) {
+                row[j] = std::exp(row[j] - max_score);
+                sum += row[j];
+            }
+            float* head_out = out + i * width + h * head_dim;
+            for (size_t j = 0; j <= i; ++j) {
+                const float weight = row[j] / sum;
+                const float* v_row = v + j * qkv_stride;
+                for (size_t d = 0; d < head_dim; ++d) {
+                    head_out[d] += weight * v_row[d];
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+std::shared_ptr<const ClipTextEncoder> ClipTextEncoder::open(const std::string& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("CLIP text encoder: cannot open " + path);
+    struct stat file_stat = {};
+    if (::fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(sizeof(ClipTextEncoderHeader))) {
+        ::close(fd);
+        throw std::runtime_error("CLIP text encoder: " + path + " is too small");
+    }
+    const size_t size = static_cast<size_t>(file_stat.st_size);
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("CLIP text encoder: cannot map " + path);
+
+    std::shared_ptr<ClipTextEncoder> encoder(new ClipTextEncoder());
+    encoder->m_mapping = mapping;
+    encoder->m_size = size;
+
+    const auto* base = static_cast<const unsigned char*>(mapping);
+    const auto* header = reinterpret_cast<const ClipTextEncoderHeader*>(base);
+    const auto invalid = [&path](const char* reason) {
+        return std::runtime_error("CLIP text encoder: " + path + " is invalid: " + reason);
+    };
+    if (std::memcmp(header->magic, kClipTextEncoderMagic, sizeof(header->magic)) != 0)
+        throw invalid("bad magic");
+    if (header->version != kClipTextEncoderVersion || header->header_size != sizeof(ClipTextEncoderHeader))
+        throw invalid("unsupported version");
+    if (header->file_size != size)
+        throw invalid("truncated file");
+    if (header->width == 0 || header->heads == 0 || header->width % header->heads != 0
+        || header->layers == 0 || header->embed_dim == 0 || header->vocab_size == 0 || header->context_length == 0)
+        throw invalid("bad model dimensions");
+
+    // Lays the tensors out in file order, checking that each fits
+    size_t offset = header->header_size;
+    const auto tensor = [&](size_t rows, size_t columns) {
+        offset = align_offset(offset);
+        const size_t bytes = rows * columns * sizeof(float);
+        if (offset + bytes > size)
+            throw invalid("tensors extend past the end of the file");
+        const auto* data = reinterpret_cast<const float*>(base + offset);
+        offset += bytes;
+        return data;
+    };
+    const size_t width = header->width;
+    encoder->m_token_embedding = tensor(header->vocab_size, width);
+    encoder->m_positional_embedding = tensor(header->context_length, width);
+    for (uint32_t i = 0; i < header->layers; ++i) {
+        Layer layer;
+        layer.ln_1_weight = tensor(1, width);
+        layer.ln_1_bias = tensor(1, width);
+        layer.in_proj_weight = tensor(3 * width, width);
+        layer.in_proj_bias = tensor(1, 3 * width);
+        layer.out_proj_weight = tensor(width, width);
+        layer.out_proj_bias = tensor(1, width);
+        layer.ln_2_weight = tensor(1, width);
+        layer.ln_2_bias = tensor(1, width);
+        layer.fc_weight = tensor(4 * width, width);
+        layer.fc_bias = tensor(1, 4 * width);
+        layer.proj_weight = tensor(width, 4 * width);
+        layer.proj_bias = tensor(1, width);
+        encoder->m_layers.push_back(layer);
+    }
+    encoder->m_ln_final_weight = tensor(1, width);
+    encoder->m_ln_final_bias = tensor(1, width);
+    encoder->m_text_projection = tensor(header->embed_dim, width);
+    encoder->m_header = header;
+    return encoder;
+}
+
+ClipTextEncoder::~ClipTextEncoder() {
+    if (m_mapping != nullptr)
+        ::munmap(m_mapping, m_size);
+}
+
+void ClipTextEncoder::encode_tokens(const std::vector<int>& tokens, float* out) const {
+    encode_batch({tokens}, out);
+}
+
+void ClipTextEncoder::encode_batch(const std::vector<std::vector<int>>& sequences, float* out) const {
+    // The rows of all sequences are stacked, so every weight matrix is streamed once per batch
+    std::vector<size_t> starts;
+    size_t count = 0;
+    for (const std::vector<int>& tokens : sequences) {
+        if (tokens.empty() || tokens.size() > m_header->context_length)
+            throw std::invalid_argument("CLIP text encoder: token sequence of length " + std::to_string(tokens.size()));
+        for (int token : tokens) {
+            if (token < 0 || static_cast<size_t>(token) >= m_header->vocab_size)
+                throw std::invalid_argument("CLIP text encoder: unknown token " + std::to_string(token));
+        }
+        starts.push_back(count);
+        count += tokens.size();
+    }
+    if (count == 0)
+        return;
+    const size_t width = m_header->width;
+
+    std::vector<float> x(count * width);
+    for (size_t s = 0; s < sequences.size(); ++s) {
+        for (size_t t = 0; t < sequences[s].size(); ++t) {
+            const float* token_row = m_token_embedding + static_cast<size_t>(sequences[s][t]) * width;
+            const float* position_row = m_positional_embedding + t * width;
+            float* row = x.data() + (starts[s] + t) * width;
+            for (size_t k = 0; k < width; ++k) {
+                row[k] = token_row[k] + position_row[k];
+            }
+        }
+    }
+
+    std::vector<float> normed(count * width);
+    std::vector<float> qkv(count * 3 * width);
+    std::vector<float> attention(count * width);
+    std::vector<float> hidden(count * 4 * width);
+    std::vector<float> residual(count * width);
+    std::vector<float> scores;
+    for (const Layer& layer : m_layers) {
+        for (size_t t = 0; t < count; ++t) {
+            layer_norm(x.data() + t * width, width, layer.ln_1_weight, layer.ln_1_bias, normed.data() + t * width);
+        }
+        linear(normed.data(), count, width, layer.in_proj_weight, layer.in_proj_bias, 3 * width, qkv.data());
+        for (size_t s = 0; s < sequences.size(); ++s) {
+            causal_attention(qkv.data() + starts[s] * 3 * width, sequences[s].size(), width, m_header->heads,
+                             scores, attention.data() + starts[s] * width);
+        }
+        linear(attention.data(), count, width, layer.out_proj_weight, layer.out_proj_bias, width, residual.data());
+        for (size_t i = 0; i < x.size(); ++i) {
+            x[i] += residual[i];
+        }
+
+        for (size_t t = 0; t < count; ++t) {
+            layer_norm(x.data() + t * width, width, layer.ln_2_weight, layer.ln_2_bias, normed.data() + t * width);
+        }
+        linear(normed.data(), count, width, layer.fc_weight, layer.fc_bias, 4 * width, hidden.data());
+        for (float& value : hidden) {
+            value = value / (1.0f + std::exp(-1.702f * value)); // QuickGELU
+        }
+        linear(hidden.data(), count, 4 * width, layer.proj_weight, layer.proj_bias, width, residual.data());
+        for (size_t i = 0; i < x.size(); ++i) {
+            x[i] += residual[i];
+        }
+    }
+
+    const size_t embed_dim = m_header->embed_dim;
+    std::vector<float> features(width);
+    for (size_t s = 0; s < sequences.size(); ++s) {
+        // CLIP takes the features at the highest token id, the end of text token
+        const std::vector<int>& tokens = sequences[s];
+        const size_t end = starts[s] + static_cast<size_t>(std::max_element(tokens.begin(), tokens.end()) - tokens.begin());
+        float* embedding = out + s * embed_dim;
+        layer_norm(x.data() + end * width, width, m_ln_final_weight, m_ln_final_bias, features.data());
+        dot_products(features.data(), 1, width, m_text_projection, embed_dim, width, width, embedding);
+
+        float sum_squares = 0.0f;
+        for (size_t k = 0; k < embed_dim; ++k) {
+            sum_squares += embedding[k] * embedding[k];
+        }
+        const float scale = sum_squares > 0.0f ? 1.0f / std::sqrt(sum_squares) : 0.0f;
+        for (size_t k = 0; k < embed_dim; ++k) {
+            embedding[k] *= scale;
+        }
+    }
+}
+
+std::shared_ptr<const ClipTextModel> ClipTextModel::load(const std::string& merges_path, const std::string& weights_path) {
+    auto model = std::make_shared<ClipTextModel>();
+    model->m_tokenizer = ClipTokenizer::load(merges_path);
+    model->m_encoder = ClipTextEncoder::open(weights_path);
+    if (model->m_tokenizer->vocab_size() != model->m_encoder->vocab_size())
+        throw std::runtime_error("CLIP text encoder: " + weights_path + " has a vocabulary of "
+                                 + std::to_string(model->m_encoder->vocab_size()) + " tokens, the tokenizer "
+                                 + std::to_string(model->m_tokenizer->vocab_size()));
+    return model;
+}
+
+void ClipTextModel::encode(const std::string& text, float* out) const {
+    m_encoder->encode_tokens(m_tokenizer->encode(text, m_encoder->context_length()), out);
+}
+
+void ClipTextModel::encode_batch(const std::vector<std::string>& texts, float* out) const {
+    std::vector<std::vector<int>> sequences;
+    for (const std::string& text : texts) {
+        sequences.push_back(m_tokenizer->encode(text, m_encoder->context_length()));
+    }
+    m_encoder->encode_batch(sequences, out);
+}
+
+} // namespace clip_matcher
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "clip_tokenizer.hpp"
+
+// CPU implementation of the CLIP text tower, so that prompts are encoded inside the plugin instead
+// of by the text_image_matcher tool.
+//
+// Weights are read from a file written by resources/export_clip_text_encoder.py (little-endian):
+//     ClipTextEncoderHeader
+//     float32 tensors, each 64-byte aligned, in this order:
+//         token_embedding         vocab_size x width
+//         positional_embedding    context_length x width
+//         for every layer:
+//             ln_1 weight, bias                       width
+//             attn in_proj weight, bias               3 width x width, 3 width
+//             attn out_proj weight, bias              width x width, width
+//             ln_2 weight, bias                       width
+//             mlp c_fc weight, bias                   4 width x width, 4 width
+//             mlp c_proj weight, bias                 width x 4 width, width
+//         ln_final weight, bias                       width
+//         text_projection, transposed                 embed_dim x width
+// Linear weights keep PyTorch's (out, in) layout, so every projection is a batch of dot products.
+//
+// The file is mapped read-only and stays mapped for the life of the encoder: only the rows of the
+// token embedding of the tokens in use are paged in. Attention is causal, so the features at the
+// end of text token only depend on the tokens before it and only the prompt's own tokens are run,
+// not the whole 77-token context.
+
+namespace clip_matcher {
+
+struct ClipTextEncoderHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t vocab_size;
+    uint32_t context_length;
+    uint32_t width;
+    uint32_t heads;
+    uint32_t layers;
+    uint32_t embed_dim;
+    uint64_t file_size;
+    uint8_t reserved[16];
+};
+
+constexpr char kClipTextEncoderMagic[8] = {'H', 'C', 'L', 'I', 'P', 'T', 'X', 'T'};
+constexpr uint32_t kClipTextEncoderVersion = 1;
+constexpr size_t kClipTextEncoderAlignment = 64;
+
+class ClipTextEncoder {
+public:
+    // Throws std::runtime_error if the file cannot be mapped or is not a valid weight file.
+    static std::shared_ptr<const ClipTextEncoder> open(const std::string& path);
+
+    ~ClipTextEncoder();
+    ClipTextEncoder(const ClipTextEncoder&) = delete;
+    ClipTextEncoder& operator=(const ClipTextEncoder&) = delete;
+
+    size_t embed_dim() const { return m_header->embed_dim; }
+    size_t context_length() const { return m_header->context_length; }
+    size_t vocab_size() const { return m_header->vocab_size; }
+
+    // Writes the normalized embedding (embed_dim() floats) of `tokens` to `out`. `tokens` is a
+    // sequence as returned by ClipTokenizer::encode(): the features of its highest token (the end of
+    // text token) are projected. Thread-safe, every call uses its own scratch buffers. Throws
+    // std::invalid_argument for an empty sequence, a sequence longer than the context or an unknown
+    // token.
+    void encode_tokens(const std::vector<int>& tokens, float* out) const;
+
+    // encode_tokens() of several sequences into consecutive rows of `out`, run as one batch so that
+    // the weights are read once for all of them.
+    void encode_batch(const std::vector<std::vector<int>>& sequences, float* out) const;
+
+private:
+    struct Layer {
+        const float* ln_1_weight;
+        const float* ln_1_bias;
+        const float* in_proj_weight;
+        const float* in_proj_bias;
+        const float* out_proj_weight;
+        const float* out_proj_bias;
+        const float* ln_2_weight;
+        const float* ln_2_bias;
+        const float* fc_weight;
+        const float* fc_bias;
+        const float* proj_weight;
+        const float* proj_bias;
+    };
+
+    ClipTextEncoder() = default;
+
+    void* m_mapping = nullptr;
+    size_t m_size = 0;
+    const ClipTextEncoderHeader* m_header = nullptr;
+    const float* m_token_embedding = nullptr;
+    const float* m_positional_embedding = nullptr;
+    std::vector<Layer> m_layers;
+    const float* m_ln_final_weight = nullptr;
+    const float* m_ln_final_bias = nullptr;
+    const float* m_text_projection = nullptr;
+};
+
+// Tokenizer and text tower of one CLIP model, loaded once and shared by every camera.
+class ClipTextModel {
+public:
+    // Throws std::runtime_error if either file cannot be loaded or they do not belong together.
+    static std::shared_ptr<const ClipTextModel> load(const std::string& merges_path, const std::string& weights_path);
+
+    size_t embed_dim() const { return m_encoder->embed_dim(); }
+
+    // Normalized embedding of `text` (embed_dim() floats) into `out`. Thread-safe.
+    void encode(const std::string& text, float* out) const;
+    // Embeddings of `texts` into consecutive rows of `out`, encoded as one batch.
+    void encode_batch(const std::vector<std::string>& texts, float* out) const;
+
+private:
+    std::unique_ptr<const ClipTokenizer> m_tokenizer;
+    std::shared_ptr<const ClipTextEncoder> m_encoder;
+};
+
+} // namespace clip_matcher
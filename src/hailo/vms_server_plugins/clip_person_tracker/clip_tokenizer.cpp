@@ -0,0 +1,228 @@
+#include "clip_tokenizer.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <stdexcept>
+
+namespace clip_matcher {
+
+namespace {
+
+// Merges used by CLIP: the vocabulary is 256 bytes, 256 end-of-word bytes, these merges and the two
+// special tokens, 49408 tokens in all.
+constexpr size_t kMergeCount = 49152 - 256 - 2;
+constexpr const char* kStartOfText = "<|startoftext|>";
+constexpr const char* kEndOfText = "<|endoftext|>";
+constexpr const char* kEndOfWord = "</w>";
+
+std::string utf8(int code_point) {
+    std::string result;
+    if (code_point < 0x80) {
+        result += static_cast<char>(code_point);
+    } else if (code_point < 0x800) {
+        result += static_cast<char>(0xC0 | (code_point >> 6));
+        result += static_cast<char>(0x80 | (code_point & 0x3F));
+    } else {
+        result += static_cast<char>(0xE0 | (code_point >> 12));
+        result += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        result += static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+    return result;
+}
+
+// Length of the UTF-8 sequence starting with `lead`, 1 for invalid bytes.
+size_t utf8_length(unsigned char lead) {
+    if (lead >= 0xF0 && lead < 0xF8)
+        return 4;
+    if (lead >= 0xE0)
+        return lead < 0xF0 ? 3 : 1;
+    if (lead >= 0xC0)
+        return 2;
+    return 1;
+}
+
+bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+bool is_letter(char c) {
+    const auto byte = static_cast<unsigned char>(c);
+    return byte >= 0x80 || (byte >= 'a' && byte <= 'z') || (byte >= 'A' && byte <= 'Z');
+}
+
+bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Collapses whitespace runs into one space, trims and lower-cases ASCII.
+std::string clean_text(const std::string& text) {
+    std::string result;
+    for (char c : text) {
+        if (is_space(c)) {
+            if (!result.empty() && result.back() != ' ')
+                result += ' ';
+        } else {
+            result += (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+    }
+    if (!result.empty() && result.back() == ' ')
+        result.pop_back();
+    return result;
+}
+
+bool starts_with(const std::string& text, size_t pos, const char* prefix) {
+    return text.compare(pos, std::char_traits<char>::length(prefix), prefix) == 0;
+}
+
+// Splits cleaned text like CLIP's pattern:
+//     <|startoftext|>|<|endoftext|>|'s|'t|'re|'ve|'m|'ll|'d|[\p{L}]+|[\p{N}]|[^\s\p{L}\p{N}]+
+std::vector<std::string> split_words(const std::string& text) {
+    static const char* const kSpecial[] = {kStartOfText, kEndOfText};
+    static const char* const kContractions[] = {"'s", "'t", "'re", "'ve", "'m", "'ll", "'d"};
+    std::vector<std::string> words;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        if (is_space(text[pos])) {
+            ++pos;
+            continue;
+        }
+        size_t end = pos;
+        for (const char* token : kSpecial) {
+            if (end == pos && starts_with(text, pos, token))
+                end = pos + std::char_traits<char>::length(token);
+        }
+        for (const char* token : kContractions) {
+            if (end == pos && starts_with(text, pos, token))
+                end = pos + std::char_traits<char>::length(token);
+        }
+        if (end == pos && is_letter(text[pos])) {
+            while (end < text.size() && is_letter(text[end]))
+                end += utf8_length(static_cast<unsigned char>(text[end]));
+        } else if (end == pos && is_digit(text[pos])) {
+            end = pos + 1;
+        } else if (end == pos) {
+            while (end < text.size() && !is_space(text[end]) && !is_letter(text[end]) && !is_digit(text[end]))
+                ++end;
+        }
+        end = std::min(end, text.size());
+        words.push_back(text.substr(pos, end - pos));
+        pos = end;
+    }
+    return words;
+}
+
+} // namespace
+
+std::unique_ptr<const ClipTokenizer> ClipTokenizer::load(const std::string& merges_path) {
+    std::ifstream file(merges_path);
+    if (!file)
+        throw std::runtime_error("CLIP tokenizer: cannot open " + merges_path);
+
+    std::unique_ptr<ClipTokenizer> tokenizer(new ClipTokenizer());
+
+    // Printable bytes stand for themselves, the others are shifted past 255 (bytes_to_unicode())
+    std::vector<int> bytes;
+    for (int b = '!'; b <= '~'; ++b)
+        bytes.push_back(b);
+    for (int b = 0xA1; b <= 0xAC; ++b)
+        bytes.push_back(b);
+    for (int b = 0xAE; b <= 0xFF; ++b)
+        bytes.push_back(b);
+    std::vector<int> code_points = bytes;
+    int shifted = 0;
+    for (int b = 0; b < 256; ++b) {
+        bool printable = false;
+        for (int printable_byte : bytes) {
+            printable = printable || printable_byte == b;
+        }
+        if (!printable) {
+            bytes.push_back(b);
+            code_points.push_back(256 + shifted++);
+        }
+    }
+    std::vector<std::string> vocab;
+    for (size_t i = 0; i < 256; ++i) {
+        tokenizer->m_byte_encoder[bytes[i]] = utf8(code_points[i]);
+        vocab.push_back(utf8(code_points[i]));
+    }
+    for (size_t i = 0; i < 256; ++i) {
+        vocab.push_back(vocab[i] + kEndOfWord);
+    }
+
+    std::string line;
+    std::getline(file, line); // version header
+    while (tokenizer->m_merge_ranks.size() < kMergeCount && std::getline(file, line)) {
+        const size_t space = line.find(' ');
+        if (space == std::string::npos)
+            continue;
+        tokenizer->m_merge_ranks.emplace(line, static_cast<int>(tokenizer->m_merge_ranks.size()));
+        vocab.push_back(line.substr(0, space) + line.substr(space + 1));
+    }
+    if (tokenizer->m_merge_ranks.size() != kMergeCount)
+        throw std::runtime_error("CLIP tokenizer: " + merges_path + " holds too few merges");
+    vocab.push_back(kStartOfText);
+    vocab.push_back(kEndOfText);
+
+    for (size_t i = 0; i < vocab.size(); ++i) {
+        tokenizer->m_encoder.emplace(vocab[i], static_cast<int>(i));
+    }
+    tokenizer->m_start_token = tokenizer->m_encoder.at(kStartOfText);
+    tokenizer->m_end_token = tokenizer->m_encoder.at(kEndOfText);
+    return tokenizer;
+}
+
+void ClipTokenizer::encode_word(const std::string& word, std::vector<int>& tokens) const {
+    if (word == kStartOfText || word == kEndOfText) {
+        tokens.push_back(m_encoder.at(word));
+        return;
+    }
+    std::vector<std::string> symbols;
+    for (char c : word) {
+        symbols.push_back(m_byte_encoder[static_cast<unsigned char>(c)]);
+    }
+    if (symbols.empty())
+        return;
+    symbols.back() += kEndOfWord;
+
+    // Merge the pair of lowest rank everywhere it occurs until no known pair is left
+    while (symbols.size() > 1) {
+        int best_rank = INT_MAX;
+        std::string best_pair;
+        for (size_t i = 0; i + 1 < symbols.size(); ++i) {
+            const auto rank = m_merge_ranks.find(symbols[i] + ' ' + symbols[i + 1]);
+            if (rank != m_merge_ranks.end() && rank->second < best_rank) {
+                best_rank = rank->second;
+                best_pair = rank->first;
+            }
+        }
+        if (best_rank == INT_MAX)
+            break;
+        std::vector<std::string> merged;
+        for (size_t i = 0; i < symbols.size(); ++i) {
+            if (i + 1 < symbols.size() && symbols[i] + ' ' + symbols[i + 1] == best_pair) {
+                merged.push_back(symbols[i] + symbols[i + 1]);
+                ++i;
+            } else {
+                merged.push_back(symbols[i]);
+            }
+        }
+        symbols.swap(merged);
+    }
+    for (const std::string& symbol : symbols) {
+        tokens.push_back(m_encoder.at(symbol));
+    }
+}
+
+std::vector<int> ClipTokenizer::encode(const std::string& text, size_t context_length) const {
+    std::vector<int> tokens = {m_start_token};
+    for (const std::string& word : split_words(clean_text(text))) {
+        encode_word(word, tokens);
+    }
+    if (context_length >= 2 && tokens.size() > context_length - 1)
+        tokens.resize(context_length - 1);
+    tokens.push_back(m_end_token);
+    return tokens;
+}
+
+} // namespace clip_matcher
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Byte-level BPE tokenizer of CLIP (SimpleTokenizer of the CLIP repository), built from its merges
+// file bpe_simple_vocab_16e6.txt.
+//
+// Text is cleaned like CLIP does it (whitespace collapsed, lower case) but without the ftfy fixes and
+// HTML unescaping, which prompts typed in the settings do not need. Non-ASCII characters count as
+// letters and only ASCII is lower-cased.
+
+namespace clip_matcher {
+
+constexpr size_t kClipContextLength = 77;
+
+class ClipTokenizer {
+public:
+    // Throws std::runtime_error if the merges file cannot be read or is too short.
+    static std::unique_ptr<const ClipTokenizer> load(const std::string& merges_path);
+
+    // Token ids of `text` between the start and end of text tokens, cut to `context_length` tokens
+    // (the end of text token is always kept last).
+    std::vector<int> encode(const std::string& text, size_t context_length = kClipContextLength) const;
+
+    int start_token() const { return m_start_token; }
+    int end_token() const { return m_end_token; }
+    size_t vocab_size() const { return m_encoder.size(); }
+
+private:
+    ClipTokenizer() = default;
+
+    // Appends the ids of the BPE tokens of one pre-tokenized word.
+    void encode_word(const std::string& word, std::vector<int>& tokens) const;
+
+    std::string m_byte_encoder[256]; // UTF-8 of the printable character standing for each byte
+    std::unordered_map<std::string, int> m_encoder;
+    std::unordered_map<std::string, int> m_merge_ranks; // "first second" -> merge priority
+    int m_start_token = 0;
+    int m_end_token = 0;
+};
+
+} // namespace clip_matcher
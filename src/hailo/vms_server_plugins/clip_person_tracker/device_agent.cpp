@@ -2,8 +2,18 @@
 
 #include "device_agent.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
 #include <chrono>
+#include <cstring>
 #include <exception>
+#include <thread>
+
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <nx/sdk/analytics/helpers/event_metadata.h>
 #include <nx/sdk/analytics/helpers/event_metadata_packet.h>
@@ -14,6 +24,7 @@
 #include "detection.h"
 #include "exceptions.h"
 #include "frame.h"
+#include "hailo_clip_plugin_ini.h"
 
 namespace hailo {
 namespace vms_server_plugins {
@@ -24,6 +35,56 @@ using namespace nx::sdk::analytics;
 
 using namespace std::string_literals;
 
+namespace {
+
+// Period at which a running text_image_matcher is checked for the cancellation of its request
+constexpr std::chrono::milliseconds kToolPollPeriod(50);
+
+/**
+ * Runs `args` (the program first, looked up in PATH) without a shell, so that the prompts reach it
+ * as they are. The program is killed as soon as `cancelled` is set: a superseded request or a camera
+ * going away does not wait for the cold start of the tool.
+ *
+ * @return The exit status, -1 if the program could not be started, died of a signal or was killed.
+ */
+int runTool(const std::vector<std::string>& args, const std::atomic<bool>& cancelled)
+{
+    std::vector<char*> argv;
+    for (const std::string& arg: args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    pid_t pid = 0;
+    const int error = posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ);
+    if (error != 0)
+    {
+        std::cout << "Cannot run " << args[0] << ": " << std::strerror(error) << std::endl;
+        return -1;
+    }
+    int status = 0;
+    while (true)
+    {
+        const pid_t done = waitpid(pid, &status, WNOHANG);
+        if (done == pid)
+            break;
+        if (done < 0 && errno != EINTR)
+            return -1;
+        if (cancelled)
+        {
+            kill(pid, SIGKILL);
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            {
+            }
+            std::cout << args[0] << " killed, its request was cancelled" << std::endl;
+            return -1;
+        }
+        std::this_thread::sleep_for(kToolPollPeriod);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+} // namespace
+
 /**
  * @param deviceInfo Various information about the related device, such as its id, vendor, model,
  *     etc.
@@ -31,19 +92,52 @@ using namespace std::string_literals;
 DeviceAgent::DeviceAgent(
     const nx::sdk::IDeviceInfo* deviceInfo,
     std::filesystem::path pluginHomeDir,
-    int DeviceAgentId)
-    : ConsumingDeviceAgent(deviceInfo, /*enableOutput*/ true)
+    int DeviceAgentId,
+    std::shared_ptr<PromptEncoder> promptEncoder,
+    std::shared_ptr<SettingsWorker> settingsWorker,
+    std::shared_ptr<DeviceScheduler> deviceScheduler,
+    std::shared_ptr<SharedPipeline> sharedPipeline,
+    std::shared_ptr<PipelinePool> pipelinePool,
+    std::shared_ptr<MatcherPool> matcherPool)
+    : ConsumingDeviceAgent(deviceInfo, /*enableOutput*/ true),
+    m_admission(AdmissionController::paramsFromIni()),
+    m_promptEncoder(std::move(promptEncoder)),
+    m_settingsWorker(std::move(settingsWorker))
 {
-    
+    const auto start = std::chrono::steady_clock::now();
     std::cout << "DeviceAgentId: " << DeviceAgentId << std::endl;
     // Create m_objectDetector
     m_pluginHomeDir = pluginHomeDir;
     m_DeviceAgentId = DeviceAgentId;
-    m_objectDetector = std::make_unique<GStreamerObjectDetector>(pluginHomeDir, this);
+    m_deviceId = deviceInfo->id();
+    for (char c : m_deviceId)
+    {
+        if (std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_')
+            m_cameraId += c;
+    }
+    if (m_cameraId.empty())
+        m_cameraId = std::to_string(m_DeviceAgentId);
+    m_objectDetector = std::make_unique<GStreamerObjectDetector>(pluginHomeDir, this, std::move(deviceScheduler),
+        std::move(sharedPipeline), std::move(pipelinePool), std::move(matcherPool));
+    std::cout << "DeviceAgent ID: " << m_DeviceAgentId << " created in " << std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+}
+
+std::filesystem::path DeviceAgent::promptEmbeddingPath() const
+{
+    return m_pluginHomeDir / "resources" / ("nx_text_embedding_" + m_cameraId + ".json");
+}
+
+std::filesystem::path DeviceAgent::defaultPromptEmbeddingPath() const
+{
+    return m_pluginHomeDir / "resources" / "nx_text_embedding.json";
 }
 
 DeviceAgent::~DeviceAgent()
 {
+    const auto start = std::chrono::steady_clock::now();
+    // Settings still being applied use this DeviceAgent
+    m_settingsWorker->cancel(m_DeviceAgentId);
     try
     {
         m_objectDetector->terminate();
@@ -57,10 +151,9 @@ DeviceAgent::~DeviceAgent()
     {    
         std::cout << "DeviceAgent::~DeviceAgent() Unknown exception caught" << std::endl;
     }
-    // wait 5 seconds before returning
-    std::cout << "DeviceAgent::~DeviceAgent() waiting 5 seconds before returning" << std::endl;
-    std::this_thread::sleep_for(std::chrono::seconds(5));
-    std::cout << "DeviceAgent::~DeviceAgent() returning" << std::endl;
+    // The pipeline of its own, if any, is still stopping in the background
+    std::cout << "DeviceAgent ID: " << m_DeviceAgentId << " terminated in " << std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
 }
 
 /**
@@ -118,8 +211,11 @@ bool DeviceAgent::pushUncompressedVideoFrame(const IUncompressedVideoFrame* vide
 
     m_lastVideoFrameTimestampUs = videoFrame->timestampUs();
 
-    // Detecting objects only on every `kDetectionFramePeriod` frame.
-    if (m_frameIndex % kDetectionFramePeriod == 0)
+    // Detecting objects only on the frames the load allows, or on every `kDetectionFramePeriod` frame.
+    const bool process = ini().admissionControl
+        ? m_admission.admit(videoFrame->timestampUs()) == AdmissionController::Decision::admit
+        : m_frameIndex % kDetectionFramePeriod == 0;
+    if (process)
     {
         const MetadataPacketList metadataPackets = processFrame(videoFrame);
         for (const Ptr<IMetadataPacket>& metadataPacket: metadataPackets)
@@ -128,11 +224,65 @@ bool DeviceAgent::pushUncompressedVideoFrame(const IUncompressedVideoFrame* vide
             pushMetadataPacket(metadataPacket.get());
         }
     }
+    if (ini().admissionControl)
+        reportAdmission();
+    reportPipeline();
 
     ++m_frameIndex;
     return true;
 }
 
+/** Tells the Server when the camera starts or stops being slowed down, logs the counters. */
+void DeviceAgent::reportAdmission()
+{
+    const AdmissionController::Counters counters = m_admission.counters();
+    if (counters.overloaded != m_admissionOverloaded)
+    {
+        m_admissionOverloaded = counters.overloaded;
+        if (m_admissionOverloaded)
+        {
+            pushPluginDiagnosticEvent(IPluginDiagnosticEvent::Level::warning,
+                "Analytics slowed down.",
+                "The pipeline is overloaded, fewer frames of this camera are analyzed.");
+        }
+        else
+        {
+            pushPluginDiagnosticEvent(IPluginDiagnosticEvent::Level::info,
+                "Analytics back to full rate.", "The pipeline keeps up with this camera again.");
+        }
+    }
+    if (m_frameIndex % kAdmissionStatsFramePeriod == 0)
+    {
+        std::cout << "Admission ID: " << m_DeviceAgentId
+            << " rate: " << counters.fps << " fps" << (counters.overloaded ? " (overloaded)" : "")
+            << " latency: " << counters.latencyMs << " ms in flight: " << counters.inFlight
+            << " admitted: " << counters.admitted << " completed: " << counters.completed
+            << " dropped (rate): " << counters.droppedRate
+            << " dropped (occupancy): " << counters.droppedOccupancy
+            << " not submitted: " << counters.notSubmitted << " lost: " << counters.lost << std::endl;
+    }
+}
+
+/** Tells the Server when the pipeline of the camera fails, and when one runs again. */
+void DeviceAgent::reportPipeline()
+{
+    const bool failed = m_objectDetector->pipelineFailed();
+    if (failed == m_pipelineFailed)
+        return;
+    m_pipelineFailed = failed;
+    if (m_pipelineFailed)
+    {
+        pushPluginDiagnosticEvent(IPluginDiagnosticEvent::Level::error,
+            "Pipeline failed.",
+            "The pipeline of this camera failed to start or broke, it is being restarted.");
+    }
+    else
+    {
+        pushPluginDiagnosticEvent(IPluginDiagnosticEvent::Level::info,
+            "Pipeline running.", "The pipeline of this camera was restarted and runs again.");
+    }
+}
+
 void DeviceAgent::doSetNeededMetadataTypes(
     nx::sdk::Result<void>* outValue,
     const nx::sdk::analytics::IMetadataTypes* /*neededMetadataTypes*/)
@@ -156,7 +306,7 @@ void DeviceAgent::doSetNeededMetadataTypes(
 };
 
 // wrapper function to allow accessing protected pushMetadataPacket function
-void DeviceAgent::pushMetadataPacketWrapper(MetadataPacketList metadataPackets)
+void DeviceAgent::pushMetadataPacketWrapper(const MetadataPacketList& metadataPackets)
 {
     try {
         for (const Ptr<IMetadataPacket>& metadataPacket: metadataPackets)
@@ -172,6 +322,38 @@ void DeviceAgent::pushMetadataPacketWrapper(MetadataPacketList metadataPackets)
     }
 }
 
+const std::string& DeviceAgent::objectTypeId(const std::string& classLabel) const
+{
+    if (classLabel == "cat")
+        return kCatObjectType;
+    if (classLabel == "dog")
+        return kDogObjectType;
+    return kPersonObjectType; //default to person
+}
+
+void DeviceAgent::pushObjectMetadata(const Ptr<ObjectMetadataPacket>& packet)
+{
+    // No person in the frame: MetadataBuilder::finish() made no packet
+    if (!packet)
+        return;
+    // At once: a packet carries the timestamp of its frame, those of several frames cannot be merged
+    const auto start = std::chrono::steady_clock::now();
+    packet->addRef();
+    pushMetadataPacket(packet.get());
+    const double pushUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    m_metadataPushUs = m_metadataPushes == 0 ? pushUs : 0.8 * m_metadataPushUs + 0.2 * pushUs;
+    ++m_metadataPushes;
+
+    const MetadataBuilder::Counters counters = m_metadataBuilder.counters();
+    if (counters.frames % kMetadataStatsFramePeriod == 0)
+    {
+        std::cout << "Metadata ID: " << m_DeviceAgentId << " frames: " << counters.frames
+            << " objects: " << counters.objects << " reused: " << counters.reusedObjects
+            << " new CLIP attributes: " << counters.newAttributes << " tracks: " << counters.tracks
+            << " pushes: " << m_metadataPushes << " push: " << m_metadataPushUs << " us" << std::endl;
+    }
+}
+
 //-------------------------------------------------------------------------------------------------
 // private
 
@@ -205,44 +387,6 @@ Ptr<IMetadataPacket> DeviceAgent::generateEventMetadataPacket()
     return eventMetadataPacket;
 }
 
-Ptr<ObjectMetadataPacket> DeviceAgent::detectionsToObjectMetadataPacket(
-    const DetectionList& detections,
-    int64_t timestampUs)
-{
-    if (detections.empty())
-        return nullptr;
-
-    const auto objectMetadataPacket = makePtr<ObjectMetadataPacket>();
-
-    for (const std::shared_ptr<Detection>& detection: detections)
-    {
-        const auto objectMetadata = makePtr<ObjectMetadata>();
-
-        objectMetadata->setBoundingBox(detection->boundingBox);
-        objectMetadata->setConfidence(detection->confidence);
-        objectMetadata->setTrackId(detection->trackId);
-
-        // Convert class label to object metadata type id.
-        if (detection->classLabel == "person")
-            objectMetadata->setTypeId(kPersonObjectType);
-        else if (detection->classLabel == "cat")
-            objectMetadata->setTypeId(kCatObjectType);
-        else if (detection->classLabel == "dog")
-            objectMetadata->setTypeId(kDogObjectType);
-        else
-            objectMetadata->setTypeId(kPersonObjectType); //default to person
-        objectMetadataPacket->addItem(objectMetadata.get());
-        // Add clip label and confidence
-        if (detection->ClipConfidence > 0.0){
-            objectMetadata->addAttribute(makePtr<Attribute>(detection->ClipLabel, std::to_string(detection->ClipConfidence)));
-            objectMetadata->addAttribute(makePtr<Attribute>("match", "true"));
-        }
-    }
-    objectMetadataPacket->setTimestampUs(timestampUs);
-
-    return objectMetadataPacket;
-}
-
 DeviceAgent::MetadataPacketList DeviceAgent::processFrame(
     const IUncompressedVideoFrame* videoFrame)
 {
@@ -264,6 +408,75 @@ DeviceAgent::MetadataPacketList DeviceAgent::processFrame(
     return {};
 }
 
+/**
+ * Publishes the prompts to the matcher without going through the disk: known prompts come from the
+ * prompt cache, new ones are encoded by the resident text model. They are then saved to
+ * embeddingPath for the next start. Nothing is published or saved once `cancelled` is set.
+ *
+ * @return False if the prompts could not be encoded here and text_image_matcher has to be run.
+ */
+bool DeviceAgent::encodePromptsInProcess(const std::vector<std::string>& texts, const std::string& embeddingPath,
+    double threshold, const std::atomic<bool>& cancelled)
+{
+    TextImageMatcher& matcher = *m_objectDetector->m_textImageMatcher;
+    clip_matcher::EmbeddingStoreContents contents;
+    contents.threshold = static_cast<float>(threshold);
+    contents.text_prefix = matcher.prompt_set()->text_prefix;
+    // The prompts of the settings are not ensembled, but the file keeps the templates of the one it
+    // replaces
+    try
+    {
+        contents.ensemble_templates = TextImageMatcher::read_ensemble_templates(
+            std::filesystem::exists(embeddingPath) ? embeddingPath : defaultPromptEmbeddingPath().string());
+    }
+    catch (const std::exception&)
+    {
+    }
+    std::vector<std::string> prompts;
+    for (const std::string& text: texts)
+    {
+        if (text.empty())
+            continue;
+        contents.entries.push_back({text, /*negative*/ false, /*ensemble*/ false});
+        prompts.push_back(text);
+    }
+    size_t dim = 0;
+    if (!m_promptEncoder->encode(contents.text_prefix, prompts, contents.embeddings, dim))
+        return false;
+    contents.dim = static_cast<uint32_t>(dim);
+    // A newer request publishes and saves its own prompts
+    if (cancelled)
+        return false;
+    matcher.load_prompts(contents, threshold);
+    if (cancelled)
+        return true;
+
+    try
+    {
+        TextImageMatcher::export_json_embeddings(embeddingPath, contents);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Cannot save prompts to " << embeddingPath << ": " << e.what() << std::endl;
+    }
+    return true;
+}
+
+/** Adds the prompts loaded from a text_image_matcher output to the prompt cache. */
+void DeviceAgent::rememberLoadedPrompts()
+{
+    const auto promptSet = m_objectDetector->m_textImageMatcher->prompt_set();
+    for (size_t row = 0; row < promptSet->valid_rows.size(); ++row)
+    {
+        const TextEmbeddingEntry& entry = promptSet->entries[promptSet->valid_rows[row]];
+        if (!entry.ensemble)
+        {
+            m_promptEncoder->remember(promptSet->text_prefix, entry.text, promptSet->prompt_rows[row],
+                promptSet->embedding_dim);
+        }
+    }
+}
+
 //Settings
 const std::string DeviceAgent::kTimeShiftSetting = "timestampShiftMs";
 nx::sdk::Result<const nx::sdk::ISettingsResponse*> DeviceAgent::settingsReceived()
@@ -277,7 +490,6 @@ nx::sdk::Result<const nx::sdk::ISettingsResponse*> DeviceAgent::settingsReceived
 
     std::vector<std::string> textSettings(5);
     std::vector<bool> textSettings_negative(5);
-    std::string textSettingsString = "";
     double detectionThreshold = 0.9;
     bool debug = false;
     const std::map<std::string, std::string>& settings = currentSettings();
@@ -297,8 +509,6 @@ nx::sdk::Result<const nx::sdk::ISettingsResponse*> DeviceAgent::settingsReceived
             if (key == key_textSetting) {
                 textSettings[i] = value;
                 std::cout << key_textSetting << ": " << value << std::endl;
-                if (value != "")
-                    textSettingsString += "\"" + value + "\" ";
             }
 
             // if (key == key_textSetting_negative) {
@@ -317,31 +527,88 @@ nx::sdk::Result<const nx::sdk::ISettingsResponse*> DeviceAgent::settingsReceived
         }
         
     }
-    // run text embedding
-    
-    std::string command = "text_image_matcher --texts-list " + textSettingsString + " --output " + m_pluginHomeDir.string() + "/resources/nx_text_embedding.json";
+    // run text embedding on the Engine's settings worker, replacing any older request of this camera
+    m_settingsWorker->submit(m_DeviceAgentId,
+        [this, textSettings, detectionThreshold, debug](const std::atomic<bool>& cancelled)
+        {
+            return applyPrompts(textSettings, detectionThreshold, debug, cancelled);
+        },
+        [this](SettingsWorker::Result result)
+        {
+            if (result == SettingsWorker::Result::applied)
+            {
+                pushPluginDiagnosticEvent(IPluginDiagnosticEvent::Level::info,
+                    "Prompts applied.", "The new text prompts are matched from now on.");
+            }
+            else if (result == SettingsWorker::Result::failed)
+            {
+                pushPluginDiagnosticEvent(IPluginDiagnosticEvent::Level::error,
+                    "Prompts not applied.", "The text prompts could not be encoded.");
+            }
+        });
 
-    std::thread t([command, detectionThreshold, debug, this] {
-        this->m_objectDetector->m_textImageMatcher->set_prompt_update(true);
+    std::cout << "keep running....." << std::endl;
+    return nullptr;
+}
+
+/**
+ * Encodes and publishes the prompts of a settings change, on the settings worker thread.
+ *
+ * @return False if the prompts were not applied, or the request was superseded before they were.
+ */
+bool DeviceAgent::applyPrompts(const std::vector<std::string>& texts, double threshold, bool debug,
+    const std::atomic<bool>& cancelled)
+{
+    if (!m_objectDetector || !m_objectDetector->m_textImageMatcher)
+    {
+        std::cerr << "Error: m_objectDetector or m_textImageMatcher is null." << std::endl;
+        return false;
+    }
+    TextImageMatcher& matcher = *m_objectDetector->m_textImageMatcher;
+    const std::string embeddingPath = promptEmbeddingPath().string();
+    matcher.set_prompt_update(true);
+    // Cached prompts and the resident encoder take milliseconds, the tool a cold start of its model
+    bool applied = encodePromptsInProcess(texts, embeddingPath, threshold, cancelled);
+    if (!applied && !cancelled)
+    {
+        // Each prompt is one argument, whatever quotes or shell characters it holds. The tool writes
+        // next to the camera's file, which is only replaced once the tool succeeded.
+        const std::string outputPath = embeddingPath + "." + std::to_string(getpid()) + ".tmp";
+        std::vector<std::string> args = {"text_image_matcher", "--texts-list"};
+        for (const std::string& text: texts)
+        {
+            if (text != "")
+                args.push_back(text);
+        }
+        args.push_back("--output");
+        args.push_back(outputPath);
         std::cout << "run text embedding....." << std::endl;
-        std::cout << "command: " << command << std::endl;
-        auto ret = std::system(command.c_str());
+        const int ret = runTool(args, cancelled);
         std::cout << "ret: " << ret << std::endl;
-        if (this->m_objectDetector && this->m_objectDetector->m_textImageMatcher) {
-            this->m_objectDetector->m_textImageMatcher->load_embeddings(m_pluginHomeDir.string() + "/resources/nx_text_embedding.json");
-            this->m_objectDetector->m_textImageMatcher->set_threshold(detectionThreshold);
-            this->m_objectDetector->m_textImageMatcher->set_debug(debug);
-            this->m_objectDetector->m_textImageMatcher->set_prompt_update(false);
-        } else {
-            std::cerr << "Error: m_objectDetector or m_textImageMatcher is null." << std::endl;
+        // A newer request rewrites the file, leave it to that one
+        std::error_code error;
+        if (ret == 0 && !cancelled)
+        {
+            std::filesystem::rename(outputPath, embeddingPath, error);
+            if (error)
+            {
+                std::cout << "Cannot save prompts to " << embeddingPath << ": " << error.message() << std::endl;
+            }
+            else
+            {
+                matcher.load_embeddings(embeddingPath, threshold);
+                rememberLoadedPrompts();
+                applied = true;
+            }
         }
+        std::filesystem::remove(outputPath, error);
+    }
+    // A newer request applies its own debug flag along with its prompts
+    if (!cancelled)
+        matcher.set_debug(debug);
+    matcher.set_prompt_update(false);
     std::cout << "text embedding finished" << std::endl;
-    });
-
-    t.detach();
-
-    std::cout << "keep running....." << std::endl;
-    return nullptr;
+    return applied;
 }
 
 } // namespace clip_person_tracker
@@ -9,8 +9,10 @@
 #include <nx/sdk/helpers/uuid_helper.h>
 #include <nx/sdk/ptr.h>
 
+#include "admission_controller.h"
 #include "engine.h"
 #include "gstreamer_pipeline.hpp"
+#include "metadata_builder.h"
 
 // Tappas includes
 #include "hailo_objects.hpp"
@@ -29,9 +31,25 @@ public:
     DeviceAgent(
         const nx::sdk::IDeviceInfo* deviceInfo,
         std::filesystem::path pluginHomeDir,
-        int DeviceAgentId);
+        int DeviceAgentId,
+        std::shared_ptr<PromptEncoder> promptEncoder,
+        std::shared_ptr<SettingsWorker> settingsWorker,
+        std::shared_ptr<DeviceScheduler> deviceScheduler,
+        std::shared_ptr<SharedPipeline> sharedPipeline,
+        std::shared_ptr<PipelinePool> pipelinePool,
+        std::shared_ptr<MatcherPool> matcherPool);
     virtual ~DeviceAgent() override;
     int m_DeviceAgentId; // Device Agent ID
+    std::string m_deviceId; // Id of the camera in the VMS
+    std::string m_cameraId; // m_deviceId reduced to characters safe in a file name
+
+    // Text embeddings of this camera's prompts, written by the text encoder on a settings change.
+    std::filesystem::path promptEmbeddingPath() const;
+    // Text embeddings the camera starts from until it has prompts of its own.
+    std::filesystem::path defaultPromptEmbeddingPath() const;
+
+    // Encoder of the prompts of the Engine, shared by its cameras.
+    const std::shared_ptr<PromptEncoder>& promptEncoder() const { return m_promptEncoder; }
 
 protected:
     virtual std::string manifestString() const override;
@@ -46,19 +64,25 @@ protected:
 public:
     nx::sdk::Ptr<nx::sdk::analytics::IMetadataPacket> generateEventMetadataPacket();
 
-    nx::sdk::Ptr<nx::sdk::analytics::ObjectMetadataPacket> detectionsToObjectMetadataPacket(
-        const DetectionList& detections,
-        int64_t timestampUs);
+    /** Object type of a detection label, one of the type IDs of the manifest. */
+    const std::string& objectTypeId(const std::string& classLabel) const;
+
+    /** Pushes the object metadata of a frame, timing the Server taking it for the logs. */
+    void pushObjectMetadata(const nx::sdk::Ptr<nx::sdk::analytics::ObjectMetadataPacket>& packet);
 
-    void pushMetadataPacketWrapper(MetadataPacketList metadataPackets);
+    void pushMetadataPacketWrapper(const MetadataPacketList& metadataPackets);
 
     // Used for checking whether the frame size changed, and for reinitializing the tracker.
     int64_t m_lastVideoFrameTimestampUs = 0;
+    AdmissionController m_admission; // Frames sent to m_objectDetector, completed from its pipeline
+    MetadataBuilder m_metadataBuilder; // Object metadata of the frames, built by the matching of this camera
     std::unique_ptr<GStreamerObjectDetector> m_objectDetector;
     std::filesystem::path m_pluginHomeDir;
 private:
     MetadataPacketList processFrame(
         const nx::sdk::analytics::IUncompressedVideoFrame* videoFrame);
+    void reportAdmission();
+    void reportPipeline();
 
 private:
     bool m_FirstSetting = true;
@@ -70,12 +94,24 @@ private:
     /** Length of the the track (in frames). The value was chosen arbitrarily. */
     static constexpr int kTrackFrameCount = 256;
 
-    /** Should work on modern PCs. */
+    /** Should work on modern PCs. Used when admission control is off. */
     static constexpr int kDetectionFramePeriod = 2;
 
+    /** Frames between two logs of the admission counters. */
+    static constexpr int kAdmissionStatsFramePeriod = 3000;
+
+    /** Frames between two logs of the metadata counters. */
+    static constexpr uint64_t kMetadataStatsFramePeriod = 3000;
+
 private:
     bool m_terminated = false;
     bool m_terminatedPrevious = false;
+    bool m_admissionOverloaded = false; //< Last overload state reported to the Server.
+    bool m_pipelineFailed = false; //< Last pipeline state reported to the Server.
+
+    // Object metadata delivery, used only by pushObjectMetadata()
+    double m_metadataPushUs = 0.0; //< Moving average of the time the Server takes per packet.
+    uint64_t m_metadataPushes = 0;
     nx::sdk::Uuid m_trackId = nx::sdk::UuidHelper::randomUuid();
     int m_frameIndex = 0; /**< Used for generating the detection in the right place. */
     int m_trackIndex = 0; /**< Used in the description of the events. */
@@ -86,6 +122,13 @@ public:
 private:
     mutable std::mutex m_mutex;
     int m_timestampShiftMs = 0;
+    std::shared_ptr<PromptEncoder> m_promptEncoder;
+    std::shared_ptr<SettingsWorker> m_settingsWorker;
+    bool applyPrompts(const std::vector<std::string>& texts, double threshold, bool debug,
+        const std::atomic<bool>& cancelled);
+    bool encodePromptsInProcess(const std::vector<std::string>& texts, const std::string& embeddingPath,
+        double threshold, const std::atomic<bool>& cancelled);
+    void rememberLoadedPrompts();
 protected:
     virtual nx::sdk::Result<const nx::sdk::ISettingsResponse*> settingsReceived() override;
 
@@ -0,0 +1,389 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "device_scheduler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+namespace {
+
+// A camera that did not report for longer gets no frames
+constexpr std::chrono::seconds kStaleReport(5);
+// A camera that never reported counts as the average camera for as long after it was placed
+constexpr std::chrono::seconds kNewCamera(10);
+// Latency of a camera when none measures it: the loads are then proportional to the frame rates
+constexpr double kDefaultLatencyMs = 1000.0;
+// A camera moves only if its new group ends up lighter than its old one by this part of its load
+constexpr double kMoveMargin = 0.25;
+constexpr double kFpsAlpha = 0.5;
+
+std::vector<int> uniqueGroups(const std::vector<int>& groups)
+{
+    std::vector<int> result;
+    for (const int group: groups)
+    {
+        if (std::find(result.begin(), result.end(), group) == result.end())
+            result.push_back(group);
+    }
+    // validate() keeps the lists of the config non-empty, a group must be there all the same
+    if (result.empty())
+        result.push_back(1);
+    return result;
+}
+
+double seconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<double>(duration).count();
+}
+
+} // namespace
+
+int DeviceScheduler::GroupLoads::leastLoaded(int except) const
+{
+    int best = -1;
+    for (int i = 0; i < (int) groups.size(); ++i)
+    {
+        if (groups[i] == except)
+            continue;
+        if (best < 0 || loads[i] < loads[best] || (loads[i] == loads[best] && cameras[i] < cameras[best]))
+            best = i;
+    }
+    return best < 0 ? -1 : groups[best];
+}
+
+double DeviceScheduler::GroupLoads::load(int group) const
+{
+    const auto found = std::find(groups.begin(), groups.end(), group);
+    return found == groups.end() ? 0.0 : loads[found - groups.begin()];
+}
+
+DeviceScheduler::DeviceScheduler(const PipelineConfig& config, int rebalancePeriodMs):
+    m_detectionGroups(uniqueGroups(config.detectionVdeviceGroups)),
+    m_clipGroups(uniqueGroups(config.clipVdeviceGroups)),
+    m_rebalancePeriod(std::max(rebalancePeriodMs, 0))
+{
+}
+
+DevicePlacement DeviceScheduler::firstGroups() const
+{
+    DevicePlacement groups;
+    groups.detectionVdeviceGroup = m_detectionGroups.front();
+    groups.clipVdeviceGroup = m_clipGroups.front();
+    return groups;
+}
+
+DevicePlacement DeviceScheduler::next() const
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return nextLocked(loadsLocked(Clock::now()));
+}
+
+DevicePlacement DeviceScheduler::place(int deviceAgentId, const std::vector<DevicePlacement>& ready)
+{
+    const Clock::time_point now = Clock::now();
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    const Loads loads = loadsLocked(now);
+    DevicePlacement groups = nextLocked(loads);
+
+    // A started pipeline saves seconds of loading the networks, worth a slightly more loaded group
+    double cameraLoad = 1.0;
+    if (!loads.cameras.empty())
+    {
+        double sum = 0.0;
+        for (const auto& camera: loads.cameras)
+            sum += camera.second;
+        cameraLoad = sum / loads.cameras.size();
+    }
+    const auto acceptable =
+        [&](const GroupLoads& network, int group, int best)
+        {
+            return std::find(network.groups.begin(), network.groups.end(), group) != network.groups.end()
+                && network.load(group) <= network.load(best) + kMoveMargin * cameraLoad;
+        };
+    for (const DevicePlacement& candidate: ready)
+    {
+        if (acceptable(loads.detection, candidate.detectionVdeviceGroup, groups.detectionVdeviceGroup)
+            && acceptable(loads.clip, candidate.clipVdeviceGroup, groups.clipVdeviceGroup))
+        {
+            groups = candidate;
+            break;
+        }
+    }
+
+    Camera& camera = m_cameras[deviceAgentId];
+    camera = Camera();
+    camera.groups = groups;
+    camera.movable = true;
+    camera.placedAt = now;
+    std::cout << "Device scheduler: camera " << deviceAgentId << " placed on detection vdevice "
+        << groups.detectionVdeviceGroup << ", CLIP vdevice " << groups.clipVdeviceGroup << "\n"
+        << dumpLocked(loadsLocked(now));
+    return groups;
+}
+
+void DeviceScheduler::assign(int deviceAgentId, const DevicePlacement& groups)
+{
+    const Clock::time_point now = Clock::now();
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    Camera& camera = m_cameras[deviceAgentId];
+    camera = Camera();
+    camera.groups = groups;
+    camera.placedAt = now;
+    std::cout << "Device scheduler: camera " << deviceAgentId << " on the shared pipeline\n"
+        << dumpLocked(loadsLocked(now));
+}
+
+void DeviceScheduler::remove(int deviceAgentId)
+{
+    const Clock::time_point now = Clock::now();
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    const auto camera = m_cameras.find(deviceAgentId);
+    if (camera == m_cameras.end())
+        return;
+    if (camera->second.moving)
+        m_moving = false;
+    m_cameras.erase(camera);
+    std::cout << "Device scheduler: camera " << deviceAgentId << " removed\n" << dumpLocked(loadsLocked(now));
+    // The cameras left may be unbalanced now
+    if (m_rebalancePeriod.count() > 0)
+        rebalanceLocked(now);
+}
+
+bool DeviceScheduler::report(int deviceAgentId, uint64_t frames, float latencyMs, DevicePlacement* moveTo)
+{
+    const Clock::time_point now = Clock::now();
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    const auto found = m_cameras.find(deviceAgentId);
+    if (found == m_cameras.end())
+        return false;
+    Camera& camera = found->second;
+
+    // After a pause the frame rate starts over from this report
+    if (!camera.reported || now - camera.reportedAt > kStaleReport)
+    {
+        camera.reported = true;
+        camera.fps = 0.0;
+    }
+    else if (now > camera.reportedAt && frames >= camera.frames)
+    {
+        const double fps = (frames - camera.frames) / seconds(now - camera.reportedAt);
+        camera.fps = camera.fps > 0.0 ? (1.0 - kFpsAlpha) * camera.fps + kFpsAlpha * fps : fps;
+    }
+    camera.reportedAt = now;
+    camera.frames = frames;
+    camera.latencyMs = latencyMs;
+
+    if (m_rebalancePeriod.count() > 0 && now - m_lastRebalance >= m_rebalancePeriod)
+        rebalanceLocked(now);
+    if (!camera.moving)
+        return false;
+
+    std::cout << "Device scheduler: camera " << deviceAgentId << " moves from detection vdevice "
+        << camera.groups.detectionVdeviceGroup << ", CLIP vdevice " << camera.groups.clipVdeviceGroup
+        << " to detection vdevice " << camera.moveTo.detectionVdeviceGroup << ", CLIP vdevice "
+        << camera.moveTo.clipVdeviceGroup << std::endl;
+    camera.moving = false;
+    m_moving = false;
+    camera.groups = camera.moveTo;
+    camera.placedAt = now;
+    // Its frame rate is measured again on the new pipeline
+    camera.reported = false;
+    camera.fps = 0.0;
+    *moveTo = camera.groups;
+    std::cout << dumpLocked(loadsLocked(now));
+    return true;
+}
+
+std::vector<DeviceScheduler::Placement> DeviceScheduler::placements() const
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    const Loads loads = loadsLocked(Clock::now());
+    std::vector<Placement> result;
+    for (const auto& [deviceAgentId, camera]: m_cameras)
+    {
+        Placement placement;
+        placement.deviceAgentId = deviceAgentId;
+        placement.groups = camera.groups;
+        placement.movable = camera.movable;
+        placement.fps = static_cast<float>(camera.fps);
+        placement.latencyMs = camera.latencyMs;
+        placement.load = static_cast<float>(loads.cameras.at(deviceAgentId));
+        result.push_back(placement);
+    }
+    return result;
+}
+
+std::string DeviceScheduler::dump() const
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return dumpLocked(loadsLocked(Clock::now()));
+}
+
+DeviceScheduler::Loads DeviceScheduler::loadsLocked(Clock::time_point now) const
+{
+    Loads loads;
+    loads.detection.groups = m_detectionGroups;
+    loads.clip.groups = m_clipGroups;
+    for (GroupLoads* network: {&loads.detection, &loads.clip})
+    {
+        network->loads.assign(network->groups.size(), 0.0);
+        network->cameras.assign(network->groups.size(), 0);
+    }
+
+    const auto measured =
+        [now](const Camera& camera)
+        {
+            return camera.reported && camera.fps > 0.0 && now - camera.reportedAt <= kStaleReport;
+        };
+    double latencySum = 0.0;
+    int latencyCameras = 0;
+    for (const auto& camera: m_cameras)
+    {
+        if (measured(camera.second) && camera.second.latencyMs > 0.0f)
+        {
+            latencySum += camera.second.latencyMs;
+            ++latencyCameras;
+        }
+    }
+    const double defaultLatencyMs = latencyCameras > 0 ? latencySum / latencyCameras : kDefaultLatencyMs;
+
+    double measuredSum = 0.0;
+    int measuredCameras = 0;
+    for (const auto& [deviceAgentId, camera]: m_cameras)
+    {
+        if (!measured(camera))
+            continue;
+        const double latencyMs = camera.latencyMs > 0.0f ? camera.latencyMs : defaultLatencyMs;
+        const double load = camera.fps * latencyMs / 1000.0;
+        loads.cameras[deviceAgentId] = load;
+        measuredSum += load;
+        ++measuredCameras;
+    }
+    const double averageLoad = measuredCameras > 0 ? measuredSum / measuredCameras : 1.0;
+
+    for (const auto& [deviceAgentId, camera]: m_cameras)
+    {
+        if (!measured(camera))
+        {
+            const bool streaming = camera.reported
+                ? now - camera.reportedAt <= kStaleReport
+                : now - camera.placedAt <= kNewCamera;
+            loads.cameras[deviceAgentId] = streaming ? averageLoad : 0.0;
+        }
+        const double load = loads.cameras[deviceAgentId];
+        const std::pair<GroupLoads*, int> networks[] = {
+            {&loads.detection, camera.groups.detectionVdeviceGroup},
+            {&loads.clip, camera.groups.clipVdeviceGroup}};
+        for (const auto& [network, group]: networks)
+        {
+            const auto found = std::find(network->groups.begin(), network->groups.end(), group);
+            if (found == network->groups.end())
+                continue;
+            network->loads[found - network->groups.begin()] += load;
+            ++network->cameras[found - network->groups.begin()];
+        }
+    }
+    return loads;
+}
+
+DevicePlacement DeviceScheduler::nextLocked(const Loads& loads) const
+{
+    DevicePlacement groups;
+    groups.detectionVdeviceGroup = loads.detection.leastLoaded();
+    groups.clipVdeviceGroup = loads.clip.leastLoaded();
+    return groups;
+}
+
+void DeviceScheduler::rebalanceLocked(Clock::time_point now)
+{
+    m_lastRebalance = now;
+    if (m_moving)
+    {
+        // A camera that stopped getting frames will not pick its move up, another one may go
+        const auto moving = std::find_if(m_cameras.begin(), m_cameras.end(),
+            [](const auto& camera) { return camera.second.moving; });
+        if (moving != m_cameras.end() && now - moving->second.reportedAt <= kStaleReport)
+            return;
+        if (moving != m_cameras.end())
+            moving->second.moving = false;
+        m_moving = false;
+    }
+
+    const Loads loads = loadsLocked(now);
+    Camera* best = nullptr;
+    DevicePlacement bestMoveTo;
+    double bestGain = 0.0;
+    for (auto& [deviceAgentId, camera]: m_cameras)
+    {
+        // A move restarts the pipeline of the camera: not for the shared pipeline, nor twice a period
+        if (!camera.movable || !camera.reported || camera.fps <= 0.0 || now - camera.placedAt < m_rebalancePeriod)
+            continue;
+        const double load = loads.cameras.at(deviceAgentId);
+        if (load <= 0.0)
+            continue;
+        DevicePlacement moveTo = camera.groups;
+        double gain = 0.0;
+        const std::pair<const GroupLoads*, int*> networks[] = {
+            {&loads.detection, &moveTo.detectionVdeviceGroup},
+            {&loads.clip, &moveTo.clipVdeviceGroup}};
+        for (const auto& [network, group]: networks)
+        {
+            const int target = network->leastLoaded(*group);
+            if (target < 0)
+                continue;
+            const double from = network->load(*group);
+            const double to = network->load(target);
+            if (to + load * (1.0 + kMoveMargin) < from)
+            {
+                gain += from - (to + load);
+                *group = target;
+            }
+        }
+        if (moveTo != camera.groups && gain > bestGain)
+        {
+            best = &camera;
+            bestMoveTo = moveTo;
+            bestGain = gain;
+        }
+    }
+    if (best == nullptr)
+        return;
+    best->moving = true;
+    best->moveTo = bestMoveTo;
+    m_moving = true;
+}
+
+std::string DeviceScheduler::dumpLocked(const Loads& loads) const
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+    const std::pair<const char*, const GroupLoads*> networks[] = {
+        {"detection", &loads.detection}, {"CLIP", &loads.clip}};
+    for (const auto& [name, network]: networks)
+    {
+        for (size_t i = 0; i < network->groups.size(); ++i)
+        {
+            const int group = network->groups[i];
+            out << "  " << name << " vdevice " << group << ": load " << network->loads[i] << ", cameras";
+            for (const auto& [deviceAgentId, camera]: m_cameras)
+            {
+                const int cameraGroup = network == &loads.detection
+                    ? camera.groups.detectionVdeviceGroup : camera.groups.clipVdeviceGroup;
+                if (cameraGroup == group)
+                    out << " " << deviceAgentId << (camera.movable ? "" : " (shared)");
+            }
+            out << "\n";
+        }
+    }
+    return out.str();
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
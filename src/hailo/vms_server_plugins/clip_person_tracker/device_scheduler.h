@@ -0,0 +1,146 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pipeline_config.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/**
+ * Places the networks of the cameras of an Engine on the vdevice groups of the pipeline config
+ * (detectionVdeviceGroups and clipVdeviceGroups), and keeps the groups balanced as cameras come, go
+ * and change their frame rate.
+ *
+ * The load of a camera is the number of its frames in the networks: the frames per second coming
+ * out of its pipeline times their latency through it, both reported by the camera (see report()).
+ * A camera that has not reported yet counts as the average camera, one that stopped reporting (no
+ * frames) for nothing. The load of a group is that of the cameras placed on it, for the detection
+ * and the CLIP groups separately.
+ *
+ * A new camera goes to the least loaded group of each network, the one with the fewest cameras on
+ * a tie. Once per rebalance period, and when a camera goes, one camera of a pipeline of its own may
+ * be moved to a less loaded group: the move must leave the new group less loaded than the old one
+ * by a margin, so that cameras do not go back and forth. The cameras of the shared pipeline stay on
+ * its groups.
+ *
+ * The groups are only labels here: with stand-in networks (see standInInference) the placement is
+ * done the same without a Hailo device.
+ *
+ * Thread-safe.
+ */
+class DeviceScheduler
+{
+public:
+    struct Placement
+    {
+        int deviceAgentId = 0;
+        DevicePlacement groups;
+        bool movable = false; //< Placed by place(), rather than assigned to a shared pipeline lane.
+        float fps = 0.0f;
+        float latencyMs = 0.0f; //< 0 if the camera does not measure it.
+        float load = 0.0f; //< Frames in the networks, estimated as described above.
+    };
+
+    /** @param rebalancePeriodMs 0 never moves a camera once placed. */
+    DeviceScheduler(const PipelineConfig& config, int rebalancePeriodMs);
+
+    DeviceScheduler(const DeviceScheduler&) = delete;
+    DeviceScheduler& operator=(const DeviceScheduler&) = delete;
+
+    /** The first group of each network, those of the shared pipeline. */
+    DevicePlacement firstGroups() const;
+
+    /** Where place() would put a camera now, which the PipelinePool starts its warm pipelines for. */
+    DevicePlacement next() const;
+
+    /**
+     * Places a new camera, which may be moved later.
+     *
+     * @param ready Placements pipelines are already started for: one of them is taken if its groups
+     *     are about as loaded as the least loaded ones (within the rebalancing margin).
+     */
+    DevicePlacement place(int deviceAgentId, const std::vector<DevicePlacement>& ready = {});
+
+    /** Counts a camera that runs on `groups` and cannot be moved, on a lane of the shared pipeline. */
+    void assign(int deviceAgentId, const DevicePlacement& groups);
+
+    void remove(int deviceAgentId);
+
+    /**
+     * Updates the load of a camera; called about once a second while it gets frames.
+     *
+     * @param frames Frames out of the pipeline of the camera so far.
+     * @param latencyMs Recent latency of its frames through the pipeline, 0 if not measured.
+     * @param moveTo Set to the groups the camera is to move to if it returns true, from when the
+     *     camera is counted there.
+     */
+    bool report(int deviceAgentId, uint64_t frames, float latencyMs, DevicePlacement* moveTo);
+
+    std::vector<Placement> placements() const;
+
+    /** One line per group, with its load and cameras. */
+    std::string dump() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Camera
+    {
+        DevicePlacement groups;
+        bool movable = false;
+        Clock::time_point placedAt; //< Or moved.
+        bool reported = false;
+        Clock::time_point reportedAt;
+        uint64_t frames = 0; //< At the last report.
+        double fps = 0.0;
+        float latencyMs = 0.0f;
+        bool moving = false; //< To `moveTo`, once the camera reports.
+        DevicePlacement moveTo;
+    };
+
+    /** Load by group of one network, with the cameras on each. */
+    struct GroupLoads
+    {
+        std::vector<int> groups; //< In the order of the config.
+        std::vector<double> loads;
+        std::vector<int> cameras;
+
+        int leastLoaded(int except = -1) const;
+        double load(int group) const;
+    };
+
+    struct Loads
+    {
+        std::map<int, double> cameras; //< By deviceAgentId.
+        GroupLoads detection;
+        GroupLoads clip;
+    };
+
+    Loads loadsLocked(Clock::time_point now) const;
+    DevicePlacement nextLocked(const Loads& loads) const;
+    void rebalanceLocked(Clock::time_point now);
+    std::string dumpLocked(const Loads& loads) const;
+
+private:
+    const std::vector<int> m_detectionGroups;
+    const std::vector<int> m_clipGroups;
+    const std::chrono::milliseconds m_rebalancePeriod;
+
+    mutable std::mutex m_mutex;
+    std::map<int, Camera> m_cameras; //< By deviceAgentId.
+    bool m_moving = false; //< A move is waiting for its camera to report.
+    Clock::time_point m_lastRebalance = Clock::now();
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
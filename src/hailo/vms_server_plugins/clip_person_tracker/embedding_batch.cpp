@@ -0,0 +1,144 @@
+#include "embedding_batch.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CLIP_MATCHER_X86 1
+#endif
+
+namespace clip_matcher {
+
+namespace {
+
+constexpr size_t kRowAlignmentFloats = 16; // 64 bytes
+
+template <typename T>
+float dequantize_scalar(const T* in, size_t dim, float scale, float zero_point, float* out) {
+    float sum_squares = 0.0f;
+    for (size_t k = 0; k < dim; ++k) {
+        const float value = (static_cast<float>(in[k]) - zero_point) * scale;
+        out[k] = value;
+        sum_squares += value * value;
+    }
+    return sum_squares;
+}
+
+#if defined(CLIP_MATCHER_X86)
+
+__attribute__((target("avx2,fma")))
+float horizontal_sum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+// Widens 8 quantized values to float32, then (q - zp) * scale with the squares accumulated.
+__attribute__((target("avx2,fma")))
+float dequantize_uint8_avx2(const uint8_t* in, size_t dim, float scale, float zero_point, float* out) {
+    const __m256 scale_v = _mm256_set1_ps(scale);
+    const __m256 zero_point_v = _mm256_set1_ps(zero_point);
+    __m256 sum_squares = _mm256_setzero_ps();
+    size_t k = 0;
+    for (; k + 8 <= dim; k += 8) {
+        const __m128i q = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + k));
+        const __m256 values = _mm256_mul_ps(
+            _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(q)), zero_point_v), scale_v);
+        _mm256_storeu_ps(out + k, values);
+        sum_squares = _mm256_fmadd_ps(values, values, sum_squares);
+    }
+    return horizontal_sum(sum_squares) + dequantize_scalar(in + k, dim - k, scale, zero_point, out + k);
+}
+
+__attribute__((target("avx2,fma")))
+float dequantize_uint16_avx2(const uint16_t* in, size_t dim, float scale, float zero_point, float* out) {
+    const __m256 scale_v = _mm256_set1_ps(scale);
+    const __m256 zero_point_v = _mm256_set1_ps(zero_point);
+    __m256 sum_squares = _mm256_setzero_ps();
+    size_t k = 0;
+    for (; k + 8 <= dim; k += 8) {
+        const __m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + k));
+        const __m256 values = _mm256_mul_ps(
+            _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(q)), zero_point_v), scale_v);
+        _mm256_storeu_ps(out + k, values);
+        sum_squares = _mm256_fmadd_ps(values, values, sum_squares);
+    }
+    return horizontal_sum(sum_squares) + dequantize_scalar(in + k, dim - k, scale, zero_point, out + k);
+}
+
+bool cpu_has_avx2() {
+    static const bool has_avx2 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }();
+    return has_avx2;
+}
+
+#endif
+
+} // namespace
+
+float dequantize_embedding(const QuantizedEmbeddingView& view, float* out) {
+    switch (view.type) {
+        case QuantizedType::uint8: {
+            const auto* in = static_cast<const uint8_t*>(view.data);
+#if defined(CLIP_MATCHER_X86)
+            if (cpu_has_avx2())
+                return dequantize_uint8_avx2(in, view.dim, view.scale, view.zero_point, out);
+#endif
+            return dequantize_scalar(in, view.dim, view.scale, view.zero_point, out);
+        }
+        case QuantizedType::uint16: {
+            const auto* in = static_cast<const uint16_t*>(view.data);
+#if defined(CLIP_MATCHER_X86)
+            if (cpu_has_avx2())
+                return dequantize_uint16_avx2(in, view.dim, view.scale, view.zero_point, out);
+#endif
+            return dequantize_scalar(in, view.dim, view.scale, view.zero_point, out);
+        }
+        default:
+            return dequantize_scalar(static_cast<const float*>(view.data), view.dim, view.scale,
+                                     view.zero_point, out);
+    }
+}
+
+void EmbeddingBatch::reserve(size_t rows, size_t dim) {
+    const size_t stride = (dim + kRowAlignmentFloats - 1) / kRowAlignmentFloats * kRowAlignmentFloats;
+    if (m_data.size() < rows * stride)
+        m_data.resize(rows * stride);
+    m_row_scales.reserve(rows);
+}
+
+void EmbeddingBatch::clear() {
+    m_rows = 0;
+    m_dim = 0;
+    m_stride = 0;
+    m_row_scales.clear();
+}
+
+bool EmbeddingBatch::add(const QuantizedEmbeddingView& view, bool normalize) {
+    if (view.data == nullptr || view.dim == 0)
+        return false;
+    if (m_rows == 0) {
+        m_dim = view.dim;
+        m_stride = (m_dim + kRowAlignmentFloats - 1) / kRowAlignmentFloats * kRowAlignmentFloats;
+    } else if (view.dim != m_dim) {
+        return false;
+    }
+    // Grows geometrically, so only frames with more detections than ever before allocate
+    if (m_data.size() < (m_rows + 1) * m_stride)
+        m_data.resize(std::max(m_data.size() * 2, (m_rows + 1) * m_stride));
+
+    float* row = m_data.data() + m_rows * m_stride;
+    const float sum_squares = dequantize_embedding(view, row);
+    float row_scale = 1.0f;
+    if (normalize)
+        row_scale = sum_squares > 0.0f ? 1.0f / std::sqrt(sum_squares) : 0.0f;
+    m_row_scales.push_back(row_scale);
+    ++m_rows;
+    return true;
+}
+
+} // namespace clip_matcher
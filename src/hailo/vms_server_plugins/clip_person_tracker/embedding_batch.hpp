@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "aligned_allocator.hpp"
+
+// Batch of image embeddings gathered from the CLIP outputs of one frame, filled in place from the
+// raw (quantized) network outputs so the matcher can score the whole frame with one kernel call.
+
+namespace clip_matcher {
+
+enum class QuantizedType {
+    uint8,
+    uint16,
+    float32,
+};
+
+// Non-owning view of one embedding as produced by the network: value = (q - zero_point) * scale.
+struct QuantizedEmbeddingView {
+    const void* data = nullptr;
+    QuantizedType type = QuantizedType::float32;
+    size_t dim = 0;
+    float scale = 1.0f;
+    float zero_point = 0.0f;
+};
+
+class EmbeddingBatch {
+public:
+    // Preallocates room for `rows` embeddings of `dim` values, later frames with up to that many
+    // detections do not allocate.
+    void reserve(size_t rows, size_t dim);
+    void clear();
+
+    // Dequantizes `view` into a new row. The L2 norm is accumulated in the same pass and kept as a
+    // per-row scale (see row_scales()) instead of rewriting the row. Returns false, adding nothing,
+    // if the dimension differs from the rows already in the batch.
+    bool add(const QuantizedEmbeddingView& view, bool normalize = true);
+
+    size_t rows() const { return m_rows; }
+    size_t dim() const { return m_dim; }
+    // Distance in floats between consecutive rows (rows are padded to 64 bytes).
+    size_t stride() const { return m_stride; }
+    const float* data() const { return m_data.data(); }
+    // 1 / ||row|| for normalized rows, 1 otherwise. Multiplying a row's dot products by its scale
+    // gives the dot products of the normalized embedding.
+    const float* row_scales() const { return m_row_scales.data(); }
+
+private:
+    AlignedFloatVector m_data;
+    std::vector<float> m_row_scales;
+    size_t m_rows = 0;
+    size_t m_dim = 0;
+    size_t m_stride = 0;
+};
+
+// Dequantizes `view` into `out` and returns the sum of squares of the dequantized values.
+float dequantize_embedding(const QuantizedEmbeddingView& view, float* out);
+
+} // namespace clip_matcher
@@ -0,0 +1,297 @@
+#include "embedding_store.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace clip_matcher {
+
+namespace {
+
+size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+size_t element_size(EmbeddingDType dtype) {
+    return dtype == EmbeddingDType::float16 ? sizeof(uint16_t) : sizeof(float);
+}
+
+void write_padding(std::ofstream& file, size_t target_offset) {
+    static const char zeros[kEmbeddingStoreAlignment] = {};
+    size_t position = static_cast<size_t>(file.tellp());
+    while (position < target_offset) {
+        size_t chunk = std::min(target_offset - position, sizeof(zeros));
+        file.write(zeros, chunk);
+        position += chunk;
+    }
+}
+
+} // namespace
+
+void collapse_template_embeddings(const float* rows, size_t count, size_t dim, float* out) {
+    std::fill(out, out + dim, 0.0f);
+    for (size_t row = 0; row < count; ++row) {
+        for (size_t k = 0; k < dim; ++k) {
+            out[k] += rows[row * dim + k];
+        }
+    }
+    float sum_squares = 0.0f;
+    for (size_t k = 0; k < dim; ++k) {
+        sum_squares += out[k] * out[k];
+    }
+    if (sum_squares > 0.0f) {
+        const float inverse_norm = 1.0f / std::sqrt(sum_squares);
+        for (size_t k = 0; k < dim; ++k) {
+            out[k] *= inverse_norm;
+        }
+    }
+}
+
+uint16_t float_to_half(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    const uint32_t float_exponent = (bits >> 23) & 0xffu;
+    uint32_t mantissa = bits & 0x7fffffu;
+
+    if (float_exponent == 0xffu) // inf or nan
+        return static_cast<uint16_t>(sign | 0x7c00u | (mantissa != 0 ? 0x200u : 0u));
+
+    const int32_t exponent = static_cast<int32_t>(float_exponent) - 127 + 15;
+    if (exponent >= 31) // too large, round to inf
+        return static_cast<uint16_t>(sign | 0x7c00u);
+
+    if (exponent <= 0) { // subnormal half (or zero)
+        if (exponent < -10)
+            return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000u;
+        const uint32_t shift = static_cast<uint32_t>(14 - exponent);
+        uint32_t half_mantissa = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half_mantissa & 1u)))
+            ++half_mantissa;
+        return static_cast<uint16_t>(sign | half_mantissa);
+    }
+
+    uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    const uint32_t remainder = mantissa & 0x1fffu;
+    // Round to nearest even, a carry correctly moves into the exponent
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u)))
+        ++half;
+    return static_cast<uint16_t>(half);
+}
+
+float half_to_float(uint16_t value) {
+    const uint32_t sign = static_cast<uint32_t>(value & 0x8000u) << 16;
+    const uint32_t exponent = (value >> 10) & 0x1fu;
+    const uint32_t mantissa = value & 0x3ffu;
+
+    if (exponent == 0) {
+        const float magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -magnitude : magnitude;
+    }
+    uint32_t bits;
+    if (exponent == 31)
+        bits = sign | 0x7f800000u | (mantissa << 13);
+    else
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+std::string create_temp_file_for(const std::string& path) {
+    std::string temp_path = path + ".XXXXXX";
+    const int fd = ::mkstemp(temp_path.data());
+    if (fd < 0)
+        throw std::runtime_error("Cannot create a temporary file for " + path);
+    ::fchmod(fd, 0644);
+    ::close(fd);
+    return temp_path;
+}
+
+EmbeddingStoreSource embedding_store_source(const std::string& path) {
+    EmbeddingStoreSource source;
+    struct stat file_stat = {};
+    if (::stat(path.c_str(), &file_stat) != 0)
+        return source;
+    source.size = static_cast<uint64_t>(file_stat.st_size);
+    source.mtime_ns = int64_t(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+    source.inode = static_cast<uint64_t>(file_stat.st_ino);
+    return source;
+}
+
+void write_embedding_store(const std::string& path, const EmbeddingStoreContents& contents,
+                           EmbeddingDType dtype) {
+    const size_t count = contents.entries.size();
+    if (contents.embeddings.size() != count * contents.dim)
+        throw std::runtime_error("Embedding store: embeddings size does not match entries x dim");
+
+    // String table: text prefix first, then every prompt text
+    std::string strings = contents.text_prefix;
+    std::vector<EmbeddingStoreRecord> records(count);
+    for (size_t i = 0; i < count; ++i) {
+        const EmbeddingStoreEntry& entry = contents.entries[i];
+        records[i].text_offset = static_cast<uint32_t>(strings.size());
+        records[i].text_size = static_cast<uint32_t>(entry.text.size());
+        records[i].flags = (entry.negative ? kRecordNegative : 0u) | (entry.ensemble ? kRecordEnsemble : 0u);
+        records[i].template_count = entry.template_count;
+        strings += entry.text;
+    }
+
+    EmbeddingStoreHeader header = {};
+    std::memcpy(header.magic, kEmbeddingStoreMagic, sizeof(header.magic));
+    header.version = kEmbeddingStoreVersion;
+    header.header_size = sizeof(EmbeddingStoreHeader);
+    header.dim = contents.dim;
+    header.count = static_cast<uint32_t>(count);
+    header.dtype = static_cast<uint32_t>(dtype);
+    header.threshold = contents.threshold;
+    header.records_offset = align_up(sizeof(EmbeddingStoreHeader), alignof(EmbeddingStoreRecord));
+    header.embeddings_offset = align_up(header.records_offset + count * sizeof(EmbeddingStoreRecord),
+                                        kEmbeddingStoreAlignment);
+    header.strings_offset = header.embeddings_offset + count * contents.dim * element_size(dtype);
+    header.strings_size = strings.size();
+    header.text_prefix_offset = 0;
+    header.text_prefix_size = static_cast<uint32_t>(contents.text_prefix.size());
+    header.file_size = header.strings_offset + header.strings_size;
+    header.source = contents.source;
+
+    // A temporary name of its own: several matchers may convert the same JSON file at once
+    const std::string temp_path = create_temp_file_for(path);
+    const auto fail = [&temp_path](const std::string& message) {
+        std::error_code error;
+        std::filesystem::remove(temp_path, error);
+        return std::runtime_error(message);
+    };
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            throw fail("Embedding store: cannot create " + temp_path);
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        write_padding(file, header.records_offset);
+        file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(EmbeddingStoreRecord));
+        write_padding(file, header.embeddings_offset);
+        if (dtype == EmbeddingDType::float16) {
+            std::vector<uint16_t> halves(contents.embeddings.size());
+            for (size_t i = 0; i < halves.size(); ++i) {
+                halves[i] = float_to_half(contents.embeddings[i]);
+            }
+            file.write(reinterpret_cast<const char*>(halves.data()), halves.size() * sizeof(uint16_t));
+        } else {
+            file.write(reinterpret_cast<const char*>(contents.embeddings.data()),
+                       contents.embeddings.size() * sizeof(float));
+        }
+        file.write(strings.data(), strings.size());
+        if (!file)
+            throw fail("Embedding store: failed writing " + temp_path);
+    }
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+    if (error)
+        throw fail("Embedding store: cannot rename " + temp_path + ": " + error.message());
+}
+
+std::shared_ptr<const MappedEmbeddingStore> MappedEmbeddingStore::open(const std::string& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Embedding store: cannot open " + path);
+    struct stat file_stat = {};
+    if (::fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(sizeof(EmbeddingStoreHeader))) {
+        ::close(fd);
+        throw std::runtime_error("Embedding store: " + path + " is too small");
+    }
+    const size_t size = static_cast<size_t>(file_stat.st_size);
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Embedding store: cannot map " + path);
+    // The whole file is read on the first match anyway
+    ::madvise(mapping, size, MADV_WILLNEED);
+
+    std::shared_ptr<MappedEmbeddingStore> store(new MappedEmbeddingStore());
+    store->m_mapping = mapping;
+    store->m_size = size;
+
+    const auto* base = static_cast<const unsigned char*>(mapping);
+    const auto* header = reinterpret_cast<const EmbeddingStoreHeader*>(base);
+    const auto invalid = [&path](const char* reason) {
+        return std::runtime_error("Embedding store: " + path + " is invalid: " + reason);
+    };
+    if (std::memcmp(header->magic, kEmbeddingStoreMagic, sizeof(header->magic)) != 0)
+        throw invalid("bad magic");
+    if (header->version != kEmbeddingStoreVersion || header->header_size != sizeof(EmbeddingStoreHeader))
+        throw invalid("unsupported version");
+    if (header->file_size != size)
+        throw invalid("truncated file");
+    if (header->dtype != static_cast<uint32_t>(EmbeddingDType::float32)
+        && header->dtype != static_cast<uint32_t>(EmbeddingDType::float16))
+        throw invalid("unknown embedding type");
+
+    const uint64_t records_end = header->records_offset + uint64_t(header->count) * sizeof(EmbeddingStoreRecord);
+    const uint64_t embeddings_size = uint64_t(header->count) * header->dim
+        * element_size(static_cast<EmbeddingDType>(header->dtype));
+    if (header->records_offset % alignof(EmbeddingStoreRecord) != 0 || records_end > size)
+        throw invalid("bad record table");
+    if (header->embeddings_offset % kEmbeddingStoreAlignment != 0 || header->embeddings_offset < records_end
+        || header->embeddings_offset + embeddings_size > size)
+        throw invalid("bad embedding block");
+    if (header->strings_offset + header->strings_size > size
+        || uint64_t(header->text_prefix_offset) + header->text_prefix_size > header->strings_size)
+        throw invalid("bad string table");
+
+    const auto* records = reinterpret_cast<const EmbeddingStoreRecord*>(base + header->records_offset);
+    for (uint32_t i = 0; i < header->count; ++i) {
+        if (uint64_t(records[i].text_offset) + records[i].text_size > header->strings_size)
+            throw invalid("bad prompt text");
+    }
+
+    store->m_header = header;
+    store->m_records = records;
+    store->m_embeddings = base + header->embeddings_offset;
+    store->m_strings = reinterpret_cast<const char*>(base + header->strings_offset);
+    return store;
+}
+
+MappedEmbeddingStore::~MappedEmbeddingStore() {
+    if (m_mapping != nullptr)
+        ::munmap(m_mapping, m_size);
+}
+
+std::string_view MappedEmbeddingStore::text_prefix() const {
+    return std::string_view(m_strings + m_header->text_prefix_offset, m_header->text_prefix_size);
+}
+
+std::string_view MappedEmbeddingStore::text(size_t index) const {
+    return std::string_view(m_strings + m_records[index].text_offset, m_records[index].text_size);
+}
+
+const float* MappedEmbeddingStore::float32_embeddings() const {
+    if (dtype() != EmbeddingDType::float32)
+        return nullptr;
+    return reinterpret_cast<const float*>(m_embeddings);
+}
+
+void MappedEmbeddingStore::copy_embedding(size_t index, float* out) const {
+    const size_t dim = m_header->dim;
+    if (dtype() == EmbeddingDType::float32) {
+        std::memcpy(out, m_embeddings + index * dim * sizeof(float), dim * sizeof(float));
+        return;
+    }
+    const auto* halves = reinterpret_cast<const uint16_t*>(m_embeddings) + index * dim;
+    for (size_t k = 0; k < dim; ++k) {
+        out[k] = half_to_float(halves[k]);
+    }
+}
+
+} // namespace clip_matcher
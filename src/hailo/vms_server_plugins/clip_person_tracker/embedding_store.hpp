@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Compact binary file holding a set of prompt embeddings, memory-mapped by TextImageMatcher instead
+// of parsing nx_text_embedding.json.
+//
+// Layout (little-endian, all offsets from the start of the file):
+//     EmbeddingStoreHeader
+//     EmbeddingStoreRecord[count]         one per prompt
+//     embeddings                          count x dim float32 or float16, 64-byte aligned
+//     string table                        text prefix and prompt texts, not null-terminated
+
+namespace clip_matcher {
+
+enum class EmbeddingDType : uint32_t {
+    float32 = 0,
+    float16 = 1,
+};
+
+// Identity of the JSON file a store was converted from, to tell whether the store is still fresh.
+// Size and modification time (in nanoseconds) alone could miss a same-size rewrite within one
+// timestamp tick; the inode changes whenever the file is replaced through a rename, as the
+// text_image_matcher output and export_json_embeddings are.
+struct EmbeddingStoreSource {
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    uint64_t inode = 0;
+
+    bool operator==(const EmbeddingStoreSource& other) const {
+        return size == other.size && mtime_ns == other.mtime_ns && inode == other.inode;
+    }
+    bool operator!=(const EmbeddingStoreSource& other) const { return !(*this == other); }
+};
+
+// Identity of the file at `path`, all zeros if it cannot be read.
+EmbeddingStoreSource embedding_store_source(const std::string& path);
+
+// Creates an empty file of a unique name in the directory of `path`, to be written and then renamed
+// over `path`. Throws std::runtime_error on failure.
+std::string create_temp_file_for(const std::string& path);
+
+struct EmbeddingStoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t dim;
+    uint32_t count;
+    uint32_t dtype; // EmbeddingDType
+    float threshold;
+    uint64_t records_offset;
+    uint64_t embeddings_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint32_t text_prefix_offset; // relative to strings_offset
+    uint32_t text_prefix_size;
+    uint64_t file_size;
+    EmbeddingStoreSource source; // all zeros if not converted from a file
+};
+
+struct EmbeddingStoreRecord {
+    uint32_t text_offset; // relative to strings_offset
+    uint32_t text_size;
+    uint32_t flags; // EmbeddingStoreRecordFlags
+    uint32_t template_count; // template rows averaged into this embedding, 0 if not ensembled
+};
+
+enum EmbeddingStoreRecordFlags : uint32_t {
+    kRecordNegative = 1u << 0,
+    kRecordEnsemble = 1u << 1,
+};
+
+constexpr char kEmbeddingStoreMagic[8] = {'H', 'C', 'L', 'I', 'P', 'E', 'M', 'B'};
+// 3: ensembled rows are collapsed from their ensemble templates when they can be encoded
+constexpr uint32_t kEmbeddingStoreVersion = 3;
+constexpr size_t kEmbeddingStoreAlignment = 64;
+
+// Extension of the binary store written next to an imported JSON file.
+constexpr const char* kEmbeddingStoreExtension = ".bin";
+
+struct EmbeddingStoreEntry {
+    std::string text;
+    bool negative = false;
+    bool ensemble = false;
+    uint32_t template_count = 0;
+};
+
+// In-memory contents of a store, used to write one.
+struct EmbeddingStoreContents {
+    uint32_t dim = 0;
+    float threshold = 0.5f;
+    std::string text_prefix;
+    std::vector<EmbeddingStoreEntry> entries;
+    std::vector<float> embeddings; // entries.size() x dim, row-major
+    EmbeddingStoreSource source; // of the file the contents were read from, if any
+    std::vector<std::string> ensemble_templates; // of the JSON file, not kept in the store
+};
+
+// Writes `contents` to `path` through a temporary file of a unique name and a rename, so a store that
+// is mapped by a running matcher is never modified in place, and concurrent writers of the same store
+// never mix their bytes. Throws std::runtime_error on failure.
+void write_embedding_store(const std::string& path, const EmbeddingStoreContents& contents,
+                           EmbeddingDType dtype = EmbeddingDType::float32);
+
+// Read-only memory mapping of a store file. The file is validated once on open; all accessors are
+// then plain pointer reads into the mapping.
+class MappedEmbeddingStore {
+public:
+    // Throws std::runtime_error if the file cannot be mapped or is not a valid store.
+    static std::shared_ptr<const MappedEmbeddingStore> open(const std::string& path);
+
+    ~MappedEmbeddingStore();
+    MappedEmbeddingStore(const MappedEmbeddingStore&) = delete;
+    MappedEmbeddingStore& operator=(const MappedEmbeddingStore&) = delete;
+
+    uint32_t dim() const { return m_header->dim; }
+    uint32_t count() const { return m_header->count; }
+    float threshold() const { return m_header->threshold; }
+    EmbeddingDType dtype() const { return static_cast<EmbeddingDType>(m_header->dtype); }
+    const EmbeddingStoreSource& source() const { return m_header->source; }
+    std::string_view text_prefix() const;
+
+    std::string_view text(size_t index) const;
+    bool negative(size_t index) const { return (m_records[index].flags & kRecordNegative) != 0; }
+    bool ensemble(size_t index) const { return (m_records[index].flags & kRecordEnsemble) != 0; }
+    uint32_t template_count(size_t index) const { return m_records[index].template_count; }
+
+    // count() x dim() float32 matrix inside the mapping, or nullptr if the store holds float16.
+    const float* float32_embeddings() const;
+    // Decodes row `index` into `out` (dim() floats) whatever the stored type.
+    void copy_embedding(size_t index, float* out) const;
+
+private:
+    MappedEmbeddingStore() = default;
+
+    void* m_mapping = nullptr;
+    size_t m_size = 0;
+    const EmbeddingStoreHeader* m_header = nullptr;
+    const EmbeddingStoreRecord* m_records = nullptr;
+    const unsigned char* m_embeddings = nullptr;
+    const char* m_strings = nullptr;
+};
+
+// Averages `count` template embeddings (`dim` floats each, e.g. one per ensemble_template of a
+// prompt) into `out` and renormalizes the result, so an ensembled prompt is matched as one row.
+void collapse_template_embeddings(const float* rows, size_t count, size_t dim, float* out);
+
+uint16_t float_to_half(float value);
+float half_to_float(uint16_t value);
+
+} // namespace clip_matcher
@@ -5,6 +5,8 @@
 #include "device_agent.h"
 #include "hailo_clip_plugin_ini.h"
 
+#include <algorithm>
+
 #include <nx/kit/json.h>
 
 namespace hailo {
@@ -16,11 +18,34 @@ using namespace nx::sdk::analytics;
 
 int Engine::m_DeviceManagerCounter = 0;
 
+const std::vector<std::string> kDefaultTextSettings = {
+    "man with a striped shirt", "man with blue jeans", "man with red hat", "man", "woman"};
+const std::string kDefaultTextPrefix = "A photo of a ";
+
 Engine::Engine(std::filesystem::path pluginHomeDir):
     // Call the DeviceAgent helper class constructor telling it to verbosely report to stderr.
     nx::sdk::analytics::Engine(ini().enableOutput),
-    m_pluginHomeDir(pluginHomeDir)
+    m_pluginHomeDir(pluginHomeDir),
+    m_promptEncoder(std::make_shared<PromptEncoder>(pluginHomeDir, "RN50x4")),
+    m_settingsWorker(std::make_shared<SettingsWorker>())
 {
+    // The default prompts are applied by every new camera, have them ready
+    m_promptEncoder->prewarm(kDefaultTextPrefix, kDefaultTextSettings);
+    // The networks of every camera are placed on the least loaded vdevice groups
+    m_deviceScheduler = std::make_shared<DeviceScheduler>(
+        PipelineConfig::load(m_pluginHomeDir), ini().deviceRebalancePeriodMs);
+    // Cameras batch their frames together in one pipeline, the pipeline starts with the first camera
+    if (ini().sharedPipelineCameras > 0)
+    {
+        m_sharedPipeline = std::make_shared<SharedPipeline>(m_pluginHomeDir, ini().sharedPipelineCameras,
+            m_deviceScheduler->firstGroups(), std::max(2, ini().sharedPipelineWidth) & ~1,
+            std::max(2, ini().sharedPipelineHeight) & ~1);
+    }
+    // The cameras beyond the shared pipeline find a pipeline of their own started
+    m_pipelinePool = std::make_shared<PipelinePool>(m_pluginHomeDir, ini().warmPipelines, m_deviceScheduler);
+    // Frames out of the pipelines are matched off their streaming threads
+    if (ini().matcherWorkers > 0)
+        m_matcherPool = std::make_shared<MatcherPool>(ini().matcherWorkers, ini().matcherQueueDepth);
 }
 
 Engine::~Engine()
@@ -39,7 +64,9 @@ Engine::~Engine()
 void Engine::doObtainDeviceAgent(Result<IDeviceAgent*>* outResult, const IDeviceInfo* deviceInfo)
 {
     std::cout << "m_DeviceManagerCounter: " << m_DeviceManagerCounter << std::endl;
-    *outResult = new DeviceAgent(deviceInfo, m_pluginHomeDir, m_DeviceManagerCounter);
+    *outResult = new DeviceAgent(
+        deviceInfo, m_pluginHomeDir, m_DeviceManagerCounter, m_promptEncoder, m_settingsWorker,
+        m_deviceScheduler, m_sharedPipeline, m_pipelinePool, m_matcherPool);
     m_DeviceManagerCounter++;
 }
 
@@ -65,7 +92,7 @@ std::string Engine::manifestString() const
     // check if the json file exists
     std::string jsonPath = m_pluginHomeDir.string() + "resources/nx_text_embedding.json";
     
-    std::vector<std::string> defaultValues = {"man with a striped shirt", "man with blue jeans", "man with red hat", "man", "woman"};
+    const std::vector<std::string>& defaultValues = kDefaultTextSettings;
     
     
     Json::object textSetting = {
@@ -3,15 +3,29 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include <nx/sdk/analytics/helpers/plugin.h>
 #include <nx/sdk/analytics/helpers/engine.h>
 #include <nx/sdk/analytics/i_uncompressed_video_frame.h>
 
+#include "device_scheduler.h"
+#include "matcher_pool.h"
+#include "pipeline_pool.h"
+#include "prompt_encoder.h"
+#include "settings_worker.h"
+#include "shared_pipeline.h"
+
 namespace hailo {
 namespace vms_server_plugins {
 namespace clip_person_tracker {
 
+/** Text prompts of a new camera, also the prompts the prompt cache is prewarmed with. */
+extern const std::vector<std::string> kDefaultTextSettings;
+extern const std::string kDefaultTextPrefix;
+
 class Engine: public nx::sdk::analytics::Engine
 {
 public:
@@ -29,6 +43,12 @@ protected:
 
 private:
     std::filesystem::path m_pluginHomeDir;
+    std::shared_ptr<PromptEncoder> m_promptEncoder; // Shared by the DeviceAgents
+    std::shared_ptr<SettingsWorker> m_settingsWorker; // Applies the settings of every DeviceAgent
+    std::shared_ptr<DeviceScheduler> m_deviceScheduler; // Places the networks of the cameras on the vdevice groups
+    std::shared_ptr<SharedPipeline> m_sharedPipeline; // Inference of the first cameras, null if disabled
+    std::shared_ptr<PipelinePool> m_pipelinePool; // Pipelines of the cameras without a shared lane
+    std::shared_ptr<MatcherPool> m_matcherPool; // Matching of every camera, null to match on the streaming threads
     // Add counter to allow to instantiate every device agent with a unique ID
     static int m_DeviceManagerCounter;
 
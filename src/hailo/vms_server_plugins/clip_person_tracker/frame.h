@@ -22,13 +22,16 @@ struct Frame
     const int64_t timestampUs;
     const int64_t index;
     cv::Mat cvMat;
+    /** Frame the data belongs to, not owned: add a ref to use the data after the Frame is gone. */
+    const nx::sdk::analytics::IUncompressedVideoFrame* const videoFrame;
 
 public:
     Frame(const nx::sdk::analytics::IUncompressedVideoFrame* frame, int64_t index):      
         width(frame->width()),
         height(frame->height()),
         timestampUs(frame->timestampUs()),
-        index(index)
+        index(index),
+        videoFrame(frame)
     {    
         cvMat = cv::Mat(
         /*_rows*/ frame->height(),
@@ -0,0 +1,283 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "frame_ingest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+namespace {
+
+constexpr size_t kBytesPerPixel = 3; //< RGB
+
+void releasePool(GstBufferPool* pool)
+{
+    // Buffers still in the pipeline keep the pool alive until they are returned
+    gst_buffer_pool_set_active(pool, FALSE);
+    gst_object_unref(pool);
+}
+
+} // namespace
+
+/** Ref to a frame held by a zero-copy GstBuffer, released from the buffer's destroy notify. */
+struct FrameIngest::WrappedFrame
+{
+    const nx::sdk::analytics::IUncompressedVideoFrame* videoFrame;
+    std::shared_ptr<SharedCounters> counters;
+};
+
+FrameIngest::FrameIngest(int maxWidth, int maxHeight, int poolBuffers, bool zeroCopy, bool fixedSize):
+    m_maxWidth(maxWidth),
+    m_maxHeight(maxHeight),
+    m_poolBuffers(poolBuffers),
+    m_zeroCopy(zeroCopy),
+    m_fixedSize(fixedSize)
+{
+}
+
+FrameIngest::~FrameIngest()
+{
+    if (m_pool)
+        releasePool(m_pool);
+    if (m_caps)
+        gst_caps_unref(m_caps);
+}
+
+GstBuffer* FrameIngest::makeBuffer(const Frame& frame)
+{
+    if (frame.width <= 0 || frame.height <= 0)
+        return nullptr;
+    if (frame.width != m_inputWidth || frame.height != m_inputHeight)
+        configure(frame.width, frame.height);
+
+    const size_t lineSize = static_cast<size_t>(frame.videoFrame->lineSize(0));
+    const size_t dataSize = static_cast<size_t>(frame.videoFrame->dataSize(0));
+    const size_t rowBytes = static_cast<size_t>(m_inputWidth) * kBytesPerPixel;
+    if (lineSize < rowBytes || dataSize < lineSize * (m_inputHeight - 1) + rowBytes)
+    {
+        std::cout << "Frame ingest: frame data too small for " << m_inputWidth << "x" << m_inputHeight
+            << " RGB, line size " << lineSize << std::endl;
+        m_counters->droppedFrames.fetch_add(1);
+        return nullptr;
+    }
+    const bool resized = m_outputWidth != m_inputWidth || m_outputHeight != m_inputHeight
+        || m_contentWidth != m_outputWidth || m_contentHeight != m_outputHeight;
+    // Rows padded differently than GStreamer expects would shift every row of the image
+    if (m_zeroCopy && !resized && lineSize == m_stride && dataSize >= m_stride * m_outputHeight)
+        return wrap(frame);
+    return copy(frame);
+}
+
+FrameIngest::Counters FrameIngest::counters() const
+{
+    Counters result;
+    result.zeroCopyFrames = m_counters->zeroCopyFrames.load();
+    result.copiedFrames = m_counters->copiedFrames.load();
+    result.resizedFrames = m_counters->resizedFrames.load();
+    result.resizeUs = m_counters->resizeUs.load();
+    result.droppedFrames = m_counters->droppedFrames.load();
+    result.outstandingFrames = m_counters->outstandingFrames.load();
+    result.inputWidth = m_inputWidth;
+    result.inputHeight = m_inputHeight;
+    result.outputWidth = m_outputWidth;
+    result.outputHeight = m_outputHeight;
+    return result;
+}
+
+FrameIngest::Content FrameIngest::content() const
+{
+    Content result;
+    if (m_outputWidth <= 0 || m_outputHeight <= 0)
+        return result;
+    result.x = float(m_contentX) / m_outputWidth;
+    result.y = float(m_contentY) / m_outputHeight;
+    result.width = float(m_contentWidth) / m_outputWidth;
+    result.height = float(m_contentHeight) / m_outputHeight;
+    return result;
+}
+
+/** Picks the output resolution of a new input resolution and sets up its caps and buffer pool. */
+void FrameIngest::configure(int inputWidth, int inputHeight)
+{
+    m_inputWidth = inputWidth;
+    m_inputHeight = inputHeight;
+    double scale = 1.0;
+    if (m_maxWidth > 0 && inputWidth > m_maxWidth)
+        scale = std::min(scale, double(m_maxWidth) / inputWidth);
+    if (m_maxHeight > 0 && inputHeight > m_maxHeight)
+        scale = std::min(scale, double(m_maxHeight) / inputHeight);
+    m_outputWidth = inputWidth;
+    m_outputHeight = inputHeight;
+    m_contentX = 0;
+    m_contentY = 0;
+    if (m_fixedSize)
+    {
+        // Scaled up as well as down, into the middle of the fixed frame
+        m_outputWidth = m_maxWidth;
+        m_outputHeight = m_maxHeight;
+        const double fit = std::min(double(m_maxWidth) / inputWidth, double(m_maxHeight) / inputHeight);
+        m_contentWidth = std::clamp(int(inputWidth * fit + 0.5), 1, m_maxWidth);
+        m_contentHeight = std::clamp(int(inputHeight * fit + 0.5), 1, m_maxHeight);
+        m_contentX = (m_maxWidth - m_contentWidth) / 2;
+        m_contentY = (m_maxHeight - m_contentHeight) / 2;
+    }
+    else if (scale < 1.0)
+    {
+        // Even sizes, as the crop and resize elements downstream prefer them
+        m_outputWidth = std::max(2, int(inputWidth * scale) & ~1);
+        m_outputHeight = std::max(2, int(inputHeight * scale) & ~1);
+    }
+    if (!m_fixedSize)
+    {
+        m_contentWidth = m_outputWidth;
+        m_contentHeight = m_outputHeight;
+    }
+    m_stride = GST_ROUND_UP_4(static_cast<size_t>(m_outputWidth) * kBytesPerPixel);
+    std::cout << "Frame ingest: camera input " << inputWidth << "x" << inputHeight << ", fed to the pipeline as "
+        << m_outputWidth << "x" << m_outputHeight;
+    if (m_contentWidth != m_outputWidth || m_contentHeight != m_outputHeight)
+    {
+        std::cout << " (letterboxed, image " << m_contentWidth << "x" << m_contentHeight << " at " << m_contentX
+            << "," << m_contentY << ")";
+    }
+    std::cout << std::endl;
+
+    if (m_caps)
+        gst_caps_unref(m_caps);
+    m_caps = gst_caps_new_simple("video/x-raw",
+        "format", G_TYPE_STRING, "RGB",
+        "width", G_TYPE_INT, m_outputWidth,
+        "height", G_TYPE_INT, m_outputHeight,
+        NULL);
+    ++m_capsGeneration;
+
+    if (m_pool)
+    {
+        releasePool(m_pool);
+        m_pool = nullptr;
+    }
+    if (m_poolBuffers <= 0)
+        return;
+    m_pool = gst_buffer_pool_new();
+    GstStructure* config = gst_buffer_pool_get_config(m_pool);
+    gst_buffer_pool_config_set_params(config, m_caps, static_cast<guint>(m_stride * m_outputHeight),
+        /*min_buffers*/ 0, /*max_buffers*/ static_cast<guint>(m_poolBuffers));
+    if (!gst_buffer_pool_set_config(m_pool, config) || !gst_buffer_pool_set_active(m_pool, TRUE))
+    {
+        std::cout << "Frame ingest: cannot set up a pool of " << m_poolBuffers
+            << " buffers, allocating a buffer per copied frame" << std::endl;
+        gst_object_unref(m_pool);
+        m_pool = nullptr;
+    }
+}
+
+/** Empty output buffer, null when the pool is exhausted. */
+GstBuffer* FrameIngest::acquire()
+{
+    GstBuffer* buffer = nullptr;
+    if (!m_pool)
+        return gst_buffer_new_allocate(nullptr, m_stride * m_outputHeight, nullptr);
+    // Never block the caller: an exhausted pool means the pipeline is behind anyway
+    GstBufferPoolAcquireParams params = {};
+    params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+    if (gst_buffer_pool_acquire_buffer(m_pool, &buffer, &params) != GST_FLOW_OK)
+        return nullptr;
+    return buffer;
+}
+
+GstBuffer* FrameIngest::wrap(const Frame& frame)
+{
+    frame.videoFrame->addRef();
+    auto* wrapped = new WrappedFrame{frame.videoFrame, m_counters};
+    m_counters->outstandingFrames.fetch_add(1);
+    m_counters->zeroCopyFrames.fetch_add(1);
+    const size_t size = m_stride * m_outputHeight;
+    return gst_buffer_new_wrapped_full(
+        (GstMemoryFlags) GST_MEMORY_FLAG_READONLY,
+        (gpointer) frame.videoFrame->data(0),
+        size,
+        /*offset*/ 0,
+        size,
+        wrapped,
+        &FrameIngest::releaseWrappedFrame);
+}
+
+GstBuffer* FrameIngest::copy(const Frame& frame)
+{
+    GstBuffer* buffer = acquire();
+    if (!buffer)
+    {
+        m_counters->droppedFrames.fetch_add(1);
+        return nullptr;
+    }
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_WRITE))
+    {
+        gst_buffer_unref(buffer);
+        m_counters->droppedFrames.fetch_add(1);
+        return nullptr;
+    }
+
+    // The borders of a pooled buffer may hold the image of another resolution
+    if (m_contentWidth != m_outputWidth || m_contentHeight != m_outputHeight)
+        clearBorders(map.data);
+    uint8_t* content = map.data + m_contentY * m_stride + m_contentX * kBytesPerPixel;
+    if (m_contentWidth == m_inputWidth && m_contentHeight == m_inputHeight)
+    {
+        const auto* source = static_cast<const uint8_t*>(frame.videoFrame->data(0));
+        const size_t lineSize = static_cast<size_t>(frame.videoFrame->lineSize(0));
+        const size_t rowBytes = static_cast<size_t>(m_contentWidth) * kBytesPerPixel;
+        for (int row = 0; row < m_contentHeight; ++row)
+            std::memcpy(content + row * m_stride, source + row * lineSize, rowBytes);
+        m_counters->copiedFrames.fetch_add(1);
+    }
+    else
+    {
+        // Bilinear is the fastest of the cv::resize() filters that stays sharp enough for detection
+        const auto startTime = std::chrono::steady_clock::now();
+        cv::Mat output(m_contentHeight, m_contentWidth, CV_8UC3, content, m_stride);
+        cv::resize(frame.cvMat, output, output.size(), 0, 0, cv::INTER_LINEAR);
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - startTime);
+        m_counters->resizeUs.fetch_add(static_cast<uint64_t>(elapsed.count()));
+        m_counters->resizedFrames.fetch_add(1);
+    }
+    gst_buffer_unmap(buffer, &map);
+    return buffer;
+}
+
+/** Blacks out the output around the camera image of a letterboxed frame. */
+void FrameIngest::clearBorders(uint8_t* data) const
+{
+    const size_t rowBytes = static_cast<size_t>(m_outputWidth) * kBytesPerPixel;
+    const size_t leftBytes = static_cast<size_t>(m_contentX) * kBytesPerPixel;
+    const size_t contentBytes = static_cast<size_t>(m_contentWidth) * kBytesPerPixel;
+    for (int row = 0; row < m_outputHeight; ++row)
+    {
+        uint8_t* line = data + row * m_stride;
+        if (row < m_contentY || row >= m_contentY + m_contentHeight)
+        {
+            std::memset(line, 0, rowBytes);
+            continue;
+        }
+        std::memset(line, 0, leftBytes);
+        std::memset(line + leftBytes + contentBytes, 0, rowBytes - leftBytes - contentBytes);
+    }
+}
+
+void FrameIngest::releaseWrappedFrame(gpointer data)
+{
+    auto* wrapped = static_cast<WrappedFrame*>(data);
+    wrapped->counters->outstandingFrames.fetch_sub(1);
+    wrapped->videoFrame->releaseRef();
+    delete wrapped;
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,135 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include <gst/gst.h>
+
+#include "frame.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/**
+ * Turns the frames of a camera into GstBuffers for the appsrc of its pipeline.
+ *
+ * Frames are fed at their own resolution, or scaled down to fit maxWidth x maxHeight (keeping the
+ * aspect ratio) when larger. The output resolution follows the camera: the caller renegotiates the
+ * appsrc caps when capsGeneration() changes. With fixedSize, frames are instead always fed at
+ * maxWidth x maxHeight, for an appsrc whose caps cannot change (the lanes of the SharedPipeline):
+ * they are scaled to fit keeping their aspect ratio, and centered between black borders
+ * (letterboxed). The detections are then relative to the whole output frame, content() maps them
+ * back onto the camera image.
+ *
+ * A frame fed at its own resolution whose rows are laid out like GStreamer expects them (line size
+ * equal to the default stride of the caps) is wrapped without copying: the buffer holds a ref to
+ * the IUncompressedVideoFrame and releases it from its destroy notify, so the queues downstream
+ * can keep it for as long as they need. Other frames are copied or resized into packed buffers,
+ * taken from a bounded GstBufferPool when one is configured.
+ */
+class FrameIngest
+{
+public:
+    /** Counters of the frames made so far; the resolutions are those of the last frame. */
+    struct Counters
+    {
+        uint64_t zeroCopyFrames = 0;
+        uint64_t copiedFrames = 0;
+        uint64_t resizedFrames = 0;
+        uint64_t resizeUs = 0; //< Total time spent resizing.
+        uint64_t droppedFrames = 0; //< The buffer pool was exhausted, or the frame data was short.
+        int64_t outstandingFrames = 0; //< Wrapped frames still referenced by the pipeline.
+        int inputWidth = 0;
+        int inputHeight = 0;
+        int outputWidth = 0;
+        int outputHeight = 0;
+    };
+
+    /** Part of the output frame covered by the camera image, relative to the output frame. */
+    struct Content
+    {
+        float x = 0.0f;
+        float y = 0.0f;
+        float width = 1.0f;
+        float height = 1.0f;
+    };
+
+    /**
+     * @param maxWidth, maxHeight Larger frames are scaled down to fit, 0 never scales.
+     * @param poolBuffers Size of the buffer pool of the copy path, 0 allocates a buffer per copy.
+     * @param zeroCopy False copies every frame.
+     * @param fixedSize Feeds every frame at maxWidth x maxHeight, both must then be positive.
+     */
+    FrameIngest(int maxWidth, int maxHeight, int poolBuffers, bool zeroCopy, bool fixedSize);
+    ~FrameIngest();
+
+    FrameIngest(const FrameIngest&) = delete;
+    FrameIngest& operator=(const FrameIngest&) = delete;
+
+    /**
+     * @return Buffer with the RGB data of `frame` at the resolution of outputCaps(), owned by the
+     *     caller, or null if the frame was dropped.
+     */
+    GstBuffer* makeBuffer(const Frame& frame);
+
+    /** Caps of the buffers of the last makeBuffer(), null before the first frame. Not a new ref. */
+    GstCaps* outputCaps() const { return m_caps; }
+    /** Changes every time outputCaps() does. */
+    uint64_t capsGeneration() const { return m_capsGeneration; }
+
+    /** Of the buffers of the last makeBuffer(); changes only when capsGeneration() does. */
+    Content content() const;
+
+    Counters counters() const;
+
+private:
+    struct SharedCounters
+    {
+        std::atomic<uint64_t> zeroCopyFrames{0};
+        std::atomic<uint64_t> copiedFrames{0};
+        std::atomic<uint64_t> resizedFrames{0};
+        std::atomic<uint64_t> resizeUs{0};
+        std::atomic<uint64_t> droppedFrames{0};
+        std::atomic<int64_t> outstandingFrames{0};
+    };
+    struct WrappedFrame;
+
+    void configure(int inputWidth, int inputHeight);
+    GstBuffer* acquire();
+    GstBuffer* wrap(const Frame& frame);
+    GstBuffer* copy(const Frame& frame);
+    void clearBorders(uint8_t* data) const;
+    static void releaseWrappedFrame(gpointer data);
+
+private:
+    const int m_maxWidth;
+    const int m_maxHeight;
+    const int m_poolBuffers;
+    const bool m_zeroCopy;
+    const bool m_fixedSize;
+
+    // Negotiated on the first frame and on every resolution change, used by makeBuffer() only
+    int m_inputWidth = 0;
+    int m_inputHeight = 0;
+    int m_outputWidth = 0;
+    int m_outputHeight = 0;
+    int m_contentX = 0; //< Rectangle of the output the camera image is scaled to, in pixels.
+    int m_contentY = 0;
+    int m_contentWidth = 0;
+    int m_contentHeight = 0;
+    size_t m_stride = 0; //< Bytes per row of a packed RGB output buffer, as GStreamer lays it out.
+    GstCaps* m_caps = nullptr;
+    uint64_t m_capsGeneration = 0;
+    GstBufferPool* m_pool = nullptr;
+
+    // Shared with the destroy notify of the wrapped frames, which may outlive the FrameIngest
+    const std::shared_ptr<SharedCounters> m_counters = std::make_shared<SharedCounters>();
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
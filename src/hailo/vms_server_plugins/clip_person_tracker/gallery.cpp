@@ -0,0 +1,278 @@
+#include "gallery.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "embedding_store.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CLIP_MATCHER_X86 1
+#endif
+
+namespace clip_matcher {
+
+namespace {
+
+int64_t partition_start(int64_t timestamp_us) {
+    int64_t start = timestamp_us / kGalleryPartitionDurationUs * kGalleryPartitionDurationUs;
+    if (start > timestamp_us) // floor for timestamps before the epoch
+        start -= kGalleryPartitionDurationUs;
+    return start;
+}
+
+// Cuts off the partial last record a crash or a failed append may have left in a partition: the
+// records appended after it would be read shifted by it. False if the partition cannot be cut.
+bool truncate_partial_record(int fd, size_t record_size) {
+    struct stat file_stat = {};
+    if (::fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(sizeof(GalleryPartitionHeader)))
+        return false;
+    const size_t size = static_cast<size_t>(file_stat.st_size);
+    const size_t records = (size - sizeof(GalleryPartitionHeader)) / record_size;
+    const size_t whole_size = sizeof(GalleryPartitionHeader) + records * record_size;
+    return whole_size == size || ::ftruncate(fd, static_cast<off_t>(whole_size)) == 0;
+}
+
+float dot_half_scalar(const uint16_t* embedding, const float* query, size_t dim) {
+    float sum = 0.0f;
+    for (size_t k = 0; k < dim; ++k) {
+        sum += half_to_float(embedding[k]) * query[k];
+    }
+    return sum;
+}
+
+#if defined(CLIP_MATCHER_X86)
+
+__attribute__((target("avx2,fma,f16c")))
+float dot_half_f16c(const uint16_t* embedding, const float* query, size_t dim) {
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    size_t k = 0;
+    for (; k + 16 <= dim; k += 16) {
+        const __m256 e0 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(embedding + k)));
+        const __m256 e1 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(embedding + k + 8)));
+        sum0 = _mm256_fmadd_ps(e0, _mm256_loadu_ps(query + k), sum0);
+        sum1 = _mm256_fmadd_ps(e1, _mm256_loadu_ps(query + k + 8), sum1);
+    }
+    const __m256 sum = _mm256_add_ps(sum0, sum1);
+    __m128 half_sum = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    half_sum = _mm_add_ps(half_sum, _mm_movehl_ps(half_sum, half_sum));
+    half_sum = _mm_add_ss(half_sum, _mm_movehdup_ps(half_sum));
+    return _mm_cvtss_f32(half_sum) + dot_half_scalar(embedding + k, query + k, dim - k);
+}
+
+bool cpu_has_f16c() {
+    static const bool has_f16c = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    }();
+    return has_f16c;
+}
+
+#endif
+
+float dot_half(const uint16_t* embedding, const float* query, size_t dim) {
+#if defined(CLIP_MATCHER_X86)
+    if (cpu_has_f16c())
+        return dot_half_f16c(embedding, query, dim);
+#endif
+    return dot_half_scalar(embedding, query, dim);
+}
+
+bool worse_hit(const GalleryHit& a, const GalleryHit& b) {
+    return a.score > b.score;
+}
+
+// Scores the records of one partition into the `top_k` min-heap of `hits`.
+void search_partition(const std::string& path, const std::string& camera_id, const GalleryQuery& query,
+                      std::vector<GalleryHit>& hits) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    struct stat file_stat = {};
+    if (::fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(sizeof(GalleryPartitionHeader))) {
+        ::close(fd);
+        return;
+    }
+    const size_t size = static_cast<size_t>(file_stat.st_size);
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        return;
+    // Read once front to back
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+
+    const auto* base = static_cast<const unsigned char*>(mapping);
+    const auto* header = reinterpret_cast<const GalleryPartitionHeader*>(base);
+    if (std::memcmp(header->magic, kGalleryMagic, sizeof(header->magic)) == 0
+        && header->version == kGalleryVersion && header->header_size == sizeof(GalleryPartitionHeader)
+        && header->dim == query.dim && header->record_size >= gallery_record_size(header->dim)) {
+        const size_t count = (size - header->header_size) / header->record_size;
+        for (size_t i = 0; i < count; ++i) {
+            const unsigned char* record = base + header->header_size + i * header->record_size;
+            const auto* record_header = reinterpret_cast<const GalleryRecordHeader*>(record);
+            if (record_header->end_us < query.start_us || record_header->start_us > query.end_us)
+                continue;
+            const float score = dot_half(reinterpret_cast<const uint16_t*>(record + sizeof(GalleryRecordHeader)),
+                                         query.text_embedding, query.dim);
+            if (score < query.min_score || (hits.size() == query.top_k && score <= hits.front().score))
+                continue;
+            GalleryHit hit;
+            hit.camera_id = camera_id;
+            hit.track.track_id = record_header->track_id;
+            hit.track.start_us = record_header->start_us;
+            hit.track.end_us = record_header->end_us;
+            std::copy(record_header->bbox, record_header->bbox + 4, hit.track.bbox);
+            hit.track.confidence = record_header->confidence;
+            hit.track.observations = record_header->observations;
+            hit.score = score;
+            if (hits.size() == query.top_k) {
+                std::pop_heap(hits.begin(), hits.end(), worse_hit);
+                hits.back() = std::move(hit);
+            } else {
+                hits.push_back(std::move(hit));
+            }
+            std::push_heap(hits.begin(), hits.end(), worse_hit);
+        }
+    }
+    ::munmap(mapping, size);
+}
+
+} // namespace
+
+size_t gallery_record_size(size_t dim) {
+    const size_t size = sizeof(GalleryRecordHeader) + dim * sizeof(uint16_t);
+    return (size + 15) / 16 * 16;
+}
+
+GalleryWriter::GalleryWriter(const std::string& gallery_dir, const std::string& camera_id)
+    : m_camera_dir((std::filesystem::path(gallery_dir) / camera_id).string()) {
+    std::filesystem::create_directories(m_camera_dir);
+}
+
+GalleryWriter::~GalleryWriter() {
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+void GalleryWriter::open_partition(int64_t partition_start_us, size_t dim) {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_partition_start_us = std::numeric_limits<int64_t>::min();
+    const std::string path = (std::filesystem::path(m_camera_dir)
+        / (std::to_string(partition_start_us) + kGalleryPartitionExtension)).string();
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Gallery: cannot open " + path + ": " + std::strerror(errno));
+
+    GalleryPartitionHeader header = {};
+    ssize_t read_size = ::pread(fd, &header, sizeof(header), 0);
+    // Created by a writer that crashed before its header was whole: no record in it yet
+    if (read_size > 0 && read_size < static_cast<ssize_t>(sizeof(header)) && ::ftruncate(fd, 0) == 0)
+        read_size = 0;
+    if (read_size == 0) {
+        std::memcpy(header.magic, kGalleryMagic, sizeof(header.magic));
+        header.version = kGalleryVersion;
+        header.header_size = sizeof(GalleryPartitionHeader);
+        header.dim = static_cast<uint32_t>(dim);
+        header.record_size = static_cast<uint32_t>(gallery_record_size(dim));
+        header.partition_start_us = partition_start_us;
+        header.partition_duration_us = kGalleryPartitionDurationUs;
+        if (::write(fd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))) {
+            ::close(fd);
+            throw std::runtime_error("Gallery: cannot write " + path);
+        }
+    } else if (read_size != static_cast<ssize_t>(sizeof(header))
+        || std::memcmp(header.magic, kGalleryMagic, sizeof(header.magic)) != 0
+        || header.version != kGalleryVersion || header.header_size != sizeof(GalleryPartitionHeader)
+        || header.dim != dim || header.record_size < gallery_record_size(dim)) {
+        ::close(fd);
+        throw std::runtime_error("Gallery: " + path + " is not a gallery partition of dimension "
+                                 + std::to_string(dim));
+    }
+    if (!truncate_partial_record(fd, header.record_size)) {
+        ::close(fd);
+        throw std::runtime_error("Gallery: cannot truncate " + path + ": " + std::strerror(errno));
+    }
+    m_fd = fd;
+    m_partition_start_us = partition_start_us;
+    m_dim = dim;
+    m_record_size = header.record_size;
+    m_record.assign(m_record_size, 0);
+}
+
+void GalleryWriter::append(const GalleryTrack& track, const float* embedding, size_t dim) {
+    const int64_t start_us = partition_start(track.end_us);
+    if (m_fd < 0 || start_us != m_partition_start_us || dim != m_dim)
+        open_partition(start_us, dim);
+
+    GalleryRecordHeader record_header = {};
+    record_header.start_us = track.start_us;
+    record_header.end_us = track.end_us;
+    record_header.track_id = track.track_id;
+    record_header.observations = track.observations;
+    std::copy(track.bbox, track.bbox + 4, record_header.bbox);
+    record_header.confidence = track.confidence;
+    std::memcpy(m_record.data(), &record_header, sizeof(record_header));
+    auto* halves = reinterpret_cast<uint16_t*>(m_record.data() + sizeof(record_header));
+    for (size_t k = 0; k < dim; ++k) {
+        halves[k] = float_to_half(embedding[k]);
+    }
+    // One write per record. A short write (disk full) or a crash during it leaves a partial last
+    // record, cut off here or when the partition is opened again before anything is appended to it.
+    if (::write(m_fd, m_record.data(), m_record.size()) != static_cast<ssize_t>(m_record.size())) {
+        if (!truncate_partial_record(m_fd, m_record_size)) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        throw std::runtime_error("Gallery: failed appending to " + m_camera_dir);
+    }
+}
+
+std::vector<GalleryHit> search_gallery(const std::string& gallery_dir, const GalleryQuery& query) {
+    std::vector<GalleryHit> hits;
+    if (query.text_embedding == nullptr || query.dim == 0 || query.top_k == 0)
+        return hits;
+    hits.reserve(query.top_k);
+
+    std::error_code error;
+    for (const auto& camera : std::filesystem::directory_iterator(gallery_dir, error)) {
+        const std::string camera_id = camera.path().filename().string();
+        if (!camera.is_directory(error))
+            continue;
+        if (!query.camera_ids.empty()
+            && std::find(query.camera_ids.begin(), query.camera_ids.end(), camera_id) == query.camera_ids.end())
+            continue;
+        for (const auto& partition : std::filesystem::directory_iterator(camera.path(), error)) {
+            if (partition.path().extension() != kGalleryPartitionExtension)
+                continue;
+            int64_t start_us = 0;
+            try {
+                start_us = std::stoll(partition.path().stem().string());
+            } catch (const std::exception&) {
+                continue;
+            }
+            // A partition holds the tracks that ended in it; tracks longer than a partition that
+            // started in the window but ended more than one partition after it are not searched.
+            // Written so that the default, unbounded window does not overflow.
+            if (start_us + kGalleryPartitionDurationUs <= query.start_us
+                || start_us - kGalleryPartitionDurationUs > query.end_us)
+                continue;
+            search_partition(partition.path().string(), camera_id, query, hits);
+        }
+    }
+    std::sort_heap(hits.begin(), hits.end(), worse_hit);
+    return hits;
+}
+
+} // namespace clip_matcher
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+// On-disk gallery of person embeddings, so that a prompt entered now can be searched over the people
+// seen before it existed.
+//
+// Every track that leaves a camera is appended as one record: its running (normalized) CLIP
+// embedding stored as float16, its track ID, the time range it was seen and its best bounding box.
+// Records go to one file per camera and hour:
+//     <gallery dir>/<camera id>/<partition start, us since epoch>.gal
+// A partition is an append-only file of fixed-size records after a GalleryPartitionHeader, so a
+// search maps each partition of the requested time window read-only and scans it linearly. A record
+// cut short by a crash is ignored. Partitions are kGalleryPartitionDurationUs long.
+
+namespace clip_matcher {
+
+struct GalleryPartitionHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t dim;
+    uint32_t record_size;
+    int64_t partition_start_us;
+    int64_t partition_duration_us;
+    uint8_t reserved[24];
+};
+
+// Followed by dim float16 values, then padding up to record_size.
+struct GalleryRecordHeader {
+    int64_t start_us;
+    int64_t end_us;
+    int32_t track_id;
+    uint32_t observations;
+    float bbox[4]; // xmin, ymin, width, height of the best detection, relative to the frame
+    float confidence;
+    uint32_t reserved;
+};
+
+constexpr char kGalleryMagic[8] = {'H', 'C', 'L', 'I', 'P', 'G', 'A', 'L'};
+constexpr uint32_t kGalleryVersion = 1;
+constexpr int64_t kGalleryPartitionDurationUs = 3600LL * 1000 * 1000;
+constexpr const char* kGalleryPartitionExtension = ".gal";
+
+struct GalleryTrack {
+    int32_t track_id = 0;
+    int64_t start_us = 0;
+    int64_t end_us = 0;
+    float bbox[4] = {};
+    float confidence = 0.0f;
+    uint32_t observations = 0;
+};
+
+// Appends the tracks of one camera. Not thread-safe, each camera owns its writer.
+class GalleryWriter {
+public:
+    GalleryWriter(const std::string& gallery_dir, const std::string& camera_id);
+    ~GalleryWriter();
+    GalleryWriter(const GalleryWriter&) = delete;
+    GalleryWriter& operator=(const GalleryWriter&) = delete;
+
+    // Appends `track` with its normalized `embedding` (dim floats) to the partition holding
+    // track.end_us. Throws std::runtime_error if the partition cannot be written, or holds
+    // embeddings of another dimension.
+    void append(const GalleryTrack& track, const float* embedding, size_t dim);
+
+    const std::string& camera_dir() const { return m_camera_dir; }
+
+private:
+    void open_partition(int64_t partition_start_us, size_t dim);
+
+    std::string m_camera_dir;
+    int m_fd = -1;
+    int64_t m_partition_start_us = std::numeric_limits<int64_t>::min();
+    size_t m_dim = 0;
+    size_t m_record_size = 0;
+    std::vector<unsigned char> m_record;
+};
+
+struct GalleryQuery {
+    const float* text_embedding = nullptr; // normalized
+    size_t dim = 0;
+    // Tracks seen at any time in [start_us, end_us] are scored
+    int64_t start_us = std::numeric_limits<int64_t>::min();
+    int64_t end_us = std::numeric_limits<int64_t>::max();
+    std::vector<std::string> camera_ids; // empty searches every camera
+    size_t top_k = 50;
+    float min_score = -1.0f;
+};
+
+struct GalleryHit {
+    std::string camera_id;
+    GalleryTrack track;
+    float score = 0.0f; // cosine similarity of the track and text embeddings
+};
+
+// Ranks the tracks of `query`'s time window by similarity to its text embedding, best first.
+// Partitions that cannot be read are skipped.
+std::vector<GalleryHit> search_gallery(const std::string& gallery_dir, const GalleryQuery& query);
+
+// Record size of a partition holding embeddings of `dim` values.
+size_t gallery_record_size(size_t dim);
+
+} // namespace clip_matcher
@@ -3,7 +3,11 @@
 #include <thread>
 #include <atomic>
 #include <mutex>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstdlib> 
+#include <dlfcn.h>
 #include <opencv2/opencv.hpp>
 
 #include <nx/sdk/analytics/helpers/object_metadata_packet.h>
@@ -14,6 +18,8 @@
 #include "exceptions.h"
 #include "frame.h"
 #include "device_agent.h"
+#include "hailo_clip_plugin_ini.h"
+#include "pipeline_builder.h"
 
 #include "gstreamer_pipeline.hpp"
 #include "TextImageMatcher.hpp"
@@ -23,6 +29,7 @@
 #include "hailo_objects.hpp"
 #include "hailo_common.hpp"
 #include "gst_hailo_meta.hpp"
+#include "hailomat.hpp"
 #include "hailo_xtensor.hpp"
 #include "xtensor/xadapt.hpp"
 #include "xtensor/xarray.hpp"
@@ -31,35 +38,333 @@ using nx::sdk::Ptr;
 using nx::sdk::analytics::IMetadataPacket;
 using nx::sdk::analytics::ObjectMetadataPacket;
 
+// Frames between two logs of the frame ingest counters
+static constexpr uint64_t kIngestStatsFramePeriod = 3000;
+// Frames between two logs of the time spent handing frames over and matching them
+static constexpr uint64_t kMatcherStatsFramePeriod = 3000;
+// Between two reports of the load of the camera to the device scheduler
+static constexpr std::chrono::seconds kLoadReportPeriod(1);
+
+// Classification the track cache probe adds to persons that skip CLIP in this frame
+static const std::string kClipCachedClassificationType = "clip_cached";
+
+// Crops every person except those marked by the track cache probe. Used by the CLIP hailocropper
+// instead of person_cropper from libclip_croppers.so when tracks may skip CLIP (see
+// ini().trackSkipClipSimilarity), hailocropper loads it from the plugin library itself.
+extern "C" __attribute__((visibility("default")))
+std::vector<HailoROIPtr> clip_track_cropper(std::shared_ptr<HailoMat> image, HailoROIPtr roi)
+{
+    std::vector<HailoROIPtr> crop_rois;
+    for (HailoDetectionPtr &detection : hailo_common::get_hailo_detections(roi))
+    {
+        if (detection->get_label() != "person")
+            continue;
+        bool cached = false;
+        for (auto &classification : hailo_common::get_hailo_classifications(detection))
+        {
+            if (classification->get_classification_type() == kClipCachedClassificationType)
+                cached = true;
+        }
+        if (!cached)
+            crop_rois.emplace_back(detection);
+    }
+    return crop_rois;
+}
+
 namespace hailo {
 namespace vms_server_plugins {
 namespace clip_person_tracker {
 
-GStreamerObjectDetector::GStreamerObjectDetector(std::filesystem::path pluginHomeDir, hailo::vms_server_plugins::clip_person_tracker::DeviceAgent* deviceAgentPtr)
-    : deviceAgent(deviceAgentPtr) // Initialize the DeviceAgent pointer
+static constexpr int kNoTrackId = -1;
+
+static int get_track_id(const HailoDetectionPtr& detection)
+{
+    std::vector<HailoUniqueIDPtr> track_id = hailo_common::get_hailo_track_id(detection);
+    if (track_id.size() != 1)
+        return kNoTrackId;
+    return track_id[0]->get_id();
+}
+
+static void remove_classifications(const HailoDetectionPtr& detection, const std::string& type)
+{
+    for (auto &classification : hailo_common::get_hailo_classifications(detection))
+    {
+        if (classification->get_classification_type() == type)
+            detection->remove_object(classification);
+    }
+}
+
+// Path of the shared library this code is in, empty if it cannot be found
+static std::string pluginLibraryPath()
+{
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(&clip_track_cropper), &info) == 0 || info.dli_fname == nullptr)
+        return "";
+    return info.dli_fname;
+}
+
+PipelineResources pipelineResources(const std::filesystem::path& pluginHomeDir)
+{
+    PipelineResources resources;
+    const std::string resources_dir = pluginHomeDir.string() + "/resources/";
+    resources.detectionHefPath = resources_dir + "yolov5s_personface.hef";
+    resources.detectionPostSoPath = resources_dir + "libyolo_post.so";
+    resources.detectionPostConfigPath = resources_dir + "configs/yolov5_personface.json";
+    resources.wholeBufferCropSoPath = resources_dir + "libwhole_buffer.so";
+    resources.clipHefPath = resources_dir + "clip_resnet_50x4.hef";
+    // With fusedClipDequantize the raw CLIP embeddings are dequantized and normalized while matching
+    if (!ini().fusedClipDequantize)
+        resources.clipPostSoPath = resources_dir + "libclip_post.so";
+    resources.clipCropperSoPath = resources_dir + "libclip_croppers.so";
+    resources.clipCropperFunction = "person_cropper";
+    // Tracks with a confident cached match are left out of the CLIP crops
+    if (ini().trackSkipClipSimilarity > 0)
+    {
+        const std::string plugin_library_path = pluginLibraryPath();
+        if (plugin_library_path.empty())
+        {
+            std::cout << "Plugin library not found, running CLIP on every person" << std::endl;
+        }
+        else
+        {
+            resources.clipCropperSoPath = plugin_library_path;
+            resources.clipCropperFunction = "clip_track_cropper";
+        }
+    }
+    resources.standInNetworks = ini().standInInference;
+    return resources;
+}
+
+// Results of a frame that left the pipeline, copied out of its buffer on the streaming thread so
+// that they can be matched on the matcher pool while the pipeline goes on
+struct GStreamerObjectDetector::MatcherFrame
+{
+    struct Object
+    {
+        float bbox[4] = {}; // xmin, ymin, width, height
+        std::string label;
+        float confidence = 0.0f;
+        int trackId = kNoTrackId;
+        int clipRow = -1; // Row of the CLIP embedding in `embeddings`, -1 without one
+    };
+
+    int64_t timestampUs = 0;
+    GstClockTime pts = GST_CLOCK_TIME_NONE;
+    std::vector<Object> objects;
+    clip_matcher::EmbeddingBatch embeddings;
+};
+
+class GStreamerObjectDetector::MatcherJob: public MatcherPool::Job
+{
+public:
+    MatcherJob(GStreamerObjectDetector* detector, std::unique_ptr<MatcherFrame> frame, LatencyTracer* latencyTracer):
+        m_detector(detector), m_frame(std::move(frame)), m_latencyTracer(latencyTracer)
+    {
+    }
+
+    // Run or not, the frame goes back to the detector, which waits for it before going away
+    ~MatcherJob() override
+    {
+        m_detector->recycleMatcherFrame(std::move(m_frame));
+        const std::lock_guard<std::mutex> lock(m_detector->m_matcherMutex);
+        --m_detector->m_pendingMatches;
+        m_detector->m_matcherDone.notify_all();
+    }
+
+    void run() override
+    {
+        if (!m_detector->isTerminated())
+            m_detector->matchFrame(*m_frame, m_latencyTracer);
+    }
+
+private:
+    GStreamerObjectDetector* const m_detector;
+    std::unique_ptr<MatcherFrame> m_frame;
+    LatencyTracer* const m_latencyTracer;
+};
+
+GStreamerObjectDetector::GStreamerObjectDetector(std::filesystem::path pluginHomeDir, hailo::vms_server_plugins::clip_person_tracker::DeviceAgent* deviceAgentPtr,
+                                                 std::shared_ptr<DeviceScheduler> deviceScheduler,
+                                                 std::shared_ptr<SharedPipeline> sharedPipeline, std::shared_ptr<PipelinePool> pipelinePool,
+                                                 std::shared_ptr<MatcherPool> matcherPool)
+    : deviceAgent(deviceAgentPtr), // Initialize the DeviceAgent pointer
+      m_deviceScheduler(std::move(deviceScheduler)),
+      m_sharedPipeline(std::move(sharedPipeline)),
+      m_pipelinePool(std::move(pipelinePool)),
+      m_matcherPool(std::move(matcherPool))
 {
     m_pluginHomeDir = pluginHomeDir;
-    
-    // Initialize GStreamer and create pipeline
-    pipeline_thread = std::make_unique<std::thread>(&GStreamerObjectDetector::runPipeline, this);
+    m_pipelineConfig = PipelineConfig::load(m_pluginHomeDir);
+    // Room for the CLIP embeddings (640 values for RN50x4) of a crowded frame
+    m_trackBatch.reserve(64, 640);
+
+    clip_matcher::TrackCacheParams trackCacheParams;
+    trackCacheParams.ema_alpha = ini().trackEmbeddingAlpha;
+    // hailotracker reuses a track ID only after keep-tracked + keep-lost frames without it
+    trackCacheParams.expire_frames = m_pipelineConfig.trackerKeepTrackedFrames + m_pipelineConfig.trackerKeepLostFrames;
+    trackCacheParams.skip_similarity = ini().trackSkipClipSimilarity;
+    trackCacheParams.skip_min_observations = ini().trackSkipClipMinObservations;
+    trackCacheParams.max_skipped_frames = ini().trackMaxSkippedFrames;
+    m_trackCache.set_params(trackCacheParams);
+
+    // Tracks are written to the gallery when they leave the camera
+    if (ini().galleryDir[0] != '\0')
+    {
+        try {
+            m_gallery = std::make_unique<clip_matcher::GalleryWriter>(ini().galleryDir, deviceAgent->m_cameraId);
+            NX_PRINT << "Writing tracks to gallery " << m_gallery->camera_dir();
+        } catch (const std::exception& e) {
+            NX_PRINT << "Cannot create gallery in " << ini().galleryDir << ": " << e.what();
+        }
+    }
+
     try {
-        m_textImageMatcher = TextImageMatcher::getInstance("RN50x4", 0.5, 10);
-        m_textImageMatcher->load_embeddings(m_pluginHomeDir.string() + "/resources/nx_text_embedding.json");
+        // Each camera has its own prompts; cameras with the same prompts share their embeddings
+        m_textImageMatcher = TextImageMatcher::create("RN50x4", 0.5, 10,
+                                                      &clip_matcher::PromptEmbeddingStore::instance());
+        m_textImageMatcher->set_run_softmax(ini().matcherSoftmax);
+        m_textImageMatcher->set_ann_min_prompts(static_cast<size_t>(std::max(ini().annMinPrompts, 0)));
+        // Ensembled prompts are expanded through their templates by the cache and resident model
+        std::shared_ptr<PromptEncoder> promptEncoder = deviceAgent->promptEncoder();
+        m_textImageMatcher->set_text_encoder(
+            [promptEncoder](const std::string& textPrefix, const std::vector<std::string>& texts,
+                std::vector<float>& embeddings, size_t& dim)
+            {
+                return promptEncoder->encode(textPrefix, texts, embeddings, dim);
+            });
+        // A camera without prompts of its own yet starts from the default ones
+        const std::filesystem::path cameraEmbeddings = deviceAgent->promptEmbeddingPath();
+        m_textImageMatcher->load_embeddings(std::filesystem::exists(cameraEmbeddings)
+            ? cameraEmbeddings.string()
+            : deviceAgent->defaultPromptEmbeddingPath().string());
         // m_DetectionManager = DetectionManager::getInstance();
     } catch (const std::exception& e) {
         NX_PRINT << "An error occurred: " << e.what() << std::endl;
     } catch (...) {
         NX_PRINT << "An unknown error occurred." << std::endl;
     }
+
+    // Results may come as soon as the lane is taken or the pipeline runs, the matcher is ready now
+    if (m_sharedPipeline)
+        m_sharedLane = m_sharedPipeline->attach(this);
+    if (m_sharedLane >= 0)
+    {
+        m_deviceScheduler->assign(deviceAgent->m_DeviceAgentId, m_sharedPipeline->placement());
+        // The lanes are negotiated once, frames are letterboxed into them
+        m_frameIngest = std::make_unique<FrameIngest>(m_sharedPipeline->width(), m_sharedPipeline->height(),
+            ini().ingestPoolBuffers, ini().zeroCopyIngest, /*fixedSize*/ true);
+        m_loaded = true;
+    }
+    else
+    {
+        if (m_sharedPipeline)
+            NX_PRINT << "Shared pipeline full, camera " << deviceAgent->m_DeviceAgentId << " runs its own pipeline";
+        // A warm pipeline if the pool has one on the groups of the camera, frames are dropped until
+        // the pipeline runs otherwise
+        const DevicePlacement placement = m_deviceScheduler->place(deviceAgent->m_DeviceAgentId, m_pipelinePool->ready());
+        m_pipeline = m_pipelinePool->claim(placement);
+        NX_PRINT << "Camera " << deviceAgent->m_DeviceAgentId << " runs on pipeline ID: " << m_pipeline->id();
+        // The appsrc caps are set from the first frame, see pushFrameToPipeline()
+        m_frameIngest = std::make_unique<FrameIngest>(
+            ini().maxInputWidth, ini().maxInputHeight, ini().ingestPoolBuffers, ini().zeroCopyIngest, /*fixedSize*/ false);
+        m_pipeline->attach(this, makeLatencyTracer());
+        m_loaded = true;
+    }
     // m_thread_id = std::this_thread::get_id();
 }
 
+// The lanes of the shared pipeline are traced by the pipeline
+std::unique_ptr<LatencyTracer> GStreamerObjectDetector::makeLatencyTracer() {
+    if (!ini().latencyTracing)
+        return nullptr;
+    const std::string tracePath = ini().latencyTraceDir[0] == '\0' ? ""
+        : (std::filesystem::path(ini().latencyTraceDir) / ("latency_trace_" + deviceAgent->m_cameraId + ".json")).string();
+    return std::make_unique<LatencyTracer>("ID: " + std::to_string(deviceAgent->m_DeviceAgentId),
+        ini().latencyReportFrames, tracePath, ini().latencyTraceFrames);
+}
 
-GStreamerObjectDetector::~GStreamerObjectDetector() {
-    if (pipeline_thread && pipeline_thread->joinable()) {
-        pipeline_thread->join();
+// Called on the frame thread. The frames in the old pipeline are dropped, and the tracks of the
+// camera end: the new tracker numbers the persons anew.
+void GStreamerObjectDetector::moveTo(const DevicePlacement& placement) {
+    std::unique_ptr<CameraPipeline> pipeline = m_pipelinePool->claim(placement);
+    NX_PRINT << "Camera " << deviceAgent->m_DeviceAgentId << " moves from pipeline ID: " << m_pipeline->id()
+             << " to pipeline ID: " << pipeline->id();
+    m_pipeline->detach();
+    // The frames posted to the matcher pool use the latency tracer of the old pipeline
+    waitForMatching();
+    m_pipelinePool->release(std::move(m_pipeline));
+    if (ini().admissionControl)
+        deviceAgent->m_admission.abandonInFlight();
+
+    // Nothing is matched until the new pipeline is attached
+    m_trackCache.drain(m_finishedTracks);
+    if (m_gallery)
+        writeToGallery(m_finishedTracks);
+    else
+        m_finishedTracks.clear();
+    m_pipeline = std::move(pipeline);
+    m_pipeline->attach(this, makeLatencyTracer());
+}
+
+// Called on the frame thread. A failed pipeline is never restarted: the camera gets a new one, on
+// the same groups, once the backoff of the pool for its failures in a row has passed.
+void GStreamerObjectDetector::checkPipeline() {
+    if (!m_pipeline->failed()) {
+        if (m_pipelineFailures > 0 && m_pipeline->running()) {
+            NX_PRINT << "Camera " << deviceAgent->m_DeviceAgentId << " runs on pipeline ID: " << m_pipeline->id()
+                     << " after " << m_pipelineFailures << " failed";
+            m_pipelineFailures = 0;
+        }
+        return;
     }
+    const auto now = std::chrono::steady_clock::now();
+    if (!m_pipelineRetryAt) {
+        ++m_pipelineFailures;
+        const std::chrono::milliseconds delay = PipelinePool::retryDelay(m_pipelineFailures);
+        m_pipelineRetryAt = now + delay;
+        NX_PRINT << "Camera " << deviceAgent->m_DeviceAgentId << " pipeline ID: " << m_pipeline->id()
+                 << " failed (" << m_pipelineFailures << " in a row), replacing it in " << delay.count() << " ms";
+        return;
+    }
+    if (now < *m_pipelineRetryAt)
+        return;
+    m_pipelineRetryAt.reset();
+    moveTo(m_pipeline->placement());
+}
+
+
+GStreamerObjectDetector::~GStreamerObjectDetector() {
     terminate();
+    // Frames still queued on the matcher pool use this detector
+    waitForMatching();
+    // The tracks still on screen end here
+    if (m_gallery)
+    {
+        m_trackCache.drain(m_finishedTracks);
+        writeToGallery(m_finishedTracks);
+    }
+}
+
+void GStreamerObjectDetector::writeToGallery(std::vector<clip_matcher::TrackSummary>& tracks) {
+    for (const clip_matcher::TrackSummary& summary : tracks)
+    {
+        const clip_matcher::TrackState& state = summary.state;
+        if (state.embedding.empty())
+            continue;
+        clip_matcher::GalleryTrack track;
+        track.track_id = summary.track_id;
+        track.start_us = state.first_seen_us;
+        track.end_us = state.last_seen_us;
+        std::copy(state.best_sighting.bbox, state.best_sighting.bbox + 4, track.bbox);
+        track.confidence = state.best_sighting.confidence;
+        track.observations = static_cast<uint32_t>(state.observations);
+        try {
+            m_gallery->append(track, state.embedding.data(), state.embedding.size());
+        } catch (const std::exception& e) {
+            NX_PRINT << "Gallery error: " << e.what();
+        }
+    }
+    tracks.clear();
 }
 
 
@@ -80,76 +385,21 @@ bool GStreamerObjectDetector::isTerminated() const {
 }
 
 void GStreamerObjectDetector::terminate() {
-    std::cout << "Terminating GStreamer pipeline" << std::endl;
     if (isTerminated())
         return;
-    
-    NX_PRINT << "Terminating GStreamer pipeline";
-    try {
-        // Send EOS to the pipeline
-        if (this->m_loaded && this->pipeline != nullptr && this->appsrc != nullptr) {
-            std::cout << "sending eos" << std::endl;
-            try {
-                GstFlowReturn ret;
-                g_signal_emit_by_name(this->appsrc, "end-of-stream", &ret);
-                if (ret != GST_FLOW_OK) {
-                    // handle error
-                    std::cout << "Error sending EOS to pipeline" << std::endl;
-                }
-            } 
-            catch (const std::exception& e) {
-                std::cout << e.what() << std::endl;
-            }
-        } 
-        else {
-            std::cout << "GStreamerObjectDetector::terminate(): Pipeline not started yet" << std::endl;
-            return;
-        }
-        // Stop the GStreamer pipeline
-        std::cout << "stop pipeline" << std::endl;
-        
-        // check if pipline is running
-        GstState current_state;
-        if (gst_element_get_state(this->pipeline, &current_state, NULL, GST_CLOCK_TIME_NONE) != GST_STATE_CHANGE_FAILURE) {
-            if (current_state == GST_STATE_PLAYING) {
-                std::cout << "Stop pipeline: Setting state to NULL" << std::endl;
-                GstStateChangeReturn ret = gst_element_set_state(this->pipeline, GST_STATE_NULL);
-                if (ret == GST_STATE_CHANGE_FAILURE) {
-                    std::cout << "Failed to set pipeline state to NULL" << std::endl;
-                }
-                std::cout << "Stop pipeline: Setting state to NULL done" << std::endl;
-            }
-        }
 
-        // if (this->pipeline != nullptr){
-        //     std::cout << "stop pipeline setting state to null" << std::endl;
-        //     gst_element_set_state(this->pipeline, GST_STATE_NULL);
-        //     std::cout << "stop pipeline unrefing pipeline" << std::endl;
-        //     // gst_object_unref(this->pipeline);
-        // }
-
-        // std::cout << "stop pipeline unrefing appsrc" << std::endl;
-        // if (this->appsrc != nullptr){
-        //     gst_object_unref(this->appsrc);
-        // }
-        std::cout << "stop pipeline unrefing clip_matcher_identity" << std::endl;
-        
-        // if (this->clip_matcher_identity != nullptr){
-        //     gst_object_unref(this->clip_matcher_identity);
-        // }
-        std::cout << "stop pipeline unrefing main_loop" << std::endl;
-        if (this->main_loop != nullptr){
-            g_main_loop_quit(this->main_loop);
-            g_main_loop_unref(this->main_loop);
-        }
-        std::cout << "stop pipeline done" << std::endl;
-    } catch (const std::exception& e) {
-        std::cerr << "An error occurred while stopping the pipeline: " << e.what() << std::endl;
-    } catch (...) {
-        std::cerr << "An unknown error occurred while stopping the pipeline." << std::endl;
-    }
+    NX_PRINT << "Terminating GStreamer pipeline";
+    // No more results once detached: the shared pipeline keeps running for the other cameras, the
+    // pipeline of its own is stopped by the pool, waiting for its last frames would only delay this
+    if (m_sharedLane >= 0)
+        m_sharedPipeline->detach(m_sharedLane);
+    if (m_pipeline)
+        m_pipeline->detach();
     m_terminated = true;
-    
+    waitForMatching();
+    if (m_pipeline)
+        m_pipelinePool->release(std::move(m_pipeline));
+    m_deviceScheduler->remove(deviceAgent->m_DeviceAgentId);
 }
 
 DetectionList GStreamerObjectDetector::run(const Frame& frame) {
@@ -168,311 +418,339 @@ DetectionList GStreamerObjectDetector::run(const Frame& frame) {
     }
     return {};
 }
-gboolean async_bus_callback(GstBus *bus, GstMessage *message, gpointer user_data)
+
+// Adds the CLIP embedding of `detection` to `batch`. Without the clip_post filter (see
+// ini().fusedClipDequantize) the raw CLIP output tensor is dequantized and normalized in the batch,
+// otherwise the normalized float embedding the filter attached as a HailoMatrix is used.
+static bool add_clip_embedding(clip_matcher::EmbeddingBatch& batch, const HailoDetectionPtr& detection)
 {
-  GStreamerObjectDetector *detector = static_cast<GStreamerObjectDetector *>(user_data);
-  switch (GST_MESSAGE_TYPE(message))
-  {
-  case GST_MESSAGE_ERROR:
-  {
-    // An error occurred in the pipeline
-    GError *error = nullptr;
-    gchar *debug_info = nullptr;
-    gst_message_parse_error(message, &error, &debug_info);
-    g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(message->src), error->message);
-    g_printerr("Debugging info: %s\n", debug_info ? debug_info : "none");
-    g_clear_error(&error);
-    g_free(debug_info);
-    // stop main loop
-    // g_main_loop_quit(detector->main_loop);
-    break;
-  }
-  case GST_MESSAGE_EOS:
-    // The pipeline has reached the end of the stream
-    g_print("End-Of-Stream reached.\n");
-    // stop main loop
-    // g_main_loop_quit(detector->main_loop);
-    break;
-  
-  // print QOS message
-  case GST_MESSAGE_QOS:
-  {
-    std::cout << "QOS message detected from " << GST_OBJECT_NAME(message->src) << std::endl;
-    break;
-  }
-  default:
-    // Print a message for other message types
-    // g_print("Received message of type %s\n", GST_MESSAGE_TYPE_NAME(message));
-    break;
-  }
-  // We want to keep receiving messages
-  return TRUE;
+    clip_matcher::QuantizedEmbeddingView view;
+    auto matrix_objs = detection->get_objects_typed(HAILO_MATRIX);
+    if (matrix_objs.size() > 0)
+    {
+        HailoMatrixPtr matrix_ptr = std::dynamic_pointer_cast<HailoMatrix>(matrix_objs[0]);
+        view.data = matrix_ptr->get_data().data();
+        view.type = clip_matcher::QuantizedType::float32;
+        view.dim = matrix_ptr->size();
+        return batch.add(view, /*normalize*/ false);
+    }
+    if (!detection->has_tensors())
+        return false;
+
+    HailoTensorPtr tensor = detection->get_tensors()[0];
+    const hailo_vstream_info_t& info = tensor->vstream_info();
+    view.data = tensor->data();
+    view.dim = tensor->width() * tensor->height() * tensor->features();
+    view.scale = info.quant_info.qp_scale;
+    view.zero_point = info.quant_info.qp_zp;
+    switch (info.format.type)
+    {
+    case HAILO_FORMAT_TYPE_UINT8:
+        view.type = clip_matcher::QuantizedType::uint8;
+        break;
+    case HAILO_FORMAT_TYPE_UINT16:
+        view.type = clip_matcher::QuantizedType::uint16;
+        break;
+    case HAILO_FORMAT_TYPE_FLOAT32:
+        view.type = clip_matcher::QuantizedType::float32;
+        view.scale = 1.0f;
+        view.zero_point = 0.0f;
+        break;
+    default:
+        return false;
+    }
+    return batch.add(view, /*normalize*/ true);
 }
 
-void GStreamerObjectDetector::runPipeline() {
-    gst_init(nullptr, nullptr);
-    int deviceAgentId = this->deviceAgent->m_DeviceAgentId;
-    std::string deviceAgentIdStr = std::to_string(deviceAgentId);
-    std::cout << "runPipeline() Device agent ID: " << deviceAgentIdStr << " PID: " << getpid() << ", Thread ID: " << std::this_thread::get_id() << ", this pointer: " << this << std::endl;
-    // Run the GStreamer pipeline in a separate thread
-    std::string clip_vdevice = "1"; // hailo used for CLIP
-    std::string detection_vdevice = "3"; // Hailo used for detection
-    bool multi_device = true; // Set to true to use multi hailo chips
-    if (multi_device)
+// Called on the CLIP cropper sink pad, marks the persons whose track has a confident cached match so
+// that clip_track_cropper leaves them out of the CLIP crops
+GstPadProbeReturn GStreamerObjectDetector::on_clip_cropper_probe(GstPad* pad, GstPadProbeInfo* info, gpointer data) {
+    GStreamerObjectDetector* detector = static_cast<GStreamerObjectDetector*>(data);
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (buffer == nullptr || detector->isTerminated())
+        return GST_PAD_PROBE_OK;
+    HailoROIPtr roi = get_hailo_main_roi(buffer, false);
+    if (roi == nullptr)
+        return GST_PAD_PROBE_OK;
+
+    for (HailoDetectionPtr &detection : hailo_common::get_hailo_detections(roi))
+    {
+        // Marks of previous frames come back with the tracker's past metadata
+        remove_classifications(detection, kClipCachedClassificationType);
+        if (detection->get_label() != "person")
+            continue;
+        const int track_id = get_track_id(detection);
+        if (track_id == kNoTrackId || !detector->m_trackCache.should_skip_clip(track_id))
+            continue;
+        // Without a crop the detection must not be matched on an embedding of a previous frame
+        for (auto &matrix : detection->get_objects_typed(HAILO_MATRIX))
+            detection->remove_object(matrix);
+        detection->add_object(std::make_shared<HailoClassification>(kClipCachedClassificationType, "", 1.0f));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void GStreamerObjectDetector::handOffToMatcher(GstBuffer* buffer, LatencyTracer* latencyTracer) {
+    // if terminated, return
+    if (isTerminated())
     {
-        if (deviceAgentId % 2 == 1){
-            detection_vdevice = "2";
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    ++m_pipelineFrames;
+    const GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if (latencyTracer)
+        latencyTracer->mark(pts, LatencyTracer::handoffIn);
+    // The frame is out of the pipeline, the next one may be admitted
+    if (ini().admissionControl)
+        this->deviceAgent->m_admission.completed(static_cast<int64_t>(pts / 1000));
+
+    std::unique_ptr<MatcherFrame> frame;
+    {
+        const std::lock_guard<std::mutex> lock(m_matcherMutex);
+        if (!m_freeMatcherFrames.empty())
+        {
+            frame = std::move(m_freeMatcherFrames.back());
+            m_freeMatcherFrames.pop_back();
         }
     }
-    else 
+    if (!frame)
     {
-        detection_vdevice = "1";
+        frame = std::make_unique<MatcherFrame>();
+        // Room for the CLIP embeddings (640 values for RN50x4) of a crowded frame
+        frame->objects.reserve(64);
+        frame->embeddings.reserve(64, 640);
+    }
+    frame->timestampUs = static_cast<int64_t>(GST_BUFFER_DTS(buffer) / 1000);
+    frame->pts = pts;
+    frame->objects.clear();
+    frame->embeddings.clear();
+
+    // Boxes relative to the frame of the lane, letterboxed, are mapped back onto the camera image
+    FrameIngest::Content content;
+    if (m_sharedLane >= 0)
+    {
+        const std::lock_guard<std::mutex> lock(m_laneContentMutex);
+        content = m_laneContent;
     }
-    std::cout << "ID: " << deviceAgentIdStr << " Detection vdevice: " << detection_vdevice << std::endl;
 
-    std::string hef_path = this->m_pluginHomeDir.string() + "/resources/yolov5s_personface.hef";
-    std::string clip_hef_path = this->m_pluginHomeDir.string() + "/resources/clip_resnet_50x4.hef";
-    
-    std::string post_so_path = this->m_pluginHomeDir.string() + "/resources/libyolo_post.so";
-    std::string config_path = this->m_pluginHomeDir.string() + "/resources/configs/yolov5_personface.json";
-    std::string clip_cropper_so_path = this->m_pluginHomeDir.string() + "/resources/libclip_croppers.so";
-    std::string clip_post_so_path = this->m_pluginHomeDir.string() + "/resources/libclip_post.so";
-    std::string cpp_aspect_fix_path = this->m_pluginHomeDir.string() + "/resources/libaspect_ratio_fix.so";
-    std::string WHOLE_BUFFER_CROP_SO = this->m_pluginHomeDir.string() + "/resources/libwhole_buffer.so";
-    std::string pipeline_string = "appsrc name=app_source ! "
-    "video/x-raw, width=1280, height=720, format=RGB ! "
-    "queue leaky=downstream max-size-buffers=3 max-size-bytes=0 max-size-time=0 name=pre_detection_tee max-size-buffers=12 name=pre_detection_tee ! "
-    "hailocropper  name=detection_crop so-path=" + WHOLE_BUFFER_CROP_SO + " function-name=create_crops use-letterbox=true resize-method=inter-area internal-offset=true "
-    "hailoaggregator name=agg1 "
-    "detection_crop. ! queue leaky=no max-size-buffers=20 max-size-bytes=0 max-size-time=0 silent=true name=detection_bypass_q ! agg1.sink_0 "
-    "detection_crop. ! queue leaky=no max-size-buffers=3 max-size-bytes=0 max-size-time=0 silent=true name=pre_detecion_net ! "
-    "video/x-raw, pixel-aspect-ratio=1/1 ! "
-    "hailonet hef-path=" + hef_path + " batch-size=8 vdevice-group-id=" + detection_vdevice + " "
-    "multi-process-service=false scheduler-timeout-ms=100 scheduler-priority=31 ! "
-    "queue leaky=no max-size-buffers=3 max-size-bytes=0 max-size-time=0 name=pre_detecion_post ! "
-    "hailofilter so-path=" +  post_so_path + " qos=false function_name=yolov5_personface_letterbox config-path=" + config_path + " ! "
-    "queue leaky=no max-size-buffers=3 max-size-bytes=0 max-size-time=0 ! "
-    "agg1.sink_1 "
-    "agg1. ! "   
-    "queue leaky=no max-size-buffers=3 max-size-bytes=0 max-size-time=0 ! "
-    "hailotracker name=hailo_tracker class-id=1 kalman-dist-thr=0.8 iou-thr=0.9 init-iou-thr=0.7 keep-new-frames=2 keep-tracked-frames=15 keep-lost-frames=2 keep-past-metadata=true qos=false ! "
-    "queue leaky=no max-size-buffers=3 max-size-bytes=0 max-size-time=0 ! "
-    "hailocropper so-path=" + clip_cropper_so_path + " function-name=person_cropper internal-offset=true name=cropper use-letterbox=true no-scaling-bbox=true "
-    "hailoaggregator name=agg cropper. ! "
-    "queue leaky=no max-size-buffers=20 max-size-bytes=0 max-size-time=0 name=clip_bypass_q ! "
-    "agg.sink_0 cropper. ! queue leaky=no max-size-buffers=3 max-size-bytes=0 max-size-time=0 name=pre_clip_net ! "
-    "hailonet hef-path=" + clip_hef_path + " vdevice-group-id=" + clip_vdevice + " multi-process-service=false batch-size=8 scheduler-timeout-ms=1000 ! "
-    "queue leaky=no max-size-buffers=3 max-size-bytes=0 max-size-time=0 ! "
-    "hailofilter name=clip_post so-path=" + clip_post_so_path + " qos=false ! "
-    "queue leaky=no max-size-buffers=3 max-size-bytes=0 max-size-time=0 ! agg.sink_1 agg. ! "
-    "queue leaky=no max-size-buffers=3 max-size-bytes=0 max-size-time=0 ! "
-    "identity name=clip_matcher_identity ! "
-    "fakesink silent=true name=clip_matcher_sink sync=false async=false qos=false ";
-    
-    
-    NX_PRINT << "Running pipeline: " << pipeline_string;
-    // Parse the pipeline string and create the pipeline
-    GError* error = nullptr;
-    this->pipeline = gst_parse_launch(pipeline_string.c_str(), &error);
-    if (error) {
-        // throw ObjectDetectorInitializationError("Error creating pipeline: " + std::string(error->message));
-        std::cout << "Error creating pipeline ID: " << deviceAgentIdStr << " " << error->message << std::endl;
-    }
-    std::cout << "Parsing pipeline ID: " << deviceAgentIdStr << " done" << std::endl;
-    // connect bus to pipeline
-    this->bus = gst_pipeline_get_bus(GST_PIPELINE(this->pipeline));
-    gst_bus_add_watch(this->bus, async_bus_callback, this);
-
-    // Get the appsrc element from the pipeline
-    this->appsrc = gst_bin_get_by_name(GST_BIN(this->pipeline), "app_source");
-    
-    //Set appsrc properties
-    GstCaps *caps = gst_caps_new_simple("video/x-raw",
-                                    "format", G_TYPE_STRING, "RGB",
-                                    "width", G_TYPE_INT, 1280,
-                                    "height", G_TYPE_INT, 720,
-                                    NULL);
-    g_object_set(G_OBJECT(this->appsrc), "caps", caps, NULL);
-    gst_caps_unref(caps);
-
-    // get the clip_matcher_identity element from the pipeline
-    this->clip_matcher_identity = gst_bin_get_by_name(GST_BIN(this->pipeline), "clip_matcher_identity");
-    // Connect to the "handoff" signal emitted by the identity element
-    g_signal_connect(this->clip_matcher_identity, "handoff", G_CALLBACK(this->on_handoff_clip), this);
-
-    // Set the pipeline state to PLAYING
-    std::cout << "Running pipeline ID: " << deviceAgentIdStr << " setting pipeline to playing" << std::endl;
-    gst_element_set_state(this->pipeline, GST_STATE_PLAYING);
-    // check if the pipeline is running
-    if (gst_element_get_state(this->pipeline, nullptr, nullptr, GST_SECOND) == GST_STATE_CHANGE_FAILURE) {
-        NX_PRINT << "Error running pipeline ID: " << deviceAgentIdStr << std::endl;
-        std::cout << "Error running pipeline ID: " << deviceAgentIdStr << std::endl;
-        // throw ObjectDetectorInitializationError("Error running pipeline");
-    }
-    std::cout << "Running pipeline ID: " << deviceAgentIdStr << " done" << std::endl;
-    // Run the main loop this is blocking will run until the main loop is stopped
-    this->main_loop = g_main_loop_new(nullptr, FALSE);
-    this->m_loaded = true;
-    g_main_loop_run(this->main_loop);
-    // Free resources
-    this->terminate();
+    // Only what the matching needs is copied: the detections go on living in the tracker, which
+    // must not see them change from another thread
+    HailoROIPtr roi = get_hailo_main_roi(buffer, false);
+    if (roi != nullptr)
+    {
+        for (HailoDetectionPtr &detection : hailo_common::get_hailo_detections(roi))
+        {
+            // The tracker carries the marks of the track cache probe to the next frames
+            remove_classifications(detection, kClipCachedClassificationType);
+            MatcherFrame::Object object;
+            const HailoBBox bbox = detection->get_bbox();
+            const float xmin = std::clamp((bbox.xmin() - content.x) / content.width, 0.0f, 1.0f);
+            const float ymin = std::clamp((bbox.ymin() - content.y) / content.height, 0.0f, 1.0f);
+            const float xmax = std::clamp((bbox.xmin() + bbox.width() - content.x) / content.width, 0.0f, 1.0f);
+            const float ymax = std::clamp((bbox.ymin() + bbox.height() - content.y) / content.height, 0.0f, 1.0f);
+            object.bbox[0] = xmin;
+            object.bbox[1] = ymin;
+            object.bbox[2] = xmax - xmin;
+            object.bbox[3] = ymax - ymin;
+            object.label = detection->get_label();
+            object.confidence = detection->get_confidence();
+            object.trackId = get_track_id(detection);
+            const size_t row = frame->embeddings.rows();
+            if (add_clip_embedding(frame->embeddings, detection))
+                object.clipRow = static_cast<int>(row);
+            frame->objects.push_back(std::move(object));
+        }
+    }
+    if (latencyTracer)
+        latencyTracer->mark(pts, LatencyTracer::handoffOut);
 
+    if (m_matcherPool)
+    {
+        {
+            const std::lock_guard<std::mutex> lock(m_matcherMutex);
+            ++m_pendingMatches;
+        }
+        std::unique_ptr<MatcherPool::Job> job = std::make_unique<MatcherJob>(this, std::move(frame), latencyTracer);
+        // A refused frame is dropped like in a leaky queue, the job going away releases it
+        if (!m_matcherPool->post(this->deviceAgent->m_DeviceAgentId, job))
+            ++m_droppedMatches;
+        job.reset();
+    }
+    m_handoffUs += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    if (frame)
+    {
+        matchFrame(*frame, latencyTracer);
+        recycleMatcherFrame(std::move(frame));
+    }
 }
 
+void GStreamerObjectDetector::recycleMatcherFrame(std::unique_ptr<MatcherFrame> frame) {
+    if (!frame)
+        return;
+    const std::lock_guard<std::mutex> lock(m_matcherMutex);
+    m_freeMatcherFrames.push_back(std::move(frame));
+}
 
-// Helper function to get xtensor from HailoMatrixPtr
-static xt::xarray<float> get_xtensor(HailoMatrixPtr matrix)
-{
-    // Adapt a HailoTensorPtr to an xarray (quantized)
-    xt::xarray<float> xtensor = xt::adapt(matrix->get_data().data(), matrix->size(), xt::no_ownership(), matrix->shape());
-    // remove (squeeze) xtensor first dim
-    xtensor = xt::squeeze(xtensor, 0);
-    return xtensor;
+void GStreamerObjectDetector::waitForMatching() {
+    std::unique_lock<std::mutex> lock(m_matcherMutex);
+    m_matcherDone.wait(lock, [this]() { return m_pendingMatches == 0; });
 }
-// This function is called when the identity element emits the "handoff" signal
-void GStreamerObjectDetector::on_handoff_clip(GstElement* object, GstBuffer* buffer, gpointer data) {
-    GStreamerObjectDetector* detector = static_cast<GStreamerObjectDetector*>(data);
-    
-    // if terminated, return
-    if (detector->isTerminated())
-    {
-        return;
+
+// Matches the persons of a frame and pushes their metadata, on the matcher pool (one frame of the
+// camera at a time, in order) or on the streaming thread
+void GStreamerObjectDetector::matchFrame(MatcherFrame& frame, LatencyTracer* latencyTracer) {
+    const auto start = std::chrono::steady_clock::now();
+    if (latencyTracer)
+        latencyTracer->mark(frame.pts, LatencyTracer::matchIn);
+    matchObjects(frame);
+    if (latencyTracer)
+        latencyTracer->mark(frame.pts, LatencyTracer::matchOut);
+
+    const uint64_t matchUs = m_matchUs += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    const uint64_t frames = ++m_matchedFrames;
+    if (frames % kMatcherStatsFramePeriod == 0) {
+        std::cout << "Matcher ID: " << this->deviceAgent->m_DeviceAgentId << " frames: " << frames
+                  << " handoff (streaming threads): " << m_handoffUs / 1000.0 / frames << " ms/frame"
+                  << " matching (" << (m_matcherPool ? "matcher pool" : "streaming threads") << "): "
+                  << matchUs / 1000.0 / frames << " ms/frame"
+                  << " dropped: " << m_droppedMatches << " untracked persons: " << m_untrackedObjects << std::endl;
     }
+}
 
-    // Get Hailo ROI from buffer
-    HailoROIPtr roi;
-    roi = get_hailo_main_roi(buffer, false);
-    if (roi == nullptr)
+void GStreamerObjectDetector::matchObjects(const MatcherFrame& frame) {
+    clip_matcher::TrackCache& track_cache = m_trackCache;
+    if (m_gallery)
     {
-        return;
+        track_cache.begin_frame(&m_finishedTracks);
+        writeToGallery(m_finishedTracks);
     }
-    // define 2D array for image embedding
-    xt::xarray<double> image_embedding;
-    
-    // vector to hold detections
-    std::vector<HailoDetectionPtr> detections_ptrs;
-    
-    // vector to hold used detections
-    std::vector<HailoDetectionPtr> used_detections;
-    
-    // Get detections from roi
-    detections_ptrs = hailo_common::get_hailo_detections(roi);
-    for (HailoDetectionPtr &detection : detections_ptrs)
+    else
     {
-        auto matrix_objs = detection->get_objects_typed(HAILO_MATRIX);
-        if (matrix_objs.size() > 0)
+        track_cache.begin_frame();
+    }
+
+    // objects used, with a CLIP embedding in this frame or a cached track
+    const clip_matcher::EmbeddingBatch& clip_batch = frame.embeddings;
+    std::vector<size_t>& used_objects = m_usedObjects;
+    used_objects.clear();
+    for (size_t index = 0; index < frame.objects.size(); ++index)
+    {
+        const MatcherFrame::Object& object = frame.objects[index];
+        clip_matcher::TrackSighting sighting;
+        sighting.timestamp_us = frame.timestampUs;
+        std::copy(object.bbox, object.bbox + 4, sighting.bbox);
+        sighting.confidence = object.confidence;
+        if (object.clipRow >= 0)
         {
-            HailoMatrixPtr matrix_ptr = std::dynamic_pointer_cast<HailoMatrix>(matrix_objs[0]);
-            xt::xarray<float> embeddings = get_xtensor(matrix_ptr);
-            // if image_embedding is empty or 0-dimensional, initialize it with embeddings
-            if (image_embedding.size() == 0 || image_embedding.dimension() == 0)
+            if (object.trackId != kNoTrackId)
             {
-                image_embedding = embeddings;
+                track_cache.update(object.trackId, clip_batch.data() + object.clipRow * clip_batch.stride(),
+                                   clip_batch.dim(), clip_batch.row_scales()[object.clipRow], sighting);
             }
-            else 
-            {
-                // if image_embedding is not empty and not 0-dimensional, concatenate it with embeddings
-                image_embedding = xt::concatenate(xt::xtuple(image_embedding, embeddings), 0);
-            }
-            used_detections.push_back(detection);
+            used_objects.push_back(index);
+        }
+        else if (object.trackId != kNoTrackId && track_cache.touch(object.trackId, sighting))
+        {
+            used_objects.push_back(index);
         }
     }
-    
-    // if image_embedding is empty, return
-    if (image_embedding.size() == 0 || image_embedding.dimension() == 0)
-    {
+
+    // if there are no embeddings, return
+    if (used_objects.empty())
         return;
-    }
-    
-    std::vector<Match> matches = detector->m_textImageMatcher->match(image_embedding);
-    for (auto &match : matches)
+
+    // Match the running embedding of tracked persons, the embedding of this frame otherwise
+    clip_matcher::EmbeddingBatch& track_batch = m_trackBatch;
+    track_batch.clear();
+    std::vector<int>& batch_rows = m_batchRows;
+    batch_rows.assign(used_objects.size(), -1);
+    for (size_t i = 0; i < used_objects.size(); ++i)
     {
-        auto detection = used_detections[match.row_idx];
-        auto old_classifications = hailo_common::get_hailo_classifications(detection);
-        for (auto old_classification : old_classifications)
+        const MatcherFrame::Object& object = frame.objects[used_objects[i]];
+        clip_matcher::QuantizedEmbeddingView view;
+        view.type = clip_matcher::QuantizedType::float32;
+        bool normalize = false;
+        if (object.trackId != kNoTrackId && track_cache.copy_embedding(object.trackId, m_trackEmbedding))
+        {
+            view.data = m_trackEmbedding.data();
+            view.dim = m_trackEmbedding.size();
+        }
+        else if (object.clipRow >= 0)
         {
-            if (old_classification->get_classification_type() == "clip")
-            detection->remove_object(old_classification);
+            view.data = clip_batch.data() + object.clipRow * clip_batch.stride();
+            view.dim = clip_batch.dim();
+            normalize = true;
         }
-        // if (match.negative || !match.passed_threshold)
-        // {
-        //     continue;
-        // }
-        HailoClassificationPtr classification = std::make_shared<HailoClassification>(std::string("clip"), match.text, match.similarity);
-        detection->add_object(classification);
+        const int row = static_cast<int>(track_batch.rows());
+        if (track_batch.add(view, normalize))
+            batch_rows[i] = row;
     }
-    
-    // NX detections
-    DetectionList nx_detections;
 
-    // get buffer dts
-    GstClockTime dts = GST_BUFFER_DTS(buffer);
-    //convert dts to microseconds
-    uint64_t timestampUs = dts / 1000;
-    
-    //print detections
-    for (HailoDetectionPtr &detection : used_detections)
+    // Every row is scored, the threshold and negative prompts are applied below. The texts are
+    // assigned into the matches of the previous frames, reusing their capacity.
+    std::vector<clip_matcher::TrackMatch>& batch_matches = m_batchMatches;
+    if (batch_matches.size() < track_batch.rows())
+        batch_matches.resize(track_batch.rows());
+    const bool scored = m_textImageMatcher->score(track_batch, m_matchScores);
+    for (size_t row = 0; row < track_batch.rows(); ++row)
     {
-        if (detection->get_label() != "person")
+        clip_matcher::TrackMatch& track_match = batch_matches[row];
+        track_match.valid = scored;
+        if (!scored)
             continue;
-        // get BBOX
-        HailoBBox bbox = detection->get_bbox();
-        //get track id
-        std::vector<HailoUniqueIDPtr> track_id = hailo_common::get_hailo_track_id(detection);
-        int id = 9999;
-        if (track_id.size() == 1) {
-            id = track_id[0]->get_id();
-            // NX_PRINT << "Handoff Probe track_id: " << id;
-        } 
-        else {
-            std::cout << " ID not found" << std::endl;
-        }
-        
+        const PromptSet& prompts = *m_matchScores.prompt_set;
+        const TextEmbeddingEntry& entry = prompts.entries[m_matchScores.best_entry(row)];
+        track_match.text.assign(entry.text);
+        track_match.similarity = m_matchScores.best_similarity(row);
+        track_match.negative = entry.negative;
+        track_match.passed_threshold = track_match.similarity > prompts.threshold;
+    }
+    const bool debug = m_textImageMatcher->get_debug();
+    const bool prompt_upadte = m_textImageMatcher->get_prompt_update();
+
+    // NX metadata, made of the objects of the previous frames
+    MetadataBuilder& metadata = this->deviceAgent->m_metadataBuilder;
+    metadata.begin(frame.timestampUs);
 
-        std::vector<HailoClassificationPtr> classifications = hailo_common::get_hailo_classifications(detection);
-        std::string clip_text = "";
+    for (size_t i = 0; i < used_objects.size(); ++i)
+    {
+        const MatcherFrame::Object& object = frame.objects[used_objects[i]];
+        static const clip_matcher::TrackMatch kNoMatch;
+        const clip_matcher::TrackMatch& track_match = batch_rows[i] >= 0 ? batch_matches[batch_rows[i]] : kNoMatch;
+        if (object.trackId != kNoTrackId)
+            track_cache.set_match(object.trackId, track_match);
+
+        static const std::string kNoText;
+        const std::string* clip_text = &kNoText;
         float clip_confidence = 0.0;
-        bool prompt_upadte = detector->m_textImageMatcher->get_prompt_update();
-        for (auto classification : classifications)
+        // While new prompts are being computed the stale classifications are dropped
+        if (track_match.valid && !prompt_upadte && (debug || (!track_match.negative && track_match.passed_threshold)))
         {
-            if (classification->get_classification_type() == "clip")
-            {
-                if (prompt_upadte)
-                {
-                    detection->remove_object(classification);
-                }
-                else
-                {
-                clip_text = classification->get_label();
-                clip_confidence = classification->get_confidence();
-                // std::cout << clip_text << " " << clip_confidence << std::endl;
-                }
-            }
+            clip_text = &track_match.text;
+            clip_confidence = track_match.similarity;
+        }
+
+        if (object.label != "person")
+            continue;
+        int id = object.trackId;
+        // Counted for the matcher log: once per person and frame would flood the log
+        if (id == kNoTrackId) {
+            id = 9999;
+            ++m_untrackedObjects;
         }
-        // convert hailo detection to nx detection
-        const std::shared_ptr<Detection> nx_detection = std::make_shared<Detection>(Detection{
-            /*boundingBox*/ nx::sdk::analytics::Rect(bbox.xmin(), bbox.ymin(), bbox.width(), bbox.height()),
-            /*classLabel*/ detection->get_label(),
-            /*confidence*/ detection->get_confidence(),
-            /*m_trackId*/ nx::sdk::Uuid(0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,id),
-            /*ClipLabel*/ clip_text,
-            /*ClipConfidence*/ clip_confidence
-        });
-        nx_detections.push_back(nx_detection);
+
+        // convert hailo detection to nx object metadata
+        metadata.add(this->deviceAgent->objectTypeId(object.label),
+                     nx::sdk::analytics::Rect(object.bbox[0], object.bbox[1], object.bbox[2], object.bbox[3]),
+                     object.confidence, id, *clip_text, clip_confidence);
     }
 
     try {
-        const auto& objectMetadataPacket =
-            detector->deviceAgent->detectionsToObjectMetadataPacket(nx_detections, timestampUs);
-        hailo::vms_server_plugins::clip_person_tracker::DeviceAgent::MetadataPacketList metadataPackets;
-        
-        if (objectMetadataPacket)
-        {
-            metadataPackets.push_back(objectMetadataPacket);
-        }
         // Push metadata packets to the DeviceAgent
-        detector->deviceAgent->pushMetadataPacketWrapper(metadataPackets);
-        
+        this->deviceAgent->pushObjectMetadata(metadata.finish());
     }
     catch (const std::exception& e) {
         NX_PRINT << "Exception caught: " << e.what() << '\n';
@@ -480,49 +758,86 @@ void GStreamerObjectDetector::on_handoff_clip(GstElement* object, GstBuffer* buf
     catch (...) {
         NX_PRINT << "Unknown exception caught\n";
     }
-    
-    return ;
 }
     
 void GStreamerObjectDetector::pushFrameToPipeline(const Frame& frame) {
     
+    // The admission controller counts the frames in the pipeline
+    const bool admission = ini().admissionControl;
+    AdmissionController& admission_controller = this->deviceAgent->m_admission;
+
     //check if pipeline is already running if not return
     if (!this->m_loaded) {
+        if (admission)
+            admission_controller.notSubmitted(frame.timestampUs);
         return;
     }
+    // Before the frame is submitted: replacing the pipeline abandons the frames in flight
+    if (this->m_pipeline)
+        checkPipeline();
     
     // Push frame data to the appsrc element in the GStreamer pipeline  
-    const cv::Mat image = frame.cvMat;
-    if (frame.width != 1280 || frame.height != 720) {
-        // throw ObjectDetectionError("Frame size is not 1280x720");
-        NX_PRINT << "Frame size is not 1280x720 width: " << frame.width << " height: " << frame.height << std::endl;
-        std::cout << "Frame size is not 1280x720 width: " << frame.width << " height: " << frame.height << std::endl;
-        return;
-    }
-    
-    // convert cv::Mat to GstBuffer
+    // Wraps the frame (kept alive until the pipeline releases the buffer), copies or resizes it
     auto timestampUs = frame.timestampUs;
     GstClockTime timestampNs = (GstClockTime)(timestampUs * 1000); // convert to nanoseconds
-    GstBuffer* buffer = gst_buffer_new_wrapped_full(
-        (GstMemoryFlags)GST_MEMORY_FLAG_READONLY,
-        (gpointer)image.data,
-        image.total() * image.elemSize(),
-        0,
-        image.total() * image.elemSize(),
-        nullptr,
-        nullptr);
-    
+    GstBuffer* buffer = this->m_frameIngest->makeBuffer(frame);
+    if (buffer == nullptr) {
+        if (admission)
+            admission_controller.notSubmitted(timestampUs);
+        return;
+    }
+
     // set buffer timestamp will be used later in the on_handoff function
     buffer->pts = timestampNs;
     buffer->dts = timestampNs;
     buffer->duration = GST_CLOCK_TIME_NONE;
     
-    GstFlowReturn ret;
-    g_signal_emit_by_name(this->appsrc, "push-buffer", buffer, &ret);
-    gst_buffer_unref(buffer);
-    if (ret != GST_FLOW_OK) {
-        // throw std::runtime_error("Error pushing buffer to pipeline");
-        std::cout << "Error pushing buffer to pipeline" << std::endl;
+    // Before the push: the frame may come out of the pipeline before the push returns
+    if (admission)
+        admission_controller.submitted(timestampUs);
+    bool pushed = true;
+    if (this->m_sharedLane >= 0) {
+        // New camera resolution: the frames in flight are mapped back with the new borders too
+        if (this->m_frameIngest->capsGeneration() != this->m_laneCapsGeneration) {
+            this->m_laneCapsGeneration = this->m_frameIngest->capsGeneration();
+            const std::lock_guard<std::mutex> lock(this->m_laneContentMutex);
+            this->m_laneContent = this->m_frameIngest->content();
+        }
+        pushed = this->m_sharedPipeline->push(this->m_sharedLane, buffer);
+        gst_buffer_unref(buffer);
+    }
+    else {
+        // The caps of the frame ingest go to the appsrc before the first buffer they apply to
+        pushed = this->m_pipeline->push(buffer, this->m_frameIngest->outputCaps(), this->m_frameIngest->capsGeneration());
+        gst_buffer_unref(buffer);
+    }
+    if (!pushed && admission)
+        admission_controller.notSubmitted(timestampUs);
+    const FrameIngest::Counters counters = this->m_frameIngest->counters();
+    if ((counters.zeroCopyFrames + counters.copiedFrames + counters.resizedFrames) % kIngestStatsFramePeriod == 0) {
+        const double resizeMs = counters.resizedFrames == 0
+            ? 0.0 : counters.resizeUs / 1000.0 / counters.resizedFrames;
+        std::cout << "Frame ingest ID: " << this->deviceAgent->m_DeviceAgentId
+                  << " input: " << counters.inputWidth << "x" << counters.inputHeight
+                  << " fed as: " << counters.outputWidth << "x" << counters.outputHeight
+                  << " zero-copy: " << counters.zeroCopyFrames << " copied: " << counters.copiedFrames
+                  << " resized: " << counters.resizedFrames << " (" << resizeMs << " ms/frame)"
+                  << " dropped: " << counters.droppedFrames << " outstanding: " << counters.outstandingFrames
+                  << std::endl;
+    }
+
+    // The device scheduler balances the vdevice groups on the load of the cameras, and may move
+    // this one if it runs a pipeline of its own
+    const auto now = std::chrono::steady_clock::now();
+    if (now - this->m_loadReportedAt >= kLoadReportPeriod) {
+        this->m_loadReportedAt = now;
+        const float latencyMs = admission ? admission_controller.counters().latencyMs : 0.0f;
+        DevicePlacement placement;
+        if (this->m_deviceScheduler->report(this->deviceAgent->m_DeviceAgentId, this->m_pipelineFrames, latencyMs, &placement)
+            && this->m_pipeline)
+        {
+            moveTo(placement);
+        }
     }
     return;
 }
@@ -1,19 +1,33 @@
 #pragma once
 
+#include <chrono>
 #include <filesystem>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 #include <memory>
 #include <thread>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
 
 #include "TextImageMatcher.hpp"
+#include "gallery.hpp"
+#include "track_cache.hpp"
 // #include "DetectionManager.h"
 
+#include "camera_pipeline.h"
+#include "device_scheduler.h"
 #include "exceptions.h"
 #include "frame.h"
+#include "frame_ingest.h"
+#include "latency_tracer.h"
+#include "matcher_pool.h"
+#include "pipeline_builder.h"
+#include "pipeline_config.h"
+#include "pipeline_pool.h"
+#include "shared_pipeline.h"
 #include "detection.h"
 
 #include <gst/gst.h>
@@ -23,35 +37,89 @@ namespace vms_server_plugins {
 namespace clip_person_tracker {
 class DeviceAgent; // Forward declaration of DeviceAgent
 
+// Networks, post-processing libraries and CLIP cropper of the pipelines, from the plugin resources
+PipelineResources pipelineResources(const std::filesystem::path& pluginHomeDir);
+
 class GStreamerObjectDetector {
 public:
-    explicit GStreamerObjectDetector(std::filesystem::path pluginHomeDir, hailo::vms_server_plugins::clip_person_tracker::DeviceAgent* deviceAgentPtr);
+    // Runs on a lane of sharedPipeline if one is free, otherwise (or if null) on a pipeline of its own
+    // claimed from pipelinePool, which stops it once this is terminated, on the vdevice groups given by
+    // deviceScheduler; the pipeline of its own is replaced when the scheduler moves the camera.
+    // Frames are matched on matcherPool, or on the streaming thread if it is null.
+    GStreamerObjectDetector(std::filesystem::path pluginHomeDir, hailo::vms_server_plugins::clip_person_tracker::DeviceAgent* deviceAgentPtr,
+                            std::shared_ptr<DeviceScheduler> deviceScheduler, std::shared_ptr<SharedPipeline> sharedPipeline, std::shared_ptr<PipelinePool> pipelinePool,
+                            std::shared_ptr<MatcherPool> matcherPool);
     ~GStreamerObjectDetector();
     void ensureInitialized();
     bool isTerminated() const;
+    // Stops the results and waits for the frames being matched; the pipeline of its own is stopped
+    // in the background by the pipeline pool
     void terminate();
     void set_debug(bool debug);
     DetectionList run(const Frame& frame);
+    // The pipelines of its own failed, and none runs yet; reported to the Server by the DeviceAgent
+    bool pipelineFailed() const { return m_pipelineFailures > 0; }
     hailo::vms_server_plugins::clip_person_tracker::DeviceAgent* deviceAgent; // Pointer to DeviceAgent
-    TextImageMatcher* m_textImageMatcher; // Pointer to TextImageMatcher
+    std::unique_ptr<TextImageMatcher> m_textImageMatcher; // Prompts of this camera, rows shared with the other cameras
+    MatchScores m_matchScores; // Match state of this pipeline, used only by matchFrame
+    clip_matcher::TrackCache m_trackCache; // Running CLIP embedding and match per tracked person
+    clip_matcher::EmbeddingBatch m_trackBatch; // Embeddings matched for the current frame, used only by matchFrame
+    AlignedFloatVector m_trackEmbedding; // Scratch copy of a track's running embedding
+    std::unique_ptr<clip_matcher::GalleryWriter> m_gallery; // Gallery of the tracks of this camera, null when disabled
+    std::vector<clip_matcher::TrackSummary> m_finishedTracks; // Tracks to write to the gallery, used only by matchFrame
+    std::unique_ptr<FrameIngest> m_frameIngest; // Makes the appsrc buffers, set before m_loaded
     // DetectionManager* m_DetectionManager; // Pointer to DetectionManager
     int m_thread_id; // Thread ID
     std::atomic<bool> m_debug;
 private:
-    void runPipeline();
+    friend class SharedPipeline; // Hands the results of a lane to handOffToMatcher
+    friend class CameraPipeline; // Hands the results of the pipeline of its own to handOffToMatcher
+    struct MatcherFrame; // Results of a frame, copied out of its buffer
+    class MatcherJob; // Matches a MatcherFrame on the matcher pool
     void pushFrameToPipeline(const Frame& frame);
-    static void on_handoff_clip(GstElement* object, GstBuffer* buffer, gpointer data);
-    std::unique_ptr<std::thread> pipeline_thread;
+    std::unique_ptr<LatencyTracer> makeLatencyTracer(); // Null if latency tracing is disabled
+    void moveTo(const DevicePlacement& placement); // Replaces the pipeline of its own by one on `placement`
+    void checkPipeline(); // Replaces the pipeline of its own after a backoff once it failed
+    void writeToGallery(std::vector<clip_matcher::TrackSummary>& tracks);
+    // Streaming thread side of the matching: copies the results of the frame of `buffer` and posts them
+    void handOffToMatcher(GstBuffer* buffer, LatencyTracer* latencyTracer);
+    void matchFrame(MatcherFrame& frame, LatencyTracer* latencyTracer);
+    void matchObjects(const MatcherFrame& frame);
+    void recycleMatcherFrame(std::unique_ptr<MatcherFrame> frame);
+    void waitForMatching(); // Until the frames posted to the matcher pool are done
+    static GstPadProbeReturn on_clip_cropper_probe(GstPad* pad, GstPadProbeInfo* info, gpointer data);
+    std::shared_ptr<DeviceScheduler> m_deviceScheduler;
+    std::shared_ptr<SharedPipeline> m_sharedPipeline;
+    int m_sharedLane = -1; // Lane of m_sharedPipeline, -1 when running a pipeline of its own
+    std::mutex m_laneContentMutex; // Guards m_laneContent
+    FrameIngest::Content m_laneContent; // Of the letterboxed lane frames, to map their detections back
+    uint64_t m_laneCapsGeneration = 0; // Of m_laneContent, used only by pushFrameToPipeline
+    std::shared_ptr<PipelinePool> m_pipelinePool;
+    std::unique_ptr<CameraPipeline> m_pipeline; // The pipeline of its own, null on a lane or once terminated
+    int m_pipelineFailures = 0; // Pipelines of its own failed in a row, used only on the frame thread
+    std::optional<std::chrono::steady_clock::time_point> m_pipelineRetryAt; // Set while m_pipeline failed
+    std::shared_ptr<MatcherPool> m_matcherPool; // Null matches on the streaming thread
+    std::mutex m_matcherMutex; // Guards the matcher frames below
+    std::condition_variable m_matcherDone;
+    int m_pendingMatches = 0; // Frames posted to m_matcherPool and not done yet
+    std::vector<std::unique_ptr<MatcherFrame>> m_freeMatcherFrames; // Reused, with their allocations
+    // Scratch of matchObjects, cleared per frame: it only allocates when a frame has more persons
+    // than any before
+    std::vector<size_t> m_usedObjects; // Objects of the frame with a CLIP embedding or a cached track
+    std::vector<int> m_batchRows; // Row of each used object in m_trackBatch, -1 if none
+    std::vector<clip_matcher::TrackMatch> m_batchMatches; // Match of each row of m_trackBatch, texts reused
+    std::atomic<uint64_t> m_handoffUs{0}; // Spent on the streaming threads handing frames over
+    std::atomic<uint64_t> m_matchUs{0}; // Spent matching, on the matcher pool
+    std::atomic<uint64_t> m_matchedFrames{0};
+    std::atomic<uint64_t> m_droppedMatches{0}; // The worker of this camera had a full queue
+    std::atomic<uint64_t> m_untrackedObjects{0}; // Persons matched without a track ID
+    std::atomic<uint64_t> m_pipelineFrames{0}; // Out of the pipeline, reported to m_deviceScheduler
+    std::chrono::steady_clock::time_point m_loadReportedAt; // Used only by pushFrameToPipeline
     std::atomic<bool> m_terminated{false};
     std::atomic<bool> m_loaded{false};
     // const std::filesystem::path m_modelPath;
     std::filesystem::path m_pluginHomeDir;
-    std::mutex pipeline_mutex;
-    GstElement* pipeline;
-    GstElement* appsrc;
-    GstElement* clip_matcher_identity;
-    GMainLoop* main_loop;
-    GstBus *bus;
+    PipelineConfig m_pipelineConfig; // Tuning of the pipeline, loaded once per camera
 };  
 
 } // namespace clip_person_tracker
@@ -15,6 +15,140 @@ struct Ini: public nx::kit::IniConfig
     Ini(): IniConfig("hailo_clip_plugin.ini") { reload(); }
 
     NX_INI_FLAG(0, enableOutput, "");
+    NX_INI_FLAG(0, fusedClipDequantize,
+        "Run the CLIP network without the clip_post filter: the raw quantized embeddings are\n"
+        "dequantized and normalized by the plugin while matching.");
+    NX_INI_FLOAT(0.3f, trackEmbeddingAlpha,
+        "Weight of a new CLIP embedding in the running average kept per track (scaled by the\n"
+        "detection confidence). 1 matches every frame on its own embedding.");
+    NX_INI_FLOAT(0.0f, trackSkipClipSimilarity,
+        "Tracks whose averaged embedding matches a prompt with at least this similarity are not\n"
+        "sent to CLIP, their cached match is reported instead. 0 runs CLIP on every person.");
+    NX_INI_INT(3, trackSkipClipMinObservations,
+        "CLIP embeddings a track needs before it may skip CLIP.");
+    NX_INI_INT(15, trackMaxSkippedFrames,
+        "Longest run of frames a track may skip CLIP before it is embedded again.");
+    NX_INI_FLAG(1, matcherSoftmax,
+        "Report the similarity of a person to a prompt as a softmax over all the prompts. When off,\n"
+        "it is the cosine similarity mapped linearly to [0, 1], which allows annMinPrompts; the\n"
+        "Threshold setting then applies to that mapping.");
+    NX_INI_INT(4096, annMinPrompts,
+        "Prompt vocabularies of at least this size are matched through an approximate\n"
+        "nearest-neighbour (IVF-flat) index instead of scoring every prompt. 0 disables the index.\n"
+        "Needs matcherSoftmax off: a softmax over the prompts needs all of them.");
+    NX_INI_FLAG(1, inProcessTextEncoder,
+        "Encode the prompts inside the plugin when the text encoder files are in resources/\n"
+        "(bpe_simple_vocab_16e6.txt, clip_text_encoder_RN50x4.bin); otherwise, or when off, the\n"
+        "text_image_matcher tool is run.");
+    NX_INI_INT(4096, promptCacheEntries,
+        "Prompt embeddings kept in memory by the prompt cache (prompt_embedding_cache.bin in the\n"
+        "plugin home dir); prompts found there are not encoded again.");
+    NX_INI_INT(1920, maxInputWidth,
+        "Frames wider than this are scaled down (keeping the aspect ratio) before the pipeline;\n"
+        "smaller frames are fed at their own resolution. 0 never scales.");
+    NX_INI_INT(1080, maxInputHeight,
+        "Frames taller than this are scaled down (keeping the aspect ratio) before the pipeline.\n"
+        "0 never scales.");
+    NX_INI_FLAG(1, zeroCopyIngest,
+        "Hand the camera frames to the pipeline without copying them when their rows are not\n"
+        "padded; the frame is released when the pipeline is done with it. Off copies every frame.");
+    NX_INI_INT(4, ingestPoolBuffers,
+        "Buffers of the pool frames are copied into (padded frames, or zeroCopyIngest off); frames\n"
+        "are dropped while all are in the pipeline. 0 allocates a buffer per copied frame.");
+    NX_INI_FLAG(1, admissionControl,
+        "Pick the frames sent to the pipeline by its load: at admissionTargetFps, slowed down while\n"
+        "the pipeline is overloaded. Off sends every second frame, whatever the load.");
+    NX_INI_FLOAT(15.0f, admissionTargetFps,
+        "Frames per second of a camera sent to the pipeline when it keeps up. 0 sends every frame\n"
+        "the occupancy limit allows.");
+    NX_INI_FLOAT(1.0f, admissionMinFps, "Lowest rate an overloaded pipeline slows a camera down to.");
+    NX_INI_INT(10, admissionMaxInFlight,
+        "Frames of a camera in the pipeline at most; frames beyond are not sent. The rate is cut\n"
+        "when 3/4 of them are in use.");
+    NX_INI_INT(1500, admissionTargetLatencyMs,
+        "End-to-end latency (appsrc to matching) above which the rate of a camera is cut.");
+    NX_INI_INT(3000, admissionFrameTimeoutMs,
+        "Frames in the pipeline for longer are counted as lost, which also cuts the rate.");
+    NX_INI_INT(0, sharedPipelineCameras,
+        "Cameras that share one pipeline, whose detection and CLIP networks batch the frames of all\n"
+        "of them; further cameras run a pipeline of their own. 0 gives every camera its own pipeline.");
+    NX_INI_INT(1280, sharedPipelineWidth,
+        "Width of the frames of the shared pipeline, which the camera images are scaled to fit\n"
+        "keeping their aspect ratio, between black borders.");
+    NX_INI_INT(720, sharedPipelineHeight,
+        "Height of the frames of the shared pipeline, see sharedPipelineWidth.");
+    NX_INI_INT(1, warmPipelines,
+        "Pipelines of their own kept started ahead, so that new cameras without a lane of the shared\n"
+        "pipeline get one at once. 0 starts the pipeline of a camera when it comes.");
+    NX_INI_INT(60000, warmPipelineRetireMs,
+        "Time a warm pipeline is kept on vdevice groups a new camera would no longer be placed on,\n"
+        "before it is replaced by one on the groups it would.");
+    NX_INI_INT(1000, pipelineEosTimeoutMs,
+        "Time a stopping pipeline gives its last frames to come out before it is stopped anyway.");
+    NX_INI_INT(20000, pipelinePrerollTimeoutMs,
+        "Time a starting pipeline is given to load its networks and run a blank frame through them,\n"
+        "after which it is failed. 0 does not preroll: the first frame of the camera does it.");
+    NX_INI_INT(1000, pipelineRetryMs,
+        "Time before a pipeline that failed to start or broke is replaced, doubled after each further\n"
+        "failure in a row up to 32 times.");
+    NX_INI_INT(30000, deviceRebalancePeriodMs,
+        "Period at which a camera with a pipeline of its own may be moved to less loaded vdevice groups,\n"
+        "restarting its pipeline and tracks. 0 leaves the cameras where they were placed.");
+    NX_INI_INT(2, matcherWorkers,
+        "Threads matching the frames out of the pipelines, each serving its cameras in order.\n"
+        "0 matches on the GStreamer streaming threads.");
+    NX_INI_INT(16, matcherQueueDepth,
+        "Frames waiting for each matcher thread; frames beyond are dropped.");
+    NX_INI_STRING("", pipelineProfile,
+        "JSON profile of the pipeline settings below, absolute or relative to the plugin home dir\n"
+        "(e.g. resources/configs/pipeline_profile.json). Its keys are the names of the settings,\n"
+        "the values it sets override those of this file.");
+    NX_INI_INT(12, inputQueueDepth,
+        "Frames buffered after the appsrc; older frames are dropped when the pipeline is behind.");
+    NX_INI_INT(3, queueDepth, "Buffers of the queues between the pipeline elements.");
+    NX_INI_INT(20, bypassQueueDepth,
+        "Frames held by the aggregators while their crops are in the detection or CLIP network.");
+    NX_INI_INT(8, detectionBatchSize, "batch-size of the detection network.");
+    NX_INI_INT(100, detectionSchedulerTimeoutMs, "scheduler-timeout-ms of the detection network.");
+    NX_INI_INT(31, detectionSchedulerPriority, "scheduler-priority of the detection network.");
+    NX_INI_STRING("3,2", detectionVdeviceGroups,
+        "vdevice-group-id the detection networks may run on, comma separated: each camera is placed\n"
+        "on the least loaded one.");
+    NX_INI_INT(8, clipBatchSize, "batch-size of the CLIP network.");
+    NX_INI_INT(1000, clipSchedulerTimeoutMs, "scheduler-timeout-ms of the CLIP network.");
+    NX_INI_INT(16, clipSchedulerPriority, "scheduler-priority of the CLIP network.");
+    NX_INI_STRING("1", clipVdeviceGroups,
+        "vdevice-group-id the CLIP networks may run on, comma separated: each camera is placed on the\n"
+        "least loaded one.");
+    NX_INI_FLOAT(0.8f, trackerKalmanDistThreshold, "kalman-dist-thr of hailotracker.");
+    NX_INI_FLOAT(0.9f, trackerIouThreshold, "iou-thr of hailotracker.");
+    NX_INI_FLOAT(0.7f, trackerInitIouThreshold, "init-iou-thr of hailotracker.");
+    NX_INI_INT(2, trackerKeepNewFrames, "keep-new-frames of hailotracker.");
+    NX_INI_INT(15, trackerKeepTrackedFrames, "keep-tracked-frames of hailotracker.");
+    NX_INI_INT(2, trackerKeepLostFrames, "keep-lost-frames of hailotracker.");
+    NX_INI_FLAG(0, standInInference,
+        "Run the pipeline without a Hailo device: CPU stand-ins replace the detection and CLIP\n"
+        "networks, with deterministic persons and embeddings. For profiling and testing only.");
+    NX_INI_INT(3, standInPersons, "Persons the stand-in detection finds in every frame.");
+    NX_INI_INT(640, standInEmbeddingDim,
+        "Size of the stand-in CLIP embeddings; the prompt embeddings must have the same size.");
+    NX_INI_FLOAT(0.1f, standInEmbeddingNoise,
+        "Per-frame noise of the stand-in embedding of a track, relative to the embedding.");
+    NX_INI_INT(20000, standInDetectionBatchUs,
+        "Simulated time of a detection batch (detectionBatchSize frames), in microseconds.");
+    NX_INI_INT(40000, standInClipBatchUs,
+        "Simulated time of a CLIP batch (clipBatchSize crops), in microseconds.");
+    NX_INI_FLAG(0, latencyTracing,
+        "Time every frame through the stages of its pipeline, from the appsrc push to the end of\n"
+        "the matching, and log their p50/p95/p99 per camera.");
+    NX_INI_INT(3000, latencyReportFrames, "Frames between two latency reports of a camera.");
+    NX_INI_STRING("", latencyTraceDir,
+        "With latencyTracing, directory where the stages of the first latencyTraceFrames frames of\n"
+        "every camera are written as Chrome trace JSON (latency_trace_<camera>.json).");
+    NX_INI_INT(1000, latencyTraceFrames, "Frames of a camera written to its latency trace.");
+    NX_INI_STRING("", galleryDir,
+        "Directory of the person gallery: when set, the averaged CLIP embedding of every track is\n"
+        "appended there when the track ends, so new prompts can be searched over past tracks.");
 };
 
 Ini& ini();
@@ -0,0 +1,175 @@
+#include "ivf_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+
+#include "similarity_kernel.hpp"
+
+namespace clip_matcher {
+
+namespace {
+
+// Rows assigned per dot_products() call while clustering, bounds the score buffer
+constexpr size_t kAssignChunkRows = 1024;
+
+void normalize(float* row, size_t dim) {
+    float sum_squares = 0.0f;
+    for (size_t k = 0; k < dim; ++k) {
+        sum_squares += row[k] * row[k];
+    }
+    if (sum_squares > 0.0f) {
+        const float inverse_norm = 1.0f / std::sqrt(sum_squares);
+        for (size_t k = 0; k < dim; ++k) {
+            row[k] *= inverse_norm;
+        }
+    }
+}
+
+// Index of the closest centroid (highest dot product) of every row.
+void assign_rows(const float* rows, size_t count, size_t dim, size_t stride,
+                 const float* centroids, size_t num_lists, std::vector<int>& assignment) {
+    std::vector<float> scores(std::min(count, kAssignChunkRows) * num_lists);
+    assignment.resize(count);
+    for (size_t first = 0; first < count; first += kAssignChunkRows) {
+        const size_t chunk = std::min(kAssignChunkRows, count - first);
+        dot_products(rows + first * stride, chunk, stride, centroids, num_lists, dim, dim, scores.data());
+        for (size_t i = 0; i < chunk; ++i) {
+            const float* row_scores = scores.data() + i * num_lists;
+            assignment[first + i] = static_cast<int>(std::max_element(row_scores, row_scores + num_lists) - row_scores);
+        }
+    }
+}
+
+bool better(const Neighbor& a, const Neighbor& b) {
+    return a.score > b.score || (a.score == b.score && a.row < b.row);
+}
+
+} // namespace
+
+std::shared_ptr<const IvfFlatIndex> IvfFlatIndex::build(const float* rows, size_t count, size_t dim,
+                                                        size_t stride, const IvfParams& params) {
+    std::shared_ptr<IvfFlatIndex> index(new IvfFlatIndex());
+    index->m_dim = dim;
+    if (count == 0 || dim == 0) {
+        index->m_list_offsets.assign(1, 0);
+        return index;
+    }
+    size_t num_lists = params.num_lists;
+    if (num_lists == 0)
+        num_lists = static_cast<size_t>(std::lround(std::sqrt(static_cast<double>(count))));
+    num_lists = std::clamp<size_t>(num_lists, 1, count);
+    index->m_num_probes = std::clamp<size_t>(params.num_probes, 1, num_lists);
+
+    // Spherical k-means, seeded with distinct rows picked at random
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), std::mt19937(params.seed));
+    AlignedFloatVector& centroids = index->m_centroids;
+    centroids.resize(num_lists * dim);
+    for (size_t l = 0; l < num_lists; ++l) {
+        std::copy(rows + order[l] * stride, rows + order[l] * stride + dim, centroids.data() + l * dim);
+    }
+
+    std::vector<int> assignment;
+    std::vector<float> sums(num_lists * dim);
+    std::vector<size_t> list_sizes(num_lists);
+    for (int iteration = 0; iteration < params.kmeans_iterations; ++iteration) {
+        assign_rows(rows, count, dim, stride, centroids.data(), num_lists, assignment);
+        std::fill(sums.begin(), sums.end(), 0.0f);
+        std::fill(list_sizes.begin(), list_sizes.end(), 0);
+        for (size_t i = 0; i < count; ++i) {
+            float* sum = sums.data() + assignment[i] * dim;
+            const float* row = rows + i * stride;
+            for (size_t k = 0; k < dim; ++k) {
+                sum[k] += row[k];
+            }
+            ++list_sizes[assignment[i]];
+        }
+        for (size_t l = 0; l < num_lists; ++l) {
+            // An empty list keeps its centroid
+            if (list_sizes[l] == 0)
+                continue;
+            std::copy(sums.begin() + l * dim, sums.begin() + (l + 1) * dim, centroids.begin() + l * dim);
+            normalize(centroids.data() + l * dim, dim);
+        }
+    }
+    assign_rows(rows, count, dim, stride, centroids.data(), num_lists, assignment);
+
+    // Drop the lists that ended up empty, so every probed list yields candidates
+    std::fill(list_sizes.begin(), list_sizes.end(), 0);
+    for (size_t i = 0; i < count; ++i) {
+        ++list_sizes[assignment[i]];
+    }
+    std::vector<int> new_list(num_lists, -1);
+    size_t kept_lists = 0;
+    for (size_t l = 0; l < num_lists; ++l) {
+        if (list_sizes[l] == 0)
+            continue;
+        std::copy(centroids.begin() + l * dim, centroids.begin() + (l + 1) * dim, centroids.begin() + kept_lists * dim);
+        new_list[l] = static_cast<int>(kept_lists++);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        assignment[i] = new_list[assignment[i]];
+    }
+    num_lists = kept_lists;
+    centroids.resize(num_lists * dim);
+    index->m_num_probes = std::min(index->m_num_probes, num_lists);
+
+    // Group the rows by list (stable, so rows stay in order inside a list)
+    index->m_list_offsets.assign(num_lists + 1, 0);
+    for (size_t i = 0; i < count; ++i) {
+        ++index->m_list_offsets[assignment[i] + 1];
+    }
+    std::partial_sum(index->m_list_offsets.begin(), index->m_list_offsets.end(), index->m_list_offsets.begin());
+    std::vector<size_t> next(index->m_list_offsets.begin(), index->m_list_offsets.end() - 1);
+    index->m_vectors.resize(count * dim);
+    index->m_rows.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const size_t position = next[assignment[i]]++;
+        std::copy(rows + i * stride, rows + i * stride + dim, index->m_vectors.data() + position * dim);
+        index->m_rows[position] = static_cast<int>(i);
+    }
+    return index;
+}
+
+void IvfFlatIndex::search(const float* query, float query_scale, size_t k, size_t num_probes,
+                          IvfSearchScratch& scratch, std::vector<Neighbor>& results) const {
+    results.clear();
+    const size_t lists = num_lists();
+    if (k == 0 || m_rows.empty())
+        return;
+    num_probes = std::clamp<size_t>(num_probes == 0 ? m_num_probes : num_probes, 1, lists);
+
+    // Closest centroids, the (positive) query scale does not change their order
+    scratch.centroid_scores.resize(lists);
+    dot_products(query, 1, m_dim, m_centroids.data(), lists, m_dim, m_dim, scratch.centroid_scores.data());
+    scratch.probe_lists.resize(lists);
+    std::iota(scratch.probe_lists.begin(), scratch.probe_lists.end(), 0);
+    const std::vector<float>& centroid_scores = scratch.centroid_scores;
+    std::partial_sort(scratch.probe_lists.begin(), scratch.probe_lists.begin() + num_probes, scratch.probe_lists.end(),
+                      [&centroid_scores](int a, int b) { return centroid_scores[a] > centroid_scores[b]; });
+
+    std::vector<Neighbor>& candidates = scratch.candidates;
+    candidates.clear();
+    for (size_t p = 0; p < num_probes; ++p) {
+        const int list = scratch.probe_lists[p];
+        const size_t begin = m_list_offsets[list];
+        const size_t size = m_list_offsets[list + 1] - begin;
+        if (size == 0)
+            continue;
+        scratch.list_scores.resize(size);
+        dot_products(query, 1, m_dim, m_vectors.data() + begin * m_dim, size, m_dim, m_dim,
+                     scratch.list_scores.data());
+        for (size_t i = 0; i < size; ++i) {
+            candidates.push_back({m_rows[begin + i], scratch.list_scores[i] * query_scale});
+        }
+    }
+
+    const size_t count = std::min(k, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(), better);
+    results.assign(candidates.begin(), candidates.begin() + count);
+}
+
+} // namespace clip_matcher
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "aligned_allocator.hpp"
+
+// Inverted-file (IVF-flat) index over normalized prompt embeddings, used by TextImageMatcher instead
+// of scoring every prompt once a vocabulary grows to thousands of phrases.
+//
+// The prompts are split into lists by spherical k-means. A search scores the query against the list
+// centroids and then only against the prompts of the best `num_probes` lists, with the same dot
+// product kernel as the brute-force match. Each list is stored contiguously, so probing a list is one
+// kernel call over a dense matrix.
+
+namespace clip_matcher {
+
+struct IvfParams {
+    // Number of lists, 0 picks about sqrt(count).
+    size_t num_lists = 0;
+    // Lists scanned per query when search() is not given a count.
+    size_t num_probes = 8;
+    int kmeans_iterations = 10;
+    uint32_t seed = 1;
+};
+
+struct Neighbor {
+    int row;     // row of the matrix the index was built from
+    float score; // dot product with the query
+};
+
+// Per-caller buffers of search(), so concurrent searches do not share memory.
+struct IvfSearchScratch {
+    std::vector<float> centroid_scores;
+    std::vector<int> probe_lists;
+    std::vector<float> list_scores;
+    std::vector<Neighbor> candidates;
+};
+
+class IvfFlatIndex {
+public:
+    // Builds the index over `count` normalized rows of `dim` floats, `stride` floats apart. The rows
+    // are copied, the matrix does not need to outlive the index.
+    static std::shared_ptr<const IvfFlatIndex> build(const float* rows, size_t count, size_t dim,
+                                                     size_t stride, const IvfParams& params = IvfParams());
+
+    // Appends to `results` (cleared first) the `k` rows with the highest dot product with
+    // `query` * `query_scale`, best first, among the lists of the `num_probes` closest centroids
+    // (0 uses the build parameters).
+    void search(const float* query, float query_scale, size_t k, size_t num_probes,
+                IvfSearchScratch& scratch, std::vector<Neighbor>& results) const;
+
+    size_t size() const { return m_rows.size(); }
+    size_t dim() const { return m_dim; }
+    size_t num_lists() const { return m_list_offsets.empty() ? 0 : m_list_offsets.size() - 1; }
+    size_t default_num_probes() const { return m_num_probes; }
+
+private:
+    IvfFlatIndex() = default;
+
+    size_t m_dim = 0;
+    size_t m_num_probes = 0;
+    AlignedFloatVector m_centroids;    // num_lists() x dim, normalized
+    std::vector<size_t> m_list_offsets; // list `l` holds vectors [m_list_offsets[l], m_list_offsets[l + 1])
+    AlignedFloatVector m_vectors;      // size() x dim, grouped by list
+    std::vector<int> m_rows;           // original row of each vector in m_vectors
+};
+
+} // namespace clip_matcher
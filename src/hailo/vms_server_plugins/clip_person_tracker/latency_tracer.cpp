@@ -0,0 +1,235 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "latency_tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+namespace {
+
+constexpr double kBucketBase = 1.1;
+
+// Name of the stage ending at each mark; the stage ending at `pushed` is the whole pipeline
+const char* const kStageNames[LatencyTracer::markCount] = {
+    "total",
+    "input_queue",
+    "letterbox_crop",
+    "detection",
+    "tracker",
+    "person_crop",
+    "clip",
+    "output_queue",
+    "handoff",
+    "matcher_queue",
+    "matching",
+};
+
+struct ProbePoint
+{
+    const char* element; //< Null for the tracker, whose name depends on the pipeline.
+    const char* pad;
+    LatencyTracer::Mark mark;
+};
+
+const ProbePoint kProbePoints[] = {
+    {"detection_crop", "sink", LatencyTracer::detectionCropIn},
+    {"pre_detecion_net", "src", LatencyTracer::detectionNetIn},
+    {"agg1", "src", LatencyTracer::detectionOut},
+    {nullptr, "src", LatencyTracer::trackerOut},
+    {"pre_clip_net", "src", LatencyTracer::clipNetIn},
+    {"agg", "src", LatencyTracer::clipOut},
+};
+
+} // namespace
+
+void LatencyTracer::Histogram::add(int64_t us)
+{
+    const int bucket = us <= 1 ? 0 : static_cast<int>(std::log(double(us)) / std::log(kBucketBase));
+    ++counts[std::min(bucket, kBuckets - 1)];
+    ++total;
+}
+
+int64_t LatencyTracer::Histogram::percentileUs(double percentile) const
+{
+    if (total == 0)
+        return 0;
+    const uint64_t rank = static_cast<uint64_t>(std::ceil(percentile / 100.0 * total));
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < kBuckets; ++bucket)
+    {
+        seen += counts[bucket];
+        // Upper bound of the bucket, off by at most 10%
+        if (seen >= rank)
+            return static_cast<int64_t>(std::pow(kBucketBase, bucket + 1));
+    }
+    return static_cast<int64_t>(std::pow(kBucketBase, kBuckets));
+}
+
+LatencyTracer::LatencyTracer(std::string name, int reportFrames, std::string tracePath, int traceFrames):
+    m_name(std::move(name)),
+    m_reportFrames(reportFrames),
+    m_traceFrames(traceFrames)
+{
+    for (int mark = 0; mark < markCount; ++mark)
+        m_probes[mark] = Probe{this, static_cast<Mark>(mark)};
+    if (!tracePath.empty() && traceFrames > 0)
+    {
+        m_trace.open(tracePath, std::ios::trunc);
+        if (m_trace)
+        {
+            m_trace << "[\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, "
+                "\"args\": {\"name\": \"" << m_name << "\"}}";
+            std::cout << "Latency tracer " << m_name << ": tracing to " << tracePath << std::endl;
+        }
+        else
+        {
+            std::cout << "Latency tracer " << m_name << ": cannot write " << tracePath << std::endl;
+        }
+    }
+}
+
+LatencyTracer::~LatencyTracer()
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_trace.is_open())
+        m_trace << "\n]\n";
+    if (m_frames > 0)
+        std::cout << "Latency tracer " << m_name << ":\n" << reportLocked();
+}
+
+void LatencyTracer::attach(GstElement* pipeline, const std::string& trackerName)
+{
+    for (const ProbePoint& point: kProbePoints)
+    {
+        const std::string elementName = point.element ? point.element : trackerName;
+        GstElement* element = gst_bin_get_by_name(GST_BIN(pipeline), elementName.c_str());
+        if (element == nullptr)
+        {
+            std::cout << "Latency tracer " << m_name << ": no " << elementName << " in the pipeline" << std::endl;
+            continue;
+        }
+        GstPad* pad = gst_element_get_static_pad(element, point.pad);
+        if (pad != nullptr)
+        {
+            gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, &LatencyTracer::onProbe, &m_probes[point.mark], nullptr);
+            gst_object_unref(pad);
+        }
+        gst_object_unref(element);
+    }
+}
+
+void LatencyTracer::markPushed(GstBuffer* buffer)
+{
+    const GstClockTime pts = GST_BUFFER_PTS(buffer);
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    Marks& marks = m_inFlight[pts];
+    marks = Marks{};
+    marks[pushed] = Clock::now();
+    while (m_inFlight.size() > kMaxInFlight)
+        m_inFlight.erase(m_inFlight.begin());
+}
+
+std::string LatencyTracer::report() const
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return reportLocked();
+}
+
+void LatencyTracer::mark(GstClockTime pts, Mark mark)
+{
+    const Clock::time_point now = Clock::now();
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    // Frames of other cameras (shared elements) and frames pushed before the tracer are ignored
+    const auto frame = m_inFlight.find(pts);
+    if (frame == m_inFlight.end())
+        return;
+    // The first buffer of a frame crossing a boundary times it, later crops do not
+    if (frame->second[mark] == Clock::time_point{})
+        frame->second[mark] = now;
+    if (mark != matchOut)
+        return;
+    finish(frame->second);
+    m_inFlight.erase(frame);
+}
+
+void LatencyTracer::finish(const Marks& marks)
+{
+    Clock::time_point previous = marks[pushed];
+    for (int mark = pushed + 1; mark < markCount; ++mark)
+    {
+        if (marks[mark] == Clock::time_point{})
+            continue;
+        m_stages[mark].add(std::chrono::duration_cast<std::chrono::microseconds>(marks[mark] - previous).count());
+        previous = marks[mark];
+    }
+    m_stages[pushed].add(std::chrono::duration_cast<std::chrono::microseconds>(previous - marks[pushed]).count());
+    ++m_frames;
+    if (m_trace.is_open() && m_tracedFrames < m_traceFrames)
+        writeTrace(marks);
+    if (m_reportFrames > 0 && m_frames % static_cast<uint64_t>(m_reportFrames) == 0)
+        std::cout << "Latency tracer " << m_name << " after " << m_frames << " frames:\n" << reportLocked();
+}
+
+/**
+ * Async events, as the frames in the pipeline overlap: one per frame, with the stages it went
+ * through nested in it.
+ */
+void LatencyTracer::writeTrace(const Marks& marks)
+{
+    const auto event = [this](const char* name, char phase, Clock::time_point time)
+        {
+            m_trace << ",\n{\"name\": \"" << name << "\", \"cat\": \"frame\", \"ph\": \"" << phase
+                << "\", \"id\": " << m_frames << ", \"pid\": 1, \"tid\": 1, \"ts\": "
+                << std::chrono::duration_cast<std::chrono::microseconds>(time - m_origin).count() << "}";
+        };
+    event("frame", 'b', marks[pushed]);
+    Clock::time_point previous = marks[pushed];
+    for (int mark = pushed + 1; mark < markCount; ++mark)
+    {
+        if (marks[mark] == Clock::time_point{})
+            continue;
+        event(kStageNames[mark], 'b', previous);
+        event(kStageNames[mark], 'e', marks[mark]);
+        previous = marks[mark];
+    }
+    event("frame", 'e', previous);
+    if (++m_tracedFrames == m_traceFrames)
+    {
+        m_trace << "\n]\n";
+        m_trace.close();
+        std::cout << "Latency tracer " << m_name << ": trace of " << m_tracedFrames << " frames written" << std::endl;
+    }
+}
+
+std::string LatencyTracer::reportLocked() const
+{
+    std::ostringstream result;
+    for (int mark = 0; mark < markCount; ++mark)
+    {
+        const Histogram& histogram = m_stages[mark];
+        result << "  " << kStageNames[mark] << ": p50 " << histogram.percentileUs(50) / 1000.0
+            << " ms, p95 " << histogram.percentileUs(95) / 1000.0
+            << " ms, p99 " << histogram.percentileUs(99) / 1000.0
+            << " ms (" << histogram.total << " frames)\n";
+    }
+    return result.str();
+}
+
+GstPadProbeReturn LatencyTracer::onProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer data)
+{
+    const Probe* probe = static_cast<const Probe*>(data);
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (buffer != nullptr)
+        probe->tracer->mark(GST_BUFFER_PTS(buffer), probe->mark);
+    return GST_PAD_PROBE_OK;
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
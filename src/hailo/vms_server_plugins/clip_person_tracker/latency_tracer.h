@@ -0,0 +1,121 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <gst/gst.h>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/**
+ * Latency of the frames of a camera through the stages of its pipeline, from the push to the appsrc
+ * to the end of their matching.
+ *
+ * A frame is followed by its PTS: pad probes at the stage boundaries timestamp the first buffer of
+ * each PTS they see (crops carry the PTS of their frame), the push, the handoff from the matcher
+ * appsink and the matching are marked by the caller. A stage lasts from the previous boundary the
+ * frame crossed: frames without persons never reach the CLIP network, their CLIP crop time counts
+ * as CLIP time.
+ *
+ * Stage latencies go into log-scale histograms, reported as p50/p95/p99 every reportFrames frames
+ * and by report(). With a trace path, the stages of the first traceFrames frames are also written
+ * as Chrome trace JSON (chrome://tracing, Perfetto).
+ */
+class LatencyTracer
+{
+public:
+    enum Mark
+    {
+        pushed,
+        detectionCropIn, //< detection_crop sink
+        detectionNetIn, //< pre_detecion_net src
+        detectionOut, //< agg1 src
+        trackerOut, //< The tracker's src
+        clipNetIn, //< pre_clip_net src
+        clipOut, //< agg src
+        handoffIn, //< The frame reached the matcher appsink
+        handoffOut, //< Handed over to the matcher
+        matchIn,
+        matchOut,
+        markCount
+    };
+
+    /**
+     * @param name Camera or lane, in the reports and as the trace thread name.
+     * @param tracePath Chrome trace JSON to write, none if empty.
+     */
+    LatencyTracer(std::string name, int reportFrames, std::string tracePath, int traceFrames);
+    ~LatencyTracer();
+
+    LatencyTracer(const LatencyTracer&) = delete;
+    LatencyTracer& operator=(const LatencyTracer&) = delete;
+
+    /**
+     * Probes the stage boundaries of `pipeline`, whose tracker is `trackerName`. The tracer must
+     * outlive the pipeline's streaming.
+     */
+    void attach(GstElement* pipeline, const std::string& trackerName);
+
+    /** Starts following the frame of `buffer`, called before pushing it to the appsrc. */
+    void markPushed(GstBuffer* buffer);
+
+    /** Marks the frame of `pts` from any thread; matchOut ends it. */
+    void mark(GstClockTime pts, Mark mark);
+
+    /** p50/p95/p99 and frame count of every stage, one line per stage. */
+    std::string report() const;
+
+private:
+    static constexpr int kBuckets = 200; //< 10% wide, from 1 us up to about 3 minutes.
+    static constexpr size_t kMaxInFlight = 256; //< Older frames are forgotten, the queues dropped them.
+
+    struct Histogram
+    {
+        std::array<uint64_t, kBuckets> counts{};
+        uint64_t total = 0;
+
+        void add(int64_t us);
+        int64_t percentileUs(double percentile) const;
+    };
+
+    using Clock = std::chrono::steady_clock;
+    using Marks = std::array<Clock::time_point, markCount>;
+
+    struct Probe
+    {
+        LatencyTracer* tracer;
+        Mark mark;
+    };
+
+    void finish(const Marks& marks);
+    void writeTrace(const Marks& marks);
+    std::string reportLocked() const;
+    static GstPadProbeReturn onProbe(GstPad* pad, GstPadProbeInfo* info, gpointer data);
+
+private:
+    const std::string m_name;
+    const int m_reportFrames;
+    const int m_traceFrames;
+    std::array<Probe, markCount> m_probes;
+
+    mutable std::mutex m_mutex;
+    std::map<GstClockTime, Marks> m_inFlight;
+    std::array<Histogram, markCount> m_stages; //< By the mark ending the stage; [pushed] is the total.
+    uint64_t m_frames = 0;
+    std::ofstream m_trace;
+    int m_tracedFrames = 0;
+    const Clock::time_point m_origin = Clock::now();
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
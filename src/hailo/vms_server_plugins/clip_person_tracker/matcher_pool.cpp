@@ -0,0 +1,84 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "matcher_pool.h"
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+MatcherPool::MatcherPool(int workers, int queueDepth)
+{
+    for (int i = 0; i < std::max(workers, 1); ++i)
+        m_workers.push_back(std::make_unique<Worker>(std::max(queueDepth, 1)));
+    for (const auto& worker: m_workers)
+        worker->thread = std::thread(&MatcherPool::run, this, std::ref(*worker));
+    std::cout << "Matcher pool: " << m_workers.size() << " workers, " << m_workers.front()->queue.capacity()
+        << " frames queued per worker" << std::endl;
+}
+
+MatcherPool::~MatcherPool()
+{
+    m_stopped = true;
+    for (const auto& worker: m_workers)
+    {
+        {
+            const std::lock_guard<std::mutex> lock(worker->mutex);
+        }
+        worker->condition.notify_all();
+        worker->thread.join();
+        // The jobs left are destroyed unrun
+        std::unique_ptr<Job> job;
+        while (worker->queue.tryPop(job))
+            job.reset();
+    }
+}
+
+bool MatcherPool::post(int key, std::unique_ptr<Job>& job)
+{
+    Worker& worker = *m_workers[static_cast<size_t>(key) % m_workers.size()];
+    if (m_stopped || !worker.queue.tryPush(job))
+        return false;
+    // Orders the push before reading `sleeping`, paired with the fence of run(): either the worker
+    // sees the job before sleeping, or this sees it sleeping and wakes it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (worker.sleeping.load())
+    {
+        const std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.condition.notify_one();
+    }
+    return true;
+}
+
+void MatcherPool::run(Worker& worker)
+{
+    std::unique_ptr<Job> job;
+    while (!m_stopped)
+    {
+        if (worker.queue.tryPop(job))
+        {
+            try
+            {
+                job->run();
+            }
+            catch (const std::exception& e)
+            {
+                std::cout << "Matcher pool: job failed: " << e.what() << std::endl;
+            }
+            job.reset();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(worker.mutex);
+        worker.sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        worker.condition.wait(lock, [&]() { return m_stopped || !worker.queue.empty(); });
+        worker.sleeping = false;
+    }
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,74 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bounded_mpsc_queue.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/**
+ * Threads matching the frames that came out of the pipelines of an Engine, so that the GStreamer
+ * streaming threads only hand the results over and go back to feeding the networks.
+ *
+ * Every key (a camera) is served by one worker, in the order its jobs were posted: the per-camera
+ * state of the matcher is never touched by two threads and the metadata of a camera keeps the order
+ * of its frames. Each worker takes its jobs from a bounded lock-free queue, and sleeps only when it
+ * is empty.
+ */
+class MatcherPool
+{
+public:
+    class Job
+    {
+    public:
+        virtual ~Job() = default;
+        virtual void run() = 0;
+    };
+
+    /** @param queueDepth Jobs waiting for each worker; more are refused. */
+    MatcherPool(int workers, int queueDepth);
+    /** Destroys the waiting jobs without running them and joins the workers. */
+    ~MatcherPool();
+
+    MatcherPool(const MatcherPool&) = delete;
+    MatcherPool& operator=(const MatcherPool&) = delete;
+
+    int workers() const { return static_cast<int>(m_workers.size()); }
+
+    /**
+     * Queues `job` on the worker of `key`, or leaves it to the caller and returns false if that
+     * worker has queueDepth jobs waiting.
+     */
+    bool post(int key, std::unique_ptr<Job>& job);
+
+private:
+    struct Worker
+    {
+        explicit Worker(int queueDepth): queue(static_cast<size_t>(queueDepth)) {}
+
+        BoundedMpscQueue<std::unique_ptr<Job>> queue;
+        std::mutex mutex; //< Only for sleeping on an empty queue.
+        std::condition_variable condition;
+        std::atomic<bool> sleeping{false};
+        std::thread thread;
+    };
+
+    void run(Worker& worker);
+
+private:
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<bool> m_stopped{false};
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
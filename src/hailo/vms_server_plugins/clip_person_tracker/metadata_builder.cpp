@@ -0,0 +1,131 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "metadata_builder.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <nx/sdk/helpers/uuid_helper.h>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+using nx::sdk::makePtr;
+using nx::sdk::Ptr;
+using nx::sdk::analytics::Attribute;
+using nx::sdk::analytics::ObjectMetadata;
+using nx::sdk::analytics::ObjectMetadataPacket;
+
+namespace {
+
+// Tracks not seen for longer are forgotten, with their objects
+constexpr uint64_t kExpireFrames = 64;
+
+// The Server has released the object, whose only reference is now the builder's
+template<typename T>
+bool isReleased(const Ptr<T>& object)
+{
+    object->addRef();
+    return object->releaseRef() == 1;
+}
+
+} // namespace
+
+MetadataBuilder::MetadataBuilder():
+    m_matchAttribute(makePtr<Attribute>("match", "true"))
+{
+}
+
+void MetadataBuilder::begin(int64_t timestampUs)
+{
+    ++m_frame;
+    ++m_counters.frames;
+    m_packet.reset();
+    m_packetTimestampUs = timestampUs;
+}
+
+void MetadataBuilder::add(const std::string& typeId, const nx::sdk::analytics::Rect& boundingBox,
+    float confidence, int trackId, const std::string& clipLabel, float clipConfidence)
+{
+    const bool clipMatch = clipConfidence > 0.0f;
+    char clipValue[kValueSize] = {};
+    if (clipMatch)
+        std::snprintf(clipValue, sizeof(clipValue), "%.2f", clipConfidence);
+
+    Track& track = m_tracks[trackId];
+    // Two objects of a frame with the same ID (persons without a track) cannot share one
+    Track oneOff;
+    Track& target = track.lastFrame == m_frame ? oneOff : track;
+    target.lastFrame = m_frame;
+
+    const bool reusable = target.metadata
+        && target.typeId == &typeId
+        && static_cast<bool>(target.clipAttribute) == clipMatch
+        && (!clipMatch || (target.clipLabel == clipLabel && std::strcmp(target.clipValue, clipValue) == 0))
+        && isReleased(target.metadata);
+    if (reusable)
+        ++m_counters.reusedObjects;
+    else
+        makeObject(target, typeId, trackId, clipLabel, clipValue, clipMatch);
+
+    target.metadata->setBoundingBox(boundingBox);
+    target.metadata->setConfidence(confidence);
+    if (!m_packet)
+    {
+        m_packet = makePtr<ObjectMetadataPacket>();
+        m_packet->setTimestampUs(m_packetTimestampUs);
+    }
+    m_packet->addItem(target.metadata.get());
+    ++m_counters.objects;
+}
+
+Ptr<ObjectMetadataPacket> MetadataBuilder::finish()
+{
+    for (auto track = m_tracks.begin(); track != m_tracks.end();)
+    {
+        if (m_frame - track->second.lastFrame > kExpireFrames)
+            track = m_tracks.erase(track);
+        else
+            ++track;
+    }
+    const Ptr<ObjectMetadataPacket> packet = m_packet;
+    m_packet.reset();
+    return packet;
+}
+
+MetadataBuilder::Counters MetadataBuilder::counters() const
+{
+    Counters result = m_counters;
+    result.tracks = static_cast<int>(m_tracks.size());
+    return result;
+}
+
+void MetadataBuilder::makeObject(Track& track, const std::string& typeId, int trackId,
+    const std::string& clipLabel, const char* clipValue, bool clipMatch)
+{
+    track.metadata = makePtr<ObjectMetadata>();
+    track.metadata->setTypeId(typeId);
+    track.metadata->setTrackId(nx::sdk::Uuid(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, trackId));
+    track.typeId = &typeId;
+    if (!clipMatch)
+    {
+        track.clipAttribute.reset();
+        return;
+    }
+
+    // The attribute of the previous object is still valid if only the object was held by the Server
+    if (!track.clipAttribute || track.clipLabel != clipLabel || std::strcmp(track.clipValue, clipValue) != 0)
+    {
+        track.clipAttribute = makePtr<Attribute>(clipLabel, clipValue);
+        track.clipLabel = clipLabel;
+        std::memcpy(track.clipValue, clipValue, kValueSize);
+        ++m_counters.newAttributes;
+    }
+    track.metadata->addAttribute(track.clipAttribute);
+    track.metadata->addAttribute(m_matchAttribute);
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
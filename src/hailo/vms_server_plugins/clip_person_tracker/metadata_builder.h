@@ -0,0 +1,88 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include <nx/sdk/analytics/helpers/attribute.h>
+#include <nx/sdk/analytics/helpers/object_metadata.h>
+#include <nx/sdk/analytics/helpers/object_metadata_packet.h>
+#include <nx/sdk/analytics/rect.h>
+#include <nx/sdk/ptr.h>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/**
+ * Builds the object metadata packets of a camera, one frame at a time, recycling the SDK objects of
+ * the previous frames instead of allocating them anew:
+ * - The ObjectMetadata of a track is reused once the Server has released it, that is once the
+ *   builder holds its only reference, and only its box and confidence are updated.
+ * - Its CLIP attribute is reused while the label and the confidence shown with it stay the same;
+ *   the confidence is shown with two decimals, formatted without allocating.
+ * A frame of known tracks thus only allocates its packet, whatever the number of persons.
+ *
+ * Not thread-safe: the metadata of a camera is built by its matching, one frame at a time.
+ */
+class MetadataBuilder
+{
+public:
+    struct Counters
+    {
+        uint64_t frames = 0;
+        uint64_t objects = 0;
+        uint64_t reusedObjects = 0; //< ObjectMetadata of a previous frame updated in place.
+        uint64_t newAttributes = 0; //< CLIP attributes made because the label or confidence changed.
+        int tracks = 0; //< Tracks whose objects are kept for the next frames.
+    };
+
+    MetadataBuilder();
+
+    MetadataBuilder(const MetadataBuilder&) = delete;
+    MetadataBuilder& operator=(const MetadataBuilder&) = delete;
+
+    void begin(int64_t timestampUs);
+
+    /**
+     * @param typeId Must outlive the builder, objects are compared by its address.
+     * @param clipConfidence Without a CLIP match (0 or less), the object gets no CLIP attribute.
+     */
+    void add(const std::string& typeId, const nx::sdk::analytics::Rect& boundingBox, float confidence,
+        int trackId, const std::string& clipLabel, float clipConfidence);
+
+    /** The packet of the frame, null if no object was added. */
+    nx::sdk::Ptr<nx::sdk::analytics::ObjectMetadataPacket> finish();
+
+    Counters counters() const;
+
+private:
+    static constexpr int kValueSize = 16;
+
+    struct Track
+    {
+        nx::sdk::Ptr<nx::sdk::analytics::ObjectMetadata> metadata;
+        const std::string* typeId = nullptr;
+        nx::sdk::Ptr<nx::sdk::analytics::Attribute> clipAttribute; //< Null without a CLIP match.
+        std::string clipLabel;
+        char clipValue[kValueSize] = {};
+        uint64_t lastFrame = 0;
+    };
+
+    void makeObject(Track& track, const std::string& typeId, int trackId, const std::string& clipLabel,
+        const char* clipValue, bool clipMatch);
+
+private:
+    const nx::sdk::Ptr<nx::sdk::analytics::Attribute> m_matchAttribute; //< Shared by the matched objects.
+    std::unordered_map<int, Track> m_tracks;
+    nx::sdk::Ptr<nx::sdk::analytics::ObjectMetadataPacket> m_packet;
+    int64_t m_packetTimestampUs = 0;
+    uint64_t m_frame = 0;
+    Counters m_counters;
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,354 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "pipeline_builder.h"
+
+#include <sstream>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+PipelineElement::PipelineElement(std::string factory, std::string name):
+    m_factory(std::move(factory))
+{
+    if (!name.empty())
+        set("name", name);
+}
+
+PipelineElement& PipelineElement::set(const std::string& key, const std::string& value)
+{
+    m_properties.emplace_back(key, value);
+    return *this;
+}
+
+PipelineElement& PipelineElement::set(const std::string& key, const char* value)
+{
+    return set(key, std::string(value));
+}
+
+PipelineElement& PipelineElement::set(const std::string& key, int value)
+{
+    return set(key, std::to_string(value));
+}
+
+PipelineElement& PipelineElement::set(const std::string& key, float value)
+{
+    std::ostringstream text;
+    text << value;
+    return set(key, text.str());
+}
+
+PipelineElement& PipelineElement::set(const std::string& key, bool value)
+{
+    return set(key, value ? "true" : "false");
+}
+
+std::string PipelineElement::toString() const
+{
+    std::string result = m_factory;
+    for (const auto& property: m_properties)
+        result += " " + property.first + "=" + property.second;
+    return result;
+}
+
+PipelineDescription::Chain& PipelineDescription::Chain::add(PipelineElement element)
+{
+    m_items.push_back({Item::Kind::element, std::move(element), ""});
+    return *this;
+}
+
+PipelineDescription::Chain& PipelineDescription::Chain::caps(std::string caps)
+{
+    m_items.push_back({Item::Kind::caps, PipelineElement(""), std::move(caps)});
+    return *this;
+}
+
+PipelineDescription::Chain& PipelineDescription::Chain::pad(std::string pad)
+{
+    m_items.push_back({Item::Kind::pad, PipelineElement(""), std::move(pad)});
+    return *this;
+}
+
+PipelineDescription::Chain& PipelineDescription::chain()
+{
+    m_chains.emplace_back();
+    return m_chains.back();
+}
+
+std::string PipelineDescription::toLaunchString() const
+{
+    std::string result;
+    for (const Chain& chain: m_chains)
+    {
+        for (size_t i = 0; i < chain.m_items.size(); ++i)
+        {
+            const Chain::Item& item = chain.m_items[i];
+            if (i > 0)
+                result += " ! ";
+            result += item.kind == Chain::Item::Kind::element ? item.element.toString() : item.text;
+        }
+        result += " ";
+    }
+    return result;
+}
+
+std::string PipelineDescription::dump() const
+{
+    std::string result;
+    for (const Chain& chain: m_chains)
+    {
+        for (size_t i = 0; i < chain.m_items.size(); ++i)
+        {
+            const Chain::Item& item = chain.m_items[i];
+            result += i == 0 ? "" : "  ! ";
+            result += item.kind == Chain::Item::Kind::element ? item.element.toString() : item.text;
+            result += "\n";
+        }
+    }
+    return result;
+}
+
+namespace {
+
+PipelineElement queue(int maxBuffers, const std::string& name = "", bool leakyDownstream = false)
+{
+    PipelineElement element("queue");
+    element
+        .set("leaky", leakyDownstream ? "downstream" : "no")
+        .set("max-size-buffers", maxBuffers)
+        .set("max-size-bytes", 0)
+        .set("max-size-time", 0);
+    if (!name.empty())
+        element.set("name", name);
+    return element;
+}
+
+// Appends the detection cropper to `input`; the frames with their detections leave from "agg1.".
+void addDetection(PipelineDescription& pipeline, PipelineDescription::Chain& input,
+    const PipelineConfig& config, const PipelineResources& resources, int vdeviceGroup)
+{
+    // Letterboxed to the detection network
+    input.add(PipelineElement("hailocropper", "detection_crop")
+        .set("so-path", resources.wholeBufferCropSoPath)
+        .set("function-name", "create_crops")
+        .set("use-letterbox", true)
+        .set("resize-method", "inter-area")
+        .set("internal-offset", true));
+    pipeline.chain().add(PipelineElement("hailoaggregator", "agg1"));
+    pipeline.chain()
+        .pad("detection_crop.")
+        .add(queue(config.bypassQueueDepth, "detection_bypass_q").set("silent", true))
+        .pad("agg1.sink_0");
+    PipelineDescription::Chain& detection = pipeline.chain();
+    detection
+        .pad("detection_crop.")
+        .add(queue(config.queueDepth, "pre_detecion_net").set("silent", true))
+        .caps("video/x-raw, pixel-aspect-ratio=1/1");
+    if (resources.standInNetworks)
+    {
+        detection.add(PipelineElement("identity", kDetectionStandInName));
+    }
+    else
+    {
+        detection
+            .add(PipelineElement("hailonet")
+                .set("hef-path", resources.detectionHefPath)
+                .set("batch-size", config.detectionBatchSize)
+                .set("vdevice-group-id", vdeviceGroup)
+                .set("multi-process-service", false)
+                .set("scheduler-timeout-ms", config.detectionSchedulerTimeoutMs)
+                .set("scheduler-priority", config.detectionSchedulerPriority))
+            .add(queue(config.queueDepth, "pre_detecion_post"))
+            .add(PipelineElement("hailofilter")
+                .set("so-path", resources.detectionPostSoPath)
+                .set("qos", false)
+                .set("function_name", "yolov5_personface_letterbox")
+                .set("config-path", resources.detectionPostConfigPath));
+    }
+    detection
+        .add(queue(config.queueDepth))
+        .pad("agg1.sink_1");
+}
+
+PipelineElement tracker(const PipelineConfig& config, const std::string& name)
+{
+    return PipelineElement("hailotracker", name)
+        .set("class-id", 1)
+        .set("kalman-dist-thr", config.trackerKalmanDistThreshold)
+        .set("iou-thr", config.trackerIouThreshold)
+        .set("init-iou-thr", config.trackerInitIouThreshold)
+        .set("keep-new-frames", config.trackerKeepNewFrames)
+        .set("keep-tracked-frames", config.trackerKeepTrackedFrames)
+        .set("keep-lost-frames", config.trackerKeepLostFrames)
+        .set("keep-past-metadata", true)
+        .set("qos", false);
+}
+
+// Appends the CLIP cropper to `input`; the frames with their embeddings leave from "agg.".
+void addClip(PipelineDescription& pipeline, PipelineDescription::Chain& input,
+    const PipelineConfig& config, const PipelineResources& resources, int vdeviceGroup)
+{
+    input.add(PipelineElement("hailocropper", "cropper")
+        .set("so-path", resources.clipCropperSoPath)
+        .set("function-name", resources.clipCropperFunction)
+        .set("internal-offset", true)
+        .set("use-letterbox", true)
+        .set("no-scaling-bbox", true));
+    pipeline.chain().add(PipelineElement("hailoaggregator", "agg"));
+    pipeline.chain()
+        .pad("cropper.")
+        .add(queue(config.bypassQueueDepth, "clip_bypass_q"))
+        .pad("agg.sink_0");
+
+    PipelineDescription::Chain& clip = pipeline.chain();
+    clip
+        .pad("cropper.")
+        .add(queue(config.queueDepth, "pre_clip_net"));
+    if (resources.standInNetworks)
+    {
+        clip
+            .add(PipelineElement("identity", kClipStandInName))
+            .add(queue(config.queueDepth))
+            .pad("agg.sink_1");
+        return;
+    }
+    clip
+        .add(PipelineElement("hailonet")
+            .set("hef-path", resources.clipHefPath)
+            .set("vdevice-group-id", vdeviceGroup)
+            .set("multi-process-service", false)
+            .set("batch-size", config.clipBatchSize)
+            .set("scheduler-timeout-ms", config.clipSchedulerTimeoutMs)
+            .set("scheduler-priority", config.clipSchedulerPriority))
+        .add(queue(config.queueDepth));
+    if (!resources.clipPostSoPath.empty())
+    {
+        clip
+            .add(PipelineElement("hailofilter", "clip_post")
+                .set("so-path", resources.clipPostSoPath)
+                .set("qos", false))
+            .add(queue(config.queueDepth));
+    }
+    clip.pad("agg.sink_1");
+}
+
+// Hands each frame to the matcher from its new-sample signal, on the streaming thread.
+PipelineElement matcherSink(const std::string& name)
+{
+    return PipelineElement("appsink", name)
+        .set("emit-signals", true)
+        .set("max-buffers", 1)
+        .set("enable-last-sample", false)
+        .set("sync", false)
+        .set("async", false)
+        .set("qos", false);
+}
+
+// Routes the frames that entered a hailoroundrobin on its sink_<i> to src_<i>.
+PipelineElement streamRouter(const std::string& router, int lanes)
+{
+    PipelineElement element("hailostreamrouter", router);
+    for (int lane = 0; lane < lanes; ++lane)
+    {
+        element.set("src_" + std::to_string(lane) + "::input-streams",
+            "\"<sink_" + std::to_string(lane) + ">\"");
+    }
+    return element;
+}
+
+} // namespace
+
+std::string sharedLaneName(const std::string& element, int lane)
+{
+    return element + "_" + std::to_string(lane);
+}
+
+PipelineDescription buildPipeline(
+    const PipelineConfig& config, const PipelineResources& resources, const DevicePlacement& placement)
+{
+    PipelineDescription pipeline;
+
+    PipelineDescription::Chain& input = pipeline.chain();
+    input
+        .add(PipelineElement("appsrc", "app_source"))
+        .caps("video/x-raw, format=RGB")
+        .add(queue(config.inputQueueDepth, "pre_detection_tee", /*leakyDownstream*/ true));
+    addDetection(pipeline, input, config, resources, placement.detectionVdeviceGroup);
+
+    // Tracking, then crops of the persons to embed
+    PipelineDescription::Chain& tracking = pipeline.chain();
+    tracking
+        .pad("agg1.")
+        .add(queue(config.queueDepth))
+        .add(tracker(config, "hailo_tracker"))
+        .add(queue(config.queueDepth));
+    addClip(pipeline, tracking, config, resources, placement.clipVdeviceGroup);
+
+    // Matching, handed over by the appsink
+    pipeline.chain()
+        .pad("agg.")
+        .add(queue(config.queueDepth))
+        .add(matcherSink("clip_matcher_sink"));
+    return pipeline;
+}
+
+PipelineDescription buildSharedPipeline(const PipelineConfig& config, const PipelineResources& resources,
+    const DevicePlacement& placement, int lanes, int width, int height)
+{
+    PipelineDescription pipeline;
+    const std::string laneCaps = "video/x-raw, format=RGB, width=" + std::to_string(width)
+        + ", height=" + std::to_string(height);
+
+    // Frames of all the cameras, taken in turn, share the detection network
+    for (int lane = 0; lane < lanes; ++lane)
+    {
+        pipeline.chain()
+            .add(PipelineElement("appsrc", sharedLaneName("app_source", lane)))
+            .caps(laneCaps)
+            .add(queue(config.inputQueueDepth, sharedLaneName("pre_detection_tee", lane), /*leakyDownstream*/ true))
+            .pad("detection_funnel.sink_" + std::to_string(lane));
+    }
+    PipelineDescription::Chain& detection = pipeline.chain();
+    detection
+        .add(PipelineElement("hailoroundrobin", "detection_funnel").set("mode", 1))
+        .add(queue(config.queueDepth));
+    addDetection(pipeline, detection, config, resources, placement.detectionVdeviceGroup);
+    pipeline.chain()
+        .pad("agg1.")
+        .add(queue(config.queueDepth))
+        .add(streamRouter("detection_router", lanes));
+
+    // A tracker per camera, then the persons of all the cameras share the CLIP network
+    for (int lane = 0; lane < lanes; ++lane)
+    {
+        pipeline.chain()
+            .pad("detection_router.src_" + std::to_string(lane))
+            .add(queue(config.queueDepth))
+            .add(tracker(config, sharedLaneName("hailo_tracker", lane)))
+            .add(queue(config.queueDepth, sharedLaneName("clip_lane_q", lane)))
+            .pad("clip_funnel.sink_" + std::to_string(lane));
+    }
+    PipelineDescription::Chain& clip = pipeline.chain();
+    clip
+        .add(PipelineElement("hailoroundrobin", "clip_funnel").set("mode", 1))
+        .add(queue(config.queueDepth));
+    addClip(pipeline, clip, config, resources, placement.clipVdeviceGroup);
+    pipeline.chain()
+        .pad("agg.")
+        .add(queue(config.queueDepth))
+        .add(streamRouter("clip_router", lanes));
+
+    // Matching of each camera, handed over by its appsink
+    for (int lane = 0; lane < lanes; ++lane)
+    {
+        pipeline.chain()
+            .pad("clip_router.src_" + std::to_string(lane))
+            .add(queue(config.queueDepth))
+            .add(matcherSink(sharedLaneName("clip_matcher_sink", lane)));
+    }
+    return pipeline;
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,118 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pipeline_config.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/** GStreamer element of a PipelineDescription: its factory and its properties, in order. */
+class PipelineElement
+{
+public:
+    explicit PipelineElement(std::string factory, std::string name = "");
+
+    PipelineElement& set(const std::string& key, const std::string& value);
+    PipelineElement& set(const std::string& key, const char* value);
+    PipelineElement& set(const std::string& key, int value);
+    PipelineElement& set(const std::string& key, float value);
+    PipelineElement& set(const std::string& key, bool value);
+
+    const std::string& factory() const { return m_factory; }
+    const std::vector<std::pair<std::string, std::string>>& properties() const { return m_properties; }
+    std::string toString() const;
+
+private:
+    std::string m_factory;
+    std::vector<std::pair<std::string, std::string>> m_properties;
+};
+
+/**
+ * Linked elements of a pipeline, rendered to gst_parse_launch() syntax. A chain links its items
+ * with "!"; it may start from and end at a pad of an element of another chain ("cropper.",
+ * "agg.sink_1").
+ */
+class PipelineDescription
+{
+public:
+    class Chain
+    {
+    public:
+        Chain& add(PipelineElement element);
+        Chain& caps(std::string caps);
+        Chain& pad(std::string pad);
+
+    private:
+        friend class PipelineDescription;
+        struct Item
+        {
+            enum class Kind { element, caps, pad };
+            Kind kind;
+            PipelineElement element;
+            std::string text;
+        };
+        std::vector<Item> m_items;
+    };
+
+    Chain& chain();
+
+    std::string toLaunchString() const;
+    /** One line per chain item, for the logs. */
+    std::string dump() const;
+
+private:
+    std::vector<Chain> m_chains;
+};
+
+/** Identities in place of the networks when PipelineResources::standInNetworks is set. */
+constexpr char kDetectionStandInName[] = "detection_standin";
+constexpr char kClipStandInName[] = "clip_standin";
+
+/** Files and cropper functions the pipeline of a camera is built with. */
+struct PipelineResources
+{
+    std::string detectionHefPath;
+    std::string detectionPostSoPath;
+    std::string detectionPostConfigPath;
+    std::string wholeBufferCropSoPath;
+    std::string clipHefPath;
+    std::string clipPostSoPath; //< Empty runs the CLIP network without the clip_post filter.
+    std::string clipCropperSoPath;
+    std::string clipCropperFunction;
+    /**
+     * Puts identities (see StandInInference) in place of the networks and their post-processing,
+     * which need a Hailo device; the network files are then not used.
+     */
+    bool standInNetworks = false;
+};
+
+/**
+ * Detection, tracking and CLIP pipeline of a camera: appsrc "app_source", then the matcher handoff
+ * from appsink "clip_matcher_sink"; the CLIP cropper is "cropper". Its networks run on the vdevice
+ * groups of `placement`.
+ */
+PipelineDescription buildPipeline(
+    const PipelineConfig& config, const PipelineResources& resources, const DevicePlacement& placement);
+
+/** Name of the element of a lane of the shared pipeline: "<element>_<lane>". */
+std::string sharedLaneName(const std::string& element, int lane);
+
+/**
+ * Pipeline shared by `lanes` cameras, one lane each: the frames of appsrc "app_source_<lane>",
+ * of `width` x `height`, go through a detection network and a CLIP network shared by all the
+ * lanes, which batch frames of different cameras together. Each lane has its own tracker
+ * "hailo_tracker_<lane>", queue "clip_lane_q_<lane>" before the CLIP cropper and matcher handoff
+ * from appsink "clip_matcher_sink_<lane>".
+ */
+PipelineDescription buildSharedPipeline(const PipelineConfig& config, const PipelineResources& resources,
+    const DevicePlacement& placement, int lanes, int width, int height);
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
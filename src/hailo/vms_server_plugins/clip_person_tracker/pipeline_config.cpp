@@ -0,0 +1,257 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "pipeline_config.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <nlohmann/json.hpp>
+
+#include "hailo_clip_plugin_ini.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+namespace {
+
+struct IntSetting
+{
+    const char* name;
+    int PipelineConfig::* member;
+    int min;
+    int max;
+};
+
+struct FloatSetting
+{
+    const char* name;
+    float PipelineConfig::* member;
+    float min;
+    float max;
+};
+
+// Names are those of the ini settings and of the JSON profile keys
+const IntSetting kIntSettings[] = {
+    {"inputQueueDepth", &PipelineConfig::inputQueueDepth, 1, 1000},
+    {"queueDepth", &PipelineConfig::queueDepth, 1, 1000},
+    {"bypassQueueDepth", &PipelineConfig::bypassQueueDepth, 1, 1000},
+    {"detectionBatchSize", &PipelineConfig::detectionBatchSize, 1, 64},
+    {"detectionSchedulerTimeoutMs", &PipelineConfig::detectionSchedulerTimeoutMs, 0, 60000},
+    {"detectionSchedulerPriority", &PipelineConfig::detectionSchedulerPriority, 0, 31},
+    {"clipBatchSize", &PipelineConfig::clipBatchSize, 1, 64},
+    {"clipSchedulerTimeoutMs", &PipelineConfig::clipSchedulerTimeoutMs, 0, 60000},
+    {"clipSchedulerPriority", &PipelineConfig::clipSchedulerPriority, 0, 31},
+    {"trackerKeepNewFrames", &PipelineConfig::trackerKeepNewFrames, 0, 1000},
+    {"trackerKeepTrackedFrames", &PipelineConfig::trackerKeepTrackedFrames, 1, 1000},
+    {"trackerKeepLostFrames", &PipelineConfig::trackerKeepLostFrames, 0, 1000},
+};
+
+const FloatSetting kFloatSettings[] = {
+    {"trackerKalmanDistThreshold", &PipelineConfig::trackerKalmanDistThreshold, 0.0f, 1.0f},
+    {"trackerIouThreshold", &PipelineConfig::trackerIouThreshold, 0.0f, 1.0f},
+    {"trackerInitIouThreshold", &PipelineConfig::trackerInitIouThreshold, 0.0f, 1.0f},
+};
+
+struct GroupsSetting
+{
+    const char* name;
+    std::vector<int> PipelineConfig::* member;
+};
+
+const GroupsSetting kGroupsSettings[] = {
+    {"detectionVdeviceGroups", &PipelineConfig::detectionVdeviceGroups},
+    {"clipVdeviceGroups", &PipelineConfig::clipVdeviceGroups},
+};
+
+// "3,2" -> {3, 2}; empty if a group is not a number.
+std::vector<int> parseGroups(const std::string& text)
+{
+    std::vector<int> groups;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        try
+        {
+            size_t end = 0;
+            groups.push_back(std::stoi(item, &end));
+            if (item.find_first_not_of(' ', end) != std::string::npos)
+                return {};
+        }
+        catch (const std::exception&)
+        {
+            return {};
+        }
+    }
+    return groups;
+}
+
+PipelineConfig fromIni()
+{
+    PipelineConfig config;
+    config.inputQueueDepth = ini().inputQueueDepth;
+    config.queueDepth = ini().queueDepth;
+    config.bypassQueueDepth = ini().bypassQueueDepth;
+    config.detectionBatchSize = ini().detectionBatchSize;
+    config.detectionSchedulerTimeoutMs = ini().detectionSchedulerTimeoutMs;
+    config.detectionSchedulerPriority = ini().detectionSchedulerPriority;
+    config.detectionVdeviceGroups = parseGroups(ini().detectionVdeviceGroups);
+    config.clipBatchSize = ini().clipBatchSize;
+    config.clipSchedulerTimeoutMs = ini().clipSchedulerTimeoutMs;
+    config.clipSchedulerPriority = ini().clipSchedulerPriority;
+    config.clipVdeviceGroups = parseGroups(ini().clipVdeviceGroups);
+    config.trackerKalmanDistThreshold = ini().trackerKalmanDistThreshold;
+    config.trackerIouThreshold = ini().trackerIouThreshold;
+    config.trackerInitIouThreshold = ini().trackerInitIouThreshold;
+    config.trackerKeepNewFrames = ini().trackerKeepNewFrames;
+    config.trackerKeepTrackedFrames = ini().trackerKeepTrackedFrames;
+    config.trackerKeepLostFrames = ini().trackerKeepLostFrames;
+    return config;
+}
+
+// Sets the settings present in `profile`; values of the wrong type are kept for validate() to reject.
+void applyProfile(const nlohmann::json& profile, PipelineConfig& config)
+{
+    for (const auto& item: profile.items())
+    {
+        bool known = false;
+        for (const IntSetting& setting: kIntSettings)
+        {
+            if (item.key() != setting.name)
+                continue;
+            known = true;
+            if (item.value().is_number_integer())
+                config.*setting.member = item.value().get<int>();
+            else
+                std::cout << "Pipeline profile: " << setting.name << " is not an integer" << std::endl;
+        }
+        for (const FloatSetting& setting: kFloatSettings)
+        {
+            if (item.key() != setting.name)
+                continue;
+            known = true;
+            if (item.value().is_number())
+                config.*setting.member = item.value().get<float>();
+            else
+                std::cout << "Pipeline profile: " << setting.name << " is not a number" << std::endl;
+        }
+        for (const GroupsSetting& setting: kGroupsSettings)
+        {
+            if (item.key() != setting.name)
+                continue;
+            known = true;
+            std::vector<int>& groups = config.*setting.member;
+            groups.clear();
+            if (!item.value().is_array())
+                continue;
+            for (const auto& group: item.value())
+            {
+                // An empty list is rejected by validate()
+                if (!group.is_number_integer())
+                {
+                    groups.clear();
+                    break;
+                }
+                groups.push_back(group.get<int>());
+            }
+        }
+        if (!known)
+            std::cout << "Pipeline profile: unknown setting " << item.key() << std::endl;
+    }
+}
+
+} // namespace
+
+PipelineConfig PipelineConfig::load(const std::filesystem::path& pluginHomeDir)
+{
+    PipelineConfig config = fromIni();
+    if (ini().pipelineProfile[0] != '\0')
+    {
+        const std::filesystem::path profilePath = pluginHomeDir / ini().pipelineProfile;
+        try
+        {
+            std::ifstream file(profilePath);
+            if (!file)
+                throw std::runtime_error("cannot open the file");
+            nlohmann::json profile;
+            file >> profile;
+            if (!profile.is_object())
+                throw std::runtime_error("not a JSON object");
+            applyProfile(profile, config);
+            std::cout << "Pipeline profile " << profilePath << " applied" << std::endl;
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "Pipeline profile " << profilePath << " ignored: " << e.what() << std::endl;
+        }
+    }
+    for (const std::string& message: config.validate())
+        std::cout << "Pipeline config: " << message << std::endl;
+    return config;
+}
+
+std::vector<std::string> PipelineConfig::validate()
+{
+    const PipelineConfig defaults;
+    std::vector<std::string> messages;
+    for (const IntSetting& setting: kIntSettings)
+    {
+        int& value = this->*setting.member;
+        if (value < setting.min || value > setting.max)
+        {
+            messages.push_back(std::string(setting.name) + "=" + std::to_string(value) + " is not in ["
+                + std::to_string(setting.min) + ", " + std::to_string(setting.max) + "], using "
+                + std::to_string(defaults.*setting.member));
+            value = defaults.*setting.member;
+        }
+    }
+    for (const FloatSetting& setting: kFloatSettings)
+    {
+        float& value = this->*setting.member;
+        // Also rejects NaN
+        if (!(value >= setting.min && value <= setting.max))
+        {
+            messages.push_back(std::string(setting.name) + "=" + std::to_string(value) + " is not in ["
+                + std::to_string(setting.min) + ", " + std::to_string(setting.max) + "], using "
+                + std::to_string(defaults.*setting.member));
+            value = defaults.*setting.member;
+        }
+    }
+    for (const GroupsSetting& setting: kGroupsSettings)
+    {
+        std::vector<int>& groups = this->*setting.member;
+        bool validGroups = !groups.empty();
+        for (int group: groups)
+            validGroups = validGroups && group >= 1 && group <= 64;
+        if (!validGroups)
+        {
+            messages.push_back(std::string(setting.name) + " must list groups in [1, 64], using the defaults");
+            groups = defaults.*setting.member;
+        }
+    }
+    return messages;
+}
+
+std::string PipelineConfig::dump() const
+{
+    std::ostringstream result;
+    for (const IntSetting& setting: kIntSettings)
+        result << setting.name << "=" << this->*setting.member << "\n";
+    for (const FloatSetting& setting: kFloatSettings)
+        result << setting.name << "=" << this->*setting.member << "\n";
+    for (const GroupsSetting& setting: kGroupsSettings)
+    {
+        const std::vector<int>& groups = this->*setting.member;
+        result << setting.name << "=";
+        for (size_t i = 0; i < groups.size(); ++i)
+            result << (i == 0 ? "" : ",") << groups[i];
+        result << "\n";
+    }
+    return result.str();
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
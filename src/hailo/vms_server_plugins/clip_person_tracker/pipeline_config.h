@@ -0,0 +1,75 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/**
+ * Tuning of the GStreamer pipeline of a camera: queue depths, network batching and scheduling, Hailo
+ * device groups and tracker thresholds. The defaults are the values the pipeline was tuned with.
+ */
+struct PipelineConfig
+{
+    int inputQueueDepth = 12; //< Leaky queue after the appsrc, frames beyond it are dropped.
+    int queueDepth = 3; //< Queues between the elements.
+    int bypassQueueDepth = 20; //< Queues holding the frames while their crops are in a network.
+
+    int detectionBatchSize = 8;
+    int detectionSchedulerTimeoutMs = 100;
+    int detectionSchedulerPriority = 31;
+    /** vdevice-group-id the detection networks may run on, see DeviceScheduler. */
+    std::vector<int> detectionVdeviceGroups = {3, 2};
+
+    int clipBatchSize = 8;
+    int clipSchedulerTimeoutMs = 1000;
+    int clipSchedulerPriority = 16;
+    /** vdevice-group-id the CLIP networks may run on, see DeviceScheduler. */
+    std::vector<int> clipVdeviceGroups = {1};
+
+    float trackerKalmanDistThreshold = 0.8f;
+    float trackerIouThreshold = 0.9f;
+    float trackerInitIouThreshold = 0.7f;
+    int trackerKeepNewFrames = 2;
+    int trackerKeepTrackedFrames = 15;
+    int trackerKeepLostFrames = 2;
+
+    /**
+     * The settings of hailo_clip_plugin.ini, overridden by the JSON profile it names (pipelineProfile,
+     * relative to `pluginHomeDir`) if any, then validated. Problems are logged, the offending values
+     * fall back to their defaults.
+     */
+    static PipelineConfig load(const std::filesystem::path& pluginHomeDir);
+
+    /**
+     * Resets the values out of their valid range to their defaults.
+     *
+     * @return One message per reset value.
+     */
+    std::vector<std::string> validate();
+
+    /** One "name=value" line per setting. */
+    std::string dump() const;
+};
+
+/** vdevice groups the networks of a camera run on, chosen by the DeviceScheduler. */
+struct DevicePlacement
+{
+    int detectionVdeviceGroup = 0;
+    int clipVdeviceGroup = 0;
+
+    bool operator==(const DevicePlacement& other) const
+    {
+        return detectionVdeviceGroup == other.detectionVdeviceGroup && clipVdeviceGroup == other.clipVdeviceGroup;
+    }
+    bool operator!=(const DevicePlacement& other) const { return !(*this == other); }
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,190 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "pipeline_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "hailo_clip_plugin_ini.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+PipelinePool::PipelinePool(
+    std::filesystem::path pluginHomeDir, int warm, std::shared_ptr<DeviceScheduler> deviceScheduler):
+    m_pluginHomeDir(std::move(pluginHomeDir)),
+    m_warmPipelines(std::max(warm, 0)),
+    m_retirePeriod(std::max(ini().warmPipelineRetireMs, 0)),
+    m_deviceScheduler(std::move(deviceScheduler))
+{
+    m_thread = std::thread(&PipelinePool::run, this);
+}
+
+PipelinePool::~PipelinePool()
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopped = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+std::vector<DevicePlacement> PipelinePool::ready() const
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<DevicePlacement> placements;
+    for (const WarmPipeline& warm: m_warm)
+    {
+        if (!warm.pipeline->failed())
+            placements.push_back(warm.pipeline->placement());
+    }
+    return placements;
+}
+
+std::unique_ptr<CameraPipeline> PipelinePool::claim(const DevicePlacement& placement)
+{
+    std::unique_ptr<CameraPipeline> pipeline;
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        const auto warm = std::find_if(m_warm.begin(), m_warm.end(),
+            [&placement](const WarmPipeline& candidate)
+            {
+                return candidate.pipeline->placement() == placement && !candidate.pipeline->failed();
+            });
+        if (warm != m_warm.end())
+        {
+            pipeline = std::move(warm->pipeline);
+            m_warm.erase(warm);
+        }
+    }
+    // The thread starts the next warm pipeline
+    m_wake.notify_all();
+    if (pipeline)
+    {
+        std::cout << "Pipeline pool: taking warm pipeline ID: " << pipeline->id() << std::endl;
+        return pipeline;
+    }
+    std::cout << "Pipeline pool: no warm pipeline on detection vdevice " << placement.detectionVdeviceGroup
+        << ", CLIP vdevice " << placement.clipVdeviceGroup << ", starting one" << std::endl;
+    return std::make_unique<CameraPipeline>(m_pluginHomeDir, placement);
+}
+
+void PipelinePool::release(std::unique_ptr<CameraPipeline> pipeline)
+{
+    if (!pipeline)
+        return;
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_released.push_back(std::move(pipeline));
+    }
+    m_wake.notify_all();
+}
+
+std::chrono::milliseconds PipelinePool::retryDelay(int failures)
+{
+    return std::chrono::milliseconds(std::max(ini().pipelineRetryMs, 0)) * (1 << std::clamp(failures - 1, 0, 5));
+}
+
+PipelinePool::Clock::time_point PipelinePool::retireLocked(Clock::time_point now)
+{
+    // Room left for a pipeline on the groups of the next camera
+    if ((int) m_warm.size() < m_warmPipelines || m_warm.empty())
+        return Clock::time_point::max();
+
+    // Checked again when a camera comes or goes, which is when the next camera may go elsewhere
+    const DevicePlacement next = m_deviceScheduler->next();
+    for (const WarmPipeline& warm: m_warm)
+    {
+        if (warm.pipeline->placement() == next)
+            return Clock::time_point::max();
+    }
+    WarmPipeline& oldest = m_warm.front();
+    if (now < oldest.since + m_retirePeriod)
+        return oldest.since + m_retirePeriod;
+    std::cout << "Pipeline pool: retiring warm pipeline ID: " << oldest.pipeline->id()
+        << ", the next camera goes to detection vdevice " << next.detectionVdeviceGroup
+        << ", CLIP vdevice " << next.clipVdeviceGroup << std::endl;
+    m_released.push_back(std::move(oldest.pipeline));
+    m_warm.erase(m_warm.begin());
+    return Clock::time_point::max();
+}
+
+void PipelinePool::run()
+{
+    const std::chrono::milliseconds eosTimeout(std::max(ini().pipelineEosTimeoutMs, 0));
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        const Clock::time_point now = Clock::now();
+
+        // Broken while warm: not handed out, stopped below
+        for (auto warm = m_warm.begin(); warm != m_warm.end();)
+        {
+            if (!warm->pipeline->failed())
+            {
+                ++warm;
+                continue;
+            }
+            m_released.push_back(std::move(warm->pipeline));
+            warm = m_warm.erase(warm);
+        }
+        const Clock::time_point retireAt = m_stopped ? Clock::time_point::max() : retireLocked(now);
+
+        if (!m_released.empty())
+        {
+            std::unique_ptr<CameraPipeline> pipeline = std::move(m_released.back());
+            m_released.pop_back();
+            lock.unlock();
+            pipeline->stop(eosTimeout);
+            pipeline.reset();
+            lock.lock();
+            continue;
+        }
+        if (m_stopped)
+            break;
+
+        // After a failure, the next warm pipeline waits for its retry time
+        const bool wanted = (int) m_warm.size() < m_warmPipelines;
+        if (!wanted || now < m_retryAt)
+        {
+            const Clock::time_point wakeAt = wanted ? std::min(m_retryAt, retireAt) : retireAt;
+            if (wakeAt == Clock::time_point::max())
+                m_wake.wait(lock);
+            else
+                m_wake.wait_until(lock, wakeAt);
+            continue;
+        }
+
+        // Claimable once started: a camera coming meanwhile starts its own rather than wait for it
+        lock.unlock();
+        auto pipeline = std::make_unique<CameraPipeline>(m_pluginHomeDir, m_deviceScheduler->next());
+        pipeline->waitStarted();
+        lock.lock();
+        if (pipeline->failed())
+        {
+            ++m_failures;
+            const std::chrono::milliseconds delay = retryDelay(m_failures);
+            m_retryAt = Clock::now() + delay;
+            std::cout << "Pipeline pool: warm pipeline ID: " << pipeline->id() << " failed (" << m_failures
+                << " in a row), next one in " << delay.count() << " ms" << std::endl;
+            m_released.push_back(std::move(pipeline));
+            continue;
+        }
+        m_failures = 0;
+        m_warm.push_back({std::move(pipeline), Clock::now()});
+    }
+
+    std::vector<WarmPipeline> pipelines = std::move(m_warm);
+    m_warm.clear();
+    lock.unlock();
+    for (const WarmPipeline& warm: pipelines)
+        warm.pipeline->stop(eosTimeout);
+    std::cout << "Pipeline pool stopped" << std::endl;
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,99 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "camera_pipeline.h"
+#include "device_scheduler.h"
+#include "pipeline_config.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/**
+ * Pipelines of their own of the cameras of an Engine that have no lane of the shared pipeline.
+ *
+ * Starting a pipeline (parsing it, loading its networks on the device, prerolling it) takes seconds,
+ * so the pool keeps a few started ahead for the next cameras, which claim one at once. Stopping one
+ * may take as long, so the pipelines of the cameras gone are stopped by the pool, on its thread, and
+ * not by their DeviceAgent. The thread starts the warm pipelines one at a time, after stopping
+ * the released ones, which frees the device for them.
+ *
+ * The warm pipelines are started on the groups the DeviceScheduler would place the next camera on.
+ * As the loads change, the next camera may go elsewhere: the warm pipelines on other groups are
+ * kept, since place() still takes them when their groups are about as loaded. When none of them is
+ * on the groups of the next camera, the oldest is replaced by one there, once it has been warm for
+ * warmPipelineRetireMs.
+ *
+ * A pipeline that failed to start, or broke while warm, is never handed out: it is stopped, and the
+ * next one is started after retryDelay().
+ */
+class PipelinePool
+{
+public:
+    /** @param warm Pipelines kept started ahead, 0 starts each when its camera comes. */
+    PipelinePool(std::filesystem::path pluginHomeDir, int warm, std::shared_ptr<DeviceScheduler> deviceScheduler);
+    /** Stops every pipeline left, released or warm, then the thread. */
+    ~PipelinePool();
+
+    PipelinePool(const PipelinePool&) = delete;
+    PipelinePool& operator=(const PipelinePool&) = delete;
+
+    /** Placements of the warm pipelines, for DeviceScheduler::place(). */
+    std::vector<DevicePlacement> ready() const;
+
+    /** A warm pipeline on the groups of `placement`, or one starting now. */
+    std::unique_ptr<CameraPipeline> claim(const DevicePlacement& placement);
+
+    /** Stops `pipeline` in the background; it must be detached from its detector. */
+    void release(std::unique_ptr<CameraPipeline> pipeline);
+
+    /** Time to wait before replacing the last of `failures` (at least 1) pipelines failed in a row. */
+    static std::chrono::milliseconds retryDelay(int failures);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct WarmPipeline
+    {
+        std::unique_ptr<CameraPipeline> pipeline;
+        Clock::time_point since; //< Started.
+    };
+
+    void run();
+
+    /**
+     * Releases the warm pipeline to replace by one on the groups of the next camera, if it is time.
+     *
+     * @return When to check again, Clock::time_point::max() if only once woken.
+     */
+    Clock::time_point retireLocked(Clock::time_point now);
+
+private:
+    const std::filesystem::path m_pluginHomeDir;
+    const int m_warmPipelines;
+    const std::chrono::milliseconds m_retirePeriod;
+    const std::shared_ptr<DeviceScheduler> m_deviceScheduler;
+
+    mutable std::mutex m_mutex; //< Guards the fields below.
+    std::condition_variable m_wake;
+    std::vector<WarmPipeline> m_warm; //< In the order they were started.
+    std::vector<std::unique_ptr<CameraPipeline>> m_released; //< To stop.
+    int m_failures = 0; //< Warm pipelines failed in a row.
+    Clock::time_point m_retryAt; //< No warm pipeline is started before.
+    bool m_stopped = false;
+
+    std::thread m_thread;
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,251 @@
+#include "prompt_embedding_cache.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace clip_matcher {
+
+namespace {
+
+uint64_t fnv1a64(const void* data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+uint32_t fnv1a32(const void* data, size_t size, uint32_t hash = 2166136261u) {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t record_checksum(const std::string& key, const float* embedding, size_t dim) {
+    return fnv1a32(embedding, dim * sizeof(float), fnv1a32(key.data(), key.size()));
+}
+
+// Writes `buffer` fully, one record is never left half-written by a short write.
+bool write_all(int fd, const std::vector<unsigned char>& buffer) {
+    return ::write(fd, buffer.data(), buffer.size()) == static_cast<ssize_t>(buffer.size());
+}
+
+void serialize(uint64_t hash, const std::string& key, const std::vector<float>& embedding,
+               std::vector<unsigned char>& buffer) {
+    PromptCacheRecordHeader header = {};
+    header.hash = hash;
+    header.key_size = static_cast<uint32_t>(key.size());
+    header.dim = static_cast<uint32_t>(embedding.size());
+    header.checksum = record_checksum(key, embedding.data(), embedding.size());
+    const size_t offset = buffer.size();
+    buffer.resize(offset + sizeof(header) + key.size() + embedding.size() * sizeof(float));
+    std::memcpy(buffer.data() + offset, &header, sizeof(header));
+    std::memcpy(buffer.data() + offset + sizeof(header), key.data(), key.size());
+    std::memcpy(buffer.data() + offset + sizeof(header) + key.size(), embedding.data(),
+                embedding.size() * sizeof(float));
+}
+
+std::vector<unsigned char> file_header() {
+    PromptCacheFileHeader header = {};
+    std::memcpy(header.magic, kPromptCacheMagic, sizeof(header.magic));
+    header.version = kPromptCacheVersion;
+    header.header_size = sizeof(PromptCacheFileHeader);
+    const auto* bytes = reinterpret_cast<const unsigned char*>(&header);
+    return std::vector<unsigned char>(bytes, bytes + sizeof(header));
+}
+
+} // namespace
+
+PromptEmbeddingCache::PromptEmbeddingCache(size_t capacity)
+    : m_capacity(capacity) {}
+
+PromptEmbeddingCache::PromptEmbeddingCache(const std::string& path, size_t capacity)
+    : m_capacity(capacity), m_path(path) {
+    load();
+}
+
+PromptEmbeddingCache::~PromptEmbeddingCache() {
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+std::string PromptEmbeddingCache::key(const std::string& model, const std::string& text_prefix,
+                                      const std::string& text, const std::string& template_text) {
+    // The unit separator cannot come from a settings text field
+    return model + '\x1f' + text_prefix + '\x1f' + text + '\x1f' + template_text;
+}
+
+bool PromptEmbeddingCache::lookup(const std::string& key, std::vector<float>& out) {
+    const uint64_t hash = fnv1a64(key.data(), key.size());
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto found = m_index.find(hash);
+    if (found == m_index.end() || found->second->key != key) {
+        ++m_misses;
+        return false;
+    }
+    m_entries.splice(m_entries.begin(), m_entries, found->second);
+    out = found->second->embedding;
+    ++m_hits;
+    return true;
+}
+
+void PromptEmbeddingCache::insert(const std::string& key, const float* embedding, size_t dim) {
+    const uint64_t hash = fnv1a64(key.data(), key.size());
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto found = m_index.find(hash);
+    if (found != m_index.end() && found->second->key == key && found->second->embedding.size() == dim
+        && std::memcmp(found->second->embedding.data(), embedding, dim * sizeof(float)) == 0) {
+        m_entries.splice(m_entries.begin(), m_entries, found->second);
+        return;
+    }
+    insert_locked(hash, key, embedding, dim);
+    if (m_fd < 0)
+        return;
+    append(m_entries.front());
+    if (m_file_records > 2 * m_capacity + 64)
+        compact();
+}
+
+size_t PromptEmbeddingCache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+uint64_t PromptEmbeddingCache::hits() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+uint64_t PromptEmbeddingCache::misses() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+}
+
+void PromptEmbeddingCache::insert_locked(uint64_t hash, const std::string& key, const float* embedding, size_t dim) {
+    const auto found = m_index.find(hash);
+    if (found != m_index.end()) {
+        m_entries.erase(found->second);
+        m_index.erase(found);
+    }
+    m_entries.push_front(Entry{hash, key, std::vector<float>(embedding, embedding + dim)});
+    m_index[hash] = m_entries.begin();
+    while (m_entries.size() > m_capacity && !m_entries.empty()) {
+        m_index.erase(m_entries.back().hash);
+        m_entries.pop_back();
+    }
+}
+
+void PromptEmbeddingCache::load() {
+    m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+        throw std::runtime_error("Prompt cache: cannot open " + m_path + ": " + std::strerror(errno));
+    struct stat file_stat = {};
+    if (::fstat(m_fd, &file_stat) != 0) {
+        ::close(m_fd);
+        m_fd = -1;
+        throw std::runtime_error("Prompt cache: cannot stat " + m_path);
+    }
+    std::vector<unsigned char> data(static_cast<size_t>(file_stat.st_size));
+    size_t read_size = 0;
+    while (read_size < data.size()) {
+        const ssize_t result = ::pread(m_fd, data.data() + read_size, data.size() - read_size, read_size);
+        if (result <= 0)
+            break;
+        read_size += static_cast<size_t>(result);
+    }
+    data.resize(read_size);
+
+    if (data.empty()) {
+        if (!write_all(m_fd, file_header())) {
+            ::close(m_fd);
+            m_fd = -1;
+            throw std::runtime_error("Prompt cache: cannot write " + m_path);
+        }
+        return;
+    }
+    PromptCacheFileHeader header = {};
+    if (data.size() >= sizeof(header))
+        std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, kPromptCacheMagic, sizeof(header.magic)) != 0
+        || header.version != kPromptCacheVersion || header.header_size != sizeof(header)) {
+        ::close(m_fd);
+        m_fd = -1;
+        throw std::runtime_error("Prompt cache: " + m_path + " is not a prompt cache file");
+    }
+
+    size_t offset = sizeof(header);
+    while (offset + sizeof(PromptCacheRecordHeader) <= data.size()) {
+        PromptCacheRecordHeader record = {};
+        std::memcpy(&record, data.data() + offset, sizeof(record));
+        const size_t record_size = sizeof(record) + record.key_size + size_t(record.dim) * sizeof(float);
+        if (offset + record_size > data.size())
+            break;
+        const std::string key(reinterpret_cast<const char*>(data.data() + offset + sizeof(record)), record.key_size);
+        std::vector<float> embedding(record.dim);
+        std::memcpy(embedding.data(), data.data() + offset + sizeof(record) + record.key_size,
+                    embedding.size() * sizeof(float));
+        if (record.checksum != record_checksum(key, embedding.data(), embedding.size())
+            || record.hash != fnv1a64(key.data(), key.size()))
+            break;
+        insert_locked(record.hash, key, embedding.data(), embedding.size());
+        ++m_file_records;
+        offset += record_size;
+    }
+    if (offset < data.size()) {
+        std::cout << "Prompt cache: dropping " << data.size() - offset << " damaged bytes at the end of "
+                  << m_path << std::endl;
+        if (::ftruncate(m_fd, static_cast<off_t>(offset)) != 0)
+            std::cout << "Prompt cache: cannot truncate " << m_path << std::endl;
+    }
+    if (m_file_records > 2 * m_capacity + 64)
+        compact();
+}
+
+void PromptEmbeddingCache::append(const Entry& entry) {
+    std::vector<unsigned char> buffer;
+    serialize(entry.hash, entry.key, entry.embedding, buffer);
+    if (!write_all(m_fd, buffer)) {
+        std::cout << "Prompt cache: failed appending to " << m_path << ": " << std::strerror(errno) << std::endl;
+        return;
+    }
+    ++m_file_records;
+}
+
+void PromptEmbeddingCache::compact() {
+    // Oldest first, so that loading the file back restores the recency order
+    std::vector<unsigned char> buffer = file_header();
+    for (auto entry = m_entries.rbegin(); entry != m_entries.rend(); ++entry) {
+        serialize(entry->hash, entry->key, entry->embedding, buffer);
+    }
+    const std::string temp_path = m_path + ".tmp";
+    const int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || !write_all(fd, buffer) || ::fsync(fd) != 0 || ::rename(temp_path.c_str(), m_path.c_str()) != 0) {
+        std::cout << "Prompt cache: cannot compact " << m_path << std::endl;
+        if (fd >= 0)
+            ::close(fd);
+        ::unlink(temp_path.c_str());
+        return;
+    }
+    ::close(fd);
+    const int new_fd = ::open(m_path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if (new_fd < 0) {
+        std::cout << "Prompt cache: cannot reopen " << m_path << ", no longer persisting" << std::endl;
+        ::close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    ::close(m_fd);
+    m_fd = new_fd;
+    m_file_records = m_entries.size();
+}
+
+} // namespace clip_matcher
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Content-addressed cache of prompt text embeddings, so that a prompt is only encoded the first time
+// it is seen: switching back to a known prompt list is a lookup.
+//
+// Entries are keyed by a hash of (model, text prefix, prompt text, template). The cache keeps the
+// most recently used `capacity` entries in memory and appends every new entry to a file, read back
+// on the next start:
+//     PromptCacheFileHeader
+//     records: PromptCacheRecordHeader, key bytes, dim float32 values
+// A record cut short by a crash fails its checksum and is dropped with everything after it. When the
+// file holds many more records than the memory bound it is rewritten with the live entries only.
+//
+// Not to be confused with PromptEmbeddingStore, which shares the rows of the loaded prompt sets
+// between cameras.
+
+namespace clip_matcher {
+
+struct PromptCacheFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+};
+
+struct PromptCacheRecordHeader {
+    uint64_t hash;
+    uint32_t key_size;
+    uint32_t dim;
+    uint32_t checksum; // FNV-1a of the key and embedding bytes
+    uint32_t reserved;
+};
+
+constexpr char kPromptCacheMagic[8] = {'H', 'C', 'L', 'I', 'P', 'P', 'E', 'C'};
+constexpr uint32_t kPromptCacheVersion = 1;
+
+class PromptEmbeddingCache {
+public:
+    // Memory-only cache.
+    explicit PromptEmbeddingCache(size_t capacity);
+    // Cache persisted to `path`, created if missing. Throws std::runtime_error if the file cannot be
+    // opened or is not a cache file.
+    PromptEmbeddingCache(const std::string& path, size_t capacity);
+    ~PromptEmbeddingCache();
+    PromptEmbeddingCache(const PromptEmbeddingCache&) = delete;
+    PromptEmbeddingCache& operator=(const PromptEmbeddingCache&) = delete;
+
+    static std::string key(const std::string& model, const std::string& text_prefix, const std::string& text,
+                           const std::string& template_text = "");
+
+    // Copies the embedding of `key` to `out` and marks it recently used. Returns false if it is not
+    // cached.
+    bool lookup(const std::string& key, std::vector<float>& out);
+    // Adds or replaces the embedding of `key`, appending it to the file unless it is already cached
+    // with the same values. A failed write only costs persistence, it is logged and not thrown.
+    void insert(const std::string& key, const float* embedding, size_t dim);
+
+    size_t size() const;
+    size_t capacity() const { return m_capacity; }
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+private:
+    struct Entry {
+        uint64_t hash;
+        std::string key;
+        std::vector<float> embedding;
+    };
+    using EntryList = std::list<Entry>; // most recently used first
+
+    void load();
+    void insert_locked(uint64_t hash, const std::string& key, const float* embedding, size_t dim);
+    void append(const Entry& entry);
+    void compact();
+
+    const size_t m_capacity;
+    const std::string m_path; // empty for a memory-only cache
+    int m_fd = -1;
+    size_t m_file_records = 0;
+
+    mutable std::mutex m_mutex;
+    EntryList m_entries;
+    std::unordered_map<uint64_t, EntryList::iterator> m_index;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+};
+
+} // namespace clip_matcher
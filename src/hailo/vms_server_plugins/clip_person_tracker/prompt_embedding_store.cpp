@@ -0,0 +1,59 @@
+#include "prompt_embedding_store.hpp"
+
+#include <algorithm>
+
+namespace clip_matcher {
+
+PromptEmbeddingStore& PromptEmbeddingStore::instance() {
+    static PromptEmbeddingStore store;
+    return store;
+}
+
+std::string PromptEmbeddingStore::key(const std::string& text_prefix, const std::string& text, bool ensemble) {
+    // The unit separator cannot come from a settings text field
+    return text_prefix + text + (ensemble ? "\x1f" "ensemble" : "");
+}
+
+std::shared_ptr<const SharedPromptEmbedding> PromptEmbeddingStore::intern(const std::string& key,
+    const float* embedding, size_t dim) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_requested_rows;
+    std::weak_ptr<const SharedPromptEmbedding>& slot = m_rows[key];
+    std::shared_ptr<const SharedPromptEmbedding> row = slot.lock();
+    if (row != nullptr && row->dim() == dim)
+        return row;
+    row = std::make_shared<SharedPromptEmbedding>(key, embedding, dim);
+    slot = row;
+    // Rows released by every prompt set leave an expired entry behind, drop them now and then
+    if (m_rows.size() >= m_purge_at) {
+        purge_expired();
+        m_purge_at = std::max<size_t>(64, m_rows.size() * 2);
+    }
+    return row;
+}
+
+size_t PromptEmbeddingStore::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t live = 0;
+    for (const auto& entry : m_rows) {
+        if (!entry.second.expired())
+            ++live;
+    }
+    return live;
+}
+
+size_t PromptEmbeddingStore::requested_rows() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_requested_rows;
+}
+
+void PromptEmbeddingStore::purge_expired() {
+    for (auto it = m_rows.begin(); it != m_rows.end();) {
+        if (it->second.expired())
+            it = m_rows.erase(it);
+        else
+            ++it;
+    }
+}
+
+} // namespace clip_matcher
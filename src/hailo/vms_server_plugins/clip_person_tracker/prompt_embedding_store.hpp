@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "aligned_allocator.hpp"
+
+// Process-wide store of prompt embeddings deduplicated by prompt, shared by the prompt sets of every
+// camera: cameras watching the same prompts reference the same rows instead of each holding a copy.
+//
+// Rows are reference counted through shared_ptr. A row lives as long as a prompt set uses it; the
+// store itself only keeps weak references. The store is only touched while loading prompts, the
+// per-frame match reads the rows through the camera's own prompt set without any shared lock.
+
+namespace clip_matcher {
+
+class SharedPromptEmbedding {
+public:
+    SharedPromptEmbedding(std::string key, const float* embedding, size_t dim)
+        : m_key(std::move(key)), m_embedding(embedding, embedding + dim) {}
+
+    const std::string& key() const { return m_key; }
+    const float* data() const { return m_embedding.data(); }
+    size_t dim() const { return m_embedding.size(); }
+
+private:
+    std::string m_key;
+    AlignedFloatVector m_embedding;
+};
+
+class PromptEmbeddingStore {
+public:
+    static PromptEmbeddingStore& instance();
+
+    // Key identifying the embedding of a prompt: the text the encoder saw (prefix and prompt) and
+    // whether it was ensembled.
+    static std::string key(const std::string& text_prefix, const std::string& text, bool ensemble);
+
+    // Shared row of `key`. The first caller's `embedding` (dim floats) is stored; later callers get
+    // the same row while it is alive, unless their dimension differs (another model), in which case
+    // their embedding replaces it for new callers.
+    std::shared_ptr<const SharedPromptEmbedding> intern(const std::string& key, const float* embedding, size_t dim);
+
+    // Live rows and the rows requested through intern() since startup, to see the deduplication.
+    size_t size() const;
+    size_t requested_rows() const;
+
+private:
+    void purge_expired();
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, std::weak_ptr<const SharedPromptEmbedding>> m_rows;
+    size_t m_requested_rows = 0;
+    size_t m_purge_at = 64;
+};
+
+} // namespace clip_matcher
@@ -0,0 +1,149 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "prompt_encoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "hailo_clip_plugin_ini.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+PromptEncoder::PromptEncoder(std::filesystem::path pluginHomeDir, std::string modelName):
+    m_pluginHomeDir(std::move(pluginHomeDir)),
+    m_modelName(std::move(modelName))
+{
+    const size_t capacity = static_cast<size_t>(std::max(ini().promptCacheEntries, 1));
+    const std::filesystem::path cachePath = m_pluginHomeDir / "prompt_embedding_cache.bin";
+    try
+    {
+        m_cache = std::make_unique<clip_matcher::PromptEmbeddingCache>(cachePath.string(), capacity);
+        std::cout << "Loaded " << m_cache->size() << " cached prompt embeddings from " << cachePath
+            << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Prompt cache not persisted: " << e.what() << std::endl;
+        m_cache = std::make_unique<clip_matcher::PromptEmbeddingCache>(capacity);
+    }
+}
+
+PromptEncoder::~PromptEncoder()
+{
+    if (m_prewarmThread.joinable())
+        m_prewarmThread.join();
+}
+
+void PromptEncoder::prewarm(std::string textPrefix, std::vector<std::string> texts)
+{
+    if (!ini().inProcessTextEncoder || m_prewarmThread.joinable())
+        return;
+    m_prewarmThread = std::thread(
+        [this, textPrefix = std::move(textPrefix), texts = std::move(texts)]()
+        {
+            std::vector<float> embeddings;
+            size_t dim = 0;
+            encode(textPrefix, texts, embeddings, dim);
+        });
+}
+
+bool PromptEncoder::encode(const std::string& textPrefix, const std::vector<std::string>& texts,
+    std::vector<float>& embeddings, size_t& dim)
+{
+    std::vector<std::vector<float>> rows(texts.size());
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < texts.size(); ++i)
+    {
+        if (!m_cache->lookup(cacheKey(textPrefix, texts[i]), rows[i]))
+            missing.push_back(i);
+    }
+
+    if (!missing.empty())
+    {
+        const auto textModel = ini().inProcessTextEncoder ? model() : nullptr;
+        if (!textModel)
+            return false;
+        const auto startTime = std::chrono::steady_clock::now();
+        std::vector<std::string> prompts;
+        for (size_t i: missing)
+            prompts.push_back(textPrefix + texts[i]);
+        std::vector<float> encoded(missing.size() * textModel->embed_dim());
+        try
+        {
+            textModel->encode_batch(prompts, encoded.data());
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "In-process text encoding failed: " << e.what() << std::endl;
+            return false;
+        }
+        for (size_t k = 0; k < missing.size(); ++k)
+        {
+            const float* row = encoded.data() + k * textModel->embed_dim();
+            rows[missing[k]].assign(row, row + textModel->embed_dim());
+            m_cache->insert(cacheKey(textPrefix, texts[missing[k]]), row, textModel->embed_dim());
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - startTime);
+        std::cout << "Encoded " << missing.size() << " new prompts in " << elapsed.count() << " ms"
+            << std::endl;
+    }
+
+    dim = rows.empty() ? 0 : rows[0].size();
+    embeddings.clear();
+    for (const auto& row: rows)
+    {
+        // Cached by another model version
+        if (row.size() != dim)
+            return false;
+        embeddings.insert(embeddings.end(), row.begin(), row.end());
+    }
+    std::cout << "Prompt cache: " << texts.size() - missing.size() << " of " << texts.size()
+        << " prompts cached" << std::endl;
+    return true;
+}
+
+void PromptEncoder::remember(const std::string& textPrefix, const std::string& text,
+    const float* embedding, size_t dim)
+{
+    m_cache->insert(cacheKey(textPrefix, text), embedding, dim);
+}
+
+/**
+ * CLIP text model shared by every camera, loaded on first use and kept resident. Null if its files
+ * are not in the plugin resources.
+ */
+std::shared_ptr<const clip_matcher::ClipTextModel> PromptEncoder::model()
+{
+    const std::lock_guard<std::mutex> lock(m_modelMutex);
+    if (!m_modelLoadAttempted)
+    {
+        m_modelLoadAttempted = true;
+        const std::filesystem::path resources = m_pluginHomeDir / "resources";
+        try
+        {
+            m_model = clip_matcher::ClipTextModel::load(
+                (resources / "bpe_simple_vocab_16e6.txt").string(),
+                (resources / ("clip_text_encoder_" + m_modelName + ".bin")).string());
+            std::cout << "Loaded in-process text encoder from " << resources << std::endl;
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "In-process text encoder unavailable, using text_image_matcher: "
+                << e.what() << std::endl;
+        }
+    }
+    return m_model;
+}
+
+std::string PromptEncoder::cacheKey(const std::string& textPrefix, const std::string& text) const
+{
+    return clip_matcher::PromptEmbeddingCache::key(m_modelName, textPrefix, text);
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,64 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clip_text_encoder.hpp"
+#include "prompt_embedding_cache.hpp"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/**
+ * Turns settings prompts into text embeddings for every camera of the Engine: prompts seen before
+ * come from the persistent prompt cache, the others are encoded by the resident CLIP text model
+ * (loaded on first use) and added to the cache.
+ */
+class PromptEncoder
+{
+public:
+    PromptEncoder(std::filesystem::path pluginHomeDir, std::string modelName);
+    ~PromptEncoder();
+
+    /** Encodes `texts` in the background so that they are cached before they are first applied. */
+    void prewarm(std::string textPrefix, std::vector<std::string> texts);
+
+    /**
+     * Writes the embeddings of textPrefix + each of `texts` to consecutive rows of `embeddings`.
+     *
+     * @return False if a prompt is not cached and the text model is not available; the caller then
+     *     has to run text_image_matcher.
+     */
+    bool encode(const std::string& textPrefix, const std::vector<std::string>& texts,
+        std::vector<float>& embeddings, size_t& dim);
+
+    /** Caches an embedding computed elsewhere (by text_image_matcher). */
+    void remember(const std::string& textPrefix, const std::string& text, const float* embedding,
+        size_t dim);
+
+private:
+    std::shared_ptr<const clip_matcher::ClipTextModel> model();
+    std::string cacheKey(const std::string& textPrefix, const std::string& text) const;
+
+private:
+    const std::filesystem::path m_pluginHomeDir;
+    const std::string m_modelName;
+    std::unique_ptr<clip_matcher::PromptEmbeddingCache> m_cache;
+
+    std::mutex m_modelMutex;
+    std::shared_ptr<const clip_matcher::ClipTextModel> m_model;
+    bool m_modelLoadAttempted = false;
+
+    std::thread m_prewarmThread;
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
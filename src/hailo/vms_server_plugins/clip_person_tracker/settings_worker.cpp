@@ -0,0 +1,128 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "settings_worker.h"
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+SettingsWorker::SettingsWorker():
+    m_thread(&SettingsWorker::run, this)
+{
+}
+
+SettingsWorker::~SettingsWorker()
+{
+    std::map<int, Request> dropped;
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopped = true;
+        dropped.swap(m_pending);
+        m_order.clear();
+        if (m_runningCancelled)
+            m_runningCancelled->store(true);
+    }
+    m_condition.notify_all();
+    m_thread.join();
+    for (auto& entry: dropped)
+    {
+        if (entry.second.completion)
+            entry.second.completion(Result::cancelled);
+    }
+}
+
+void SettingsWorker::submit(int cameraId, Task task, Completion completion)
+{
+    Request superseded;
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopped)
+            return;
+        const auto pending = m_pending.find(cameraId);
+        if (pending != m_pending.end())
+        {
+            superseded = std::move(pending->second);
+            pending->second = Request{std::move(task), std::move(completion)};
+        }
+        else
+        {
+            m_pending.emplace(cameraId, Request{std::move(task), std::move(completion)});
+            m_order.push_back(cameraId);
+        }
+        if (m_running && m_runningCameraId == cameraId)
+            m_runningCancelled->store(true);
+    }
+    m_condition.notify_all();
+    if (superseded.completion)
+        superseded.completion(Result::cancelled);
+}
+
+void SettingsWorker::cancel(int cameraId)
+{
+    Request dropped;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        const auto pending = m_pending.find(cameraId);
+        if (pending != m_pending.end())
+        {
+            dropped = std::move(pending->second);
+            m_pending.erase(pending);
+            m_order.erase(std::remove(m_order.begin(), m_order.end(), cameraId), m_order.end());
+        }
+        if (m_running && m_runningCameraId == cameraId)
+        {
+            m_runningCancelled->store(true);
+            m_condition.wait(lock, [&]() { return !m_running || m_runningCameraId != cameraId; });
+        }
+    }
+    if (dropped.completion)
+        dropped.completion(Result::cancelled);
+}
+
+void SettingsWorker::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_condition.wait(lock, [this]() { return m_stopped || !m_order.empty(); });
+        if (m_stopped)
+            return;
+        const int cameraId = m_order.front();
+        m_order.pop_front();
+        Request request = std::move(m_pending.at(cameraId));
+        m_pending.erase(cameraId);
+        const auto cancelled = std::make_shared<std::atomic<bool>>(false);
+        m_running = true;
+        m_runningCameraId = cameraId;
+        m_runningCancelled = cancelled;
+        lock.unlock();
+
+        Result result = Result::failed;
+        try
+        {
+            if (request.task(*cancelled))
+                result = Result::applied;
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "Settings of camera " << cameraId << " failed: " << e.what() << std::endl;
+        }
+        if (cancelled->load())
+            result = Result::cancelled;
+        if (request.completion)
+            request.completion(result);
+
+        lock.lock();
+        m_running = false;
+        m_runningCancelled.reset();
+        m_condition.notify_all();
+    }
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,89 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/**
+ * Applies settings changes of all the cameras of an Engine, one at a time on one long-lived thread.
+ *
+ * Requests are coalesced per camera: a request replaces the pending one of its camera, which is
+ * never run, and flags the running one of its camera as cancelled. A camera thus only ever gets its
+ * latest settings applied, and a burst of edits costs at most one run per camera. Cameras are served
+ * in the order of their oldest pending request.
+ */
+class SettingsWorker
+{
+public:
+    /** Outcome of a request, passed to its completion callback. */
+    enum class Result
+    {
+        applied,
+        failed,
+        cancelled, //< Superseded by a later request of the same camera, or the camera is gone.
+    };
+
+    /**
+     * Work of a request. It should check `cancelled` between its steps and stop early (returning
+     * false) once it is set; a request that returns after being cancelled is reported as cancelled.
+     *
+     * @return True if the settings were applied.
+     */
+    using Task = std::function<bool(const std::atomic<bool>& cancelled)>;
+    /**
+     * Called once the request is done, on the worker thread. A request dropped before it ran gets
+     * Result::cancelled on the thread that dropped it: the caller of the superseding submit(), of
+     * cancel(), or of the destructor.
+     */
+    using Completion = std::function<void(Result result)>;
+
+    SettingsWorker();
+    /** Cancels the pending requests and waits for the running one. */
+    ~SettingsWorker();
+
+    SettingsWorker(const SettingsWorker&) = delete;
+    SettingsWorker& operator=(const SettingsWorker&) = delete;
+
+    void submit(int cameraId, Task task, Completion completion);
+
+    /**
+     * Drops the pending request of the camera and waits until its running one has returned, so
+     * that the camera can be destroyed.
+     */
+    void cancel(int cameraId);
+
+private:
+    struct Request
+    {
+        Task task;
+        Completion completion;
+    };
+
+    void run();
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::map<int, Request> m_pending;
+    std::deque<int> m_order; //< Cameras with a pending request, oldest first.
+    int m_runningCameraId = 0;
+    bool m_running = false;
+    std::shared_ptr<std::atomic<bool>> m_runningCancelled;
+    bool m_stopped = false;
+    std::thread m_thread;
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
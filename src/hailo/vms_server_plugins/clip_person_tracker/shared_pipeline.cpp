@@ -0,0 +1,250 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "shared_pipeline.h"
+
+#include <iostream>
+
+#include "camera_pipeline.h"
+#include "gstreamer_pipeline.hpp"
+#include "hailo_clip_plugin_ini.h"
+#include "pipeline_builder.h"
+#include "pipeline_config.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+SharedPipeline::SharedPipeline(std::filesystem::path pluginHomeDir, int lanes, const DevicePlacement& placement,
+    int width, int height):
+    m_pluginHomeDir(std::move(pluginHomeDir)),
+    m_placement(placement),
+    m_width(width),
+    m_height(height)
+{
+    for (int i = 0; i < lanes; ++i)
+    {
+        auto lane = std::make_unique<Lane>();
+        lane->index = i;
+        if (ini().latencyTracing)
+        {
+            const std::string name = sharedLaneName("lane", i);
+            const std::string tracePath = ini().latencyTraceDir[0] == '\0' ? ""
+                : (std::filesystem::path(ini().latencyTraceDir) / ("latency_trace_" + name + ".json")).string();
+            lane->latencyTracer = std::make_unique<LatencyTracer>(
+                "shared " + name, ini().latencyReportFrames, tracePath, ini().latencyTraceFrames);
+        }
+        m_lanes.push_back(std::move(lane));
+    }
+}
+
+SharedPipeline::~SharedPipeline()
+{
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_thread)
+            return;
+    }
+    m_running = false;
+    // Run by the loop itself: quits it even if the thread has not reached g_main_loop_run() yet
+    GSource* source = g_idle_source_new();
+    g_source_set_callback(source, &SharedPipeline::quitMainLoop, m_mainLoop, nullptr);
+    g_source_attach(source, m_context);
+    g_source_unref(source);
+    m_thread->join();
+    g_main_loop_unref(m_mainLoop);
+    g_main_context_unref(m_context);
+}
+
+int SharedPipeline::attach(GStreamerObjectDetector* detector)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& lane: m_lanes)
+    {
+        const std::lock_guard<std::mutex> laneLock(lane->mutex);
+        if (lane->detector != nullptr)
+            continue;
+        lane->detector = detector;
+        if (!m_thread)
+        {
+            m_context = g_main_context_new();
+            m_mainLoop = g_main_loop_new(m_context, FALSE);
+            m_thread = std::make_unique<std::thread>(&SharedPipeline::run, this);
+        }
+        std::cout << "Shared pipeline: camera attached to lane " << lane->index << std::endl;
+        return lane->index;
+    }
+    return -1;
+}
+
+void SharedPipeline::detach(int lane)
+{
+    if (lane < 0 || lane >= (int) m_lanes.size())
+        return;
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    const std::lock_guard<std::mutex> laneLock(m_lanes[lane]->mutex);
+    m_lanes[lane]->detector = nullptr;
+    std::cout << "Shared pipeline: lane " << lane << " detached" << std::endl;
+}
+
+bool SharedPipeline::push(int lane, GstBuffer* buffer)
+{
+    if (!m_running || lane < 0 || lane >= (int) m_lanes.size())
+        return false;
+    if (m_lanes[lane]->latencyTracer)
+        m_lanes[lane]->latencyTracer->markPushed(buffer);
+    GstFlowReturn ret;
+    g_signal_emit_by_name(m_lanes[lane]->appsrc, "push-buffer", buffer, &ret);
+    if (ret != GST_FLOW_OK)
+    {
+        std::cout << "Shared pipeline: error pushing buffer to lane " << lane << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void SharedPipeline::run()
+{
+    initGstreamer();
+    // The bus watch is attached to the context of this thread's loop
+    g_main_context_push_thread_default(m_context);
+
+    const PipelineConfig config = PipelineConfig::load(m_pluginHomeDir);
+    const PipelineResources resources = pipelineResources(m_pluginHomeDir);
+    const int lanes = static_cast<int>(m_lanes.size());
+    const PipelineDescription description =
+        buildSharedPipeline(config, resources, m_placement, lanes, m_width, m_height);
+    const std::string pipelineString = description.toLaunchString();
+    std::cout << "Shared pipeline config:\n" << config.dump();
+    std::cout << "Shared pipeline of " << lanes << " lanes:\n" << description.dump();
+
+    GError* error = nullptr;
+    m_pipeline = gst_parse_launch(pipelineString.c_str(), &error);
+    if (error)
+    {
+        std::cout << "Error creating the shared pipeline: " << error->message << std::endl;
+        g_clear_error(&error);
+    }
+    if (m_pipeline == nullptr)
+    {
+        // The cameras stay attached but get no results, as with a broken pipeline of their own
+        g_main_loop_run(m_mainLoop);
+        g_main_context_pop_thread_default(m_context);
+        return;
+    }
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(m_pipeline));
+    gst_bus_add_watch(bus, &SharedPipeline::onBusMessage, this);
+
+    // Tracks with a confident cached match are left out of the CLIP crops, see clip_track_cropper
+    const bool skipCachedTracks = ini().trackSkipClipSimilarity > 0;
+    for (const auto& lane: m_lanes)
+    {
+        lane->appsrc = gst_bin_get_by_name(GST_BIN(m_pipeline), sharedLaneName("app_source", lane->index).c_str());
+        GstElement* sink =
+            gst_bin_get_by_name(GST_BIN(m_pipeline), sharedLaneName("clip_matcher_sink", lane->index).c_str());
+        g_signal_connect(sink, "new-sample", G_CALLBACK(&SharedPipeline::onMatcherSample), lane.get());
+        gst_object_unref(sink);
+        // Every lane also probes the shared elements, and only follows the frames it pushed
+        if (lane->latencyTracer)
+            lane->latencyTracer->attach(m_pipeline, sharedLaneName("hailo_tracker", lane->index));
+        if (skipCachedTracks)
+        {
+            // Before the lanes merge, while the frames still belong to a single tracker
+            GstElement* queue =
+                gst_bin_get_by_name(GST_BIN(m_pipeline), sharedLaneName("clip_lane_q", lane->index).c_str());
+            GstPad* queueSink = gst_element_get_static_pad(queue, "sink");
+            gst_pad_add_probe(queueSink, GST_PAD_PROBE_TYPE_BUFFER, &SharedPipeline::onClipLaneProbe,
+                lane.get(), nullptr);
+            gst_object_unref(queueSink);
+            gst_object_unref(queue);
+        }
+    }
+
+    if (resources.standInNetworks)
+    {
+        m_standInInference = std::make_unique<StandInInference>(config);
+        m_standInInference->connect(m_pipeline);
+    }
+
+    gst_element_set_state(m_pipeline, GST_STATE_PLAYING);
+    if (gst_element_get_state(m_pipeline, nullptr, nullptr, GST_SECOND) == GST_STATE_CHANGE_FAILURE)
+        std::cout << "Error running the shared pipeline" << std::endl;
+    else
+        std::cout << "Shared pipeline running" << std::endl;
+    m_running = true;
+    g_main_loop_run(m_mainLoop);
+
+    m_running = false;
+    gst_element_set_state(m_pipeline, GST_STATE_NULL);
+    gst_bus_remove_watch(bus);
+    gst_object_unref(bus);
+    for (const auto& lane: m_lanes)
+    {
+        gst_object_unref(lane->appsrc);
+        lane->appsrc = nullptr;
+    }
+    gst_object_unref(m_pipeline);
+    m_pipeline = nullptr;
+    m_standInInference.reset();
+    g_main_context_pop_thread_default(m_context);
+    std::cout << "Shared pipeline stopped" << std::endl;
+}
+
+GstFlowReturn SharedPipeline::onMatcherSample(GstElement* sink, gpointer data)
+{
+    Lane* lane = static_cast<Lane*>(data);
+    GstSample* sample = nullptr;
+    g_signal_emit_by_name(sink, "pull-sample", &sample);
+    if (sample == nullptr)
+        return GST_FLOW_OK;
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    {
+        const std::lock_guard<std::mutex> lock(lane->mutex);
+        if (lane->detector != nullptr && buffer != nullptr)
+            lane->detector->handOffToMatcher(buffer, lane->latencyTracer.get());
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+GstPadProbeReturn SharedPipeline::onClipLaneProbe(GstPad* pad, GstPadProbeInfo* info, gpointer data)
+{
+    Lane* lane = static_cast<Lane*>(data);
+    const std::lock_guard<std::mutex> lock(lane->mutex);
+    if (lane->detector == nullptr)
+        return GST_PAD_PROBE_OK;
+    return GStreamerObjectDetector::on_clip_cropper_probe(pad, info, lane->detector);
+}
+
+gboolean SharedPipeline::onBusMessage(GstBus* /*bus*/, GstMessage* message, gpointer /*data*/)
+{
+    switch (GST_MESSAGE_TYPE(message))
+    {
+        case GST_MESSAGE_ERROR:
+        {
+            GError* error = nullptr;
+            gchar* debugInfo = nullptr;
+            gst_message_parse_error(message, &error, &debugInfo);
+            std::cout << "Shared pipeline: error from " << GST_OBJECT_NAME(message->src) << ": "
+                << error->message << " (" << (debugInfo ? debugInfo : "no debug info") << ")" << std::endl;
+            g_clear_error(&error);
+            g_free(debugInfo);
+            break;
+        }
+        case GST_MESSAGE_QOS:
+            std::cout << "Shared pipeline: QOS message from " << GST_OBJECT_NAME(message->src) << std::endl;
+            break;
+        default:
+            break;
+    }
+    return TRUE;
+}
+
+gboolean SharedPipeline::quitMainLoop(gpointer data)
+{
+    g_main_loop_quit(static_cast<GMainLoop*>(data));
+    return G_SOURCE_REMOVE;
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
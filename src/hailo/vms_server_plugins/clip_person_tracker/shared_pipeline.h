@@ -0,0 +1,110 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gst/gst.h>
+
+#include "latency_tracer.h"
+#include "pipeline_config.h"
+#include "stand_in_inference.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+class GStreamerObjectDetector;
+
+/**
+ * One GStreamer pipeline for the cameras of an Engine (see buildSharedPipeline()): each camera
+ * attaches to a lane with its own appsrc and tracker, and the frames of all the lanes are taken in
+ * turn into one detection network and one CLIP network, so their batches fill from the combined
+ * frame rate of the cameras. The results of a lane go back to the GStreamerObjectDetector attached
+ * to it.
+ *
+ * The pipeline is started, on a thread of its own, by the first attach().
+ */
+class SharedPipeline
+{
+public:
+    /**
+     * @param lanes Cameras the pipeline can take; the others run a pipeline of their own.
+     * @param placement vdevice groups of the networks, see DeviceScheduler.
+     * @param width, height Resolution of the frames of every lane.
+     */
+    SharedPipeline(std::filesystem::path pluginHomeDir, int lanes, const DevicePlacement& placement, int width,
+        int height);
+    /** Stops the pipeline and waits for its thread. */
+    ~SharedPipeline();
+
+    SharedPipeline(const SharedPipeline&) = delete;
+    SharedPipeline& operator=(const SharedPipeline&) = delete;
+
+    const DevicePlacement& placement() const { return m_placement; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    /**
+     * Hands the results of a free lane to `detector`.
+     *
+     * @return The lane, or -1 if all are taken.
+     */
+    int attach(GStreamerObjectDetector* detector);
+
+    /**
+     * Frees the lane; waits for the results being handed to its detector, which gets no more of
+     * them once this returns.
+     */
+    void detach(int lane);
+
+    /**
+     * Pushes a buffer of width() x height() RGB to the appsrc of the lane. Frames are dropped while
+     * the pipeline is starting.
+     *
+     * @return False if the frame was dropped. The caller keeps its ref to the buffer either way.
+     */
+    bool push(int lane, GstBuffer* buffer);
+
+private:
+    struct Lane
+    {
+        int index = 0;
+        std::mutex mutex; //< Held while results are handed to the detector.
+        GStreamerObjectDetector* detector = nullptr;
+        GstElement* appsrc = nullptr;
+        std::unique_ptr<LatencyTracer> latencyTracer; //< Null if latency tracing is disabled.
+    };
+
+    void run();
+    static GstFlowReturn onMatcherSample(GstElement* sink, gpointer data);
+    static GstPadProbeReturn onClipLaneProbe(GstPad* pad, GstPadProbeInfo* info, gpointer data);
+    static gboolean onBusMessage(GstBus* bus, GstMessage* message, gpointer data);
+    static gboolean quitMainLoop(gpointer data);
+
+private:
+    const std::filesystem::path m_pluginHomeDir;
+    const DevicePlacement m_placement;
+    const int m_width;
+    const int m_height;
+    std::vector<std::unique_ptr<Lane>> m_lanes;
+
+    std::mutex m_mutex; //< Guards the lane assignment and the start of the thread.
+    std::unique_ptr<std::thread> m_thread;
+    std::atomic<bool> m_running{false}; //< The lanes accept frames.
+
+    // Owned by the pipeline thread once it is started
+    GMainContext* m_context = nullptr;
+    GMainLoop* m_mainLoop = nullptr;
+    GstElement* m_pipeline = nullptr;
+    std::unique_ptr<StandInInference> m_standInInference; //< Null with a Hailo device.
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,342 @@
+#include "similarity_kernel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CLIP_MATCHER_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define CLIP_MATCHER_NEON 1
+#endif
+
+namespace clip_matcher {
+
+namespace {
+
+// Every implementation scores a block of R image rows against one prompt row at a time, so each
+// prompt value is loaded once per block instead of once per image.
+constexpr size_t kImageBlock = 4;
+
+using DotProductsFn = void (*)(const float*, size_t, size_t, const float*, size_t, size_t, size_t, float*);
+using DotProductRowsFn = void (*)(const float*, size_t, size_t, const float* const*, size_t, size_t, float*);
+
+// Prompt rows of a strided matrix, or given by pointer
+struct StridedPrompts {
+    const float* base;
+    size_t stride;
+    const float* operator[](size_t p) const { return base + p * stride; }
+};
+
+struct PromptPointers {
+    const float* const* rows;
+    const float* operator[](size_t p) const { return rows[p]; }
+};
+
+template <size_t R>
+void dot_block_scalar(const float* const* rows, const float* prompt, size_t dim, float* out) {
+    float acc[R] = {};
+    for (size_t k = 0; k < dim; ++k) {
+        for (size_t r = 0; r < R; ++r) {
+            acc[r] += rows[r][k] * prompt[k];
+        }
+    }
+    for (size_t r = 0; r < R; ++r) {
+        out[r] = acc[r];
+    }
+}
+
+#if defined(CLIP_MATCHER_X86)
+
+__attribute__((target("avx2,fma")))
+inline float horizontal_sum_avx2(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+template <size_t R>
+__attribute__((target("avx2,fma")))
+void dot_block_avx2(const float* const* rows, const float* prompt, size_t dim, float* out) {
+    __m256 acc[R];
+    for (size_t r = 0; r < R; ++r) {
+        acc[r] = _mm256_setzero_ps();
+    }
+    size_t k = 0;
+    for (; k + 8 <= dim; k += 8) {
+        const __m256 p = _mm256_loadu_ps(prompt + k);
+        for (size_t r = 0; r < R; ++r) {
+            acc[r] = _mm256_fmadd_ps(_mm256_loadu_ps(rows[r] + k), p, acc[r]);
+        }
+    }
+    for (size_t r = 0; r < R; ++r) {
+        float sum = horizontal_sum_avx2(acc[r]);
+        for (size_t j = k; j < dim; ++j) {
+            sum += rows[r][j] * prompt[j];
+        }
+        out[r] = sum;
+    }
+}
+
+template <size_t R>
+__attribute__((target("avx512f")))
+void dot_block_avx512(const float* const* rows, const float* prompt, size_t dim, float* out) {
+    __m512 acc[R];
+    for (size_t r = 0; r < R; ++r) {
+        acc[r] = _mm512_setzero_ps();
+    }
+    size_t k = 0;
+    for (; k + 16 <= dim; k += 16) {
+        const __m512 p = _mm512_loadu_ps(prompt + k);
+        for (size_t r = 0; r < R; ++r) {
+            acc[r] = _mm512_fmadd_ps(_mm512_loadu_ps(rows[r] + k), p, acc[r]);
+        }
+    }
+    if (k < dim) {
+        const __mmask16 mask = static_cast<__mmask16>((1u << (dim - k)) - 1);
+        const __m512 p = _mm512_maskz_loadu_ps(mask, prompt + k);
+        for (size_t r = 0; r < R; ++r) {
+            acc[r] = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, rows[r] + k), p, acc[r]);
+        }
+    }
+    for (size_t r = 0; r < R; ++r) {
+        alignas(64) float lanes[16];
+        _mm512_store_ps(lanes, acc[r]);
+        float sum = 0.0f;
+        for (float lane : lanes) {
+            sum += lane;
+        }
+        out[r] = sum;
+    }
+}
+
+#elif defined(CLIP_MATCHER_NEON)
+
+template <size_t R>
+void dot_block_neon(const float* const* rows, const float* prompt, size_t dim, float* out) {
+    float32x4_t acc[R];
+    for (size_t r = 0; r < R; ++r) {
+        acc[r] = vdupq_n_f32(0.0f);
+    }
+    size_t k = 0;
+    for (; k + 4 <= dim; k += 4) {
+        const float32x4_t p = vld1q_f32(prompt + k);
+        for (size_t r = 0; r < R; ++r) {
+            acc[r] = vfmaq_f32(acc[r], vld1q_f32(rows[r] + k), p);
+        }
+    }
+    for (size_t r = 0; r < R; ++r) {
+        float sum = vaddvq_f32(acc[r]);
+        for (size_t j = k; j < dim; ++j) {
+            sum += rows[r][j] * prompt[j];
+        }
+        out[r] = sum;
+    }
+}
+
+#endif
+
+// Blocked GEMM-style loop shared by every implementation. The block function is not inlined into
+// this generic loop (it is compiled for a different target), one call scores a whole block.
+template <void (*BlockR)(const float* const*, const float*, size_t, float*),
+          void (*Block1)(const float* const*, const float*, size_t, float*), typename Prompts>
+void dot_products_blocked(const float* images, size_t num_images, size_t image_stride,
+                          Prompts prompts, size_t num_prompts, size_t dim, float* scores) {
+    size_t i = 0;
+    for (; i + kImageBlock <= num_images; i += kImageBlock) {
+        const float* rows[kImageBlock];
+        for (size_t r = 0; r < kImageBlock; ++r) {
+            rows[r] = images + (i + r) * image_stride;
+        }
+        for (size_t p = 0; p < num_prompts; ++p) {
+            float out[kImageBlock];
+            BlockR(rows, prompts[p], dim, out);
+            for (size_t r = 0; r < kImageBlock; ++r) {
+                scores[(i + r) * num_prompts + p] = out[r];
+            }
+        }
+    }
+    for (; i < num_images; ++i) {
+        const float* rows[1] = {images + i * image_stride};
+        for (size_t p = 0; p < num_prompts; ++p) {
+            Block1(rows, prompts[p], dim, scores + i * num_prompts + p);
+        }
+    }
+}
+
+SimdLevel detect_simd_level() {
+#if defined(CLIP_MATCHER_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SimdLevel::avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SimdLevel::avx2;
+    return SimdLevel::scalar;
+#elif defined(CLIP_MATCHER_NEON)
+    return SimdLevel::neon;
+#else
+    return SimdLevel::scalar;
+#endif
+}
+
+template <void (*BlockR)(const float* const*, const float*, size_t, float*),
+          void (*Block1)(const float* const*, const float*, size_t, float*)>
+void dot_products_strided(const float* images, size_t num_images, size_t image_stride,
+                          const float* prompts, size_t num_prompts, size_t prompt_stride,
+                          size_t dim, float* scores) {
+    dot_products_blocked<BlockR, Block1>(images, num_images, image_stride,
+                                         StridedPrompts{prompts, prompt_stride}, num_prompts, dim, scores);
+}
+
+template <void (*BlockR)(const float* const*, const float*, size_t, float*),
+          void (*Block1)(const float* const*, const float*, size_t, float*)>
+void dot_product_rows(const float* images, size_t num_images, size_t image_stride,
+                      const float* const* prompt_rows, size_t num_prompts, size_t dim, float* scores) {
+    dot_products_blocked<BlockR, Block1>(images, num_images, image_stride,
+                                         PromptPointers{prompt_rows}, num_prompts, dim, scores);
+}
+
+DotProductsFn dot_products_fn(SimdLevel level) {
+    switch (level) {
+#if defined(CLIP_MATCHER_X86)
+        case SimdLevel::avx512:
+            return dot_products_strided<dot_block_avx512<kImageBlock>, dot_block_avx512<1>>;
+        case SimdLevel::avx2:
+            return dot_products_strided<dot_block_avx2<kImageBlock>, dot_block_avx2<1>>;
+#elif defined(CLIP_MATCHER_NEON)
+        case SimdLevel::neon:
+            return dot_products_strided<dot_block_neon<kImageBlock>, dot_block_neon<1>>;
+#endif
+        default:
+            return dot_products_strided<dot_block_scalar<kImageBlock>, dot_block_scalar<1>>;
+    }
+}
+
+DotProductRowsFn dot_product_rows_fn(SimdLevel level) {
+    switch (level) {
+#if defined(CLIP_MATCHER_X86)
+        case SimdLevel::avx512:
+            return dot_product_rows<dot_block_avx512<kImageBlock>, dot_block_avx512<1>>;
+        case SimdLevel::avx2:
+            return dot_product_rows<dot_block_avx2<kImageBlock>, dot_block_avx2<1>>;
+#elif defined(CLIP_MATCHER_NEON)
+        case SimdLevel::neon:
+            return dot_product_rows<dot_block_neon<kImageBlock>, dot_block_neon<1>>;
+#endif
+        default:
+            return dot_product_rows<dot_block_scalar<kImageBlock>, dot_block_scalar<1>>;
+    }
+}
+
+const SimdLevel g_detected_simd_level = detect_simd_level();
+std::atomic<SimdLevel> g_simd_level{g_detected_simd_level};
+std::atomic<DotProductsFn> g_dot_products{dot_products_fn(g_detected_simd_level)};
+std::atomic<DotProductRowsFn> g_dot_product_rows{dot_product_rows_fn(g_detected_simd_level)};
+
+} // namespace
+
+SimdLevel active_simd_level() {
+    return g_simd_level.load(std::memory_order_relaxed);
+}
+
+bool set_simd_level(SimdLevel level) {
+    const bool supported = level == SimdLevel::scalar
+        || level == g_detected_simd_level
+        || (level == SimdLevel::avx2 && g_detected_simd_level == SimdLevel::avx512);
+    if (!supported)
+        return false;
+    g_simd_level.store(level, std::memory_order_relaxed);
+    g_dot_products.store(dot_products_fn(level), std::memory_order_relaxed);
+    g_dot_product_rows.store(dot_product_rows_fn(level), std::memory_order_relaxed);
+    return true;
+}
+
+const char* simd_level_name(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::avx512: return "avx512";
+        case SimdLevel::avx2: return "avx2";
+        case SimdLevel::neon: return "neon";
+        default: return "scalar";
+    }
+}
+
+void dot_products(const float* images, size_t num_images, size_t image_stride,
+                  const float* prompts, size_t num_prompts, size_t prompt_stride,
+                  size_t dim, float* scores) {
+    g_dot_products.load(std::memory_order_relaxed)(images, num_images, image_stride, prompts, num_prompts, prompt_stride, dim, scores);
+}
+
+void dot_products_rows(const float* images, size_t num_images, size_t image_stride,
+                       const float* const* prompt_rows, size_t num_prompts, size_t dim, float* scores) {
+    g_dot_product_rows.load(std::memory_order_relaxed)(images, num_images, image_stride, prompt_rows, num_prompts, dim, scores);
+}
+
+void dot_products_to_similarities(float* scores, size_t num_images, size_t num_prompts,
+                                  const ScoreParams& params, const float* row_scales,
+                                  int* best_idx, float* best_similarity) {
+    if (num_prompts == 0)
+        return;
+    const float linear_range = params.linear_high - params.linear_low;
+    for (size_t i = 0; i < num_images; ++i) {
+        float* row = scores + i * num_prompts;
+        if (row_scales != nullptr) {
+            for (size_t p = 0; p < num_prompts; ++p) {
+                row[p] *= row_scales[i];
+            }
+        }
+
+        size_t best = 0;
+        for (size_t p = 1; p < num_prompts; ++p) {
+            if (row[p] > row[best])
+                best = p;
+        }
+
+        if (params.run_softmax) {
+            // The softmax is monotonic, so the best prompt is already known
+            // exp(scale * (x - max)) <= 1, so large dot products no longer overflow to inf
+            const float max_score = row[best];
+            float sum = 0.0f;
+            for (size_t p = 0; p < num_prompts; ++p) {
+                row[p] = std::exp(params.logit_scale * (row[p] - max_score));
+                sum += row[p];
+            }
+            const float inv_sum = 1.0f / sum;
+            for (size_t p = 0; p < num_prompts; ++p) {
+                row[p] *= inv_sum;
+            }
+        } else {
+            for (size_t p = 0; p < num_prompts; ++p) {
+                row[p] = std::clamp((row[p] - params.linear_low) / linear_range, 0.0f, 1.0f);
+            }
+            // Clipping can tie several prompts at 0 or 1, report the first one like before
+            best = 0;
+            for (size_t p = 1; p < num_prompts; ++p) {
+                if (row[p] > row[best])
+                    best = p;
+            }
+        }
+        best_idx[i] = static_cast<int>(best);
+        best_similarity[i] = row[best];
+    }
+}
+
+void score_batch(const float* images, size_t num_images, size_t image_stride,
+                 const float* prompts, size_t num_prompts, size_t prompt_stride,
+                 size_t dim, const ScoreParams& params, const float* row_scales,
+                 float* scores, int* best_idx, float* best_similarity) {
+    dot_products(images, num_images, image_stride, prompts, num_prompts, prompt_stride, dim, scores);
+    dot_products_to_similarities(scores, num_images, num_prompts, params, row_scales, best_idx, best_similarity);
+}
+
+void score_batch_rows(const float* images, size_t num_images, size_t image_stride,
+                      const float* const* prompt_rows, size_t num_prompts, size_t dim,
+                      const ScoreParams& params, const float* row_scales,
+                      float* scores, int* best_idx, float* best_similarity) {
+    dot_products_rows(images, num_images, image_stride, prompt_rows, num_prompts, dim, scores);
+    dot_products_to_similarities(scores, num_images, num_prompts, params, row_scales, best_idx, best_similarity);
+}
+
+} // namespace clip_matcher
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+
+// Batched image/prompt similarity kernels used by TextImageMatcher.
+//
+// All matrices are row-major float32. The dot product kernel scores every image row against every
+// prompt row in one pass; the SIMD implementation (AVX-512, AVX2+FMA or NEON) is chosen once at
+// runtime from the CPU features and falls back to plain C++ everywhere else.
+
+namespace clip_matcher {
+
+enum class SimdLevel {
+    scalar,
+    neon,
+    avx2,
+    avx512,
+};
+
+// SIMD level used by dot_products(), the best one supported by this CPU unless overridden.
+SimdLevel active_simd_level();
+// Overrides the SIMD level (e.g. to compare implementations in benchmarks). Returns false and keeps
+// the current level if the CPU does not support the requested one.
+bool set_simd_level(SimdLevel level);
+const char* simd_level_name(SimdLevel level);
+
+// scores[i * num_prompts + p] = dot(images[i], prompts[p]) for every image row i and prompt row p.
+// Strides are in floats and allow padded rows.
+void dot_products(const float* images, size_t num_images, size_t image_stride,
+                  const float* prompts, size_t num_prompts, size_t prompt_stride,
+                  size_t dim, float* scores);
+
+// dot_products() with every prompt row given by pointer, for prompt rows that are not one matrix
+// (e.g. rows shared between the prompt sets of several cameras).
+void dot_products_rows(const float* images, size_t num_images, size_t image_stride,
+                       const float* const* prompt_rows, size_t num_prompts, size_t dim, float* scores);
+
+struct ScoreParams {
+    bool run_softmax = true;
+    // CLIP logit scale, softmax is computed over logit_scale * dot_product
+    float logit_scale = 100.0f;
+    // Linear mapping used when softmax is off. These values are based on statistics collected
+    // for the RN50x4 model.
+    float linear_low = 0.27f;
+    float linear_high = 0.41f;
+};
+
+// Converts the dot products of each image row (in place) into similarities: either a softmax over
+// the prompts, computed with the row maximum subtracted so it cannot overflow, or the clipped
+// linear mapping. If row_scales is not null, the dot products of row i are first multiplied by
+// row_scales[i] (used to normalize the image embeddings without rewriting them). The best prompt
+// of every row and its similarity are written to best_idx and best_similarity.
+void dot_products_to_similarities(float* scores, size_t num_images, size_t num_prompts,
+                                  const ScoreParams& params, const float* row_scales,
+                                  int* best_idx, float* best_similarity);
+
+// dot_products() followed by dot_products_to_similarities().
+void score_batch(const float* images, size_t num_images, size_t image_stride,
+                 const float* prompts, size_t num_prompts, size_t prompt_stride,
+                 size_t dim, const ScoreParams& params, const float* row_scales,
+                 float* scores, int* best_idx, float* best_similarity);
+
+// dot_products_rows() followed by dot_products_to_similarities().
+void score_batch_rows(const float* images, size_t num_images, size_t image_stride,
+                      const float* const* prompt_rows, size_t num_prompts, size_t dim,
+                      const ScoreParams& params, const float* row_scales,
+                      float* scores, int* best_idx, float* best_similarity);
+
+} // namespace clip_matcher
@@ -0,0 +1,151 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#include "stand_in_inference.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "hailo_clip_plugin_ini.h"
+#include "pipeline_builder.h"
+
+// Tappas includes
+#include "hailo_objects.hpp"
+#include "hailo_common.hpp"
+#include "gst_hailo_meta.hpp"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+namespace {
+
+constexpr int kPersonClassId = 1; //< As labeled by yolov5_personface, tracked by hailotracker.
+constexpr float kPersonWidth = 0.12f;
+constexpr float kPersonHeight = 0.35f;
+
+// Deterministic on every platform, unlike the std distributions
+uint64_t splitMix64(uint64_t& state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [-1, 1)
+float symmetricUniform(uint64_t& state)
+{
+    return static_cast<float>(splitMix64(state) >> 40) / static_cast<float>(1ull << 23) - 1.0f;
+}
+
+// Position in [0, 1] going back and forth once every 2 / speed seconds
+float bounce(double seconds, double speed, double phase)
+{
+    const double position = std::fmod(seconds * speed + phase, 2.0);
+    return static_cast<float>(position <= 1.0 ? position : 2.0 - position);
+}
+
+} // namespace
+
+StandInInference::StandInInference(const PipelineConfig& config):
+    m_persons(std::max(ini().standInPersons, 0)),
+    m_embeddingDim(std::max(ini().standInEmbeddingDim, 1)),
+    m_embeddingNoise(std::max(ini().standInEmbeddingNoise, 0.0f))
+{
+    m_detection.batchSize = config.detectionBatchSize;
+    m_detection.batchUs = std::max(ini().standInDetectionBatchUs, 0);
+    m_clip.batchSize = config.clipBatchSize;
+    m_clip.batchUs = std::max(ini().standInClipBatchUs, 0);
+}
+
+void StandInInference::connect(GstElement* pipeline)
+{
+    const std::pair<const char*, GCallback> handoffs[] = {
+        {kDetectionStandInName, G_CALLBACK(&StandInInference::onDetectionHandoff)},
+        {kClipStandInName, G_CALLBACK(&StandInInference::onClipHandoff)},
+    };
+    for (const auto& handoff: handoffs)
+    {
+        GstElement* identity = gst_bin_get_by_name(GST_BIN(pipeline), handoff.first);
+        if (identity == nullptr)
+        {
+            std::cout << "Stand-in inference: no " << handoff.first << " in the pipeline" << std::endl;
+            continue;
+        }
+        g_signal_connect(identity, "handoff", handoff.second, this);
+        gst_object_unref(identity);
+    }
+    std::cout << "Stand-in inference: " << m_persons << " persons per frame, embeddings of " << m_embeddingDim
+        << ", detection batches of " << m_detection.batchSize << " take " << m_detection.batchUs
+        << " us, CLIP batches of " << m_clip.batchSize << " take " << m_clip.batchUs << " us" << std::endl;
+}
+
+/** Adds the persons of the frame to the ROI of the whole frame, like the detection post-process. */
+void StandInInference::onDetectionHandoff(GstElement* /*object*/, GstBuffer* buffer, gpointer data)
+{
+    auto* standIn = static_cast<StandInInference*>(data);
+    simulateBatch(standIn->m_detection);
+    HailoROIPtr roi = get_hailo_main_roi(buffer, true);
+    if (roi == nullptr)
+        return;
+
+    const double seconds = GST_BUFFER_PTS_IS_VALID(buffer) ? GST_BUFFER_PTS(buffer) / 1e9 : 0.0;
+    for (int person = 0; person < standIn->m_persons; ++person)
+    {
+        // Each person has its own lane and pace, so that the tracker keeps their IDs apart
+        const float xmin = bounce(seconds, 0.05 * (person % 4 + 1), 0.37 * person) * (1.0f - kPersonWidth);
+        const float ymin = (1.0f - kPersonHeight) * (person + 0.5f) / standIn->m_persons;
+        const float confidence = 0.6f + 0.35f * bounce(seconds, 0.2, 0.11 * person);
+        roi->add_object(std::make_shared<HailoDetection>(
+            HailoBBox(xmin, ymin, kPersonWidth, kPersonHeight), kPersonClassId, "person", confidence));
+    }
+}
+
+/** Attaches the normalized embedding of the person of the crop, like the clip_post filter. */
+void StandInInference::onClipHandoff(GstElement* /*object*/, GstBuffer* buffer, gpointer data)
+{
+    auto* standIn = static_cast<StandInInference*>(data);
+    simulateBatch(standIn->m_clip);
+    HailoROIPtr roi = get_hailo_main_roi(buffer, false);
+    if (roi == nullptr)
+        return;
+
+    // The crop's ROI is the detection; persons without a track get the embedding of their row
+    uint64_t identity = static_cast<uint64_t>(roi->get_bbox().ymin() * 1000.0f);
+    if (auto detection = std::dynamic_pointer_cast<HailoDetection>(roi))
+    {
+        const std::vector<HailoUniqueIDPtr> trackIds = hailo_common::get_hailo_track_id(detection);
+        if (trackIds.size() == 1)
+            identity = static_cast<uint64_t>(trackIds[0]->get_id()) + 1000;
+    }
+    uint64_t identityState = identity * 0x2545F4914F6CDD1Dull;
+    uint64_t noiseState = identityState ^ static_cast<uint64_t>(GST_BUFFER_PTS(buffer));
+    std::vector<float> embedding(static_cast<size_t>(standIn->m_embeddingDim));
+    double squaredNorm = 0.0;
+    for (float& value: embedding)
+    {
+        value = symmetricUniform(identityState) + standIn->m_embeddingNoise * symmetricUniform(noiseState);
+        squaredNorm += double(value) * value;
+    }
+    const float scale = squaredNorm > 0.0 ? static_cast<float>(1.0 / std::sqrt(squaredNorm)) : 0.0f;
+    for (float& value: embedding)
+        value *= scale;
+    roi->add_object(std::make_shared<HailoMatrix>(std::move(embedding), 1, 1, standIn->m_embeddingDim));
+}
+
+void StandInInference::simulateBatch(Network& network)
+{
+    // A real batch holds its first buffers until it is full; paid at once, the average is the same
+    const uint64_t buffers = network.buffers.fetch_add(1) + 1;
+    if (network.batchUs > 0 && buffers % static_cast<uint64_t>(std::max(network.batchSize, 1)) == 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(network.batchUs));
+}
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
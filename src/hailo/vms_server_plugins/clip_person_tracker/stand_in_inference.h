@@ -0,0 +1,62 @@
+// Copyright 2018-present Network Optix, Inc. Licensed under MPL 2.0: www.mozilla.org/MPL/2.0/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include <gst/gst.h>
+
+#include "pipeline_config.h"
+
+namespace hailo {
+namespace vms_server_plugins {
+namespace clip_person_tracker {
+
+/**
+ * CPU stand-ins for the detection and CLIP networks, so that the pipeline runs without a Hailo
+ * device (see the standInInference ini setting). The builder puts an identity where each network
+ * and its post-processing would be; the stand-in attaches on their handoff the metadata the real
+ * stages would have attached, and everything else (croppers, aggregators, tracker, matching) runs
+ * as in production.
+ *
+ * The output only depends on the buffer timestamps: persons move along fixed paths over the frame,
+ * and the embedding of a person is derived from its track ID, with a little per-frame noise.
+ * Simulated latency is paid per batch: the buffer completing a batch of the network's batch size
+ * sleeps for the batch duration.
+ */
+class StandInInference
+{
+public:
+    /** Reads the stand-in settings of the ini; the batch sizes are those of `config`. */
+    explicit StandInInference(const PipelineConfig& config);
+
+    StandInInference(const StandInInference&) = delete;
+    StandInInference& operator=(const StandInInference&) = delete;
+
+    /** Connects to the stand-in identities of `pipeline`; must outlive the pipeline's streaming. */
+    void connect(GstElement* pipeline);
+
+private:
+    struct Network
+    {
+        int batchSize = 1;
+        int batchUs = 0;
+        std::atomic<uint64_t> buffers{0};
+    };
+
+    static void onDetectionHandoff(GstElement* object, GstBuffer* buffer, gpointer data);
+    static void onClipHandoff(GstElement* object, GstBuffer* buffer, gpointer data);
+    static void simulateBatch(Network& network);
+
+private:
+    const int m_persons;
+    const int m_embeddingDim;
+    const float m_embeddingNoise;
+    Network m_detection;
+    Network m_clip;
+};
+
+} // namespace clip_person_tracker
+} // namespace vms_server_plugins
+} // namespace hailo
@@ -0,0 +1,142 @@
+#include "track_cache.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace clip_matcher {
+
+void TrackCache::set_params(const TrackCacheParams& params) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_params = params;
+}
+
+TrackCacheParams TrackCache::params() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_params;
+}
+
+void TrackCache::begin_frame(std::vector<TrackSummary>* expired) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_frame;
+    const uint64_t expire_frames = static_cast<uint64_t>(std::max(m_params.expire_frames, 0));
+    for (auto it = m_tracks.begin(); it != m_tracks.end();) {
+        if (m_frame - it->second.last_seen_frame > expire_frames) {
+            if (expired != nullptr)
+                expired->push_back({it->first, std::move(it->second)});
+            it = m_tracks.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void TrackCache::drain(std::vector<TrackSummary>& tracks) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& [track_id, track] : m_tracks) {
+        tracks.push_back({track_id, std::move(track)});
+    }
+    m_tracks.clear();
+}
+
+void TrackCache::record_sighting(TrackState& track, const TrackSighting& sighting) {
+    if (track.observations == 0 && track.last_seen_us == 0) {
+        track.first_seen_us = sighting.timestamp_us;
+        track.best_sighting = sighting;
+    }
+    track.first_seen_us = std::min(track.first_seen_us, sighting.timestamp_us);
+    track.last_seen_us = std::max(track.last_seen_us, sighting.timestamp_us);
+    if (sighting.confidence > track.best_sighting.confidence)
+        track.best_sighting = sighting;
+}
+
+void TrackCache::update(int track_id, const float* embedding, size_t dim, float scale,
+                        const TrackSighting& sighting) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    TrackState& track = m_tracks[track_id];
+    track.last_seen_frame = m_frame;
+    track.last_embedded_frame = m_frame;
+    record_sighting(track, sighting);
+
+    float weight = std::clamp(m_params.ema_alpha * std::clamp(sighting.confidence, 0.0f, 1.0f), 0.0f, 1.0f);
+    if (track.observations == 0 || track.embedding.size() != dim) {
+        track.embedding.assign(dim, 0.0f);
+        track.observations = 0;
+        track.match = TrackMatch();
+        weight = 1.0f;
+    }
+    ++track.observations;
+
+    float sum_squares = 0.0f;
+    for (size_t k = 0; k < dim; ++k) {
+        const float value = (1.0f - weight) * track.embedding[k] + weight * scale * embedding[k];
+        track.embedding[k] = value;
+        sum_squares += value * value;
+    }
+    // Keep the average on the unit sphere, like the embeddings it is matched as
+    if (sum_squares > 0.0f) {
+        const float inverse_norm = 1.0f / std::sqrt(sum_squares);
+        for (size_t k = 0; k < dim; ++k) {
+            track.embedding[k] *= inverse_norm;
+        }
+    }
+}
+
+bool TrackCache::touch(int track_id, const TrackSighting& sighting) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_tracks.find(track_id);
+    if (it == m_tracks.end())
+        return false;
+    it->second.last_seen_frame = m_frame;
+    record_sighting(it->second, sighting);
+    return true;
+}
+
+bool TrackCache::copy_embedding(int track_id, AlignedFloatVector& out) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_tracks.find(track_id);
+    if (it == m_tracks.end() || it->second.embedding.empty())
+        return false;
+    out.assign(it->second.embedding.begin(), it->second.embedding.end());
+    return true;
+}
+
+void TrackCache::set_match(int track_id, const TrackMatch& match) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_tracks.find(track_id);
+    if (it != m_tracks.end())
+        it->second.match = match;
+}
+
+TrackMatch TrackCache::match(int track_id) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_tracks.find(track_id);
+    if (it == m_tracks.end())
+        return TrackMatch();
+    return it->second.match;
+}
+
+bool TrackCache::should_skip_clip(int track_id) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_params.skip_similarity <= 0.0f)
+        return false;
+    auto it = m_tracks.find(track_id);
+    if (it == m_tracks.end())
+        return false;
+    const TrackState& track = it->second;
+    return track.observations >= m_params.skip_min_observations
+        && track.match.valid
+        && track.match.similarity >= m_params.skip_similarity
+        && m_frame - track.last_embedded_frame < static_cast<uint64_t>(std::max(m_params.max_skipped_frames, 0));
+}
+
+size_t TrackCache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_tracks.size();
+}
+
+void TrackCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tracks.clear();
+}
+
+} // namespace clip_matcher
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "aligned_allocator.hpp"
+
+// Per-camera cache of CLIP results keyed by hailotracker track ID. Each track keeps a running,
+// quality-weighted average of its (normalized) image embeddings and the latest match of that
+// average, so a person's label does not flicker from frame to frame and tracks whose label is
+// already certain can skip the CLIP network for a while.
+//
+// The cache is written by the matching of the frames and read from the pad probe that decides
+// which crops are sent to CLIP, which run on different threads, so every call takes the cache lock.
+
+namespace clip_matcher {
+
+struct TrackCacheParams {
+    // Weight of a new embedding in the running average (scaled by its quality), 1 disables smoothing.
+    float ema_alpha = 0.3f;
+    // A track is dropped after not being seen for this many frames; matches the tracker's
+    // keep-tracked-frames + keep-lost-frames so an ID is never reused while it is still cached.
+    int expire_frames = 17;
+    // Tracks whose best similarity reaches this value skip CLIP, 0 disables skipping.
+    float skip_similarity = 0.0f;
+    // Embeddings a track needs before it may skip CLIP.
+    int skip_min_observations = 3;
+    // Longest run of frames a track may skip CLIP, so its average keeps following the person.
+    int max_skipped_frames = 15;
+};
+
+struct TrackMatch {
+    bool valid = false;
+    std::string text;
+    float similarity = 0.0f;
+    bool negative = false;
+    bool passed_threshold = false;
+};
+
+// Where and when a track was seen in one frame.
+struct TrackSighting {
+    int64_t timestamp_us = 0;
+    float bbox[4] = {}; // xmin, ymin, width, height, relative to the frame
+    float confidence = 0.0f;
+};
+
+struct TrackState {
+    AlignedFloatVector embedding; // running average, normalized
+    int observations = 0;
+    uint64_t last_seen_frame = 0;
+    uint64_t last_embedded_frame = 0;
+    TrackMatch match;
+    int64_t first_seen_us = 0;
+    int64_t last_seen_us = 0;
+    TrackSighting best_sighting; // highest confidence
+};
+
+struct TrackSummary {
+    int track_id = 0;
+    TrackState state;
+};
+
+class TrackCache {
+public:
+    explicit TrackCache(TrackCacheParams params = TrackCacheParams()) : m_params(params) {}
+
+    void set_params(const TrackCacheParams& params);
+    TrackCacheParams params() const;
+
+    // Starts a new frame and drops the tracks that expired, moving them to `expired` if given.
+    void begin_frame(std::vector<TrackSummary>* expired = nullptr);
+    // Removes every track, moving them to `tracks`.
+    void drain(std::vector<TrackSummary>& tracks);
+
+    // Mixes `embedding` (dim values, multiplied by `scale` to normalize them) into the running
+    // average of `track_id`, creating the track if needed. The sighting confidence in [0, 1] scales
+    // the weight of the new embedding. Resets the track if `dim` changed.
+    void update(int track_id, const float* embedding, size_t dim, float scale, const TrackSighting& sighting);
+    // Marks `track_id` as seen in the current frame without a new embedding. Returns false if the
+    // track is not cached.
+    bool touch(int track_id, const TrackSighting& sighting);
+
+    // Copies the running average of `track_id` into `out`. Returns false if the track is not cached.
+    bool copy_embedding(int track_id, AlignedFloatVector& out) const;
+    void set_match(int track_id, const TrackMatch& match);
+    TrackMatch match(int track_id) const;
+
+    // Whether the CLIP network can be skipped for `track_id` in the next frame.
+    bool should_skip_clip(int track_id) const;
+
+    size_t size() const;
+    void clear();
+
+private:
+    static void record_sighting(TrackState& track, const TrackSighting& sighting);
+
+    mutable std::mutex m_mutex;
+    TrackCacheParams m_params;
+    std::unordered_map<int, TrackState> m_tracks;
+    uint64_t m_frame = 0;
+};
+
+} // namespace clip_matcher